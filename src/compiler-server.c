@@ -0,0 +1,186 @@
+#include "pl0.h"
+#include "compiler.h"
+#include "lib/lexer.h"
+#include "lib/parser.h"
+#include "lib/vector.h"
+#include "lib/util.h"
+#include "lib/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// The compiler server
+// ===================
+// Most of the time it takes to compile a small PL/0 program goes to starting
+// the compiler: loading it, building the grammar, and touching all of the
+// code for the first time. The server does all of that once, and then forks a
+// copy of itself for each program that compiler-client sends it, so each
+// compile starts from a process that is already warmed up. Forking also means
+// that every compile gets a fresh copy of the compiler's global state, and
+// that a compile that crashes doesn't take the server down with it.
+
+// The socket being served, so that it can be removed when the server stops.
+static char *servedSocketPath = NULL;
+
+void stopServer(int signal) {
+    unlink(servedSocketPath);
+    _exit(0);
+}
+
+// Runs a small program through every stage of the compiler, so that the
+// grammar is built and the compiler's code is loaded before the server forks.
+void warmUpCompiler() {
+    struct vector *tokens = readPL0Tokens(
+            "const n = 2; int x; procedure p; x := x * n + 1; "
+            "begin read x; if x > 0 then call p; while odd x do x := x - 1; write x end.");
+    generatePL0(parsePL0Tokens(tokens));
+}
+
+// Reads a request from the given connection, compiles it with stdout and
+// stderr captured, and sends back the result. Returns the exit code for the
+// forked process handling the connection.
+int handleRequest(int connection) {
+    FILE *input = fdopen(connection, "r");
+    FILE *output = fdopen(dup(connection), "w");
+    if (input == NULL || output == NULL)
+        return 1;
+
+    char header[sizeof SERVER_PROTOCOL_HEADER + 1];
+    if (fgets(header, sizeof header, input) == NULL
+            || strncmp(header, SERVER_PROTOCOL_HEADER, strlen(SERVER_PROTOCOL_HEADER)) != 0)
+        return 1;
+
+    // Compile in the client's working directory, so that relative paths mean
+    // the same as they would to a compiler started by the client. If that
+    // fails, the client compiles the program itself.
+    size_t length;
+    char *workingDirectory = readString(input, &length);
+    if (workingDirectory == NULL || chdir(workingDirectory) != 0)
+        return 1;
+
+    int numArguments;
+    if (fscanf(input, "%d", &numArguments) != 1 || numArguments < 0)
+        return 1;
+
+    // Rebuild the compiler's argv, with a program name for the usage message.
+    char **arguments = allocate(sizeof(char*) * (numArguments + 2));
+    arguments[0] = "compiler";
+    int i;
+    for (i = 1; i <= numArguments; i++) {
+        arguments[i] = readString(input, &length);
+        if (arguments[i] == NULL)
+            return 1;
+    }
+    arguments[numArguments + 1] = NULL;
+
+    char *sourceCode = readString(input, &length);
+    if (sourceCode == NULL)
+        return 1;
+
+    // Capture everything that the compiler prints.
+    char *outputText, *errorText;
+    size_t outputLength, errorLength;
+    FILE *capturedOutput = open_memstream(&outputText, &outputLength);
+    FILE *capturedErrors = open_memstream(&errorText, &errorLength);
+    stdout = capturedOutput;
+    stderr = capturedErrors;
+
+    int result;
+    struct compilerOptions options;
+    char *filename;
+    if (!parseCompilerArguments(numArguments + 1, arguments, &options, &filename)) {
+        result = 1;
+    } else if (options.serve) {
+        fprintf(stderr, "The compiler server can't start another server.\n");
+        result = 1;
+    } else {
+        result = compile(sourceCode, &options);
+        if (options.printStatistics)
+            printStatistics(&options);
+    }
+
+    fclose(capturedOutput);
+    fclose(capturedErrors);
+
+    fprintf(output, "%d\n", result);
+    writeString(output, outputText, outputLength);
+    writeString(output, errorText, errorLength);
+
+    return (fclose(output) == 0) ? 0 : 1;
+}
+
+int serveCompiler(char *socketPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof address.sun_path) {
+        fprintf(stderr, "Socket path '%s' is too long.\n", socketPath);
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    // A socket file can be left behind by a server that was killed. Only
+    // replace it if no server is answering on it.
+    if (connect(server, (struct sockaddr*)&address, sizeof address) == 0) {
+        fprintf(stderr, "A compiler server is already listening on %s.\n", socketPath);
+        return 1;
+    }
+    unlink(socketPath);
+
+    if (bind(server, (struct sockaddr*)&address, sizeof address) != 0
+            || listen(server, SOMAXCONN) != 0) {
+        perror(socketPath);
+        return 1;
+    }
+
+    servedSocketPath = socketPath;
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+
+    // Let the kernel reap the forked compilers, since the server never waits
+    // for them.
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_handler = SIG_DFL;
+    action.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &action, NULL);
+
+    warmUpCompiler();
+
+    fprintf(stderr, "Compiler server listening on %s\n", socketPath);
+
+    while (1) {
+        int connection = accept(server, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            unlink(socketPath);
+            return 1;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Only the server should remove the socket.
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            close(server);
+            exit(handleRequest(connection));
+        } else if (pid < 0) {
+            perror("fork");
+        }
+
+        close(connection);
+    }
+}
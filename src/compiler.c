@@ -3,34 +3,246 @@
 #include "lib/parser.h"
 #include "lib/vector.h"
 #include "lib/util.h"
+#include "lib/memory.h"
+#include "compiler.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+
+// What happened during compilation, for printStatistics.
+struct compilerStatistics {
+    int programCacheHit;
+    struct programCacheCounters programCacheCounters;
+    int stackBound;   // -1 if the program has no stack bound.
+};
+struct compilerStatistics compilerStatistics;
+
+void printCompiledInstructions(struct vector *instructions, struct compilerOptions *options);
+long long parseSize(char *size);
+int parseOptimizerPasses(char *passes);
+
+void printUsage(char *program) {
+    printf("Usage: %s [options] <PL/0 source code filename> [<verbosity level>]\n", program);
+    printf("       %s --serve[=SOCKET]\n", program);
+    printf("Options:\n");
+    printf("  --incremental     Only regenerate procedures that changed since the last compile.\n");
+    printf("  --cache           Reuse the output for programs that were compiled before.\n");
+    printf("  --cache-dir=DIR   Directory for cached code (default: %s).\n", DEFAULT_CACHE_DIRECTORY);
+    printf("  --cache-size=SIZE Maximum size of the program cache, e.g. 500K or 64M.\n");
+    printf("  --stats           Print compilation statistics to stderr.\n");
+    printf("  --superinstructions\n");
+    printf("                    Use superinstructions, which only pl0vm can run.\n");
+    printf("  --inline          Replace calls to small procedures with their bodies.\n");
+    printf("  --tail-calls      Reuse the caller's stack frame for calls in tail position.\n");
+    printf("  --display         Access variables through a display, which only pl0vm can run.\n");
+    printf("  --optimize[=PASSES]\n");
+    printf("                    Optimize with the passes in the comma-separated list, out of\n");
+    printf("                    constants, copies, dead-stores and dead-code (default: all).\n");
+    printf("  --optimize-loops  Rotate while loops and move loop-invariant expressions out of them.\n");
+    printf("  --stack-bound     Start the output with the most stack the program can use, which\n");
+    printf("                    only pl0vm can read.\n");
+    printf("  --parallel-parse[=THREADS]\n");
+    printf("                    Parse the procedures on THREADS threads (default: one per core).\n");
+    printf("  --parallel-codegen[=THREADS]\n");
+    printf("                    Generate the procedures on THREADS threads (default: one per core).\n");
+    printf("  --object          Print an object for pl0ld to link with other objects, instead of\n");
+    printf("                    instructions.\n");
+    printf("  --line-table      Print the source line of each instruction after the instructions,\n");
+    printf("                    which only pl0vm can read.\n");
+    printf("  --emit-c          Print the program as C source code instead of instructions.\n");
+    printf("  --serve[=SOCKET]  Compile programs sent by compiler-client (default socket: %s).\n",
+            DEFAULT_SERVER_SOCKET);
+}
 
 int main(int argc, char **argv) {
-    // Print usage if the wrong number of arguments are given.
-    if (!(argc == 2 || argc == 3)) {
-        printf("Usage: %s <PL/0 source code filename> [<verbosity level>]\n", argv[0]);
+    struct compilerOptions options;
+    char *filename;
+    if (!parseCompilerArguments(argc, argv, &options, &filename))
         return 1;
-    }
 
-    // Set verbosity level.
-    int verbosity = 0;
-    if (argc == 3)
-        verbosity = atoi(argv[2]);
+    if (options.serve)
+        return serveCompiler(options.socketPath);
 
     // Read in source code.
-    char *sourceCode = readContents(argv[1]);
+    char *sourceCode = readContents(filename);
     if (sourceCode == NULL) {
         fprintf(stderr, "Error reading input file.\n");
         return 2;
     }
 
+    int result = compile(sourceCode, &options);
+
+    if (options.printStatistics)
+        printStatistics(&options);
+
+    return result;
+}
+
+int parseCompilerArguments(int argc, char **argv, struct compilerOptions *options,
+        char **filename) {
+    *options = (struct compilerOptions){0, 0, 0, DEFAULT_CACHE_DIRECTORY, DEFAULT_CACHE_SIZE, 0,
+        0, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    *filename = NULL;
+
+    // Setting optind to 0 makes getopt start over, so that the compiler
+    // server can parse the arguments of each request.
+    optind = 0;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", compilerLongOptions, NULL)) != -1) {
+        switch (option) {
+            case 'i': options->incremental = 1; break;
+            case 'c': options->programCache = 1; break;
+            case 'd': options->cacheDirectory = optarg; break;
+            case 'S':
+                options->cacheSize = parseSize(optarg);
+                if (options->cacheSize < 0) {
+                    fprintf(stderr, "Invalid cache size '%s'.\n", optarg);
+                    return 0;
+                }
+                break;
+            case 's': options->printStatistics = 1; break;
+            case 'u': options->superinstructions = 1; break;
+            case 'e': options->emitC = 1; break;
+            case 'I': options->inlining = 1; break;
+            case 'T': options->tailCalls = 1; break;
+            case 'D': options->display = 1; break;
+            case 'L': options->loops = 1; break;
+            case 'B': options->stackBound = 1; break;
+            case 'o': options->object = 1; break;
+            case 'l': options->lineTable = 1; break;
+            case 'P':
+                options->parallelParse = 1;
+                options->parseThreads = (optarg == NULL) ? 0 : atoi(optarg);
+                if (options->parseThreads < 0 || (optarg != NULL && options->parseThreads == 0)) {
+                    fprintf(stderr, "Invalid number of threads '%s'.\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'G':
+                options->parallelCodegen = 1;
+                options->codegenThreads = (optarg == NULL) ? 0 : atoi(optarg);
+                if (options->codegenThreads < 0 || (optarg != NULL && options->codegenThreads == 0)) {
+                    fprintf(stderr, "Invalid number of threads '%s'.\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'O':
+                options->optimize = 1;
+                options->optimizerPasses = (optarg == NULL) ? OPTIMIZE_ALL
+                    : parseOptimizerPasses(optarg);
+                if (options->optimizerPasses < 0) {
+                    fprintf(stderr, "Invalid optimizer passes '%s'.\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'v':
+                options->serve = 1;
+                options->socketPath = optarg;
+                break;
+            default:
+                printUsage(argv[0]);
+                return 0;
+        }
+    }
+
+    int numArguments = argc - optind;
+
+    // Objects aren't whole programs, so these options can only be used when
+    // linking them.
+    if (options->object && (options->optimize || options->inlining || options->superinstructions
+                || options->emitC || options->stackBound || options->programCache)) {
+        fprintf(stderr, "--object can't be used with --optimize, --inline, --superinstructions, "
+                "--emit-c, --stack-bound or --cache.\n");
+        return 0;
+    }
+
+    // The C backend doesn't translate the display instructions.
+    if (options->emitC && options->display) {
+        fprintf(stderr, "--emit-c can't be used with --display.\n");
+        return 0;
+    }
+
+    if (options->lineTable && (options->object || options->emitC)) {
+        fprintf(stderr, "--line-table can't be used with --object or --emit-c.\n");
+        return 0;
+    }
+
+    if (options->serve) {
+        if (numArguments != 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+
+        if (options->socketPath == NULL)
+            options->socketPath = getenv(SERVER_SOCKET_VARIABLE);
+        if (options->socketPath == NULL)
+            options->socketPath = DEFAULT_SERVER_SOCKET;
+
+        return 1;
+    }
+
+    // Print usage if the wrong number of arguments are given.
+    if (!(numArguments == 1 || numArguments == 2)) {
+        printUsage(argv[0]);
+        return 0;
+    }
+
+    *filename = argv[optind];
+
+    // Set verbosity level.
+    if (numArguments == 2)
+        options->verbosity = atoi(argv[optind + 1]);
+
+    return 1;
+}
+
+int compile(char *sourceCode, struct compilerOptions *options) {
+    int verbosity = options->verbosity;
+
+    // Programs with errors are never generated, so start from empty
+    // statistics rather than those of an earlier compile, such as the
+    // compiler server's warm-up.
+    clearGeneratorStatistics();
+
     // Print source code.
     if (verbosity >= 2)
         printf("Source code:\n%s\n", sourceCode);
 
+    // The C backend doesn't translate superinstructions, and the C compiler
+    // doesn't need them.
+    struct generatorOptions generatorOptions =
+        {NULL, options->superinstructions && !options->emitC, options->inlining,
+            options->tailCalls, options->display, options->optimize,
+            options->optimizerPasses, options->loops, 0};
+    if (options->parallelCodegen)
+        generatorOptions.threads = (options->codegenThreads > 0)
+            ? options->codegenThreads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (options->incremental)
+        generatorOptions.procedureCacheDirectory = format("%s/procedures", options->cacheDirectory);
+
+    // Look for the program in the program cache. The cache only holds the
+    // instructions, so it can't be used when printing the tokens or the parse
+    // tree.
+    int useProgramCache = (options->programCache && verbosity < 3);
+    char *programCacheDirectory = format("%s/programs", options->cacheDirectory);
+    uint64_t programKey = 0;
+    if (useProgramCache) {
+        programKey = hashProgram(sourceCode, generatorOptions);
+        struct vector *instructions = loadCachedProgram(programCacheDirectory, programKey);
+
+        compilerStatistics.programCacheHit = (instructions != NULL);
+        compilerStatistics.programCacheCounters =
+            countProgramCacheLookup(programCacheDirectory, instructions != NULL);
+
+        if (instructions != NULL) {
+            printCompiledInstructions(instructions, options);
+            return 0;
+        }
+    }
+
     // Read tokens.
     struct vector *tokens = readPL0Tokens(sourceCode);
     if (tokens == NULL) {
@@ -50,7 +262,8 @@ int main(int argc, char **argv) {
     }
 
     // Parse tokens.
-    struct parseTree tree = parsePL0Tokens(tokens);
+    struct parseTree tree = options->parallelParse
+        ? parsePL0TokensInParallel(tokens, options->parseThreads) : parsePL0Tokens(tokens);
 
     // Print parse tree.
     if (verbosity >= 4) {
@@ -65,8 +278,19 @@ int main(int argc, char **argv) {
         return 4;
     }
 
+    if (options->object) {
+        struct pl0Object *object = generatePL0Object(tree, generatorOptions);
+        if (object == NULL) {
+            fprintf(stderr, "The generator encountered errors:\n%s\n\n", getGeneratorErrors());
+            return 5;
+        }
+
+        printPL0Object(object);
+        return 0;
+    }
+
     // Generate code.
-    struct vector *instructions = generatePL0(tree);
+    struct vector *instructions = generatePL0WithOptions(tree, generatorOptions);
 
     // Check if the generator had errors.
     if (getGeneratorErrors() != NULL) {
@@ -83,6 +307,25 @@ int main(int argc, char **argv) {
         return 5;
     }
 
+    if (useProgramCache)
+        storeCachedProgram(programCacheDirectory, programKey, instructions, options->cacheSize);
+
+    printCompiledInstructions(instructions, options);
+
+    return 0;
+}
+
+void printCompiledInstructions(struct vector *instructions, struct compilerOptions *options) {
+    int verbosity = options->verbosity;
+
+    if (options->emitC) {
+        printCProgram(instructions);
+        return;
+    }
+
+    if (options->stackBound)
+        compilerStatistics.stackBound = computeStackBound(instructions);
+
     if (verbosity >= 1)
         printf("No errors, program is syntactically correct.\n\n");
 
@@ -92,9 +335,111 @@ int main(int argc, char **argv) {
         // Print code with nice opcode names.
         printInstructions(instructions, 1);
     } else {
-        // Print code suitable for the VM.
+        // Print code suitable for the VM, after the stack bound if there is
+        // one.
+        if (options->stackBound && compilerStatistics.stackBound >= 0)
+            printf("stack %d\n", compilerStatistics.stackBound);
         printInstructions(instructions, 0);
+        if (options->lineTable)
+            printLineTable(makeLineTable(instructions));
     }
+}
 
-    return 0;
+void printStatistics(struct compilerOptions *options) {
+    struct generatorStatistics statistics = getGeneratorStatistics();
+
+    fprintf(stderr, "Statistics:\n");
+    fprintf(stderr, "  procedures generated: %d\n", statistics.proceduresGenerated);
+    if (options->incremental)
+        fprintf(stderr, "  procedures reused from cache: %d\n", statistics.proceduresReused);
+    if (options->inlining) {
+        // Each inlined call saves a frame and these instructions when it runs.
+        fprintf(stderr, "  calls inlined: %d\n", statistics.callsInlined);
+        fprintf(stderr, "  call instructions saved: %d\n", statistics.callInstructionsSaved);
+    }
+    if (options->tailCalls) {
+        fprintf(stderr, "  tail calls: %d\n", statistics.tailCalls->length);
+        forVector(statistics.tailCalls, i, char *, description,
+                fprintf(stderr, "    %s\n", description););
+    }
+
+    if (options->loops) {
+        fprintf(stderr, "  loops rotated: %d\n", statistics.loopsRotated);
+        fprintf(stderr, "  expressions hoisted out of loops: %d\n", statistics.expressionsHoisted);
+    }
+
+    if (options->stackBound) {
+        if (compilerStatistics.stackBound >= 0)
+            fprintf(stderr, "  stack bound: %d\n", compilerStatistics.stackBound);
+        else
+            fprintf(stderr, "  stack bound: none\n");
+    }
+
+    if (options->optimize) {
+        int i;
+        fprintf(stderr, "  optimizer passes:\n");
+        for (i = 0; i < OPTIMIZER_PASS_COUNT; i++)
+            if (options->optimizerPasses & (1 << i))
+                fprintf(stderr, "    %s: %d changes, %.3f ms\n", getOptimizerPassName(i),
+                        statistics.optimizerChanges[i], statistics.optimizerMilliseconds[i]);
+    }
+
+    if (options->programCache) {
+        struct programCacheCounters counters = compilerStatistics.programCacheCounters;
+        fprintf(stderr, "  program cache: %s\n", compilerStatistics.programCacheHit ? "hit" : "miss");
+        fprintf(stderr, "  program cache hits: %lld\n", counters.hits);
+        fprintf(stderr, "  program cache misses: %lld\n", counters.misses);
+    }
+}
+
+// Parses a comma-separated list of optimizer pass names into OPTIMIZE_* flags.
+// "all" is every pass and "none" is none of them. Returns -1 if a name isn't
+// valid.
+int parseOptimizerPasses(char *passes) {
+    int result = 0;
+    char *copy = copyString(passes);
+    char *name = strtok(copy, ",");
+
+    while (name != NULL) {
+        int i, found = 0;
+        for (i = 0; i < OPTIMIZER_PASS_COUNT; i++) {
+            if (strcmp(name, getOptimizerPassName(i)) == 0) {
+                result |= 1 << i;
+                found = 1;
+            }
+        }
+
+        if (strcmp(name, "all") == 0)
+            result |= OPTIMIZE_ALL;
+        else if (strcmp(name, "none") != 0 && !found)
+            result = -1;
+
+        if (result < 0)
+            break;
+        name = strtok(NULL, ",");
+    }
+
+    deallocate(copy);
+    return result;
+}
+
+// Parses a size in bytes, with an optional K, M or G suffix. Returns -1 if the
+// size isn't valid.
+long long parseSize(char *size) {
+    char *suffix;
+    long long result = strtoll(size, &suffix, 10);
+
+    if (suffix == size || result < 0)
+        return -1;
+
+    if (strcmp(suffix, "") == 0)
+        return result;
+    else if (strcmp(suffix, "K") == 0)
+        return result * 1024;
+    else if (strcmp(suffix, "M") == 0)
+        return result * 1024 * 1024;
+    else if (strcmp(suffix, "G") == 0)
+        return result * 1024 * 1024 * 1024;
+    else
+        return -1;
 }
@@ -0,0 +1,110 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stddef.h>
+#include <getopt.h>
+
+// The default directory for --incremental and --cache.
+#define DEFAULT_CACHE_DIRECTORY ".pl0-cache"
+// The default maximum size of the program cache, in bytes.
+#define DEFAULT_CACHE_SIZE (64LL * 1024 * 1024)
+
+// The socket that the compiler server listens on and that compiler-client
+// connects to, unless PL0_SERVER_SOCKET is set in the environment.
+#define DEFAULT_SERVER_SOCKET ".pl0-server.sock"
+#define SERVER_SOCKET_VARIABLE "PL0_SERVER_SOCKET"
+
+struct compilerOptions {
+    int verbosity;
+    int incremental;          // Reuse code from the procedure cache.
+    int programCache;         // Reuse whole programs from the program cache.
+    char *cacheDirectory;
+    long long cacheSize;      // The maximum size of the program cache.
+    int printStatistics;
+    int serve;                // Run the compiler server instead of compiling.
+    char *socketPath;         // The socket for --serve.
+    int superinstructions;    // Generate superinstructions for pl0vm.
+    int emitC;                // Print a C program instead of instructions.
+    int inlining;             // Inline calls to small procedures.
+    int tailCalls;            // Reuse frames for calls in tail position.
+    int display;              // Access variables through a display.
+    int optimize;             // Generate code with the mid-level optimizer,
+    int optimizerPasses;      // running these OPTIMIZE_* passes.
+    int loops;                // Rotate loops and hoist invariant expressions.
+    int stackBound;           // Print the program's stack bound before it.
+    int parallelParse;        // Parse top-level procedures on parseThreads
+    int parseThreads;         // threads, or one per core if it's 0.
+    int parallelCodegen;      // Generate top-level procedures on
+    int codegenThreads;       // codegenThreads threads, or one per core.
+    int object;               // Print an object for pl0ld instead of instructions.
+    int lineTable;            // Print the line table after the instructions.
+};
+
+// The compiler's long options. This is in the header so that compiler-client
+// can find the filename in its arguments in the same way that the compiler
+// does.
+static struct option compilerLongOptions[] = {
+    {"incremental", no_argument, NULL, 'i'},
+    {"cache", no_argument, NULL, 'c'},
+    {"cache-dir", required_argument, NULL, 'd'},
+    {"cache-size", required_argument, NULL, 'S'},
+    {"stats", no_argument, NULL, 's'},
+    {"serve", optional_argument, NULL, 'v'},
+    {"superinstructions", no_argument, NULL, 'u'},
+    {"emit-c", no_argument, NULL, 'e'},
+    {"inline", no_argument, NULL, 'I'},
+    {"tail-calls", no_argument, NULL, 'T'},
+    {"display", no_argument, NULL, 'D'},
+    {"optimize", optional_argument, NULL, 'O'},
+    {"optimize-loops", no_argument, NULL, 'L'},
+    {"stack-bound", no_argument, NULL, 'B'},
+    {"parallel-parse", optional_argument, NULL, 'P'},
+    {"parallel-codegen", optional_argument, NULL, 'G'},
+    {"object", no_argument, NULL, 'o'},
+    {"line-table", no_argument, NULL, 'l'},
+    {NULL, 0, NULL, 0}
+};
+
+// Parses the compiler's command line arguments into options and sets filename
+// to the source code filename, or to NULL for --serve. Prints an error and
+// returns false if the arguments are invalid.
+// Defined in compiler.c.
+int parseCompilerArguments(int argc, char **argv, struct compilerOptions *options,
+        char **filename);
+void printUsage(char *program);
+
+// Compiles the given source code, printing the results to stdout and errors to
+// stderr. Returns the compiler's exit code.
+// Defined in compiler.c.
+int compile(char *sourceCode, struct compilerOptions *options);
+void printStatistics(struct compilerOptions *options);
+
+// Listens on the given Unix socket and compiles the programs that
+// compiler-client sends, until the server is killed. Returns an exit code if
+// the server can't start.
+// Defined in compiler-server.c.
+int serveCompiler(char *socketPath);
+
+// The server protocol
+// ===================
+// compiler-client sends its working directory, which relative paths such as
+// --cache-dir's are relative to, the compiler's command line arguments
+// (without the program name) and the source code, and the server replies with
+// what the compiler would have printed and its exit code. Each string is sent
+// as its length in decimal followed by a newline and then the bytes
+// themselves:
+//
+// pl0-compile 2
+// <working directory>
+// <number of arguments>
+// <argument>...
+// <source code>
+//
+// and the server replies with:
+//
+// <exit code>
+// <stdout>
+// <stderr>
+#define SERVER_PROTOCOL_HEADER "pl0-compile 2"
+
+#endif
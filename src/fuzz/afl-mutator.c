@@ -0,0 +1,49 @@
+#include "fuzz/grammar-mutator.h"
+#include "lib/memory.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The grammar-aware mutator (see grammar-mutator.h) as an AFL++ custom
+// mutator. Build it with `make pl0-mutator.so` and run afl-fuzz with
+// AFL_CUSTOM_MUTATOR_LIBRARY=./pl0-mutator.so.
+
+struct mutatorState {
+    unsigned int seed;
+    uint8_t *buffer;
+    size_t bufferSize;
+};
+
+void *afl_custom_init(void *afl, unsigned int seed) {
+    struct mutatorState *state = allocate(sizeof (struct mutatorState));
+    state->seed = seed;
+    state->buffer = NULL;
+    state->bufferSize = 0;
+
+    return state;
+}
+
+size_t afl_custom_fuzz(void *data, uint8_t *input, size_t inputSize, uint8_t **output,
+        uint8_t *addBuffer, size_t addBufferSize, size_t maxSize) {
+    struct mutatorState *state = data;
+
+    // AFL++ owns the input, so mutate a copy of it.
+    if (state->bufferSize < maxSize) {
+        state->buffer = reallocate(state->buffer, maxSize);
+        state->bufferSize = maxSize;
+    }
+
+    size_t size = (inputSize < maxSize) ? inputSize : maxSize;
+    memcpy(state->buffer, input, size);
+
+    state->seed += 1;
+    *output = state->buffer;
+
+    return mutatePL0Program(state->buffer, size, maxSize, state->seed);
+}
+
+void afl_custom_deinit(void *data) {
+    struct mutatorState *state = data;
+
+    deallocate(state->buffer);
+    deallocate(state);
+}
@@ -0,0 +1,256 @@
+#include "pl0.h"
+#include "fuzz/grammar-mutator.h"
+#include "lib/lexer.h"
+#include "lib/parser.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include "lib/hash.h"
+#include "lib/util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+// Fuzz target
+// ===========
+// Runs the lexer, parser and generator on each input in the same process, the
+// way libFuzzer and AFL++'s persistent mode expect. Everything an input
+// allocates comes from an arena that is reset before the next input, so memory
+// use doesn't grow over millions of iterations.
+//
+// Inputs that take longer than PL0_FUZZ_SLOW_MS milliseconds (50 by default)
+// to parse are saved as "slow units" in the directory PL0_FUZZ_SLOW_DIR
+// (slow-units by default), named after the hash of the input.
+//
+// Each input is also parsed with the Earley parser (see lib/earley.h) and with
+// parsePL0TokensInParallel, and the target aborts if either doesn't agree with
+// the recursive descent parser about whether the input parses and what its
+// parse tree is. Programs that parse are generated on one thread and on
+// several (see generatorOptions.threads), and the target aborts if the
+// instructions or the errors are different.
+
+// The number of threads for parsePL0TokensInParallel and the generator, which
+// is more than one even on machines with one core, so that the procedures are
+// split up.
+#define PARALLEL_THREADS 4
+//
+// The same file builds several drivers (see the Makefile):
+// - With no defines, it's a libFuzzer target, for libFuzzer or any driver
+//   that calls LLVMFuzzerTestOneInput, such as AFL++'s libAFLDriver.
+// - With PL0_FUZZ_AFL, it has a main() for AFL++'s persistent mode.
+// - With PL0_FUZZ_STANDALONE, it has a main() that replays the given files, or
+//   runs programs from the grammar mutator when there are no files. This
+//   needs no fuzzing tools, and is how slow units are reproduced.
+
+#define DEFAULT_SLOW_MS 50
+#define DEFAULT_SLOW_DIRECTORY "slow-units"
+
+static struct arena *arena = NULL;
+static double slowMilliseconds = DEFAULT_SLOW_MS;
+static char *slowDirectory = DEFAULT_SLOW_DIRECTORY;
+static int slowUnits = 0;
+
+double getMilliseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    arena = makeArena();
+
+    char *milliseconds = getenv("PL0_FUZZ_SLOW_MS");
+    if (milliseconds != NULL)
+        slowMilliseconds = atof(milliseconds);
+
+    char *directory = getenv("PL0_FUZZ_SLOW_DIR");
+    if (directory != NULL)
+        slowDirectory = directory;
+
+    return 0;
+}
+
+void saveSlowUnit(const uint8_t *data, size_t size, double milliseconds) {
+    slowUnits += 1;
+
+    if (!makeDirectories(slowDirectory))
+        return;
+
+    char *path = format("%s/slow-%016llx", slowDirectory,
+            (unsigned long long)hashBytes(HASH_SEED, data, size));
+
+    FILE *file = fopen(path, "wb");
+    if (file != NULL) {
+        fwrite(data, 1, size, file);
+        fclose(file);
+        fprintf(stderr, "Slow unit: parsing took %.1f ms, saved to %s\n", milliseconds, path);
+    }
+
+    deallocate(path);
+}
+
+// Aborts if generating the program on several threads doesn't give the same
+// instructions and errors as generating it on one.
+void checkParallelGenerator(struct parseTree tree) {
+    struct vector *instructions = generatePL0(tree);
+    char *errors = getGeneratorErrors();
+
+    struct generatorOptions parallelOptions = {NULL};
+    parallelOptions.threads = PARALLEL_THREADS;
+    struct vector *parallelInstructions = generatePL0WithOptions(tree, parallelOptions);
+    char *parallelErrors = getGeneratorErrors();
+
+    int same = (errors == NULL) == (parallelErrors == NULL)
+        && (errors == NULL || strcmp(errors, parallelErrors) == 0)
+        && instructions->length == parallelInstructions->length;
+    forVector(instructions, i, struct instruction, instruction,
+        if (!same)
+            break;
+        struct instruction parallelInstruction = get(struct instruction, parallelInstructions, i);
+        same = instruction.opcode == parallelInstruction.opcode
+            && instruction.lexicalLevel == parallelInstruction.lexicalLevel
+            && instruction.modifier == parallelInstruction.modifier;);
+
+    if (!same) {
+        fprintf(stderr, "The parallel generator disagrees with the generator.\n");
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    // libFuzzer calls LLVMFuzzerInitialize itself, but other drivers may not.
+    if (arena == NULL)
+        LLVMFuzzerInitialize(NULL, NULL);
+
+    struct arena *previousArena = useArena(arena);
+
+    struct vector *tokens = readPL0TokensWithLength((char*)data, size);
+
+    double start = getMilliseconds();
+    struct parseTree tree = parsePL0Tokens(tokens);
+    double milliseconds = getMilliseconds() - start;
+
+    struct parseTree earleyTree = parsePL0TokensWithEarley(tokens);
+    if (isParseTreeError(tree) != isParseTreeError(earleyTree)
+            || (!isParseTreeError(tree) && !equalParseTrees(tree, earleyTree))) {
+        fprintf(stderr, "The Earley parser disagrees with the recursive descent parser.\n");
+        abort();
+    }
+
+    struct parseTree parallelTree = parsePL0TokensInParallel(tokens, PARALLEL_THREADS);
+    if (isParseTreeError(tree) != isParseTreeError(parallelTree)
+            || (!isParseTreeError(tree) && !equalParseTrees(tree, parallelTree))) {
+        fprintf(stderr, "The parallel parser disagrees with the recursive descent parser.\n");
+        abort();
+    }
+
+    if (!isParseTreeError(tree))
+        checkParallelGenerator(tree);
+
+    // The parser and generator keep their errors in global vectors that point
+    // into the arena.
+    clearParserErrors();
+    clearGeneratorErrors();
+    useArena(previousArena);
+    resetArena(arena);
+
+    if (milliseconds > slowMilliseconds)
+        saveSlowUnit(data, size, milliseconds);
+
+    return 0;
+}
+
+size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size, size_t maxSize, unsigned int seed) {
+    return mutatePL0Program(data, size, maxSize, seed);
+}
+
+#if defined(PL0_FUZZ_AFL)
+__AFL_FUZZ_INIT();
+
+int main(int argc, char **argv) {
+    LLVMFuzzerInitialize(&argc, &argv);
+    __AFL_INIT();
+
+    unsigned char *data = __AFL_FUZZ_TESTCASE_BUF;
+    while (__AFL_LOOP(100000))
+        LLVMFuzzerTestOneInput(data, __AFL_FUZZ_TESTCASE_LEN);
+
+    return 0;
+}
+#elif defined(PL0_FUZZ_STANDALONE)
+#define MAX_PROGRAM_SIZE 4096
+
+void printUsage(char *program) {
+    printf("Usage: %s [-n iterations] [-s seed] [<input file>...]\n", program);
+    printf("Runs each input file once, or runs the given number of programs from the\n");
+    printf("grammar mutator if there are no input files.\n");
+}
+
+int main(int argc, char **argv) {
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    long iterations = 10000;
+    unsigned int seed = 1;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:s:")) != -1) {
+        switch (option) {
+            case 'n': iterations = atol(optarg); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind < argc) {
+        int i;
+        for (i = optind; i < argc; i++) {
+            // Inputs can contain null characters, so don't use readContents.
+            FILE *file = fopen(argv[i], "rb");
+            if (file == NULL) {
+                perror(argv[i]);
+                return 2;
+            }
+
+            uint8_t *contents = NULL;
+            size_t size = 0, capacity = 0, read;
+            do {
+                capacity += 4096;
+                contents = reallocate(contents, capacity);
+                read = fread(contents + size, 1, capacity - size, file);
+                size += read;
+            } while (size == capacity);
+            fclose(file);
+
+            double start = getMilliseconds();
+            LLVMFuzzerTestOneInput(contents, size);
+            printf("%s: %.3f ms\n", argv[i], getMilliseconds() - start);
+            deallocate(contents);
+        }
+
+        return 0;
+    }
+
+    // Each program is a mutation of the one before it, like a fuzzer that
+    // only ever keeps its latest input.
+    uint8_t program[MAX_PROGRAM_SIZE];
+    size_t size = 0;
+    long i;
+
+    double start = getMilliseconds();
+    for (i = 0; i < iterations; i++) {
+        size = mutatePL0Program(program, size, sizeof program, seed + i);
+        LLVMFuzzerTestOneInput(program, size);
+    }
+    double milliseconds = getMilliseconds() - start;
+
+    printf("%ld programs in %.0f ms (%.0f programs/s), %d slow units\n", iterations,
+            milliseconds, iterations / (milliseconds / 1000.0), slowUnits);
+
+    return 0;
+}
+#endif
@@ -0,0 +1,245 @@
+#include "fuzz/grammar-mutator.h"
+#include "pl0.h"
+#include "lib/lexer.h"
+#include "lib/parser.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <string.h>
+#include <limits.h>
+
+// Generated subtrees stop growing at this depth in the parse tree, by only
+// using the rules that finish the subtree the soonest.
+#define MAX_DEPTH 14
+// How many times to try to make a mutation that fits in maxSize.
+#define MAX_ATTEMPTS 8
+
+// A small pool of names and numbers, so that generated programs refer to the
+// same identifiers often enough to get past the generator's symbol checks.
+static char *identifiers[] = {"x", "y", "n", "p", "q"};
+static char *numbers[] = {"0", "1", "2", "7", "10", "255", "32767", "2147483647"};
+#define countOf(array) ((int)(sizeof (array) / sizeof (array)[0]))
+
+static struct grammar grammar = {NULL};
+// The depth of the shallowest subtree that each rule in the grammar can
+// produce, by rule index.
+static struct vector *ruleDepths = NULL;
+// Everything the mutator allocates, which is freed after every mutation.
+static struct arena *arena = NULL;
+static unsigned int randomState = 1;
+
+// Returns a random number from 0 to limit - 1 (xorshift32).
+int randomNumber(int limit) {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    return randomState % limit;
+}
+
+// Variables start with @ in the grammar (see getPL0Grammar).
+int isGrammarVariable(char *symbol) {
+    return symbol[0] == '@';
+}
+
+int getVariableDepth(char *variable) {
+    int depth = INT_MAX;
+    forVector(grammar.rules, i, struct rule, rule,
+            int ruleDepth = get(int, ruleDepths, i);
+            if (strcmp(rule.variable, variable) == 0 && ruleDepth < depth)
+                depth = ruleDepth;);
+
+    return depth;
+}
+
+// Finds the depth of the shallowest subtree for each rule, by starting with
+// the rules that only produce terminals and repeating until nothing changes.
+void computeRuleDepths() {
+    ruleDepths = makeVector(int);
+    forVector(grammar.rules, i, struct rule, rule,
+            pushLiteral(ruleDepths, int, INT_MAX););
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+
+        forVector(grammar.rules, i, struct rule, rule,
+            int depth = 1;
+            forVector(rule.production, j, char*, symbol,
+                if (isGrammarVariable(symbol)) {
+                    int symbolDepth = getVariableDepth(symbol);
+                    if (symbolDepth == INT_MAX) {
+                        depth = INT_MAX;
+                        break;
+                    }
+                    if (symbolDepth + 1 > depth)
+                        depth = symbolDepth + 1;
+                });
+
+            if (depth < get(int, ruleDepths, i)) {
+                set(ruleDepths, i, depth);
+                changed = 1;
+            });
+    }
+}
+
+// Adds the tokens of a random subtree for the given variable to tokens.
+void generateVariable(char *variable, int depth, struct vector *tokens) {
+    // Past MAX_DEPTH, only pick the rules that lead to the shallowest trees.
+    int maxRuleDepth = (depth < MAX_DEPTH) ? INT_MAX : getVariableDepth(variable);
+
+    struct vector *candidates = makeVector(int);
+    forVector(grammar.rules, i, struct rule, rule,
+            if (strcmp(rule.variable, variable) == 0 && !rule.recovers
+                    && get(int, ruleDepths, i) <= maxRuleDepth)
+                push(candidates, i););
+
+    if (candidates->length == 0)
+        return;
+
+    int ruleIndex = get(int, candidates, randomNumber(candidates->length));
+    struct rule rule = get(struct rule, grammar.rules, ruleIndex);
+
+    forVector(rule.production, i, char*, symbol,
+        if (strcmp(symbol, "nothing") == 0)
+            continue;
+
+        if (isGrammarVariable(symbol)) {
+            generateVariable(symbol, depth + 1, tokens);
+        } else if (strcmp(symbol, "identifier-token") == 0) {
+            push(tokens, identifiers[randomNumber(countOf(identifiers))]);
+        } else if (strcmp(symbol, "number-token") == 0) {
+            push(tokens, numbers[randomNumber(countOf(numbers))]);
+        } else {
+            push(tokens, symbol);
+        });
+}
+
+// Adds the tokens of the given parse tree to tokens. If replaceIndex is the
+// preorder index of one of the tree's variables, that subtree is replaced by
+// replacement instead.
+void addTreeTokens(struct parseTree root, int replaceIndex, struct vector *replacement,
+        struct vector *tokens) {
+    int index = 0;
+
+    void add(struct parseTree tree) {
+        // Leaves are tokens.
+        if (tree.children == NULL) {
+            push(tokens, tree.name);
+            return;
+        }
+
+        if (index++ == replaceIndex) {
+            vector_concat(tokens, replacement);
+            return;
+        }
+
+        forVector(tree.children, i, struct parseTree, child,
+                add(child););
+    }
+
+    add(root);
+}
+
+struct treeNode {
+    struct parseTree tree;
+    int depth;
+};
+
+// Returns a vector of treeNode structs for all of the variables in the parse
+// tree, in preorder.
+struct vector *getTreeNodes(struct parseTree root) {
+    struct vector *nodes = makeVector(struct treeNode);
+
+    void add(struct parseTree tree, int depth) {
+        if (tree.children == NULL)
+            return;
+
+        pushLiteral(nodes, struct treeNode, {tree, depth});
+        forVector(tree.children, i, struct parseTree, child,
+                add(child, depth + 1););
+    }
+
+    add(root, 0);
+
+    return nodes;
+}
+
+// Makes a mutated program as a vector of tokens.
+struct vector *makeMutation(uint8_t *data, size_t size) {
+    struct vector *tokens = makeVector(char*);
+
+    struct vector *inputTokens = readPL0TokensWithLength((char*)data, size);
+    struct parseTree tree = parsePL0Tokens(inputTokens);
+
+    // Programs that don't parse (including the empty program that fuzzers
+    // start with) are replaced by a new one.
+    if (isParseTreeError(tree)) {
+        generateVariable("@program", 0, tokens);
+        return tokens;
+    }
+
+    struct vector *nodes = getTreeNodes(tree);
+    int target = randomNumber(nodes->length);
+    struct treeNode targetNode = get(struct treeNode, nodes, target);
+
+    struct vector *replacement = makeVector(char*);
+    if (randomNumber(4) == 0) {
+        // Copy another subtree for the same variable, which can be one of the
+        // target's own parents or children. This grows programs much faster
+        // than generating them, and finds deeply nested inputs.
+        struct vector *donors = makeVector(struct parseTree);
+        forVector(nodes, i, struct treeNode, node,
+                if (strcmp(node.tree.name, targetNode.tree.name) == 0)
+                    push(donors, node.tree););
+
+        struct parseTree donor = get(struct parseTree, donors, randomNumber(donors->length));
+        addTreeTokens(donor, -1, NULL, replacement);
+    } else {
+        generateVariable(targetNode.tree.name, targetNode.depth, replacement);
+    }
+
+    addTreeTokens(tree, target, replacement, tokens);
+
+    return tokens;
+}
+
+size_t mutatePL0Program(uint8_t *data, size_t size, size_t maxSize, unsigned int seed) {
+    if (grammar.rules == NULL) {
+        grammar = getPL0Grammar();
+        computeRuleDepths();
+        arena = makeArena();
+    }
+
+    randomState = (seed != 0) ? seed : 1;
+    struct arena *previousArena = useArena(arena);
+
+    size_t newSize = 0;
+    int attempt;
+    for (attempt = 0; attempt < MAX_ATTEMPTS && newSize == 0; attempt++) {
+        struct vector *tokens = makeMutation(data, size);
+
+        // Separate the tokens with spaces, and sometimes with newlines so that
+        // the lexer's line counting gets some use.
+        size_t length = 0;
+        forVector(tokens, i, char*, token,
+                length += strlen(token) + 1;);
+
+        if (length <= maxSize) {
+            forVector(tokens, i, char*, token,
+                    size_t tokenLength = strlen(token);
+                    memcpy(data + newSize, token, tokenLength);
+                    newSize += tokenLength;
+                    data[newSize++] = (randomNumber(8) == 0) ? '\n' : ' ';);
+        }
+    }
+
+    // The parser and generator keep their errors in global vectors that point
+    // into the arena.
+    clearParserErrors();
+    clearGeneratorErrors();
+    useArena(previousArena);
+    resetArena(arena);
+
+    // Give up and keep the input if nothing fit.
+    return (newSize > 0) ? newSize : size;
+}
@@ -0,0 +1,21 @@
+#ifndef GRAMMAR_MUTATOR_H
+#define GRAMMAR_MUTATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Grammar-aware mutator
+// =====================
+// Random byte flips almost never get past the PL/0 parser, so the fuzzers
+// spend most of their time on inputs that are rejected after a few tokens. This
+// mutator works on parse trees instead. It parses the input and replaces a
+// random subtree, either with a new one generated from the rules in
+// getPL0Grammar() or with a copy of another subtree for the same variable, so
+// its output parses too. Inputs that don't parse are replaced by a new random
+// program.
+
+// Mutates the PL/0 program in data in place and returns its new size, which is
+// at most maxSize. The same seed always gives the same mutation.
+size_t mutatePL0Program(uint8_t *data, size_t size, size_t maxSize, unsigned int seed);
+
+#endif
@@ -0,0 +1,576 @@
+#include "lib/earley.h"
+#include "lib/lexer.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <string.h>
+#include <assert.h>
+
+// The parser is the one from Earley's "An efficient context-free parsing
+// algorithm", with Aycock and Horspool's fix for empty rules from "Practical
+// Earley Parsing", and Leo's optimization for right recursion from "A general
+// context-free parsing algorithm running in linear time on every LR(k)
+// grammar without using lookahead".
+//
+// An item is a rule with a dot in it, the token where the rule started (its
+// origin), and the token where the dot is (its set). The parser goes through
+// the tokens in order. At each one, it predicts the rules of the variables
+// after the dots, moves the dots past the variables whose rules completed, and
+// moves the dots past the terminal that matches the token, which makes the
+// items of the next set.
+//
+// Right recursion, like "@statements -> @statement ; @statements", would make
+// a chain of completions as long as the list after every statement, which is
+// quadratic. When only one item in a set is waiting on a variable, and the
+// variable is the last symbol of its rule, Leo's optimization goes straight to
+// the top of that chain, and the items in between are only made for the
+// chains that end up in the parse tree.
+//
+// Every item keeps the items that it was advanced from (its links), which is
+// enough to build the parse tree afterwards, starting from the completed start
+// variable in the last set.
+
+// The size that a set's hash table of items starts at, which has to be a
+// power of two.
+#define INITIAL_TABLE_SIZE 16
+#define NOT_COMPUTED -2
+
+// A rule from the grammar with its symbols numbered. Variables are numbered
+// from 0, and terminal number t is -1 - t.
+struct earleyRule {
+    char *variable;
+    int variableId;
+    struct vector *symbols;
+};
+
+struct earleyItem {
+    int rule;
+    int dot;
+    int origin;
+    int set;
+    int links;          // The first of the ways that it was reached, or -1.
+    int bestLink;       // The link that the parse tree uses, once it's picked.
+    int nextWaiting;    // The next item in the set with the same variable after its dot.
+    int nextCompleted;  // The next completed item in the set for the same variable.
+    int building;       // Whether its parse tree is being built.
+};
+
+// A way that an item was reached, by moving the dot in predecessor past a
+// token or a completed variable. If the variable was completed through a Leo
+// item, leo is that item, and the items between it and predecessor haven't
+// been made yet.
+struct earleyLink {
+    int predecessor;
+    int leo;
+    int next;
+};
+
+// The only item in a set that was waiting on a variable (via), where the
+// variable is the last symbol of via's rule. next is the Leo item for via's
+// variable in via's origin set, if there is one, and top is the via of the
+// last Leo item in that chain, which is the item whose rule completes.
+struct leoItem {
+    int via;
+    int next;
+    int top;
+};
+
+struct earleySet {
+    struct vector *items;
+    // The first item waiting on each variable, the first completed item for
+    // each variable, and the Leo item for each variable.
+    int *waiting;
+    int *completed;
+    int *leo;
+    // A hash table of the items, for finding duplicates.
+    int *table;
+    int tableSize;
+};
+
+struct parseTree earleyParse(struct vector *tokens, struct grammar grammar, char *startVariable) {
+    startParserErrors(tokens);
+
+    int length = tokens->length;
+    struct vector *variables = makeVector(char*);
+    struct vector *terminals = makeVector(char*);
+    struct vector *rules = makeVector(struct earleyRule);
+    struct vector *items = makeVector(struct earleyItem);
+    struct vector *links = makeVector(struct earleyLink);
+    struct vector *leoItems = makeVector(struct leoItem);
+    int i;
+
+    int findName(struct vector *names, char *name) {
+        forVector(names, i, char*, other,
+                if (strcmp(other, name) == 0)
+                    return i;);
+
+        return -1;
+    }
+
+    int addName(struct vector *names, char *name) {
+        int id = findName(names, name);
+        if (id < 0) {
+            id = names->length;
+            push(names, name);
+        }
+
+        return id;
+    }
+
+    // Number the variables, then the terminals, which are the symbols that
+    // aren't variables. Rules with "error" in them only match while parse()
+    // recovers from errors.
+    forVector(grammar.rules, i, struct rule, rule,
+            if (!rule.recovers)
+                addName(variables, rule.variable););
+
+    forVector(grammar.rules, i, struct rule, rule,
+        if (rule.recovers)
+            continue;
+
+        struct vector *symbols = makeVector(int);
+        forVector(rule.production, j, char*, symbol,
+            if (strcmp(symbol, "nothing") == 0)
+                continue;
+
+            int id = findName(variables, symbol);
+            if (id < 0)
+                id = -1 - addName(terminals, symbol);
+            push(symbols, id););
+
+        pushLiteral(rules, struct earleyRule,
+                {rule.variable, findName(variables, rule.variable), symbols}););
+
+    int variableCount = variables->length;
+    int start = findName(variables, startVariable);
+    if (start < 0)
+        return errorTree(startVariable, NULL);
+
+    // The rules of each variable, and whether each variable can be empty.
+    struct vector **variableRules = allocate(variableCount * sizeof (struct vector *));
+    char *nullable = allocate(variableCount);
+    for (i = 0; i < variableCount; i++) {
+        variableRules[i] = makeVector(int);
+        nullable[i] = 0;
+    }
+    forVector(rules, i, struct earleyRule, rule,
+            push(variableRules[rule.variableId], i););
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        forVector(rules, i, struct earleyRule, rule,
+            if (nullable[rule.variableId])
+                continue;
+
+            int empty = 1;
+            forVector(rule.symbols, j, int, symbol,
+                    empty = empty && symbol >= 0 && nullable[symbol];);
+            if (empty) {
+                nullable[rule.variableId] = 1;
+                changed = 1;
+            });
+    }
+
+    // The terminal that each token matches, or -1 if no rule has it.
+    int *tokenTerminals = allocate((length + 1) * sizeof (int));
+    forVector(tokens, i, struct token, token,
+            tokenTerminals[i] = findName(terminals, token.type););
+
+    struct earleySet *sets = allocate((length + 1) * sizeof (struct earleySet));
+    memset(sets, 0, (length + 1) * sizeof (struct earleySet));
+
+    struct earleyItem *item(int index) {
+        return (struct earleyItem *)vector_get(items, index);
+    }
+
+    struct earleyLink *link(int index) {
+        return (struct earleyLink *)vector_get(links, index);
+    }
+
+    struct leoItem *leoItem(int index) {
+        return (struct leoItem *)vector_get(leoItems, index);
+    }
+
+    struct vector *symbolsOf(int itemIndex) {
+        return get(struct earleyRule, rules, item(itemIndex)->rule).symbols;
+    }
+
+    int isComplete(int itemIndex) {
+        return item(itemIndex)->dot == symbolsOf(itemIndex)->length;
+    }
+
+    int symbolAfterDot(int itemIndex) {
+        return get(int, symbolsOf(itemIndex), item(itemIndex)->dot);
+    }
+
+    // Vectors only grow a few items at a time, which copies big vectors over
+    // and over again in an arena (see lib/memory.h), so these double instead.
+    void makeRoom(struct vector *vector) {
+        if (vector->length == vector->capacity)
+            vector_resize(vector, vector->capacity * 2);
+    }
+
+    int *makeArray(int size, int value) {
+        int *array = allocate(size * sizeof (int));
+        int i;
+        for (i = 0; i < size; i++)
+            array[i] = value;
+
+        return array;
+    }
+
+    unsigned int hashItem(int rule, int dot, int origin) {
+        return ((unsigned int)rule * 31 + (unsigned int)dot) * 2654435761u + (unsigned int)origin;
+    }
+
+    // Returns the slot in the set's hash table where the item is, or where
+    // it would go.
+    int findSlot(struct earleySet *set, int rule, int dot, int origin) {
+        int mask = set->tableSize - 1;
+        int slot = hashItem(rule, dot, origin) & mask;
+
+        while (set->table[slot] >= 0) {
+            struct earleyItem *other = item(set->table[slot]);
+            if (other->rule == rule && other->dot == dot && other->origin == origin)
+                break;
+            slot = (slot + 1) & mask;
+        }
+
+        return slot;
+    }
+
+    void addLink(int itemIndex, int predecessor, int leo) {
+        int existing;
+        for (existing = item(itemIndex)->links; existing >= 0; existing = link(existing)->next)
+            if (link(existing)->predecessor == predecessor && link(existing)->leo == leo)
+                return;
+
+        makeRoom(links);
+        pushLiteral(links, struct earleyLink, {predecessor, leo, item(itemIndex)->links});
+        item(itemIndex)->links = links->length - 1;
+    }
+
+    // Adds the item to the set if it isn't there already, along with how it
+    // was reached, and returns its index.
+    int addItem(int setIndex, int rule, int dot, int origin, int predecessor, int leo) {
+        struct earleySet *set = &sets[setIndex];
+        if (set->items == NULL) {
+            set->items = makeVector(int);
+            set->waiting = makeArray(variableCount, -1);
+            set->completed = makeArray(variableCount, -1);
+            set->leo = makeArray(variableCount, NOT_COMPUTED);
+            set->tableSize = INITIAL_TABLE_SIZE;
+            set->table = makeArray(set->tableSize, -1);
+        }
+
+        int slot = findSlot(set, rule, dot, origin);
+        int index = set->table[slot];
+
+        if (index < 0) {
+            index = items->length;
+            makeRoom(items);
+            makeRoom(set->items);
+            pushLiteral(items, struct earleyItem, {rule, dot, origin, setIndex, -1, -1, -1, -1, 0});
+            set->table[slot] = index;
+            push(set->items, index);
+
+            if (!isComplete(index) && symbolAfterDot(index) >= 0) {
+                item(index)->nextWaiting = set->waiting[symbolAfterDot(index)];
+                set->waiting[symbolAfterDot(index)] = index;
+            } else if (isComplete(index)) {
+                int variable = get(struct earleyRule, rules, rule).variableId;
+                item(index)->nextCompleted = set->completed[variable];
+                set->completed[variable] = index;
+            }
+
+            // Keep the table at most half full.
+            if (set->items->length * 2 > set->tableSize) {
+                set->tableSize *= 2;
+                deallocate(set->table);
+                set->table = makeArray(set->tableSize, -1);
+                forVector(set->items, i, int, other,
+                        set->table[findSlot(set, item(other)->rule, item(other)->dot,
+                            item(other)->origin)] = other;);
+            }
+        }
+
+        if (predecessor >= 0)
+            addLink(index, predecessor, leo);
+
+        return index;
+    }
+
+    // Returns the Leo item for the variable in the set, or -1 if there isn't
+    // one. The set has to be complete.
+    int findLeoItem(int setIndex, int variable) {
+        struct earleySet *set = &sets[setIndex];
+        if (set->leo[variable] != NOT_COMPUTED)
+            return set->leo[variable];
+
+        // This also stops rules like A -> B and B -> A from going around in
+        // circles.
+        set->leo[variable] = -1;
+
+        int via = set->waiting[variable];
+        if (via < 0 || item(via)->nextWaiting >= 0
+                || item(via)->dot + 1 != symbolsOf(via)->length)
+            return -1;
+
+        int next = findLeoItem(item(via)->origin,
+                get(struct earleyRule, rules, item(via)->rule).variableId);
+        int top = (next >= 0) ? leoItem(next)->top : via;
+        makeRoom(leoItems);
+        pushLiteral(leoItems, struct leoItem, {via, next, top});
+
+        set->leo[variable] = leoItems->length - 1;
+        return set->leo[variable];
+    }
+
+    void complete(int itemIndex, int setIndex) {
+        int origin = item(itemIndex)->origin;
+        int variable = get(struct earleyRule, rules, item(itemIndex)->rule).variableId;
+
+        // The origin set isn't complete yet when the rule matched nothing.
+        int leo = (origin < setIndex) ? findLeoItem(origin, variable) : -1;
+        if (leo >= 0) {
+            int top = leoItem(leo)->top;
+            addItem(setIndex, item(top)->rule, item(top)->dot + 1, item(top)->origin, top, leo);
+            return;
+        }
+
+        int waiting;
+        for (waiting = sets[origin].waiting[variable]; waiting >= 0;
+                waiting = item(waiting)->nextWaiting)
+            addItem(setIndex, item(waiting)->rule, item(waiting)->dot + 1,
+                    item(waiting)->origin, waiting, -1);
+    }
+
+    void process(int itemIndex, int setIndex) {
+        if (isComplete(itemIndex)) {
+            complete(itemIndex, setIndex);
+            return;
+        }
+
+        int symbol = symbolAfterDot(itemIndex);
+        if (symbol >= 0) {
+            // Only the first item waiting on a variable needs to predict it.
+            if (item(itemIndex)->nextWaiting < 0)
+                forVector(variableRules[symbol], i, int, rule,
+                        addItem(setIndex, rule, 0, setIndex, -1, -1););
+
+            // Aycock and Horspool's fix: a variable that can be empty might
+            // already have been completed in this set before this item came
+            // along to wait on it.
+            if (nullable[symbol])
+                addItem(setIndex, item(itemIndex)->rule, item(itemIndex)->dot + 1,
+                        item(itemIndex)->origin, itemIndex, -1);
+        } else if (setIndex < length && tokenTerminals[setIndex] == -1 - symbol) {
+            addItem(setIndex + 1, item(itemIndex)->rule, item(itemIndex)->dot + 1,
+                    item(itemIndex)->origin, itemIndex, -1);
+        }
+    }
+
+    forVector(variableRules[start], i, int, rule,
+            addItem(0, rule, 0, 0, -1, -1););
+
+    int furthest = 0;
+    for (i = 0; i <= length && sets[i].items != NULL; i++) {
+        furthest = i;
+
+        int j;
+        for (j = 0; j < sets[i].items->length; j++)
+            process(get(int, sets[i].items, j), i);
+    }
+
+    int root = -1;
+    if (furthest == length) {
+        int completed;
+        for (completed = sets[length].completed[start]; completed >= 0;
+                completed = item(completed)->nextCompleted)
+            if (item(completed)->origin == 0)
+                root = completed;
+    }
+
+    if (root < 0) {
+        // Report the terminals that could have come next at the furthest
+        // token, once for each variable.
+        forVector(sets[furthest].items, i, int, itemIndex,
+            if (isComplete(itemIndex) || symbolAfterDot(itemIndex) >= 0)
+                continue;
+
+            struct earleyRule rule = get(struct earleyRule, rules, item(itemIndex)->rule);
+            int symbol = symbolAfterDot(itemIndex);
+            int j, reported = 0;
+            for (j = 0; j < i && !reported; j++) {
+                int other = get(int, sets[furthest].items, j);
+                reported = !isComplete(other) && symbolAfterDot(other) == symbol
+                    && strcmp(get(struct earleyRule, rules, item(other)->rule).variable,
+                            rule.variable) == 0;
+            }
+
+            if (!reported)
+                addExpectedTerminal(get(char*, terminals, -1 - symbol), rule.variable, furthest););
+
+        return errorTree(startVariable, NULL);
+    }
+
+    // Building the parse tree
+    // =======================
+    // The parse tree has to pick one of the ways that each item was reached.
+    // The children of an item end at the sets of the items on the way to it,
+    // and the way where those are furthest along, comparing the first child
+    // first, is the one where each symbol took as many tokens as it could.
+
+    auto int compareItems(int a, int b);
+
+    int bestLink(int itemIndex) {
+        if (item(itemIndex)->bestLink < 0) {
+            int best = item(itemIndex)->links;
+            int other;
+            for (other = link(best)->next; other >= 0; other = link(other)->next)
+                if (compareItems(link(other)->predecessor, link(best)->predecessor) > 0)
+                    best = other;
+            item(itemIndex)->bestLink = best;
+        }
+
+        return item(itemIndex)->bestLink;
+    }
+
+    // Returns the sets that the children of an item end at.
+    int *childEnds(int itemIndex) {
+        int count = item(itemIndex)->dot;
+        int *ends = allocate((count + 1) * sizeof (int));
+
+        int current = itemIndex, child;
+        for (child = count - 1; child >= 0; child--) {
+            ends[child] = item(current)->set;
+            current = link(bestLink(current))->predecessor;
+        }
+
+        return ends;
+    }
+
+    // Compares where the children of two items end, for the first child
+    // that's different, and returns 0 if one item's children are the start of
+    // the other's.
+    int compareItems(int a, int b) {
+        int *aEnds = childEnds(a), *bEnds = childEnds(b);
+        int count = item(a)->dot < item(b)->dot ? item(a)->dot : item(b)->dot;
+        int result = 0, i;
+
+        for (i = 0; i < count && result == 0; i++)
+            result = aEnds[i] - bEnds[i];
+
+        deallocate(aEnds);
+        deallocate(bEnds);
+        return result;
+    }
+
+    // Makes the items that a Leo item skipped over, in the given set.
+    void makeSkippedItems(int leo, int setIndex) {
+        for (; leoItem(leo)->next >= 0; leo = leoItem(leo)->next) {
+            int via = leoItem(leo)->via;
+            addItem(setIndex, item(via)->rule, item(via)->dot + 1, item(via)->origin, via, -1);
+        }
+    }
+
+    auto struct parseTree buildItem(int itemIndex);
+
+    int isPreferred(int a, int b) {
+        int comparison = compareItems(a, b);
+        return comparison > 0 || (comparison == 0 && item(a)->rule < item(b)->rule);
+    }
+
+    struct parseTree buildVariable(int variable, int origin, int setIndex) {
+        struct vector *candidates = makeVector(int);
+        int completed;
+        for (completed = sets[setIndex].completed[variable]; completed >= 0;
+                completed = item(completed)->nextCompleted)
+            if (item(completed)->origin == origin)
+                push(candidates, completed);
+
+        // The first choice only fails in grammars where a variable can
+        // produce itself, where it would go around in a circle.
+        while (candidates->length > 0) {
+            int best = 0, i;
+            for (i = 1; i < candidates->length; i++)
+                if (isPreferred(get(int, candidates, i), get(int, candidates, best)))
+                    best = i;
+
+            struct parseTree tree = buildItem(get(int, candidates, best));
+            if (!isParseTreeError(tree))
+                return tree;
+
+            set(candidates, best, get(int, candidates, candidates->length - 1));
+            candidates->length -= 1;
+        }
+
+        return errorTree(NULL, NULL);
+    }
+
+    // Adds the children of the item before its dot to children, from last to
+    // first, and returns false if it can't without going around in a circle.
+    int buildChildren(int itemIndex, struct vector *children) {
+        if (item(itemIndex)->dot == 0)
+            return 1;
+
+        int best = bestLink(itemIndex);
+        int linkIndex = best;
+        while (linkIndex >= 0) {
+            struct earleyLink way = *link(linkIndex);
+            if (way.leo >= 0)
+                makeSkippedItems(way.leo, item(itemIndex)->set);
+
+            int from = item(way.predecessor)->set;
+            int symbol = get(int, symbolsOf(itemIndex), item(itemIndex)->dot - 1);
+            struct parseTree child;
+            if (symbol < 0) {
+                struct token token = get(struct token, tokens, from);
+                child = makeParseTree(token.token, NULL, tokens, from, 1);
+            } else {
+                child = buildVariable(symbol, from, item(itemIndex)->set);
+            }
+
+            int length = children->length;
+            if (!isParseTreeError(child)) {
+                push(children, child);
+                if (buildChildren(way.predecessor, children))
+                    return 1;
+            }
+            children->length = length;
+
+            // Try the other ways, after the best one.
+            linkIndex = (linkIndex == best) ? item(itemIndex)->links : link(linkIndex)->next;
+            if (linkIndex == best)
+                linkIndex = link(linkIndex)->next;
+        }
+
+        return 0;
+    }
+
+    struct parseTree buildItem(int itemIndex) {
+        struct earleyRule rule = get(struct earleyRule, rules, item(itemIndex)->rule);
+        if (item(itemIndex)->building)
+            return errorTree(rule.variable, NULL);
+
+        struct vector *children = makeVector(struct parseTree);
+        item(itemIndex)->building = 1;
+        int built = buildChildren(itemIndex, children);
+        item(itemIndex)->building = 0;
+        if (!built)
+            return errorTree(rule.variable, NULL);
+
+        // The children were found from last to first.
+        int first, last;
+        for (first = 0, last = children->length - 1; first < last; first++, last--) {
+            struct parseTree swap = get(struct parseTree, children, first);
+            set(children, first, get(struct parseTree, children, last));
+            set(children, last, swap);
+        }
+
+        return makeParseTree(rule.variable, children, tokens, item(itemIndex)->origin,
+                item(itemIndex)->set - item(itemIndex)->origin);
+    }
+
+    return buildVariable(start, 0, length);
+}
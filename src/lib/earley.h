@@ -0,0 +1,23 @@
+#ifndef EARLEY_H
+#define EARLEY_H
+
+#include "lib/vector.h"
+#include "lib/parser.h"
+
+// Earley parser
+// =============
+// A second parser for the grammars in lib/parser.h, which works with any
+// context-free grammar: left recursion, ambiguity and all. It takes O(n^3)
+// time in the worst case, O(n^2) for unambiguous grammars, and O(n) for the
+// grammars that parse() handles without backtracking, which includes PL/0.
+//
+// It returns the same parse trees as parse() does for grammars that both can
+// parse. When a grammar is ambiguous, each symbol in a rule takes as many
+// tokens as it can, from left to right, and the earlier rule wins a tie, so an
+// else goes with the closest if, like in parse(). Rules with "error" in them
+// are ignored, and syntax errors are reported in the same format as parse()
+// reports them: the terminals that could have come next at the furthest token
+// the parser got to.
+struct parseTree earleyParse(struct vector *tokens, struct grammar grammar, char *startVariable);
+
+#endif
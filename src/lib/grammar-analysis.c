@@ -0,0 +1,661 @@
+#include "lib/grammar-analysis.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include "lib/hash.h"
+#include "lib/util.h"
+#include <string.h>
+
+// The lookahead that picks a rule is the set of strings of k terminals that
+// can come next when the rule is the right one: the strings that the rule can
+// start with, followed by the strings that can come after its variable
+// (FIRST_k and FOLLOW_k). Strings that can come before the end of the input
+// are shorter than k. A variable needs k tokens of lookahead if its rules'
+// sets don't have any strings in common for k, but do for every smaller k.
+// Both are computed the usual way, by adding to the sets of every variable
+// until nothing changes.
+
+// The size that a lookahead set's hash table starts at, which has to be a
+// power of two.
+#define INITIAL_TABLE_SIZE 16
+
+// A string of up to k terminals, numbered in the order they first appear in
+// the grammar.
+struct lookahead {
+    int length;
+    int terminals[MAX_LOOKAHEAD];
+};
+
+struct lookaheadSet {
+    struct vector *lookaheads;
+    // Indexes into lookaheads, or -1 for empty slots.
+    int *table;
+    int tableSize;
+};
+
+// A rule from the grammar with its symbols numbered. Variables are numbered
+// from 0, and terminal number t is -1 - t.
+struct analysisRule {
+    int variable;
+    struct vector *symbols;
+    struct rule rule;
+};
+
+static uint64_t hashLookahead(struct lookahead lookahead) {
+    return hashBytes(hashInt(HASH_SEED, lookahead.length), lookahead.terminals,
+            lookahead.length * sizeof (int));
+}
+
+static int equalLookaheads(struct lookahead a, struct lookahead b) {
+    return a.length == b.length
+        && memcmp(a.terminals, b.terminals, a.length * sizeof (int)) == 0;
+}
+
+static struct lookaheadSet *makeLookaheadSet() {
+    struct lookaheadSet *result = allocate(sizeof (struct lookaheadSet));
+    result->lookaheads = makeVector(struct lookahead);
+    result->tableSize = INITIAL_TABLE_SIZE;
+    result->table = allocate(result->tableSize * sizeof (int));
+    memset(result->table, -1, result->tableSize * sizeof (int));
+
+    return result;
+}
+
+static void freeLookaheadSet(struct lookaheadSet *lookaheads) {
+    freeVector(lookaheads->lookaheads);
+    deallocate(lookaheads->table);
+    deallocate(lookaheads);
+}
+
+// Returns the slot of the table that has the lookahead, or the empty slot
+// where it would go.
+static int findLookaheadSlot(struct lookaheadSet *lookaheads, struct lookahead lookahead) {
+    int mask = lookaheads->tableSize - 1;
+    int slot = hashLookahead(lookahead) & mask;
+    while (lookaheads->table[slot] >= 0 && !equalLookaheads(lookahead,
+                get(struct lookahead, lookaheads->lookaheads, lookaheads->table[slot])))
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+static int containsLookahead(struct lookaheadSet *lookaheads, struct lookahead lookahead) {
+    return lookaheads->table[findLookaheadSlot(lookaheads, lookahead)] >= 0;
+}
+
+// Adds the lookahead to the set, and returns true if it wasn't in it already.
+static int addLookahead(struct lookaheadSet *lookaheads, struct lookahead lookahead) {
+    int slot = findLookaheadSlot(lookaheads, lookahead);
+    if (lookaheads->table[slot] >= 0)
+        return 0;
+
+    // Vectors grow by a fixed step, so big sets double their capacity
+    // instead.
+    struct vector *vector = lookaheads->lookaheads;
+    if (vector->length == vector->capacity)
+        vector_resize(vector, vector->capacity * 2);
+    lookaheads->table[slot] = vector->length;
+    push(vector, lookahead);
+
+    // Keep the table at most half full.
+    if (vector->length * 2 > lookaheads->tableSize) {
+        deallocate(lookaheads->table);
+        lookaheads->tableSize *= 2;
+        lookaheads->table = allocate(lookaheads->tableSize * sizeof (int));
+        memset(lookaheads->table, -1, lookaheads->tableSize * sizeof (int));
+        forVector(vector, i, struct lookahead, other,
+                lookaheads->table[findLookaheadSlot(lookaheads, other)] = i;);
+    }
+
+    return 1;
+}
+
+// Adds every lookahead in from to to, and returns true if any were new.
+static int addLookaheads(struct lookaheadSet *to, struct lookaheadSet *from) {
+    int added = 0;
+    forVector(from->lookaheads, i, struct lookahead, lookahead,
+            added |= addLookahead(to, lookahead););
+
+    return added;
+}
+
+// Adds the lookaheads of first followed by those of second, cut off at k
+// terminals, to result.
+static void addConcatenation(struct lookaheadSet *result, struct lookaheadSet *first,
+        struct lookaheadSet *second, int k) {
+    forVector(first->lookaheads, i, struct lookahead, start,
+        if (start.length >= k) {
+            addLookahead(result, start);
+            continue;
+        }
+
+        forVector(second->lookaheads, j, struct lookahead, rest,
+            struct lookahead both = start;
+            int n;
+            for (n = 0; n < rest.length && both.length < k; n++)
+                both.terminals[both.length++] = rest.terminals[n];
+            addLookahead(result, both);););
+}
+
+struct grammarReport analyzeGrammar(struct grammar grammar, char *startVariable,
+        int maxLookahead) {
+    struct grammarReport report = {NULL, 0, 0, 0, 0, 0};
+    struct vector *lines = makeVector(char*);
+    struct vector *variables = makeVector(char*);
+    struct vector *terminals = makeVector(char*);
+    struct vector *rules = makeVector(struct analysisRule);
+    int ignoredRules = 0;
+    int i, j, k;
+
+    if (maxLookahead < 1)
+        maxLookahead = 1;
+    if (maxLookahead > MAX_LOOKAHEAD)
+        maxLookahead = MAX_LOOKAHEAD;
+
+    void addLine(char *line) {
+        push(lines, line);
+    }
+
+    int findName(struct vector *names, char *name) {
+        forVector(names, i, char*, other,
+                if (strcmp(other, name) == 0)
+                    return i;);
+
+        return -1;
+    }
+
+    int addName(struct vector *names, char *name) {
+        int id = findName(names, name);
+        if (id < 0) {
+            id = names->length;
+            push(names, name);
+        }
+
+        return id;
+    }
+
+    // Number the variables, then the terminals, which are the symbols that
+    // aren't variables.
+    forVector(grammar.rules, i, struct rule, rule,
+            if (!rule.recovers)
+                addName(variables, rule.variable););
+
+    forVector(grammar.rules, i, struct rule, rule,
+        if (rule.recovers) {
+            ignoredRules++;
+            continue;
+        }
+
+        struct vector *symbols = makeVector(int);
+        forVector(rule.production, j, char*, symbol,
+            if (strcmp(symbol, "nothing") == 0)
+                continue;
+
+            int id = findName(variables, symbol);
+            if (id < 0)
+                id = -1 - addName(terminals, symbol);
+            push(symbols, id););
+
+        pushLiteral(rules, struct analysisRule,
+                {findName(variables, rule.variable), symbols, rule}););
+
+    int variableCount = variables->length;
+    int start = findName(variables, startVariable);
+    if (start < 0) {
+        report.text = format("%s has no rules.\n", startVariable);
+        return report;
+    }
+
+    char *variableName(int variable) {
+        return get(char*, variables, variable);
+    }
+
+    char *terminalName(int terminal) {
+        return get(char*, terminals, terminal);
+    }
+
+    struct analysisRule ruleAt(int index) {
+        return get(struct analysisRule, rules, index);
+    }
+
+    char *productionOf(int index) {
+        return joinStrings(ruleAt(index).rule.production, " ");
+    }
+
+    char *makeFlags() {
+        char *flags = allocate(variableCount);
+        memset(flags, 0, variableCount);
+        return flags;
+    }
+
+    // The rules of each variable, in the order that parse() tries them.
+    struct vector **alternatives = allocate(variableCount * sizeof (struct vector *));
+    for (i = 0; i < variableCount; i++)
+        alternatives[i] = makeVector(int);
+    forVector(rules, i, struct analysisRule, rule,
+            push(alternatives[rule.variable], i););
+
+    addLine(format("%s: %d variables, %d terminals and %d rules, not counting %d rules with "
+                "\"error\" in them.", startVariable, variableCount, terminals->length,
+                rules->length, ignoredRules));
+
+    // Reachable, productive and nullable variables
+    // ============================================
+    char *reachable = makeFlags();
+    void reach(int variable) {
+        if (reachable[variable])
+            return;
+        reachable[variable] = 1;
+
+        forVector(alternatives[variable], i, int, index,
+            forVector(ruleAt(index).symbols, j, int, symbol,
+                if (symbol >= 0)
+                    reach(symbol);););
+    }
+    reach(start);
+
+    char *productive = makeFlags();
+    char *nullable = makeFlags();
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        forVector(rules, i, struct analysisRule, rule,
+            int allProductive = 1, allNullable = 1;
+            forVector(rule.symbols, j, int, symbol,
+                if (symbol >= 0) {
+                    allProductive &= productive[symbol];
+                    allNullable &= nullable[symbol];
+                } else {
+                    allNullable = 0;
+                });
+
+            if (allProductive && !productive[rule.variable]) {
+                productive[rule.variable] = 1;
+                changed = 1;
+            }
+            if (allNullable && !nullable[rule.variable]) {
+                nullable[rule.variable] = 1;
+                changed = 1;
+            });
+    }
+
+    // Left recursion
+    // ==============
+    // A variable calls another one on the left if one of its rules starts
+    // with it, after variables that can produce nothing. parse() parses the
+    // other variable at the same token, so a cycle of these never ends.
+    char *leftCalls = allocate(variableCount * variableCount);
+    memset(leftCalls, 0, variableCount * variableCount);
+    forVector(rules, i, struct analysisRule, rule,
+        forVector(rule.symbols, j, int, symbol,
+            if (symbol < 0)
+                break;
+            leftCalls[rule.variable * variableCount + symbol] = 1;
+            if (!nullable[symbol])
+                break;););
+
+    // Finds the variables that from calls on the left, directly or not, and
+    // the variable before each one on the shortest way there.
+    int *queue = allocate(variableCount * sizeof (int));
+    int *previous = allocate(variableCount * sizeof (int));
+    char *leftReaches = allocate(variableCount * variableCount);
+    void findLeftCalls(int from) {
+        char *reaches = leftReaches + from * variableCount;
+        int head = 0, tail = 0, variable;
+        memset(reaches, 0, variableCount);
+        queue[tail++] = from;
+        while (head < tail) {
+            int current = queue[head++];
+            for (variable = 0; variable < variableCount; variable++) {
+                if (!leftCalls[current * variableCount + variable] || reaches[variable])
+                    continue;
+                reaches[variable] = 1;
+                previous[variable] = current;
+                queue[tail++] = variable;
+            }
+        }
+    }
+
+    int leftReach(int from, int to) {
+        return leftReaches[from * variableCount + to];
+    }
+
+    for (i = 0; i < variableCount; i++)
+        findLeftCalls(i);
+
+    addLine("");
+    addLine("Left recursion:");
+    char *inReportedCycle = makeFlags();
+    for (i = 0; i < variableCount; i++) {
+        if (!leftReach(i, i) || inReportedCycle[i])
+            continue;
+
+        // Report the shortest cycle through the variable, and only that one
+        // for all of the variables that call each other on the left.
+        findLeftCalls(i);
+        struct vector *cycle = makeVector(char*);
+        int variable = i;
+        do {
+            push(cycle, get(char*, variables, variable));
+            variable = previous[variable];
+        } while (variable != i);
+        push(cycle, get(char*, variables, i));
+        for (j = 0; j < cycle->length / 2; j++) {
+            char *swap = get(char*, cycle, j);
+            set(cycle, j, get(char*, cycle, cycle->length - 1 - j));
+            set(cycle, cycle->length - 1 - j, swap);
+        }
+        addLine(format("  %s", joinStrings(cycle, " -> ")));
+        freeVector(cycle);
+
+        for (j = 0; j < variableCount; j++)
+            if (leftReach(i, j) && leftReach(j, i))
+                inReportedCycle[j] = 1;
+        report.leftRecursiveCycles++;
+    }
+    if (report.leftRecursiveCycles == 0)
+        addLine("  none");
+
+    // Lists the variables with a flag set (or not set), and returns how many
+    // there were.
+    int listVariables(char *title, char *flags, int value) {
+        struct vector *names = makeVector(char*);
+        for (i = 0; i < variableCount; i++)
+            if (!flags[i] == !value)
+                push(names, get(char*, variables, i));
+
+        addLine("");
+        addLine(title);
+        addLine(format("  %s", names->length > 0 ? joinStrings(names, ", ") : "none"));
+        int count = names->length;
+        freeVector(names);
+
+        return count;
+    }
+
+    report.unreachableVariables = listVariables("Unreachable variables:", reachable, 0);
+    report.unproductiveVariables = listVariables("Unproductive variables:", productive, 0);
+    listVariables("Nullable variables:", nullable, 1);
+
+    // Lookahead sets
+    // ==============
+    struct lookaheadSet *nothing = makeLookaheadSet();
+    addLookahead(nothing, (struct lookahead){0});
+    struct lookaheadSet **terminalSets = allocate(terminals->length * sizeof (struct lookaheadSet *));
+    for (i = 0; i < terminals->length; i++) {
+        struct lookahead terminal = {1};
+        terminal.terminals[0] = i;
+        terminalSets[i] = makeLookaheadSet();
+        addLookahead(terminalSets[i], terminal);
+    }
+
+    struct lookaheadSet **first = allocate(variableCount * sizeof (struct lookaheadSet *));
+    struct lookaheadSet **follow = allocate(variableCount * sizeof (struct lookaheadSet *));
+
+    struct lookaheadSet *setOf(int symbol) {
+        return (symbol >= 0) ? first[symbol] : terminalSets[-1 - symbol];
+    }
+
+    // Returns the lookaheads of the symbols of a rule from index on, followed
+    // by the lookaheads in after.
+    struct lookaheadSet *firstOfSymbols(struct vector *symbols, int index,
+            struct lookaheadSet *after, int k) {
+        struct lookaheadSet *result = makeLookaheadSet();
+        addLookaheads(result, after);
+
+        int symbol;
+        for (symbol = symbols->length - 1; symbol >= index; symbol--) {
+            struct lookaheadSet *next = makeLookaheadSet();
+            addConcatenation(next, setOf(get(int, symbols, symbol)), result, k);
+            freeLookaheadSet(result);
+            result = next;
+        }
+
+        return result;
+    }
+
+    void computeLookaheads(int k) {
+        int variable;
+        for (variable = 0; variable < variableCount; variable++) {
+            first[variable] = makeLookaheadSet();
+            follow[variable] = makeLookaheadSet();
+        }
+
+        int changed = 1;
+        while (changed) {
+            changed = 0;
+            forVector(rules, i, struct analysisRule, rule,
+                struct lookaheadSet *ruleFirst = firstOfSymbols(rule.symbols, 0, nothing, k);
+                changed |= addLookaheads(first[rule.variable], ruleFirst);
+                freeLookaheadSet(ruleFirst););
+        }
+
+        // The end of the input comes after the start variable.
+        addLookahead(follow[start], (struct lookahead){0});
+        changed = 1;
+        while (changed) {
+            changed = 0;
+            forVector(rules, i, struct analysisRule, rule,
+                struct lookaheadSet *after = makeLookaheadSet();
+                addLookaheads(after, follow[rule.variable]);
+
+                int index;
+                for (index = rule.symbols->length - 1; index >= 0; index--) {
+                    int symbol = get(int, rule.symbols, index);
+                    if (symbol >= 0)
+                        changed |= addLookaheads(follow[symbol], after);
+
+                    struct lookaheadSet *next = makeLookaheadSet();
+                    addConcatenation(next, setOf(symbol), after, k);
+                    freeLookaheadSet(after);
+                    after = next;
+                }
+                freeLookaheadSet(after););
+        }
+    }
+
+    void freeLookaheads() {
+        int variable;
+        for (variable = 0; variable < variableCount; variable++) {
+            freeLookaheadSet(first[variable]);
+            freeLookaheadSet(follow[variable]);
+        }
+    }
+
+    // Returns the terminals of the one-token lookaheads that are in both
+    // sets.
+    struct vector *sharedTerminals(struct lookaheadSet *a, struct lookaheadSet *b) {
+        struct vector *names = makeVector(char*);
+        forVector(a->lookaheads, i, struct lookahead, lookahead,
+            if (lookahead.length > 0 && containsLookahead(b, lookahead)) {
+                char *name = terminalName(lookahead.terminals[0]);
+                push(names, name);
+            });
+
+        return names;
+    }
+
+    // Conflicts
+    // =========
+    computeLookaheads(1);
+
+    struct vector *firstFirst = makeVector(char*);
+    struct vector *firstFollow = makeVector(char*);
+    int variable;
+    for (variable = 0; variable < variableCount; variable++) {
+        struct vector *rulesOfVariable = alternatives[variable];
+        int count = rulesOfVariable->length;
+        struct lookaheadSet **ruleFirst = allocate((count + 1) * sizeof (struct lookaheadSet *));
+        for (i = 0; i < count; i++)
+            ruleFirst[i] = firstOfSymbols(ruleAt(get(int, rulesOfVariable, i)).symbols, 0,
+                    nothing, 1);
+
+        for (i = 0; i < count; i++) {
+            char *production = productionOf(get(int, rulesOfVariable, i));
+            int isNullable = containsLookahead(ruleFirst[i], (struct lookahead){0});
+
+            for (j = 0; j < count; j++) {
+                if (j == i)
+                    continue;
+                char *other = productionOf(get(int, rulesOfVariable, j));
+
+                struct vector *shared = sharedTerminals(ruleFirst[i], ruleFirst[j]);
+                if (j > i && shared->length > 0) {
+                    char *conflict = format("  %s: \"%s\" and \"%s\" can both start with %s",
+                            variableName(variable), production, other, joinStrings(shared, " "));
+                    push(firstFirst, conflict);
+                    report.conflicts++;
+                }
+                freeVector(shared);
+
+                if (!isNullable)
+                    continue;
+
+                if (j > i && containsLookahead(ruleFirst[j], (struct lookahead){0})) {
+                    char *conflict = format("  %s: \"%s\" and \"%s\" can both produce nothing, "
+                            "so the grammar is ambiguous", variableName(variable), production, other);
+                    push(firstFollow, conflict);
+                    report.conflicts++;
+                }
+
+                shared = sharedTerminals(ruleFirst[j], follow[variable]);
+                if (shared->length > 0) {
+                    char *conflict = format("  %s: \"%s\" can produce nothing, and \"%s\" can "
+                            "start with %s, which can also come after %s", variableName(variable),
+                            production, other, joinStrings(shared, " "), variableName(variable));
+                    push(firstFollow, conflict);
+                    report.conflicts++;
+                }
+                freeVector(shared);
+            }
+        }
+
+        for (i = 0; i < count; i++)
+            freeLookaheadSet(ruleFirst[i]);
+        deallocate(ruleFirst);
+    }
+
+    addLine("");
+    addLine("FIRST/FIRST conflicts:");
+    if (firstFirst->length == 0)
+        addLine("  none");
+    vector_concat(lines, firstFirst);
+    addLine("");
+    addLine("FIRST/FOLLOW conflicts:");
+    if (firstFollow->length == 0)
+        addLine("  none");
+    vector_concat(lines, firstFollow);
+
+    // Lookahead
+    // =========
+    // The number of tokens that each variable needs, or 0 if no number up to
+    // maxLookahead is enough.
+    int *needed = allocate(variableCount * sizeof (int));
+    for (variable = 0; variable < variableCount; variable++)
+        needed[variable] = 0;
+
+    int isChecked(int variable) {
+        return alternatives[variable]->length > 1 && reachable[variable]
+            && productive[variable] && !leftReach(variable, variable);
+    }
+
+    for (k = 1; k <= maxLookahead; k++) {
+        int unresolved = 0;
+        for (variable = 0; variable < variableCount; variable++)
+            unresolved += isChecked(variable) && needed[variable] == 0;
+        if (unresolved == 0)
+            break;
+
+        if (k > 1) {
+            freeLookaheads();
+            computeLookaheads(k);
+        }
+
+        for (variable = 0; variable < variableCount; variable++) {
+            if (!isChecked(variable) || needed[variable] != 0)
+                continue;
+
+            struct vector *rulesOfVariable = alternatives[variable];
+            int count = rulesOfVariable->length;
+            struct lookaheadSet **predict = allocate(count * sizeof (struct lookaheadSet *));
+            for (i = 0; i < count; i++)
+                predict[i] = firstOfSymbols(ruleAt(get(int, rulesOfVariable, i)).symbols, 0,
+                        follow[variable], k);
+
+            int disjoint = 1;
+            for (i = 0; i < count && disjoint; i++)
+                for (j = i + 1; j < count && disjoint; j++)
+                    forVector(predict[i]->lookaheads, l, struct lookahead, lookahead,
+                        if (containsLookahead(predict[j], lookahead)) {
+                            disjoint = 0;
+                            break;
+                        });
+            if (disjoint)
+                needed[variable] = k;
+
+            for (i = 0; i < count; i++)
+                freeLookaheadSet(predict[i]);
+            deallocate(predict);
+        }
+    }
+    freeLookaheads();
+
+    int width = 0;
+    forVector(variables, i, char*, name,
+            if ((int)strlen(name) > width)
+                width = strlen(name););
+
+    addLine("");
+    addLine("Tokens of lookahead that pick each variable's rule without backtracking:");
+    for (variable = 0; variable < variableCount; variable++) {
+        char *lookahead;
+        if (!reachable[variable])
+            lookahead = "- (unreachable)";
+        else if (!productive[variable])
+            lookahead = "- (unproductive)";
+        else if (alternatives[variable]->length == 1)
+            lookahead = "0 (one rule)";
+        else if (leftReach(variable, variable))
+            lookahead = "- (left-recursive)";
+        else if (needed[variable] == 0)
+            lookahead = format("more than %d, or it's ambiguous", maxLookahead);
+        else
+            lookahead = format("%d", needed[variable]);
+
+        if (alternatives[variable]->length > 1 && reachable[variable] && needed[variable] != 1)
+            report.backtrackingVariables++;
+
+        addLine(format("  %-*s %s", width, variableName(variable), lookahead));
+    }
+    addLine("");
+
+    report.text = joinStrings(lines, "\n");
+
+    freeLookaheadSet(nothing);
+    for (i = 0; i < terminals->length; i++)
+        freeLookaheadSet(terminalSets[i]);
+    for (i = 0; i < variableCount; i++)
+        freeVector(alternatives[i]);
+    forVector(rules, i, struct analysisRule, rule,
+            freeVector(rule.symbols););
+    deallocate(terminalSets);
+    deallocate(first);
+    deallocate(follow);
+    deallocate(alternatives);
+    deallocate(reachable);
+    deallocate(productive);
+    deallocate(nullable);
+    deallocate(leftCalls);
+    deallocate(leftReaches);
+    deallocate(queue);
+    deallocate(previous);
+    deallocate(inReportedCycle);
+    deallocate(needed);
+    freeVector(firstFirst);
+    freeVector(firstFollow);
+    freeVector(rules);
+    freeVector(variables);
+    freeVector(terminals);
+    freeVector(lines);
+
+    return report;
+}
@@ -0,0 +1,43 @@
+#ifndef GRAMMAR_ANALYSIS_H
+#define GRAMMAR_ANALYSIS_H
+
+#include "lib/parser.h"
+
+// Grammar analysis
+// ================
+// Finds the shapes in a grammar that make parse() slow or wrong. parse() tries
+// a variable's rules in order and backtracks when one fails, so it never
+// finishes on left recursion, and it reparses the same tokens whenever two
+// rules start the same way. The report has:
+//
+// * Left-recursive cycles, like "@e -> @e + @t", that parse() can't parse.
+// * Variables that can't be reached from the start variable, and variables
+//   that can't produce any string of terminals.
+// * Variables that can produce nothing.
+// * FIRST/FIRST conflicts, where two rules of a variable can start with the
+//   same terminal, and FIRST/FOLLOW conflicts, where a rule can produce
+//   nothing and another rule can start with a terminal that can come after
+//   the variable.
+// * For each variable, the number of tokens of lookahead that would pick the
+//   right rule without backtracking (strong LL(k)), up to maxLookahead.
+//
+// Rules with "error" in them only match while parse() recovers from errors,
+// so they're left out.
+
+// The longest lookahead that analyzeGrammar can check.
+#define MAX_LOOKAHEAD 8
+
+struct grammarReport {
+    char *text;
+    int leftRecursiveCycles;
+    int unreachableVariables;
+    int unproductiveVariables;
+    int conflicts;             // FIRST/FIRST and FIRST/FOLLOW conflicts.
+    // Variables that need more than one token of lookahead.
+    int backtrackingVariables;
+};
+
+struct grammarReport analyzeGrammar(struct grammar grammar, char *startVariable,
+        int maxLookahead);
+
+#endif
@@ -0,0 +1,26 @@
+#include "lib/hash.h"
+#include <string.h>
+
+#define FNV_PRIME 1099511628211ULL
+
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t length) {
+    const unsigned char *byte = bytes;
+
+    size_t i;
+    for (i = 0; i < length; i++) {
+        hash ^= byte[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+uint64_t hashString(uint64_t hash, const char *string) {
+    // Include the terminating null character so that, for example, hashing
+    // "ab" then "c" is different from hashing "a" then "bc".
+    return hashBytes(hash, string, strlen(string) + 1);
+}
+
+uint64_t hashInt(uint64_t hash, int value) {
+    return hashBytes(hash, &value, sizeof value);
+}
@@ -0,0 +1,23 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hashing
+// =======
+// A small, fast, non-cryptographic hash (64-bit FNV-1a) for building cache
+// keys. Hashes are built up incrementally by passing the previous hash as the
+// seed of the next call, starting with HASH_SEED. For example:
+//
+// uint64_t hash = HASH_SEED;
+// hash = hashString(hash, "procedure");
+// hash = hashInt(hash, 42);
+
+#define HASH_SEED 14695981039346656037ULL
+
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t length);
+uint64_t hashString(uint64_t hash, const char *string);
+uint64_t hashInt(uint64_t hash, int value);
+
+#endif
@@ -6,6 +6,7 @@ struct token {
    char *type;
    char *token;
    int line;
+   int column;
 
 };
 
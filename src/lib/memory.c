@@ -0,0 +1,268 @@
+#include "lib/memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Every allocation starts with this header, so that reallocate and deallocate
+// know how big it is and where it came from.
+struct allocation {
+    size_t size;
+    struct arena *arena;   // NULL if the memory came from malloc.
+};
+
+// Every allocation is rounded up to this, so that all memory is suitably
+// aligned for any type, like memory from malloc.
+#define ALIGNMENT 16
+#define alignSize(size) (((size) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+#define HEADER_SIZE alignSize(sizeof (struct allocation))
+
+// The size of the blocks that arenas get from malloc. Bigger allocations get a
+// block of their own.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arenaBlock {
+    struct arenaBlock *next;
+    size_t size;   // The number of bytes in data.
+    size_t used;
+    char *data;
+};
+
+struct arena {
+    struct arenaBlock *blocks;
+    // The block that allocations currently come from. Blocks before it are
+    // full, and blocks after it were kept by resetArena and are empty.
+    struct arenaBlock *current;
+    // The arena that this one was merged into (see mergeArena), and the
+    // arenas that were merged into this one. Allocations from a merged arena
+    // still point to it, so it's kept until the arena it was merged into is
+    // reset or freed.
+    struct arena *mergedInto;
+    struct arena *merged;
+    struct arena *nextMerged;
+};
+
+static __thread struct arena *currentArena = NULL;
+
+struct arena *makeArena() {
+    struct arena *arena = malloc(sizeof (struct arena));
+    arena->blocks = NULL;
+    arena->current = NULL;
+    arena->mergedInto = NULL;
+    arena->merged = NULL;
+    arena->nextMerged = NULL;
+
+    return arena;
+}
+
+struct arena *useArena(struct arena *arena) {
+    struct arena *previousArena = currentArena;
+    currentArena = arena;
+
+    return previousArena;
+}
+
+// Frees the arenas that were merged into the arena, whose blocks belong to it.
+static void freeMergedArenas(struct arena *arena) {
+    while (arena->merged != NULL) {
+        struct arena *merged = arena->merged;
+        arena->merged = merged->nextMerged;
+        freeMergedArenas(merged);
+        free(merged);
+    }
+}
+
+void resetArena(struct arena *arena) {
+    freeMergedArenas(arena);
+
+    struct arenaBlock *block;
+    for (block = arena->blocks; block != NULL; block = block->next)
+        block->used = 0;
+
+    arena->current = arena->blocks;
+}
+
+void freeArena(struct arena *arena) {
+    if (currentArena == arena)
+        currentArena = NULL;
+    freeMergedArenas(arena);
+
+    struct arenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        struct arenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+void mergeArena(struct arena *into, struct arena *from) {
+    if (currentArena == from)
+        currentArena = NULL;
+
+    // Put the blocks at the start of the list, where the full blocks are.
+    // Nothing is allocated from them until the arena is reset.
+    struct arenaBlock *last = from->blocks;
+    if (last != NULL) {
+        while (last->next != NULL)
+            last = last->next;
+        last->next = into->blocks;
+        into->blocks = from->blocks;
+    }
+
+    from->blocks = NULL;
+    from->current = NULL;
+    from->mergedInto = into;
+    from->nextMerged = into->merged;
+    into->merged = from;
+}
+
+// Returns the arena that an allocation belongs to, after any merges, and
+// makes the allocation point to it.
+static struct arena *findArena(struct allocation *allocation) {
+    while (allocation->arena->mergedInto != NULL)
+        allocation->arena = allocation->arena->mergedInto;
+
+    return allocation->arena;
+}
+
+size_t getArenaSize(struct arena *arena) {
+    size_t size = 0;
+    struct arenaBlock *block;
+    for (block = arena->blocks; block != NULL; block = block->next)
+        size += block->size;
+
+    return size;
+}
+
+// Returns size bytes from the arena, adding a new block if none of the
+// remaining blocks have enough room.
+void *allocateFromArena(struct arena *arena, size_t size) {
+    size = alignSize(size);
+
+    // Look for room in the current block and the empty blocks after it.
+    while (arena->current != NULL && arena->current->used + size > arena->current->size) {
+        if (arena->current->next == NULL)
+            break;
+        arena->current = arena->current->next;
+    }
+
+    struct arenaBlock *block = arena->current;
+    if (block == NULL || block->used + size > block->size) {
+        size_t blockSize = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+        block = malloc(alignSize(sizeof (struct arenaBlock)) + blockSize);
+        if (block == NULL)
+            return NULL;
+
+        block->size = blockSize;
+        block->used = 0;
+        block->data = (char*)block + alignSize(sizeof (struct arenaBlock));
+
+        // Add the block after the current one, so the empty blocks after it
+        // are still used later on.
+        if (arena->current == NULL) {
+            block->next = arena->blocks;
+            arena->blocks = block;
+        } else {
+            block->next = arena->current->next;
+            arena->current->next = block;
+        }
+        arena->current = block;
+    }
+
+    void *memory = block->data + block->used;
+    block->used += size;
+
+    return memory;
+}
+
+// Returns true if the given allocation is the last thing allocated from the
+// current block of its arena, which means that it can be resized in place.
+int isLastAllocation(struct allocation *allocation) {
+    struct arenaBlock *block = findArena(allocation)->current;
+
+    return block != NULL
+        && (char*)allocation + HEADER_SIZE + alignSize(allocation->size)
+            == block->data + block->used;
+}
+
+void *allocate(size_t size) {
+    struct allocation *allocation;
+    if (currentArena == NULL)
+        allocation = malloc(HEADER_SIZE + size);
+    else
+        allocation = allocateFromArena(currentArena, HEADER_SIZE + size);
+
+    if (allocation == NULL)
+        return NULL;
+
+    allocation->size = size;
+    allocation->arena = currentArena;
+
+    return (char*)allocation + HEADER_SIZE;
+}
+
+void *reallocate(void *pointer, size_t size) {
+    if (pointer == NULL)
+        return allocate(size);
+
+    struct allocation *allocation = (struct allocation*)((char*)pointer - HEADER_SIZE);
+
+    if (allocation->arena == NULL) {
+        allocation = realloc(allocation, HEADER_SIZE + size);
+        if (allocation == NULL)
+            return NULL;
+
+        allocation->size = size;
+        return (char*)allocation + HEADER_SIZE;
+    }
+
+    // Vectors grow one step at a time, so the vector being grown is often the
+    // last thing allocated and can just be extended.
+    struct arenaBlock *block = findArena(allocation)->current;
+    if (isLastAllocation(allocation)
+            && (char*)pointer + alignSize(size) <= block->data + block->size) {
+        block->used += alignSize(size) - alignSize(allocation->size);
+        allocation->size = size;
+        return pointer;
+    }
+
+    // Otherwise, make a copy in the same arena that the memory came from.
+    struct arena *previousArena = useArena(allocation->arena);
+    void *newPointer = allocate(size);
+    useArena(previousArena);
+
+    if (newPointer == NULL)
+        return NULL;
+
+    memcpy(newPointer, pointer, (size < allocation->size) ? size : allocation->size);
+    deallocate(pointer);
+
+    return newPointer;
+}
+
+void deallocate(void *pointer) {
+    if (pointer == NULL)
+        return;
+
+    struct allocation *allocation = (struct allocation*)((char*)pointer - HEADER_SIZE);
+
+    if (allocation->arena == NULL) {
+        free(allocation);
+    } else if (isLastAllocation(allocation)) {
+        // Give back the memory if nothing was allocated after it. Anything
+        // else is freed when the arena is reset.
+        allocation->arena->current->used -= HEADER_SIZE + alignSize(allocation->size);
+    }
+}
+
+char *copyString(const char *string) {
+    assert(string != NULL);
+
+    size_t length = strlen(string);
+    char *copy = allocate(length + 1);
+    if (copy != NULL)
+        memcpy(copy, string, length + 1);
+
+    return copy;
+}
@@ -0,0 +1,52 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+
+// Memory
+// ======
+// Everything in the compiler allocates memory with these functions instead of
+// malloc, realloc and free. Normally they behave just like malloc and friends,
+// but after calling useArena(arena), everything allocated on the current
+// thread comes from the given arena instead. An arena can then be reset in one
+// step, without having to track down every vector and string that was
+// allocated, and its memory is reused by the next allocations. For example:
+//
+// struct arena *arena = makeArena();
+// struct arena *previousArena = useArena(arena);
+// struct vector *tokens = readPL0Tokens(source);   // Comes from arena.
+// ...
+// useArena(previousArena);
+// resetArena(arena);   // Frees tokens and everything else at once.
+//
+// Memory always has to be freed with deallocate (not free), and it's safe to
+// call deallocate and reallocate on memory from an arena even after switching
+// to a different arena.
+
+struct arena;
+
+struct arena *makeArena();
+// Makes everything allocated on the current thread come from the given arena,
+// or from malloc if arena is NULL. Returns the arena that was used before.
+struct arena *useArena(struct arena *arena);
+// Frees everything allocated from the arena, but keeps its memory around for
+// the next allocations.
+void resetArena(struct arena *arena);
+// Frees the arena and everything allocated from it.
+void freeArena(struct arena *arena);
+// Returns the number of bytes of memory that the arena is holding on to.
+size_t getArenaSize(struct arena *arena);
+// Moves everything allocated from the arena from into the arena into, so that
+// it's reset and freed along with into. from can't be used after this. This is
+// how memory allocated on another thread joins the memory of the thread that
+// it was allocated for, since an arena can only be used by one thread at a
+// time.
+void mergeArena(struct arena *into, struct arena *from);
+
+void *allocate(size_t size);
+void *reallocate(void *pointer, size_t size);
+void deallocate(void *pointer);
+// Like strdup, but allocates the copy with allocate.
+char *copyString(const char *string);
+
+#endif
@@ -1,46 +1,143 @@
 #include "lib/parser.h"
 #include "lib/lexer.h"
 #include "lib/util.h"
+#include "lib/memory.h"
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
 
+// A failure to parse, which is only turned into an error message if the
+// parse fails and the errors are asked for. Most failures are thrown away when
+// the parser backtracks, so recording them has to be cheap: the terminal and
+// variable point into the grammar, and nothing is formatted or copied.
+struct parserFailure {
+    enum { EXPECTED_TERMINAL, TRAILING_TOKENS, UNEXPECTED_TOKEN } kind;
+    char *terminal;    // The terminal that the rule expected.
+    char *variable;    // The variable of the rule.
+    int tokenIndex;
+};
+
+// The furthest failures of the parser, which are global so that the parser
+// can add to them from anywhere (see addParserFailure), and the tokens that
+// they index into. Each thread has its own, so that threads can parse at the
+// same time.
+static __thread struct vector *parserFailures = NULL;
+static __thread int maxTokens = 0;
+static __thread struct vector *parserTokens = NULL;
+
+static void addParserFailure(struct parserFailure failure);
+
+// A parse of a variable at an index, which the parser remembers while it
+// recovers from errors so that it never parses the same variable at the same
+// index twice.
+struct memoizedParse {
+    struct parseTree result;
+    // The errors that it recovered from, and the furthest failures in it that
+    // it didn't recover from, as parserFailure structs.
+    struct vector *recoveredErrors;
+    struct vector *failures;
+};
+
 struct parseTree parse(struct vector *tokens, struct grammar grammar,
         char *startVariable) {
     // The auto keyword is required when declaring nested functions without
     // defining them (http://gcc.gnu.org/onlinedocs/gcc/Nested-Functions.html).
     auto struct parseTree parseVariable(char *variable, int index);
+    auto struct parseTree parseAlternatives(char *variable, int index);
+    auto struct parseTree recoverVariable(char *variable, int index);
     auto struct parseTree parseRule(struct rule rule, int index);
+    auto struct parseTree skipError(int index);
     auto int isVariable(char *string);
 
+    // Whether this is the second parse, which recovers from errors, and the
+    // errors that it has recovered from so far, in order.
+    int recovering = 0;
+    struct vector *recoveredErrors = NULL;
+    // The number of times that "error" has reported the current variable's
+    // failures.
+    int failuresReported = 0;
+    struct memoizedParse **memo = NULL;
+
     clearParserErrors();
+    parserTokens = tokens;
 
     struct parseTree result = parseVariable(startVariable, 0);
 
     // Make sure that we parsed all of the tokens.
     assert(!(result.numTokens > tokens->length));
-    if (result.numTokens != tokens->length) {
-        addParserError(format("Trailing tokens after input, starting at '%s'",
-                get(struct token, tokens, result.numTokens).token), result.numTokens - 1);
+    if (!isParseTreeError(result) && result.numTokens != tokens->length) {
+        addParserFailure((struct parserFailure){TRAILING_TOKENS, NULL, NULL, result.numTokens});
         result.numTokens = -1;
     }
 
+    if (!isParseTreeError(result) || grammar.synchronizingTokens == NULL
+            || grammar.synchronizingTokens->length == 0)
+        return result;
+
+    // Parse the tokens again, skipping over the errors with the "error" rules
+    // so that one parse finds all of them. Programs without errors never get
+    // here, so they parse exactly as if there were no "error" rules.
+    struct vector *firstFailures = parserFailures;
+    int firstMaxTokens = maxTokens;
+    parserFailures = NULL;
+    maxTokens = 0;
+
+    recovering = 1;
+    recoveredErrors = makeVector(struct parserFailure);
+    memo = allocate(grammar.rules->length * (tokens->length + 1) * sizeof (struct memoizedParse *));
+    memset(memo, 0, grammar.rules->length * (tokens->length + 1) * sizeof (struct memoizedParse *));
+
+    struct parseTree recovered = parseVariable(startVariable, 0);
+    if (!isParseTreeError(recovered) && recovered.numTokens != tokens->length)
+        pushLiteral(recoveredErrors, struct parserFailure,
+                {TRAILING_TOKENS, NULL, NULL, recovered.numTokens});
+    deallocate(memo);
+
+    // If even that didn't work, the first error is the only one there is to
+    // report.
+    if (isParseTreeError(recovered) || recoveredErrors->length == 0) {
+        parserFailures = firstFailures;
+        maxTokens = firstMaxTokens;
+    } else {
+        parserFailures = recoveredErrors;
+        maxTokens = get(struct parserFailure, recoveredErrors, recoveredErrors->length - 1).tokenIndex;
+    }
+
     return result;
 
     // Try to parse the given variable starting at the given index in the
     // token list.
     struct parseTree parseVariable(char *variable, int index) {
+        if (recovering)
+            return recoverVariable(variable, index);
+        else
+            return parseAlternatives(variable, index);
+    }
+
+    struct parseTree parseAlternatives(char *variable, int index) {
         // Keep track of failures so that we can return more information if the
         // parser fails to parse the tokens.
         struct vector *errorChildren = makeVector(struct parseTree);
 
         // For each production rule in the grammar.
         forVector(grammar.rules, i, struct rule, rule,
-                // If it's a production rule for the current variable.
-                if (strcmp(rule.variable, variable) == 0) {
+                // If it's a production rule for the current variable. Rules
+                // with "error" in them can't match unless the parser is
+                // recovering from errors.
+                if (strcmp(rule.variable, variable) == 0 && (recovering || !rule.recovers)) {
                     // Try to parse the production rule.
+                    int errorsBefore = 0, reportedBefore = failuresReported;
+                    struct vector *failuresBefore = NULL;
+                    int maxTokensBefore = maxTokens;
+                    if (recovering) {
+                        errorsBefore = recoveredErrors->length;
+                        failuresBefore = makeVector(struct parserFailure);
+                        if (parserFailures != NULL)
+                            vector_concat(failuresBefore, parserFailures);
+                    }
+
                     struct parseTree result = parseRule(rule, index);
 
                     // Return on the first production rule that succeeds.
@@ -48,6 +145,18 @@ struct parseTree parse(struct vector *tokens, struct grammar grammar,
                         return result;
                     else
                         push(errorChildren, result);
+
+                    // The errors that a failed rule recovered from aren't
+                    // errors in the input that parses, so the failures that
+                    // it reported are still left to report.
+                    if (recovering) {
+                        recoveredErrors->length = errorsBefore;
+                        if (failuresReported != reportedBefore) {
+                            parserFailures = failuresBefore;
+                            maxTokens = maxTokensBefore;
+                            failuresReported = reportedBefore;
+                        }
+                    }
                 });
 
         // If none of the rules we found worked, or we didn't find any rules,
@@ -55,10 +164,56 @@ struct parseTree parse(struct vector *tokens, struct grammar grammar,
         return errorTree(variable, errorChildren);
     }
 
+    // Parse the given variable while recovering from errors. Each variable's
+    // failures are collected on their own, so that "error" reports what went
+    // wrong in the variable that it's part of, and then added to the failures
+    // of the variable around it. Parses are remembered along with the errors
+    // they found, which keeps the parse linear in the number of tokens even
+    // though the "error" rules make the parser try more rules.
+    struct parseTree recoverVariable(char *variable, int index) {
+        int variableIndex = 0;
+        while (strcmp(get(struct rule, grammar.rules, variableIndex).variable, variable) != 0)
+            variableIndex++;
+        struct memoizedParse **memoized = &memo[variableIndex * (tokens->length + 1) + index];
+
+        if (*memoized == NULL) {
+            struct vector *outerFailures = parserFailures;
+            int outerMaxTokens = maxTokens, outerReported = failuresReported;
+            parserFailures = NULL;
+            maxTokens = index;
+            failuresReported = 0;
+            int errorsBefore = recoveredErrors->length;
+
+            struct parseTree result = parseAlternatives(variable, index);
+
+            *memoized = allocate(sizeof (struct memoizedParse));
+            **memoized = (struct memoizedParse){result, makeVector(struct parserFailure), parserFailures};
+            int i;
+            for (i = errorsBefore; i < recoveredErrors->length; i++)
+                push((*memoized)->recoveredErrors, get(struct parserFailure, recoveredErrors, i));
+
+            recoveredErrors->length = errorsBefore;
+            parserFailures = outerFailures;
+            maxTokens = outerMaxTokens;
+            failuresReported = outerReported;
+        }
+
+        vector_concat(recoveredErrors, (*memoized)->recoveredErrors);
+        if ((*memoized)->failures != NULL)
+            forVector((*memoized)->failures, i, struct parserFailure, failure,
+                    addParserFailure(failure););
+
+        return (*memoized)->result;
+    }
+
     // Try to parse the given production rule at the f
     struct parseTree parseRule(struct rule rule, int index) {
         int startIndex = index;
+        // Most rules that the parser tries fail, and their children are
+        // never freed, so only make room for the children that the rule can
+        // have.
         struct vector *children = makeVector(struct parseTree);
+        vector_resize(children, rule.production->length);
 
         // For each variable and terminal in the production rule.
         forVector(rule.production, i, char*, varOrTerminal,
@@ -68,6 +223,18 @@ struct parseTree parse(struct vector *tokens, struct grammar grammar,
             if (strcmp(varOrTerminal, "nothing") == 0)
                 continue;
 
+            // Special case for errors, which parseAlternatives only lets
+            // the parser get to while it's recovering.
+            if (strcmp(varOrTerminal, "error") == 0) {
+                struct parseTree skipped = skipError(index);
+                if (isParseTreeError(skipped))
+                    return errorTree(rule.variable, children);
+
+                push(children, skipped);
+                index += skipped.numTokens;
+                continue;
+            }
+
             if (isVariable(varOrTerminal)) {
                 // Try to parse the variable, and if it matches, go to the next
                 // token after all of the tokens that the variable matched. If
@@ -83,10 +250,8 @@ struct parseTree parse(struct vector *tokens, struct grammar grammar,
             } else /* varOrTerminal is a terminal */ {
                 // Return an error if we hit end of input before parsing is done.
                 if (index >= tokens->length) {
-                    addParserError(
-                        format("Expected '%s' but got end of input while parsing %s.",
-                            varOrTerminal, rule.variable),
-                        index);
+                    addParserFailure((struct parserFailure){EXPECTED_TERMINAL,
+                            varOrTerminal, rule.variable, index});
                     return errorTree(rule.variable, children);
                 }
 
@@ -98,19 +263,77 @@ struct parseTree parse(struct vector *tokens, struct grammar grammar,
 
                 // Check if the current token is the same type as the expected token.
                 if (strcmp(currentToken.type, tokenType) == 0) {
-                    pushLiteral(children, struct parseTree, {currentToken.token, NULL, 1});
+                    pushLiteral(children, struct parseTree,
+                            makeParseTree(currentToken.token, NULL, tokens, index, 1));
                     index += 1;
                 } else {
-                    addParserError(
-                        format("Expected '%s' but got '%s' while parsing %s (line %d).",
-                            varOrTerminal, currentToken.token, rule.variable, currentToken.line),
-                        index);
+                    addParserFailure((struct parserFailure){EXPECTED_TERMINAL,
+                            varOrTerminal, rule.variable, index});
                     return errorTree(rule.variable, children);
                 }
             });
 
-        int numTokens = index - startIndex;
-        return (struct parseTree){rule.variable, children, numTokens};
+        return makeParseTree(rule.variable, children, tokens, startIndex, index - startIndex);
+    }
+
+    // Match "error" at the given index: skip up to the next synchronizing
+    // token that isn't nested inside the skipped tokens, and report the
+    // current variable's furthest failures as a recovered error.
+    struct parseTree skipError(int index) {
+        int end = index;
+        int depth = 0;
+        while (end < tokens->length) {
+            char *type = get(struct token, tokens, end).type;
+            int opens = 0, closes = 0, synchronizes = 0;
+            forVector(grammar.nestingTokens, i, struct nestingTokens, nesting,
+                    opens |= strcmp(type, nesting.open) == 0;
+                    closes |= strcmp(type, nesting.close) == 0;);
+            forVector(grammar.synchronizingTokens, i, char*, token,
+                    synchronizes |= strcmp(type, token) == 0;);
+
+            if (depth == 0 && (synchronizes || closes))
+                break;
+            if (opens)
+                depth++;
+            else if (closes)
+                depth--;
+            end++;
+        }
+
+        if (end == index && index < tokens->length)
+            return errorTree("@error", NULL);
+
+        if (parserFailures != NULL && parserFailures->length > 0) {
+            // Backtracking can fail the same way more than once.
+            int reportedStart = recoveredErrors->length;
+            forVector(parserFailures, i, struct parserFailure, failure,
+                    int j;
+                    for (j = reportedStart; j < recoveredErrors->length; j++) {
+                        struct parserFailure reported = get(struct parserFailure, recoveredErrors, j);
+                        if (reported.kind == failure.kind && reported.tokenIndex == failure.tokenIndex
+                                && strcmp(reported.terminal, failure.terminal) == 0
+                                && strcmp(reported.variable, failure.variable) == 0)
+                            break;
+                    }
+                    if (j == recoveredErrors->length)
+                        push(recoveredErrors, failure););
+        } else {
+            pushLiteral(recoveredErrors, struct parserFailure, {UNEXPECTED_TOKEN, NULL, NULL, index});
+        }
+        // Those failures have been reported, so the next error is whatever
+        // goes wrong after the skipped tokens.
+        parserFailures = NULL;
+        maxTokens = end;
+        failuresReported++;
+
+        struct vector *children = makeVector(struct parseTree);
+        int i;
+        for (i = index; i < end; i++) {
+            struct token token = get(struct token, tokens, i);
+            pushLiteral(children, struct parseTree, makeParseTree(token.token, NULL, tokens, i, 1));
+        }
+
+        return makeParseTree("@error", children, tokens, index, end - index);
     }
 
     int isVariable(char *string) {
@@ -122,6 +345,18 @@ struct parseTree parse(struct vector *tokens, struct grammar grammar,
     }
 }
 
+struct parseTree makeParseTree(char *name, struct vector *children, struct vector *tokens,
+        int index, int numTokens) {
+    struct parseTree tree = {name, children, numTokens, 0, 0};
+    if (numTokens > 0) {
+        struct token token = get(struct token, tokens, index);
+        tree.line = (token.line < MAX_TREE_LINE) ? token.line : MAX_TREE_LINE;
+        tree.column = (token.column < MAX_TREE_COLUMN) ? token.column : MAX_TREE_COLUMN;
+    }
+
+    return tree;
+}
+
 struct parseTree errorTree(char *name, struct vector *children) {
     return (struct parseTree){name, children, -1};
 }
@@ -178,8 +413,26 @@ struct parseTree getFirstChild(struct parseTree tree) {
         return errorTree(NULL, NULL);
 }
 
+int equalParseTrees(struct parseTree a, struct parseTree b) {
+    if (a.numTokens != b.numTokens || (a.children == NULL) != (b.children == NULL)
+            || a.line != b.line || a.column != b.column)
+        return 0;
+    if ((a.name == NULL || b.name == NULL) ? a.name != b.name : strcmp(a.name, b.name) != 0)
+        return 0;
+    if (a.children == NULL)
+        return 1;
+    if (a.children->length != b.children->length)
+        return 0;
+
+    forVector(a.children, i, struct parseTree, child,
+            if (!equalParseTrees(child, get(struct parseTree, b.children, i)))
+                return 0;);
+
+    return 1;
+}
+
 void freeParseTree(struct parseTree tree) {
-    free(tree.name);
+    deallocate(tree.name);
 
     if (tree.children != NULL) {
         forVector(tree.children, i, struct parseTree, child,
@@ -190,15 +443,23 @@ void freeParseTree(struct parseTree tree) {
 
 void addRule(struct grammar grammar, char *variable, char *productionString) {
     struct vector *production = splitString(productionString, " ");
-    pushLiteral(grammar.rules, struct rule, {variable, production});
+    int recovers = 0;
+    forVector(production, i, char*, symbol,
+            recovers |= strcmp(symbol, "error") == 0;);
+    pushLiteral(grammar.rules, struct rule, {variable, production, recovers});
+}
+
+void addSynchronizingToken(struct grammar grammar, char *token) {
+    push(grammar.synchronizingTokens, token);
 }
 
-struct vector *parserErrors = NULL;
-int maxTokens = 0;
+void addNestingTokens(struct grammar grammar, char *open, char *close) {
+    pushLiteral(grammar.nestingTokens, struct nestingTokens, {open, close});
+}
 
-void addParserError(char *message, int numTokens) {
-    if (parserErrors == NULL)
-        parserErrors = makeVector(char*);
+static void addParserFailure(struct parserFailure failure) {
+    if (parserFailures == NULL)
+        parserFailures = makeVector(struct parserFailure);
 
     // We only want to keep the "most successful" errors, because otherwise
     // there would be too many errors to be useful. By most successful, I mean
@@ -208,27 +469,77 @@ void addParserError(char *message, int numTokens) {
     // same thing as the last error generated, because the parser may backtrack
     // and try other options before finally giving up). So, we ignore any
     // errors that occurred after parsing a smaller number of tokens.
-    if (numTokens > maxTokens) {
-        clearParserErrors();
-        maxTokens = numTokens;
-        parserErrors = makeVector(char*);
+    if (failure.tokenIndex > maxTokens) {
+        parserFailures->length = 0;
+        maxTokens = failure.tokenIndex;
     }
 
-    if (numTokens == maxTokens)
-        push(parserErrors, message);
+    if (failure.tokenIndex == maxTokens)
+        push(parserFailures, failure);
 }
 
 void clearParserErrors() {
-    parserErrors = NULL;
+    parserFailures = NULL;
     maxTokens = 0;
+    parserTokens = NULL;
+}
+
+void startParserErrors(struct vector *tokens) {
+    clearParserErrors();
+    parserTokens = tokens;
+}
+
+void addExpectedTerminal(char *terminal, char *variable, int tokenIndex) {
+    addParserFailure((struct parserFailure){EXPECTED_TERMINAL, terminal, variable, tokenIndex});
+}
+
+static char *formatParserFailure(struct parserFailure failure) {
+    int atEnd = failure.tokenIndex >= parserTokens->length;
+    struct token token = atEnd ? (struct token){NULL, NULL, 0}
+        : get(struct token, parserTokens, failure.tokenIndex);
+
+    switch (failure.kind) {
+        case EXPECTED_TERMINAL:
+            if (atEnd)
+                return format("Expected '%s' but got end of input while parsing %s.",
+                        failure.terminal, failure.variable);
+            return format("Expected '%s' but got '%s' while parsing %s (line %d).",
+                    failure.terminal, token.token, failure.variable, token.line);
+        case TRAILING_TOKENS:
+            return format("Trailing tokens after input, starting at '%s' (line %d).",
+                    token.token, token.line);
+        default:
+            if (atEnd)
+                return format("Unexpected end of input.");
+            return format("Unexpected '%s' (line %d).", token.token, token.line);
+    }
 }
 
 char *getParserErrors() {
-    if (parserErrors == NULL)
+    struct vector *errors = getParserErrorList();
+    if (errors == NULL)
         return NULL;
-    else {
-        return joinStrings(parserErrors, "\n");
-    }
+
+    struct vector *messages = makeVector(char*);
+    forVector(errors, i, struct parserError, error,
+            push(messages, error.message););
+
+    char *result = joinStrings(messages, "\n");
+    freeVector(messages);
+
+    return result;
+}
+
+struct vector *getParserErrorList() {
+    if (parserFailures == NULL)
+        return NULL;
+
+    struct vector *errors = makeVector(struct parserError);
+    forVector(parserFailures, i, struct parserFailure, failure,
+            pushLiteral(errors, struct parserError,
+                {formatParserFailure(failure), failure.tokenIndex}););
+
+    return errors;
 }
 
 void printParseTree(struct parseTree root) {
@@ -9,11 +9,32 @@ struct parseTree {
     char *name;
     struct vector *children;
     int numTokens;   // The number of tokens that this parse tree represents.
+    // Where the tree's first token is in the source code, or 0 if the tree
+    // has no tokens. These fit in the space after numTokens, so that parse
+    // trees are no bigger with them; lines and columns that don't fit are
+    // MAX_TREE_LINE and MAX_TREE_COLUMN.
+    unsigned int line : 20;
+    unsigned int column : 12;
 };
+#define MAX_TREE_LINE ((1 << 20) - 1)
+#define MAX_TREE_COLUMN ((1 << 12) - 1)
 
 // A grammar holds the production rules of a context-free grammar.
 struct grammar {
     struct vector *rules;
+    // The tokens that the parser skips up to when it recovers from a syntax
+    // error, and the pairs of tokens that it skips over as a whole while it
+    // does (see "error" in addRule). Grammars without any synchronizing tokens
+    // stop at the first error.
+    struct vector *synchronizingTokens;
+    struct vector *nestingTokens;
+};
+
+// A token that opens a nested part of the input, like begin, and the token
+// that closes it, like end.
+struct nestingTokens {
+    char *open;
+    char *close;
 };
 
 struct rule {
@@ -21,10 +42,14 @@ struct rule {
     // variables or terminals.
     char *variable;
     struct vector *production;
+    // Whether the production has "error" in it (see addRule).
+    int recovers;
 };
 
 // Parse the given tokens using the given grammar and start variable,
-// returning a parse tree.
+// returning a parse tree. If the tokens don't parse, and the grammar has
+// synchronizing tokens, they are parsed again with error recovery, so that
+// the parser errors have every syntax error in them instead of only the first.
 struct parseTree parse(struct vector *tokens, struct grammar grammar, char *startVariable);
 
 // Returns a parse tree that indicates an error occurred, with the given error
@@ -33,9 +58,30 @@ struct parseTree errorTree(char *name, struct vector *children);
 // Returns tree if the given tree is a tree that was produced by errorTree().
 int isParseTreeError(struct parseTree tree);
 
-void addParserError(char *message, int currentIndex);
+// A parser error, along with the index of the token that the parser was at
+// when the error happened.
+struct parserError {
+    char *message;
+    int tokenIndex;
+};
+
+// The parser only formats its error messages when these are called, so they
+// have to be called while the tokens from the last parse are still around.
 void clearParserErrors();
 char *getParserErrors();
+// Returns the errors from the last parse as a vector of parserError structs,
+// or NULL if there weren't any errors.
+struct vector *getParserErrorList();
+
+// For other parsers that report their errors the same way as parse() (see
+// lib/earley.h): start the errors for a parse of the given tokens, and record
+// that a rule for variable expected terminal at a token.
+void startParserErrors(struct vector *tokens);
+void addExpectedTerminal(char *terminal, char *variable, int tokenIndex);
+// Returns a parse tree for the numTokens tokens starting at tokens[index],
+// which is at the location of the first one. Tokens have NULL children.
+struct parseTree makeParseTree(char *name, struct vector *children, struct vector *tokens,
+        int index, int numTokens);
 
 // Functions for manipulating parse trees
 // ======================================
@@ -48,6 +94,9 @@ int hasChild(struct parseTree parent, char *childName);
 // Returns a list of all of the children of parent with the given name.
 struct vector *getChildren(struct parseTree parent, char *childName);
 struct parseTree getFirstChild(struct parseTree parent);
+// Returns true if the two parse trees have the same names, shape and
+// locations.
+int equalParseTrees(struct parseTree a, struct parseTree b);
 
 // Recursively print and free a parse tree and all of its children.
 void printParseTree(struct parseTree tree);
@@ -58,6 +107,16 @@ void freeParseTree(struct parseTree tree);
 // Add a production rule to the given grammar. The production rule maps from
 // variable -> productionString, where production string is a space-separated
 // list of other variables and terminals that the variable should produce.
+//
+// The special symbol "error" only matches while the parser recovers from
+// errors. It skips the tokens up to the next synchronizing token, and reports
+// the furthest the variable's other rules got before they failed as an error.
+// It has to skip at least one token, unless it's at the end of the input.
 void addRule(struct grammar grammar, char *variable, char *productionString);
+// Add a token to the tokens that "error" skips up to.
+void addSynchronizingToken(struct grammar grammar, char *token);
+// Make "error" skip over everything from open up to the matching close,
+// including any synchronizing tokens in between.
+void addNestingTokens(struct grammar grammar, char *open, char *close);
 
 #endif
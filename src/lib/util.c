@@ -1,5 +1,6 @@
 #include "lib/util.h"
 #include "lib/vector.h"
+#include "lib/memory.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -8,6 +9,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
+// For makeDirectories:
+#include <sys/stat.h>
 
 char *format(const char *fmt, ...) {
     int n;
@@ -15,7 +18,7 @@ char *format(const char *fmt, ...) {
     char *p, *np;
     va_list ap;
 
-    if ((p = malloc(size)) == NULL)
+    if ((p = allocate(size)) == NULL)
         return NULL;
 
     while (1) {
@@ -40,8 +43,8 @@ char *format(const char *fmt, ...) {
 
         size = n + 1;       /* Precisely what is needed */
 
-        if ((np = realloc (p, size)) == NULL) {
-            free(p);
+        if ((np = reallocate (p, size)) == NULL) {
+            deallocate(p);
             return NULL;
         } else {
             p = np;
@@ -53,7 +56,7 @@ char *format(const char *fmt, ...) {
 struct vector *splitString(char const *constString, char *splitCharacters) {
     // strsep modifies the string you give it, so in order to use splitString
     // one string literals we need to make a mutable copy of the given string.
-    char *string = strdup(constString);
+    char *string = copyString(constString);
     char *originalString = string;
 
     struct vector *result = makeVector(char*);
@@ -70,11 +73,11 @@ struct vector *splitString(char const *constString, char *splitCharacters) {
         // inside the string that you give it, so if we free the original
         // string the substrings will just be pointing to unallocated
         // memory and cause a segfault).
-        substring = strdup(substring);
+        substring = copyString(substring);
         push(result, substring);
     }
 
-    free(originalString);
+    deallocate(originalString);
 
     return result;
 }
@@ -105,35 +108,29 @@ int isInteger(char *string) {
 }
 
 char *joinStrings(struct vector *strings, char *separator) {
-    char *join(struct vector *strings, char *separator) {
-        if (strings->length == 0)
-            return "";
-
-        char *lastString = get(char*, strings, strings->length - 1);
-        if (strings->length == 1)
-            return lastString;
-
-        // Remove the last string from strings.
-        strings->length -= 1;
-        char *firstStrings = joinStrings(strings, separator);
-
-        char *result = format("%s%s%s", firstStrings, separator, lastString);
-
-        free(firstStrings);
-
-        return result;
-    }
-
-    // join modifies the vector given to it, so make a copy so we don't modify
-    // the vector passed to joinStrings.
-    struct vector *copy = vector_copy(strings);
+    // Measure the result first, so that it's copied once.
+    size_t length = 0, separatorLength = strlen(separator);
+    forVector(strings, i, char*, string,
+            length += strlen(string) + ((i > 0) ? separatorLength : 0););
+
+    char *result = allocate(length + 1);
+    char *end = result;
+    forVector(strings, i, char*, string,
+        if (i > 0) {
+            memcpy(end, separator, separatorLength);
+            end += separatorLength;
+        }
+        size_t stringLength = strlen(string);
+        memcpy(end, string, stringLength);
+        end += stringLength;);
+    *end = '\0';
 
-    return join(copy, separator);
+    return result;
 }
 
 char *substring(char *string, int length) {
 
-    char *substr = (char*)malloc(sizeof(char) * (length + 1));
+    char *substr = (char*)allocate(sizeof(char) * (length + 1));
     strncpy(substr, string, length);
     // Add null character.
     substr[length] = '\0';
@@ -156,7 +153,7 @@ char *readContents(char *filename) {
     rewind(file);
 
     // Try to read 'length' characters.
-    char *contents = malloc(sizeof(char)*(length + 1));
+    char *contents = allocate(sizeof(char)*(length + 1));
     int charsRead = fread(contents, sizeof(char), length, file);
     // Add null character.
     contents[charsRead] = '\0';
@@ -172,3 +169,45 @@ char *readContents(char *filename) {
 
 }
 
+
+int makeDirectories(char *path) {
+    assert(path != NULL);
+
+    // Make each parent directory in turn by temporarily cutting the path off
+    // after it.
+    char *copy = copyString(path);
+    char *slash;
+    for (slash = strchr(copy, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(copy, 0777);
+        *slash = '/';
+    }
+
+    int result = (mkdir(copy, 0777) == 0 || errno == EEXIST);
+    deallocate(copy);
+
+    return result;
+}
+
+void writeString(FILE *file, char *string, size_t length) {
+    fprintf(file, "%zu\n", length);
+    fwrite(string, sizeof(char), length, file);
+}
+
+char *readString(FILE *file, size_t *length) {
+    if (fscanf(file, "%zu", length) != 1 || fgetc(file) != '\n')
+        return NULL;
+
+    char *string = allocate(sizeof(char) * (*length + 1));
+    if (string == NULL)
+        return NULL;
+
+    if (fread(string, sizeof(char), *length, file) != *length) {
+        deallocate(string);
+        return NULL;
+    }
+    // Add null character.
+    string[*length] = '\0';
+
+    return string;
+}
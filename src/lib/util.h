@@ -1,6 +1,8 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stdio.h>
+
 // Random utility functions, mostly dealing with strings.
 
 // Wrapper for sprintf that allocates the string for you. Copied from the
@@ -29,4 +31,19 @@ int isInteger(char *string);
 // string, closes the file, and returns the string.
 char *readContents(char *filename);
 
+// Creates the directory with the given path, along with any missing parent
+// directories, like `mkdir -p`. Returns true on success, including when the
+// directory already exists.
+int makeDirectories(char *path);
+
+// Write a string to the given file as its length in decimal, a newline, and
+// then the given number of bytes, so that it can be read back with
+// readString even if it contains newlines or null characters.
+void writeString(FILE *file, char *string, size_t length);
+
+// Read a string written by writeString. Returns a null-terminated string and
+// sets length to its length (not counting the null character), or returns
+// NULL if the file doesn't contain a complete string.
+char *readString(FILE *file, size_t *length);
+
 #endif
@@ -1,4 +1,5 @@
 #include "lib/vector.h"
+#include "lib/memory.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -6,13 +7,13 @@
 struct vector* vector_init(int itemSize) {
     assert(itemSize > 0);
 
-    struct vector *vector = (struct vector*)malloc(sizeof (struct vector));
+    struct vector *vector = (struct vector*)allocate(sizeof (struct vector));
 
     vector->itemSize = itemSize;
     vector->length = 0;
     vector->capacity = INITIAL_CAPACITY;
 
-    vector->items = malloc(itemSize * vector->capacity);
+    vector->items = allocate(itemSize * vector->capacity);
 
     return vector;
 }
@@ -20,12 +21,12 @@ struct vector* vector_init(int itemSize) {
 struct vector* vector_copy(struct vector *vector) {
     assert(vector != NULL);
 
-    struct vector *newVector = (struct vector*)malloc(sizeof (struct vector));
+    struct vector *newVector = (struct vector*)allocate(sizeof (struct vector));
 
     newVector->itemSize = vector->itemSize;
     newVector->length = vector->length;
     newVector->capacity = vector->capacity;
-    newVector->items = malloc(newVector->itemSize * newVector->capacity);
+    newVector->items = allocate(newVector->itemSize * newVector->capacity);
 
     memcpy(newVector->items, vector->items, newVector->itemSize * newVector->capacity);
 
@@ -52,8 +53,11 @@ void vector_set(struct vector *vector, int index, void *item) {
     if (index + 1 > vector->length)
         vector->length = index + 1;
 
+    // Big vectors double, so that growing one costs linear time even when
+    // it can't grow in place (see lib/memory.h).
     if (vector->length > vector->capacity)
-        vector_resize(vector, vector->capacity + CAPACITY_STEP);
+        vector_resize(vector, (vector->capacity < CAPACITY_STEP)
+                ? vector->capacity + CAPACITY_STEP : vector->capacity * 2);
 
     int offset = index * vector->itemSize;
     memcpy((char*)(vector->items) + offset, item, vector->itemSize);
@@ -62,14 +66,14 @@ void vector_set(struct vector *vector, int index, void *item) {
 void vector_resize(struct vector *vector, int newCapacity) {
     assert(vector != NULL);
 
-    // Attempt to realloc vector->items, or just malloc it again if that doesn't work.
-    void *newItems = realloc(vector->items, vector->itemSize * newCapacity);
+    // Attempt to reallocate vector->items, or just allocate it again if that doesn't work.
+    void *newItems = reallocate(vector->items, vector->itemSize * newCapacity);
 
     if (newItems == NULL)
     {
-        newItems = malloc(vector->itemSize * newCapacity);
+        newItems = allocate(vector->itemSize * newCapacity);
         memcpy(newItems, vector->items, vector->itemSize * vector->capacity);
-        free(vector->items);
+        deallocate(vector->items);
     }
 
     vector->items = newItems;
@@ -108,7 +112,7 @@ int vector_find(struct vector *vector, void *value) {
 }
 
 void vector_free(struct vector *vector) {
-    free(vector->items);
-    free(vector);
+    deallocate(vector->items);
+    deallocate(vector);
 }
 
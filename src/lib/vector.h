@@ -57,7 +57,8 @@ struct vector
 
 // Number of spaces to initialize when calling vector_init.
 #define INITIAL_CAPACITY 20
-// Number of spaces to add when capacity is exceeded.
+// Number of spaces to add when the capacity of a small vector is exceeded.
+// Vectors with at least this many spaces double their capacity instead.
 #define CAPACITY_STEP 20
 
 // Macros
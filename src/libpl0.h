@@ -0,0 +1,84 @@
+#ifndef LIBPL0_H
+#define LIBPL0_H
+
+#include <stddef.h>
+
+// libpl0
+// ======
+// The PL/0 compiler as a library, for programs that compile many PL/0 programs
+// without starting a compiler for each one. Build it with `make libpl0.a` or
+// `make libpl0.so`. For example:
+//
+// struct pl0_context *context = pl0_create_context();
+// struct pl0_output output;
+// size_t i;
+// if (pl0_compile(context, source, strlen(source), &output) == PL0_OK) {
+//     for (i = 0; i < output.instruction_count; i++)
+//         printf("%d %d %d\n", output.instructions[i].opcode,
+//                 output.instructions[i].level, output.instructions[i].modifier);
+// } else {
+//     for (i = 0; i < output.diagnostic_count; i++)
+//         printf("line %d: %s\n", output.diagnostics[i].line,
+//                 output.diagnostics[i].message);
+// }
+// pl0_free_context(context);
+//
+// Everything that a compilation allocates belongs to its context, and is
+// reused by the context's next compilation, so compiling any number of
+// programs with one context doesn't leak memory. Threads can compile at the
+// same time as long as each uses its own context; the library does its own
+// locking around the parts of the compiler that are shared between threads.
+
+#if defined(__GNUC__)
+#define PL0_API __attribute__((visibility("default")))
+#else
+#define PL0_API
+#endif
+
+// The results of pl0_compile. These are the same as the compiler's exit codes.
+enum pl0_status {
+    PL0_OK = 0,
+    PL0_PARSER_ERROR = 4,
+    PL0_GENERATOR_ERROR = 5
+};
+
+// The part of the compiler that found a problem.
+enum pl0_phase {
+    PL0_PHASE_PARSER = 1,
+    PL0_PHASE_GENERATOR
+};
+
+struct pl0_diagnostic {
+    enum pl0_phase phase;
+    int line;              // The source line, or 0 if it isn't known.
+    int column;            // The column on that line, or 0 if it isn't known.
+    const char *message;
+};
+
+// An instruction for the PL/0 virtual machine, as printed by `compiler`.
+struct pl0_instruction {
+    int opcode;
+    int level;
+    int modifier;
+};
+
+// The results of a compilation. The arrays belong to the context, and stay
+// valid until the next call to pl0_compile or pl0_free_context with it.
+struct pl0_output {
+    const struct pl0_instruction *instructions;
+    size_t instruction_count;     // 0 if there were any errors.
+    const struct pl0_diagnostic *diagnostics;
+    size_t diagnostic_count;
+};
+
+struct pl0_context;
+
+PL0_API struct pl0_context *pl0_create_context(void);
+PL0_API void pl0_free_context(struct pl0_context *context);
+
+// Compiles length bytes of PL/0 source code, which doesn't need to be
+// null-terminated, and fills in output. Returns a pl0_status.
+PL0_API int pl0_compile(struct pl0_context *context, const char *source, size_t length,
+        struct pl0_output *output);
+
+#endif
@@ -0,0 +1,262 @@
+#include "pl0.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <stdio.h>
+#include <string.h>
+
+// C backend
+// =========
+// Translates stack code to a C program that does the same thing as running
+// it in the VM, so that a C compiler can turn it into native code. Each
+// instruction becomes a few statements on a global stack, with a label in
+// front of it if something jumps to it. The stack, the frame layout that cal
+// builds (function value, static link, dynamic link, return address) and the
+// error messages are the same as in src/vm/vm.c.
+//
+// Return addresses are still instruction addresses on the stack, so opr 0 0
+// jumps through a switch over the instructions that follow a cal. The
+// generated code only checks sp at cal, inc and backward jumps, like the JIT
+// in src/vm/jit.c; the stack has room above and below it for whatever
+// straight-line code between those checks can push or pop.
+
+// The number of values on the stack, which is the same as VM_STACK_SIZE.
+#define C_STACK_SIZE (1 << 20)
+// The largest offset from bp that a variable in the current frame can have
+// before its address is checked.
+#define C_MAX_OFFSET 4096
+
+// Where a label is needed in front of an instruction.
+enum { JUMP_TARGET = 1, RETURN_TARGET = 2 };
+
+static int isValidAddress(int address, int length) {
+    return address >= 0 && address <= length;
+}
+
+// Prints the statements for opr with the given modifier, other than opr 0 0.
+static void printOperator(int modifier, int address) {
+    char *relation = NULL;
+    char *arithmetic = NULL;
+
+    switch (modifier) {
+        case OPR_NEG:
+            printf("    stack[sp] = (int)-(unsigned)stack[sp];\n");
+            return;
+        case OPR_ODD:
+            printf("    stack[sp] = stack[sp] %% 2 != 0;\n");
+            return;
+        case OPR_ADD: arithmetic = "+"; break;
+        case OPR_SUB: arithmetic = "-"; break;
+        case OPR_MUL: arithmetic = "*"; break;
+        case OPR_DIV:
+        case OPR_MOD:
+            printf("    sp -= 1;\n");
+            printf("    if (stack[sp + 1] == 0)\n");
+            printf("        fail(%d, \"division by zero\");\n", address);
+            printf("    stack[sp] = stack[sp] %s stack[sp + 1];\n",
+                    (modifier == OPR_DIV) ? "/" : "%");
+            return;
+        case OPR_EQL: relation = "=="; break;
+        case OPR_NEQ: relation = "!="; break;
+        case OPR_LSS: relation = "<"; break;
+        case OPR_LEQ: relation = "<="; break;
+        case OPR_GTR: relation = ">"; break;
+        case OPR_GEQ: relation = ">="; break;
+        default:
+            printf("    fail(%d, \"invalid operator\");\n", address);
+            return;
+    }
+
+    printf("    sp -= 1;\n");
+    // Overflow wraps around in the VM, but is undefined in C, so do the
+    // arithmetic on unsigned values.
+    if (arithmetic != NULL)
+        printf("    stack[sp] = (int)((unsigned)stack[sp] %s (unsigned)stack[sp + 1]);\n",
+                arithmetic);
+    else
+        printf("    stack[sp] = stack[sp] %s stack[sp + 1];\n", relation);
+}
+
+// Prints an expression for the address of the variable at the given level and
+// offset.
+static void printVariable(int level, int offset, int address) {
+    if (level == 0 && offset >= 0 && offset <= C_MAX_OFFSET)
+        printf("bp + %d", offset);
+    else
+        printf("variable(bp, %d, %d, %d)", level, offset, address);
+}
+
+// Prints a jump to the given address from the instruction at from.
+static void printJump(int target, int from, int length) {
+    if (!isValidAddress(target, length))
+        printf("fail(%d, \"jump out of the program\");\n", from);
+    else if (target <= from)
+        printf("{ checkStack(sp, %d); goto L%d; }\n", from, target);
+    else
+        printf("goto L%d;\n", target);
+}
+
+void printCProgram(struct vector *instructions) {
+    int length = instructions->length;
+    int hasReturn = 0;
+
+    char *labels = allocate(length + 1);
+    memset(labels, 0, length + 1);
+    forVector(instructions, i, struct instruction, instruction,
+            if (hasCodeAddress(instruction.opcode)
+                    && isValidAddress(instruction.modifier, length))
+                labels[instruction.modifier] |= JUMP_TARGET;
+            if (instruction.opcode == OP_OPR && instruction.modifier == OPR_RET)
+                hasReturn = 1;);
+    // Only opr 0 0 jumps to return targets, and unused labels are warnings.
+    if (hasReturn)
+        forVector(instructions, i, struct instruction, instruction,
+                if (instruction.opcode == OP_CAL)
+                    labels[i + 1] |= RETURN_TARGET;);
+
+    // Room around the stack for what straight-line code can push or pop, and
+    // for variables at small offsets from bp, which aren't checked.
+    int margin = 2 * length + C_MAX_OFFSET + 16;
+
+    printf("// Generated by the PL/0 compiler. Build it with a C compiler, e.g.\n");
+    printf("// gcc -O2 -o program program.c\n");
+    printf("#include <stdio.h>\n");
+    printf("#include <stdlib.h>\n");
+    printf("\n");
+    printf("#define STACK_SIZE %d\n", C_STACK_SIZE);
+    printf("#define MARGIN %d\n", margin);
+    printf("\n");
+    printf("// The stack starts at 1, like in the VM.\n");
+    printf("static int memory[MARGIN + STACK_SIZE + MARGIN];\n");
+    printf("#define stack (memory + MARGIN)\n");
+    printf("\n");
+    printf("static void fail(int address, const char *error) {\n");
+    printf("    fflush(stdout);\n");
+    printf("    fprintf(stderr, \"Error at instruction %%d: %%s.\\n\", address, error);\n");
+    printf("    exit(1);\n");
+    printf("}\n");
+    printf("\n");
+    printf("static inline void checkStack(int sp, int address) {\n");
+    printf("    if (sp < 0 || sp > STACK_SIZE)\n");
+    printf("        fail(address, (sp < 0) ? \"stack underflow\" : \"stack overflow\");\n");
+    printf("}\n");
+    printf("\n");
+    printf("// The base of the frame the given number of levels down.\n");
+    printf("static inline int base(int bp, int level) {\n");
+    printf("    while (level-- > 0 && bp >= 1 && bp < STACK_SIZE)\n");
+    printf("        bp = stack[bp + 1];\n");
+    printf("    return bp;\n");
+    printf("}\n");
+    printf("\n");
+    printf("static inline int variable(int bp, int level, int offset, int address) {\n");
+    printf("    int variable = base(bp, level) + offset;\n");
+    printf("    if (variable < 1 || variable > STACK_SIZE)\n");
+    printf("        fail(address, \"variable address out of range\");\n");
+    printf("    return variable;\n");
+    printf("}\n");
+    printf("\n");
+    printf("int main(void) {\n");
+    printf("    int sp = 0, bp = 1;\n");
+    if (hasReturn)
+        printf("    int returnAddress = 0, address = 0;\n");
+    printf("\n");
+
+    forVector(instructions, i, struct instruction, instruction,
+        int level = instruction.lexicalLevel;
+        int modifier = instruction.modifier;
+
+        if (labels[i])
+            printf("L%d:\n", i);
+        printf("    // %d %s %d %d\n", i, instruction.opcodeName, level, modifier);
+
+        switch (instruction.opcode) {
+            case OP_LIT:
+                printf("    stack[++sp] = %d;\n", modifier);
+                break;
+            case OP_OPR:
+                if (modifier == OPR_RET) {
+                    printf("    sp = bp - 1;\n");
+                    printf("    returnAddress = stack[sp + 4];\n");
+                    printf("    bp = stack[sp + 3];\n");
+                    printf("    if (bp == 0)\n");
+                    printf("        return 0;\n");
+                    printf("    address = %d;\n", i);
+                    printf("    goto ret;\n");
+                } else {
+                    printOperator(modifier, i);
+                }
+                break;
+            case OP_LOD:
+                printf("    stack[sp + 1] = stack[");
+                printVariable(level, modifier, i);
+                printf("];\n");
+                printf("    sp += 1;\n");
+                break;
+            case OP_STO:
+                printf("    stack[");
+                printVariable(level, modifier, i);
+                printf("] = stack[sp];\n");
+                printf("    sp -= 1;\n");
+                break;
+            case OP_CAL:
+                printf("    checkStack(sp, %d);\n", i);
+                printf("    stack[sp + 1] = 0;\n");
+                printf("    stack[sp + 2] = base(bp, %d);\n", level);
+                printf("    stack[sp + 3] = bp;\n");
+                printf("    stack[sp + 4] = %d;\n", i + 1);
+                printf("    bp = sp + 1;\n");
+                printf("    ");
+                printJump(modifier, i, length);
+                break;
+            case OP_INC:
+                printf("    sp += %d;\n", modifier);
+                printf("    checkStack(sp, %d);\n", i);
+                break;
+            case OP_JMP:
+                printf("    ");
+                printJump(modifier, i, length);
+                break;
+            case OP_JPC:
+                printf("    if (stack[sp--] == 0)\n");
+                printf("        ");
+                printJump(modifier, i, length);
+                break;
+            case OP_WRITE:
+                printf("    printf(\"Output: %%d\\n\", stack[sp]);\n");
+                printf("    sp -= 1;\n");
+                break;
+            case OP_READ:
+                printf("    printf(\"Input: \");\n");
+                printf("    fflush(stdout);\n");
+                printf("    sp += 1;\n");
+                printf("    if (scanf(\"%%d\", &stack[sp]) != 1)\n");
+                printf("        fail(%d, \"couldn't read input\");\n", i);
+                break;
+            default:
+                // Superinstructions aren't translated; the C compiler does
+                // better with the instructions they replace.
+                printf("    fail(%d, \"invalid instruction\");\n", i);
+                break;
+        });
+
+    // Running past the last instruction, or jumping to the address after it.
+    if (labels[length])
+        printf("L%d:\n", length);
+    printf("    fail(%d, \"jump out of the program\");\n", length);
+
+    if (hasReturn) {
+        printf("\n");
+        printf("ret:\n");
+        printf("    switch (returnAddress) {\n");
+        int i;
+        for (i = 0; i <= length; i++)
+            if (labels[i] & RETURN_TARGET)
+                printf("        case %d: goto L%d;\n", i, i);
+        printf("        default: fail(address, \"return to an invalid address\");\n");
+        printf("    }\n");
+    }
+
+    printf("    return 1;\n");
+    printf("}\n");
+
+    deallocate(labels);
+}
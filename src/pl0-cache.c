@@ -0,0 +1,354 @@
+#include "pl0.h"
+#include "lib/vector.h"
+#include "lib/util.h"
+#include "lib/hash.h"
+#include "lib/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// Cached blocks are stored as text files, one per key, that look like:
+//
+// pl0-procedure 2
+// 3
+// 6 0 4 0 0 1
+// 7 0 2 1 0 1
+// 5 1 9 2 2 9 fact
+//
+// The first line identifies the format and its version, the second line is the
+// number of instructions, and each of the following lines holds an opcode,
+// lexical level, modifier, relocation type (see pl0.h), line and column,
+// followed by the procedure name for RELOCATE_SYMBOL instructions. The lines
+// are relative to the procedure's first line (see loadProcedureFromCache).
+#define PROCEDURE_CACHE_HEADER "pl0-procedure 2"
+
+// The longest procedure name that the cache will store.
+#define MAX_SYMBOL_LENGTH 255
+
+char *getCachePath(char *directory, uint64_t key, char *extension) {
+    return format("%s/%016llx.%s", directory, (unsigned long long)key, extension);
+}
+
+struct vector *loadCachedProcedure(char *directory, uint64_t key) {
+    char *path = getCachePath(directory, key, "proc");
+    FILE *file = fopen(path, "r");
+    deallocate(path);
+
+    if (file == NULL)
+        return NULL;
+
+    struct vector *cachedInstructions = makeVector(struct cachedInstruction);
+
+    char header[sizeof PROCEDURE_CACHE_HEADER + 1];
+    int count;
+    int valid = (fgets(header, sizeof header, file) != NULL
+            && strncmp(header, PROCEDURE_CACHE_HEADER, strlen(PROCEDURE_CACHE_HEADER)) == 0
+            && fscanf(file, "%d", &count) == 1 && count >= 0);
+
+    int i;
+    for (i = 0; valid && i < count; i++) {
+        struct cachedInstruction cached = {{0, NULL, 0, 0}, RELOCATE_NONE, NULL};
+        struct instruction *instruction = &cached.instruction;
+
+        if (fscanf(file, "%d %d %d %d %d %d", &instruction->opcode, &instruction->lexicalLevel,
+                    &instruction->modifier, &cached.relocation, &instruction->line,
+                    &instruction->column) != 6) {
+            valid = 0;
+            break;
+        }
+
+        instruction->opcodeName = getOpcodeName(instruction->opcode);
+        if (instruction->opcodeName == NULL)
+            valid = 0;
+
+        if (cached.relocation == RELOCATE_SYMBOL) {
+            char symbol[MAX_SYMBOL_LENGTH + 1];
+            if (fscanf(file, "%255s", symbol) == 1)
+                cached.symbol = copyString(symbol);
+            else
+                valid = 0;
+        } else if (cached.relocation != RELOCATE_NONE && cached.relocation != RELOCATE_BLOCK) {
+            valid = 0;
+        }
+
+        push(cachedInstructions, cached);
+    }
+
+    fclose(file);
+
+    // Treat damaged cache files as if they weren't there; they will be
+    // replaced the next time the procedure is stored.
+    if (!valid) {
+        freeVector(cachedInstructions);
+        return NULL;
+    }
+
+    return cachedInstructions;
+}
+
+void storeCachedProcedure(char *directory, uint64_t key, struct vector *cachedInstructions) {
+    if (!makeDirectories(directory))
+        return;
+
+    // Write to a temporary file first and then rename it, so that other
+    // compilers using the same cache never see a partially written file. The
+    // generator's threads can store the same procedure at the same time, so
+    // each thread has its own.
+    char *path = getCachePath(directory, key, "proc");
+    char *temporaryPath = format("%s.%d.%lx.tmp", path, (int)getpid(),
+            (unsigned long)pthread_self());
+
+    FILE *file = fopen(temporaryPath, "w");
+    if (file != NULL) {
+        fprintf(file, "%s\n%d\n", PROCEDURE_CACHE_HEADER, cachedInstructions->length);
+        forVector(cachedInstructions, i, struct cachedInstruction, cached,
+            struct instruction instruction = cached.instruction;
+            fprintf(file, "%d %d %d %d %d %d", instruction.opcode, instruction.lexicalLevel,
+                    instruction.modifier, cached.relocation, instruction.line, instruction.column);
+            if (cached.relocation == RELOCATE_SYMBOL)
+                fprintf(file, " %s", cached.symbol);
+            fprintf(file, "\n"););
+
+        if (fclose(file) == 0)
+            rename(temporaryPath, path);
+        else
+            unlink(temporaryPath);
+    }
+
+    deallocate(temporaryPath);
+    deallocate(path);
+}
+
+// Program cache
+// =============
+// Programs are stored in the same way as procedures, but without relocation
+// types, and with the lines as they are:
+//
+// pl0-program 2
+// 2
+// 6 0 4 1 1
+// 2 0 0 1 1
+//
+// Every file is written under a temporary name and then renamed, so readers
+// never need to lock anything. Eviction and the lookup counters are protected
+// by an flock() on the "lock" file in the cache directory, so that many
+// compilers can share the same cache.
+#define PROGRAM_CACHE_HEADER "pl0-program 2"
+
+uint64_t hashProgram(char *sourceCode, struct generatorOptions options) {
+    uint64_t hash = hashString(HASH_SEED, PROGRAM_CACHE_HEADER);
+    hash = hashString(hash, PL0_COMPILER_VERSION);
+    hash = hashGeneratorOptions(hash, options);
+
+    return hashString(hash, sourceCode);
+}
+
+struct vector *loadCachedProgram(char *directory, uint64_t key) {
+    char *path = getCachePath(directory, key, "prog");
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        deallocate(path);
+        return NULL;
+    }
+
+    struct vector *instructions = makeVector(struct instruction);
+
+    char header[sizeof PROGRAM_CACHE_HEADER + 1];
+    int count;
+    int valid = (fgets(header, sizeof header, file) != NULL
+            && strncmp(header, PROGRAM_CACHE_HEADER, strlen(PROGRAM_CACHE_HEADER)) == 0
+            && fscanf(file, "%d", &count) == 1 && count >= 0);
+
+    int i;
+    for (i = 0; valid && i < count; i++) {
+        struct instruction instruction;
+        if (fscanf(file, "%d %d %d %d %d", &instruction.opcode, &instruction.lexicalLevel,
+                    &instruction.modifier, &instruction.line, &instruction.column) != 5) {
+            valid = 0;
+            break;
+        }
+
+        instruction.opcodeName = getOpcodeName(instruction.opcode);
+        if (instruction.opcodeName == NULL)
+            valid = 0;
+
+        push(instructions, instruction);
+    }
+
+    fclose(file);
+
+    if (valid) {
+        // Mark the program as recently used by updating its modification time,
+        // which is what eviction sorts by.
+        utimensat(AT_FDCWD, path, NULL, 0);
+    } else {
+        freeVector(instructions);
+        instructions = NULL;
+    }
+
+    deallocate(path);
+
+    return instructions;
+}
+
+// Opens and locks the lock file of the given cache directory. Returns the file
+// descriptor to pass to unlockCache, or -1 if the cache can't be locked.
+int lockCache(char *directory) {
+    char *path = format("%s/lock", directory);
+    int lock = open(path, O_RDWR | O_CREAT, 0666);
+    deallocate(path);
+
+    if (lock >= 0 && flock(lock, LOCK_EX) != 0) {
+        close(lock);
+        lock = -1;
+    }
+
+    return lock;
+}
+
+void unlockCache(int lock) {
+    // Closing the file releases the lock.
+    if (lock >= 0)
+        close(lock);
+}
+
+struct cachedFile {
+    char *path;
+    long long size;
+    struct timespec lastUsed;
+};
+
+// Removes the least recently used programs from the cache until it's no bigger
+// than maxSize bytes. The cache must be locked.
+void evictCachedPrograms(char *directory, long long maxSize) {
+    DIR *dir = opendir(directory);
+    if (dir == NULL)
+        return;
+
+    struct vector *files = makeVector(struct cachedFile);
+    long long totalSize = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char *extension = strrchr(entry->d_name, '.');
+        if (extension == NULL || strcmp(extension, ".prog") != 0)
+            continue;
+
+        char *path = format("%s/%s", directory, entry->d_name);
+        struct stat status;
+        if (stat(path, &status) != 0) {
+            deallocate(path);
+            continue;
+        }
+
+        pushLiteral(files, struct cachedFile, {path, status.st_size, status.st_mtim});
+        totalSize += status.st_size;
+    }
+
+    closedir(dir);
+
+    int isOlder(struct cachedFile *a, struct cachedFile *b) {
+        if (a->lastUsed.tv_sec != b->lastUsed.tv_sec)
+            return a->lastUsed.tv_sec < b->lastUsed.tv_sec;
+        return a->lastUsed.tv_nsec < b->lastUsed.tv_nsec;
+    }
+
+    // Repeatedly remove the oldest file. Eviction usually only removes a file
+    // or two, so this is cheaper than sorting all of them.
+    while (totalSize > maxSize && files->length > 0) {
+        int oldest = 0;
+        forVectorPointers(files, i, struct cachedFile, file,
+                if (isOlder(file, (struct cachedFile*)vector_get(files, oldest)))
+                    oldest = i;);
+
+        struct cachedFile file = get(struct cachedFile, files, oldest);
+        unlink(file.path);
+        totalSize -= file.size;
+        deallocate(file.path);
+
+        // Move the last file into the removed file's place.
+        struct cachedFile last = get(struct cachedFile, files, files->length - 1);
+        set(files, oldest, last);
+        files->length -= 1;
+    }
+
+    forVector(files, i, struct cachedFile, file,
+            deallocate(file.path););
+    freeVector(files);
+}
+
+void storeCachedProgram(char *directory, uint64_t key, struct vector *instructions,
+        long long maxSize) {
+    if (!makeDirectories(directory))
+        return;
+
+    char *path = getCachePath(directory, key, "prog");
+    char *temporaryPath = format("%s.%d.tmp", path, (int)getpid());
+
+    FILE *file = fopen(temporaryPath, "w");
+    if (file != NULL) {
+        fprintf(file, "%s\n%d\n", PROGRAM_CACHE_HEADER, instructions->length);
+        forVector(instructions, i, struct instruction, instruction,
+            fprintf(file, "%d %d %d %d %d\n", instruction.opcode, instruction.lexicalLevel,
+                    instruction.modifier, instruction.line, instruction.column););
+
+        if (fclose(file) == 0)
+            rename(temporaryPath, path);
+        else
+            unlink(temporaryPath);
+    }
+
+    deallocate(temporaryPath);
+    deallocate(path);
+
+    int lock = lockCache(directory);
+    if (lock >= 0) {
+        evictCachedPrograms(directory, maxSize);
+        unlockCache(lock);
+    }
+}
+
+struct programCacheCounters countProgramCacheLookup(char *directory, int hit) {
+    struct programCacheCounters counters = {0, 0};
+
+    if (!makeDirectories(directory))
+        return counters;
+
+    int lock = lockCache(directory);
+    if (lock < 0)
+        return counters;
+
+    char *path = format("%s/counters", directory);
+
+    FILE *file = fopen(path, "r");
+    if (file != NULL) {
+        if (fscanf(file, "%lld %lld", &counters.hits, &counters.misses) != 2)
+            counters = (struct programCacheCounters){0, 0};
+        fclose(file);
+    }
+
+    if (hit)
+        counters.hits += 1;
+    else
+        counters.misses += 1;
+
+    // Nobody reads the counters without holding the lock, so they can be
+    // rewritten in place.
+    file = fopen(path, "w");
+    if (file != NULL) {
+        fprintf(file, "%lld %lld\n", counters.hits, counters.misses);
+        fclose(file);
+    }
+
+    deallocate(path);
+    unlockCache(lock);
+
+    return counters;
+}
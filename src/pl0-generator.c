@@ -1,10 +1,13 @@
 #include "pl0.h"
 #include "lib/parser.h"
 #include "lib/util.h"
+#include "lib/hash.h"
+#include "lib/memory.h"
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
 
 // The number of memory locations in the stack frame that the CAL instruction
 // creates.
@@ -20,6 +23,10 @@ struct symbol {
     int address;   // The address of the symbol on the stack, in it's lexical
                    // level, or the address in the code if it's a procedure.
     int constantValue;     // If it's a constant, holds the value of the constant.
+    // If it's a procedure that was generated with loop optimizations, holds
+    // the variables declared outside of it that calling it can change, as
+    // symbols. NULL if they aren't known.
+    struct vector *modifiedVariables;
 };
 // Symbol types
 enum { VARIABLE = 1, CONSTANT, PROCEDURE };
@@ -29,13 +36,38 @@ struct generatorState {
     struct vector *symbols;   // The symbol table.
     //int currentAddress;   // The current code address.
     int currentLevel;     // The current lexical level.
+    int frameSize;        // The size of the current block's stack frame.
+    int statementStart;   // The address of the current block's statement.
     struct vector *instructions;   // The instructions that have been generated so far.
     struct generatorState *parentState;
+    // Loop-invariant expressions that were computed before the loops that
+    // are being generated, as hoistedExpression structs.
+    struct vector *hoistedExpressions;
+    int temporaryStart;   // The address of the first slot for their values.
+    int temporaries;      // The number of slots in use.
+    int maxTemporaries;   // The number of slots in the frame.
+};
+
+// An expression that is computed once before a loop instead of every time the
+// loop uses it.
+struct hoistedExpression {
+    struct vector *children;   // The children of the expression's parse tree,
+                               // which identify it.
+    int address;               // The slot in the frame that holds its value.
 };
 
 // Error fucntions.
 void addGeneratorError(char *errorMessage);
-void clearGeneratorErrors();
+static void pushGeneratorError(struct generatorError error);
+int countGeneratorErrors();
+// Each thread that generates procedures has its own errors.
+extern __thread struct vector *generatorErrors;
+
+// The options passed to generatePL0WithOptions, and the statistics returned by
+// getGeneratorStatistics. Each thread that generates procedures has its own
+// (see generateProceduresInParallel).
+static __thread struct generatorOptions options;
+static __thread struct generatorStatistics statistics;
 
 // Functions used by generatorInstructions.
 // ========================================
@@ -51,6 +83,7 @@ void generate_constant(struct parseTree tree, struct generatorState *state);
 void generate_procedureDeclaration(struct parseTree tree, struct generatorState *state);
 void generate_procedures(struct parseTree tree, struct generatorState *state);
 void generate_procedure(struct parseTree tree, struct generatorState *state);
+void generateProcedureBody(struct parseTree tree, struct generatorState *state, int symbolIndex);
 void generate_statement(struct parseTree tree, struct generatorState *state);
 void generate_statements(struct parseTree tree, struct generatorState *state);
 void generate_beginBlock(struct parseTree tree, struct generatorState *state);
@@ -82,33 +115,184 @@ void addConstant(struct generatorState *state, struct parseTree identifierTree,
         struct parseTree numberTree);
 void addProcedure(struct generatorState *state, struct parseTree identifierTree, int address);
 struct symbol getSymbol(struct generatorState *state, char *name);
+struct symbol getSymbolOrImport(struct generatorState *state, char *name, int type);
+int lookupSymbol(struct generatorState *state, char *name, struct symbol *result);
+
+// The symbols in an object that pl0ld relocates, or NULL if the generator
+// isn't generating an object (see generatePL0Object): the variables declared
+// at the top level, which can move in the main program's frame, and the
+// procedures, variables and constants that are used without being declared,
+// which are imported. Imported symbols have the address -1, and the rest
+// have their address in the frame. Each one's symbol in the symbol table has
+// OBJECT_SYMBOL of its index as its address until the object is generated.
+// The instructions that use symbols never have modifiers below -1 otherwise:
+// -1 is the address of jumps that haven't been filled in yet.
+static __thread struct vector *objectSymbols = NULL;
+#define OBJECT_SYMBOL(index) (-2 - (index))
+
+static int usesObjectSymbol(struct instruction instruction) {
+    int opcode = instruction.opcode;
+    return instruction.modifier <= OBJECT_SYMBOL(0)
+        && (opcode == OP_CAL || opcode == OP_CAL_DISPLAY || opcode == OP_JMP
+            || opcode == OP_LOD || opcode == OP_STO
+            || opcode == OP_LOD_DISPLAY || opcode == OP_STO_DISPLAY);
+}
+
+// Functions for reusing procedures from the procedure cache.
+// ===========================================================
+uint64_t hashProcedure(struct parseTree tree, struct generatorState *state);
+int loadProcedureFromCache(uint64_t key, struct generatorState *state, int line);
+void saveProcedureToCache(uint64_t key, struct generatorState *state, int start, int line);
+
+// Functions for loop optimizations.
+// ==================================
+int findModifiedVariables(struct parseTree tree, struct generatorState *state,
+        struct vector *modifiedVariables);
+void hoistInvariantExpressions(struct parseTree loop, struct generatorState *state);
+int loadHoistedExpression(struct parseTree tree, struct generatorState *state);
+
+// Functions for generating procedures in parallel.
+// =================================================
+int generateProceduresInParallel(struct parseTree tree, struct generatorState *state);
+
+// Functions for tail calls.
+// =========================
+void convertTailCalls(struct generatorState *state, char *procedureName);
+char *getToken(struct parseTree parent);
 
 // Functions used by addInstruction.
 // Utility function to initialize a struct instruction.
 struct instruction makeInstruction(char *instruction, int lexicalLevel, int modifier);
-// Given a string represtation of an instruction, such as "lit" or "sto",
-// return the corresponding integer opcode.
-int getOpcode(char *instruction);
+
+// The location of the innermost part of the parse tree with tokens that the
+// generator is generating, which makeInstruction gives to the instructions.
+static __thread int currentLine = 0, currentColumn = 0;
 
 // Implementation
 // ===========================================================
 struct vector *generatePL0(struct parseTree tree) {
+    struct generatorOptions defaultOptions = {NULL};
+
+    return generatePL0WithOptions(tree, defaultOptions);
+}
+
+struct vector *generatePL0WithOptions(struct parseTree tree, struct generatorOptions generatorOptions) {
     clearGeneratorErrors();
+    options = generatorOptions;
+    clearGeneratorStatistics();
+
+    // What loop optimizations do in a procedure depends on what the
+    // procedures it calls change, which isn't part of the procedure cache's
+    // key, so procedures aren't cached or reused with them.
+    if (options.loops)
+        options.procedureCacheDirectory = NULL;
 
     struct generatorState *state = makeGeneratorState();
     generate(tree, state);
-    return state->instructions;
+
+    struct vector *instructions = state->instructions;
+    if (countGeneratorErrors() > 0)
+        return instructions;
+
+    // The generator has already checked the program for errors, so the
+    // optimizer's code replaces its code.
+    if (options.optimize)
+        instructions = optimizePL0(tree, options, &statistics);
+
+    // Inlining a procedure's own procedures can make it small enough to be
+    // inlined too, so repeat until nothing more is inlined.
+    if (options.inlining) {
+        int callsInlined;
+        do {
+            callsInlined = statistics.callsInlined;
+            instructions = inlineProcedures(instructions, &statistics);
+        } while (statistics.callsInlined > callsInlined);
+    }
+    if (options.superinstructions)
+        instructions = selectSuperinstructions(instructions);
+
+    return instructions;
 }
 
-void printInstructions(struct vector *instructions, int humanReadable) {
-    forVector(instructions, i, struct instruction, instruction,
-        int lineNumber = i;
-        if (humanReadable)
-            printf("%3d %-5s %-3d %-3d\n", lineNumber, instruction.opcodeName,
-                    instruction.lexicalLevel, instruction.modifier);
-        else
-            printf("%d %d %d\n", instruction.opcode,
-                    instruction.lexicalLevel, instruction.modifier););
+struct pl0Object *generatePL0Object(struct parseTree tree, struct generatorOptions generatorOptions) {
+    clearGeneratorErrors();
+    options = generatorOptions;
+    // The rest of the options need to know what the imported symbols are, or
+    // work on whole programs.
+    options.procedureCacheDirectory = NULL;
+    options.superinstructions = options.inlining = options.optimize = options.threads = 0;
+    clearGeneratorStatistics();
+    objectSymbols = makeVector(struct symbol);
+
+    struct generatorState *state = makeGeneratorState();
+    generate(tree, state);
+
+    if (countGeneratorErrors() > 0) {
+        objectSymbols = NULL;
+        return NULL;
+    }
+
+    struct pl0Object *object = allocate(sizeof (struct pl0Object));
+    object->name = NULL;
+    object->code = makeVector(struct cachedInstruction);
+    object->exports = makeVector(struct objectSymbol);
+    object->globals = state->frameSize - STACK_FRAME_SIZE;
+    // The statement ends before the program's return.
+    object->statementSize = state->instructions->length - 1 - state->statementStart;
+    object->display = options.display;
+
+    forVector(state->instructions, i, struct instruction, instruction,
+        struct cachedInstruction cached = {instruction, RELOCATE_NONE, NULL};
+        if (usesObjectSymbol(instruction)) {
+            struct symbol symbol = get(struct symbol, objectSymbols,
+                    OBJECT_SYMBOL(instruction.modifier));
+            cached.relocation = (symbol.address == -1) ? RELOCATE_SYMBOL : RELOCATE_GLOBAL;
+            cached.symbol = (symbol.address == -1) ? symbol.name : NULL;
+            cached.instruction.modifier = (symbol.address == -1) ? 0 : symbol.address;
+        } else if (hasCodeAddress(instruction.opcode)) {
+            cached.relocation = RELOCATE_BLOCK;
+        }
+        push(object->code, cached););
+
+    // A name can be declared more than once, and the first declaration is
+    // the one that the program's statement sees.
+    forVector(state->symbols, i, struct symbol, symbol,
+        int exported = 0;
+        forVector(object->exports, j, struct objectSymbol, export,
+                exported |= (strcmp(export.name, symbol.name) == 0););
+        if (exported)
+            continue;
+
+        struct objectSymbol export = {symbol.name, OBJECT_PROCEDURE, symbol.address};
+        if (symbol.type == VARIABLE)
+            export = (struct objectSymbol){symbol.name, OBJECT_VARIABLE,
+                get(struct symbol, objectSymbols, OBJECT_SYMBOL(symbol.address)).address};
+        else if (symbol.type == CONSTANT)
+            export = (struct objectSymbol){symbol.name, OBJECT_CONSTANT, symbol.constantValue};
+        push(object->exports, export););
+
+    objectSymbols = NULL;
+    return object;
+}
+
+uint64_t hashGeneratorOptions(uint64_t hash, struct generatorOptions generatorOptions) {
+    // The procedure cache directory and the number of threads only change how
+    // the code is produced.
+    hash = hashInt(hash, generatorOptions.superinstructions);
+    hash = hashInt(hash, generatorOptions.inlining);
+    hash = hashInt(hash, generatorOptions.tailCalls);
+    hash = hashInt(hash, generatorOptions.display);
+    hash = hashInt(hash, generatorOptions.optimize);
+    hash = hashInt(hash, generatorOptions.loops);
+    return hashInt(hash, generatorOptions.optimizerPasses);
+}
+
+struct generatorStatistics getGeneratorStatistics() {
+    return statistics;
+}
+
+void clearGeneratorStatistics() {
+    statistics = (struct generatorStatistics){0, 0, 0, 0, makeVector(char *), {0}, {0}, 0, 0};
 }
 
 void generate(struct parseTree tree, struct generatorState *state) {
@@ -122,6 +306,13 @@ void generate(struct parseTree tree, struct generatorState *state) {
     int is(char *name) {
         return (strcmp(tree.name, name) == 0);
     }
+    // The tree's instructions are at its location, unless they're for a part
+    // of it with a location of its own.
+    int line = currentLine, column = currentColumn;
+    if (tree.line > 0) {
+        currentLine = tree.line;
+        currentColumn = tree.column;
+    }
     void call(void (*generateFunction)(struct parseTree, struct generatorState*)) {
         (*generateFunction)(tree, state);
     }
@@ -156,6 +347,9 @@ void generate(struct parseTree tree, struct generatorState *state) {
     else if (is("@sign")) call(generate_sign);
     else if (is("@number")) call(generate_number);
     else if (is("@identifier")) call(generate_identifier);
+
+    currentLine = line;
+    currentColumn = column;
 }
 
 void generate_program(struct parseTree tree, struct generatorState *state) {
@@ -169,11 +363,23 @@ void generate_program(struct parseTree tree, struct generatorState *state) {
 void generate_block(struct parseTree tree, struct generatorState *state) {
     assert(hasChild(tree, "@statement"));
 
+    int frameStart = state->instructions->length;
     addInstruction(state, "inc", 0, STACK_FRAME_SIZE);
+    state->frameSize = STACK_FRAME_SIZE;
     generate(getChild(tree, "@const-declaration"), state);
     generate(getChild(tree, "@var-declaration"), state);
     generate(getChild(tree, "@procedure-declaration"), state);
+    state->statementStart = state->instructions->length;
+    // The slots for hoisted expressions go after the variables.
+    state->temporaryStart = state->frameSize;
     generate(getChild(tree, "@statement"), state);
+
+    // Make room in the frame for the hoisted expressions.
+    if (state->maxTemporaries > 0) {
+        struct instruction *inc = vector_get(state->instructions, frameStart);
+        inc->modifier += state->maxTemporaries;
+        state->frameSize += state->maxTemporaries;
+    }
 }
 
 void generate_varDeclaration(struct parseTree tree, struct generatorState *state) {
@@ -190,6 +396,7 @@ void generate_varDeclaration(struct parseTree tree, struct generatorState *state
 
         // Allocate space for the variables.
         addInstruction(state, "inc", 0, numVariables);
+        state->frameSize += numVariables;
     }
 }
 
@@ -232,6 +439,9 @@ void generate_constant(struct parseTree tree, struct generatorState *state) {
 
 void generate_procedureDeclaration(struct parseTree tree, struct generatorState *state) {
     if (hasChild(tree, "@procedures") && hasChild(getChild(tree, "@procedures"), "@procedure")) {
+        if (generateProceduresInParallel(getChild(tree, "@procedures"), state))
+            return;
+
         addInstruction(state, "jmp", -1, -1);
         int jmpInstruction = state->instructions->length - 1;
         generate(getChild(tree, "@procedures"), state);
@@ -251,15 +461,72 @@ void generate_procedure(struct parseTree tree, struct generatorState *state) {
     assert(hasChild(tree, "@identifier") && hasChild(tree, "@block"));
 
     addProcedure(state, getChild(tree, "@identifier"), state->instructions->length);
+    generateProcedureBody(tree, state, state->symbols->length - 1);
+}
+
+// Generates the code of the procedure whose symbol is at symbolIndex in the
+// state's symbols at the end of the state's instructions.
+void generateProcedureBody(struct parseTree tree, struct generatorState *state, int symbolIndex) {
+    // Reuse the procedure's code if it was cached by an earlier compilation.
+    uint64_t cacheKey = 0;
+    if (options.procedureCacheDirectory != NULL) {
+        cacheKey = hashProcedure(tree, state);
+        if (loadProcedureFromCache(cacheKey, state, tree.line)) {
+            statistics.proceduresReused += 1;
+            return;
+        }
+    }
+
+    // The threads that generate procedures in parallel start here instead
+    // of in generate.
+    int line = currentLine, column = currentColumn;
+    currentLine = tree.line;
+    currentColumn = tree.column;
+
+    int start = state->instructions->length;
+    int errorsBefore = countGeneratorErrors();
 
     struct generatorState *procedureState = makeGeneratorState();
     procedureState->currentLevel = state->currentLevel + 1;
     procedureState->parentState = state;
     procedureState->instructions = state->instructions;
     generate(getChild(tree, "@block"), procedureState);
-    addInstruction(procedureState, "opr", 0, 0);
+    // Procedures called with cald have to restore the display when they
+    // return.
+    if (options.display)
+        addInstruction(procedureState, "retd", 0, 0);
+    else
+        addInstruction(procedureState, "opr", 0, 0);
+
+    if (options.tailCalls)
+        convertTailCalls(procedureState, getToken(getChild(tree, "@identifier")));
+
+    // Loops that call the procedure need to know what it changes. Its own
+    // variables are in a different frame from theirs.
+    if (options.loops) {
+        struct vector *modifiedVariables = makeVector(struct symbol);
+        struct parseTree statement = getChild(getChild(tree, "@block"), "@statement");
+        if (findModifiedVariables(statement, procedureState, modifiedVariables)) {
+            struct symbol *procedure = vector_get(state->symbols, symbolIndex);
+            procedure->modifiedVariables = makeVector(struct symbol);
+            forVector(modifiedVariables, i, struct symbol, variable,
+                    if (variable.level <= state->currentLevel)
+                        push(procedure->modifiedVariables, variable););
+        }
+        freeVector(modifiedVariables);
+    }
 
     //vector_concat(state->instructions, procedureState->instructions);
+
+    statistics.proceduresGenerated += 1;
+
+    // Don't cache procedures with errors, so that the errors are reported
+    // again the next time the procedure is compiled.
+    if (options.procedureCacheDirectory != NULL && countGeneratorErrors() == errorsBefore)
+        saveProcedureToCache(cacheKey, state, start, tree.line);
+
+    currentLine = line;
+    currentColumn = column;
 }
 
 void generate_statement(struct parseTree tree, struct generatorState *state) {
@@ -307,9 +574,14 @@ void generate_callStatement(struct parseTree tree, struct generatorState *state)
 
     struct parseTree identifier = getChild(tree, "@identifier");
     char *procedureName = getFirstChild(identifier).name;
-    struct symbol procedure = getSymbol(state, procedureName);
+    struct symbol procedure = getSymbolOrImport(state, procedureName, PROCEDURE);
     int levelsBack = state->currentLevel - procedure.level;
-    addInstruction(state, "cal", levelsBack, procedure.address);
+    if (procedure.type == VARIABLE || procedure.type == CONSTANT)
+        addGeneratorError("Cannot call a variable or constant.");
+    else if (options.display)
+        addInstruction(state, "cald", procedure.level + 1, procedure.address);
+    else
+        addInstruction(state, "cal", levelsBack, procedure.address);
 }
 
 /*void generate_ifStatement(struct parseTree tree, struct generatorState *state) {
@@ -372,19 +644,60 @@ void generate_ifStatement(struct parseTree tree, struct generatorState *state) {
 void generate_whileStatement(struct parseTree tree, struct generatorState *state) {
     assert(hasChild(tree, "@condition") && hasChild(tree, "@statement"));
 
-    int beginning = state->instructions->length;
-    generate(getChild(tree, "@condition"), state);
-    // Generate a fake jpc instruction first so that we can find out what
-    // instruction we need to jump to.
-    addInstruction(state, "jpc", -1, -1);
-    int jpcIndex = state->instructions->length - 1;
-    generate(getChild(tree, "@statement"), state);
-    addInstruction(state, "jmp", 0, beginning);
-    int afterWhileLoop = state->instructions->length;
+    struct parseTree condition = getChild(tree, "@condition");
+    int temporaries = state->temporaries;
+    int hoistedExpressions = state->hoistedExpressions->length;
+    if (options.loops)
+        hoistInvariantExpressions(tree, state);
+
+    // Rotate the loop, so that each iteration only runs one jump:
+    //
+    //   <condition>, jpc after, body: <statement>, <inverted condition>,
+    //   jpc body, after:
+    //
+    // An odd condition can't be inverted without adding instructions, so
+    // those loops keep the jmp back to the condition.
+    if (options.loops && !hasChild(condition, "odd")) {
+        generate(condition, state);
+        addInstruction(state, "jpc", -1, -1);
+        int jpcIndex = state->instructions->length - 1;
+        int body = state->instructions->length;
+        generate(getChild(tree, "@statement"), state);
 
-    // Modify the jpc instruction to jump to the end of the if statement.
-    struct instruction jpcInstruction = makeInstruction("jpc", 0, afterWhileLoop);
-    set(state->instructions, jpcIndex, jpcInstruction);
+        generate(getChild(condition, "@expression"), state);
+        generate(getLastChild(condition, "@expression"), state);
+        generate(getChild(condition, "@rel-op"), state);
+        struct instruction *operator = vector_get(state->instructions,
+                state->instructions->length - 1);
+        // = and <>, < and >=, and <= and > are each other's inverses.
+        if (operator->modifier == OPR_EQL || operator->modifier == OPR_NEQ)
+            operator->modifier = OPR_EQL + OPR_NEQ - operator->modifier;
+        else
+            operator->modifier = OPR_LSS + OPR_GEQ - operator->modifier;
+        addInstruction(state, "jpc", 0, body);
+
+        struct instruction jpcInstruction = makeInstruction("jpc", 0, state->instructions->length);
+        set(state->instructions, jpcIndex, jpcInstruction);
+        statistics.loopsRotated += 1;
+    } else {
+        int beginning = state->instructions->length;
+        generate(condition, state);
+        // Generate a fake jpc instruction first so that we can find out what
+        // instruction we need to jump to.
+        addInstruction(state, "jpc", -1, -1);
+        int jpcIndex = state->instructions->length - 1;
+        generate(getChild(tree, "@statement"), state);
+        addInstruction(state, "jmp", 0, beginning);
+        int afterWhileLoop = state->instructions->length;
+
+        // Modify the jpc instruction to jump to the end of the if statement.
+        struct instruction jpcInstruction = makeInstruction("jpc", 0, afterWhileLoop);
+        set(state->instructions, jpcIndex, jpcInstruction);
+    }
+
+    // The slots of the loop's hoisted expressions are free again.
+    state->temporaries = temporaries;
+    state->hoistedExpressions->length = hoistedExpressions;
 }
 
 void generate_condition(struct parseTree tree, struct generatorState *state) {
@@ -405,6 +718,9 @@ void generate_condition(struct parseTree tree, struct generatorState *state) {
 void generate_expression(struct parseTree tree, struct generatorState *state) {
     assert(hasChild(tree, "@term"));
 
+    if (loadHoistedExpression(tree, state))
+        return;
+
     generate(getChild(tree, "@term"), state);
 
     if (hasChild(tree, "@add-or-subtract")) {
@@ -429,6 +745,9 @@ void generate_addOrSubtract(struct parseTree tree, struct generatorState *state)
 void generate_term(struct parseTree tree, struct generatorState *state) {
     assert(hasChild(tree, "@factor"));
 
+    if (loadHoistedExpression(tree, state))
+        return;
+
     generate(getChild(tree, "@factor"), state);
 
     if (hasChild(tree, "@multiply-or-divide")) {
@@ -518,12 +837,18 @@ void generate_relationalOperator(struct parseTree tree, struct generatorState *s
 // Generator state functions
 // =========================
 struct generatorState *makeGeneratorState() {
-    struct generatorState *state = malloc(sizeof (struct generatorState));
+    struct generatorState *state = allocate(sizeof (struct generatorState));
 
     state->symbols = makeVector(struct symbol);
     state->currentLevel = 0;
+    state->frameSize = 0;
+    state->statementStart = 0;
     state->instructions = makeVector(struct instruction);
     state->parentState = NULL;
+    state->hoistedExpressions = makeVector(struct hoistedExpression);
+    state->temporaryStart = 0;
+    state->temporaries = 0;
+    state->maxTemporaries = 0;
 
     return state;
 }
@@ -534,22 +859,8 @@ void addInstruction(struct generatorState *state, char *instruction, int lexical
 }
 
 struct instruction makeInstruction(char *instruction, int lexicalLevel, int modifier) {
-    return (struct instruction){getOpcode(instruction), instruction, lexicalLevel, modifier};
-}
-
-int getOpcode(char *instruction) {
-    if (strcmp(instruction, "lit") == 0) return 1;
-    if (strcmp(instruction, "opr") == 0) return 2;
-    if (strcmp(instruction, "lod") == 0) return 3;
-    if (strcmp(instruction, "sto") == 0) return 4;
-    if (strcmp(instruction, "cal") == 0) return 5;
-    if (strcmp(instruction, "inc") == 0) return 6;
-    if (strcmp(instruction, "jmp") == 0) return 7;
-    if (strcmp(instruction, "jpc") == 0) return 8;
-    if (strcmp(instruction, "write") == 0) return 9;
-    if (strcmp(instruction, "read") == 0) return 10;
-
-    return 0;
+    return (struct instruction){getOpcode(instruction), instruction, lexicalLevel, modifier,
+        currentLine, currentColumn};
 }
 
 // If the given parse tree has a single child node, return the name of that
@@ -563,11 +874,13 @@ char *getToken(struct parseTree parent) {
 
 void addLoadInstruction(struct generatorState *state, struct parseTree identifier) {
     char *name = getToken(identifier);
-    struct symbol symbol = getSymbol(state, name);
+    struct symbol symbol = getSymbolOrImport(state, name, VARIABLE);
 
     int levelsBack = state->currentLevel - symbol.level;
     if (symbol.type == PROCEDURE)
         addGeneratorError("Cannot take value of procedure.");
+    else if (symbol.type == VARIABLE && options.display)
+        addInstruction(state, "lodd", symbol.level, symbol.address);
     else if (symbol.type == VARIABLE)
         addInstruction(state, "lod", levelsBack, symbol.address);
     else if (symbol.type == CONSTANT)
@@ -575,22 +888,32 @@ void addLoadInstruction(struct generatorState *state, struct parseTree identifie
 }
 void addStoreInstruction(struct generatorState *state, struct parseTree identifier) {
     char *name = getToken(identifier);
-    struct symbol symbol = getSymbol(state, name);
+    struct symbol symbol = getSymbolOrImport(state, name, VARIABLE);
     int levelsBack = state->currentLevel - symbol.level;
     if (symbol.type == PROCEDURE || symbol.type == CONSTANT)
         addGeneratorError("Cannot store into a constant or procedure.");
+    else if (symbol.type == VARIABLE && options.display)
+        addInstruction(state, "stod", symbol.level, symbol.address);
     else if (symbol.type == VARIABLE)
         addInstruction(state, "sto", levelsBack, symbol.address);
 }
 
 void addVariable(struct generatorState *state, struct parseTree identifierTree) {
     char *name = getToken(identifierTree);
-    // TODO: Will the position in the symbol table will always correspond to
-    // the correct address for the symbol in each lexical level?
-    int address = state->symbols->length;
-    // Account for data put on stack by CAL instruction.
-    address += STACK_FRAME_SIZE;
-    struct symbol symbol = {name, VARIABLE, state->currentLevel, address, 0};
+    // Variables go in the frame in the order they're declared. Constants
+    // don't take up space in it.
+    int address = STACK_FRAME_SIZE;
+    forVector(state->symbols, i, struct symbol, symbol,
+            if (symbol.type == VARIABLE)
+                address += 1;);
+    struct symbol symbol = {name, VARIABLE, state->currentLevel, address, 0, NULL};
+
+    // pl0ld moves the variables of objects' top levels in the main
+    // program's frame.
+    if (objectSymbols != NULL && state->currentLevel == 0) {
+        push(objectSymbols, symbol);
+        symbol.address = OBJECT_SYMBOL(objectSymbols->length - 1);
+    }
 
     push(state->symbols, symbol);
 }
@@ -602,39 +925,670 @@ void addConstant(struct generatorState *state, struct parseTree identifierTree,
     assert(isInteger(number));
     int value = atoi(number);
 
-    struct symbol symbol = {name, CONSTANT, state->currentLevel, 0, value};
+    struct symbol symbol = {name, CONSTANT, state->currentLevel, 0, value, NULL};
 
     push(state->symbols, symbol);
 }
 void addProcedure(struct generatorState *state, struct parseTree identifierTree, int address) {
     char *name = getToken(identifierTree);
-    struct symbol symbol = {name, PROCEDURE, state->currentLevel, address, 0};
+    struct symbol symbol = {name, PROCEDURE, state->currentLevel, address, 0, NULL};
     push(state->symbols, symbol);
 }
 struct symbol getSymbol(struct generatorState *state, char *name) {
-    // TODO: Check for symbols in higher lexical levels.
+    struct symbol symbol;
+
+    if (lookupSymbol(state, name, &symbol))
+        return symbol;
+
+    addGeneratorError(format("Could not find symbol '%s'.", name));
+
+    return (struct symbol){NULL, -1, -1, -1, -1, NULL};
+}
+// Like getSymbol, but when generating an object, a symbol that doesn't exist
+// is imported as a procedure, or as a variable or constant, depending on the
+// type (PROCEDURE or VARIABLE). pl0ld turns loads of imported constants into
+// lit instructions.
+struct symbol getSymbolOrImport(struct generatorState *state, char *name, int type) {
+    struct symbol symbol;
+
+    if (objectSymbols == NULL || lookupSymbol(state, name, &symbol))
+        return getSymbol(state, name);
+
+    forVector(objectSymbols, i, struct symbol, imported,
+        if (imported.address == -1 && strcmp(imported.name, name) == 0) {
+            if (imported.type != type)
+                addGeneratorError(format("'%s' is used as both a procedure and a variable.", name));
+            return (struct symbol){name, imported.type, 0, OBJECT_SYMBOL(i), 0, NULL};
+        });
+
+    pushLiteral(objectSymbols, struct symbol, {name, type, 0, -1, 0, NULL});
+
+    return (struct symbol){name, type, 0, OBJECT_SYMBOL(objectSymbols->length - 1), 0, NULL};
+}
+// Like getSymbol, but returns false instead of adding an error if the symbol
+// doesn't exist.
+int lookupSymbol(struct generatorState *state, char *name, struct symbol *result) {
     forVector(state->symbols, i, struct symbol, symbol,
-            if (strcmp(symbol.name, name) == 0)
-                return symbol;);
+            if (strcmp(symbol.name, name) == 0) {
+                *result = symbol;
+                return 1;
+            });
 
-    if (state->parentState == NULL) {
-        addGeneratorError(format("Could not find symbol '%s'.", name));
+    if (state->parentState == NULL)
+        return 0;
+    else
+        return lookupSymbol(state->parentState, name, result);
+}
 
-        return (struct symbol){NULL, -1, -1, -1, -1};
-    } else {
-        return getSymbol(state->parentState, name);
+// Procedure cache functions
+// =========================
+// The code generated for a procedure only depends on the procedure's tokens,
+// its lexical level, and what the identifiers in it refer to in the enclosing
+// scopes, so those are what the cache key is made of. The addresses of outer
+// procedures are left out of the key, because calls to them are relocated by
+// name when the procedure is loaded, so that adding code before a procedure
+// doesn't stop it from being reused. The locations of the tokens are part of
+// the key relative to the procedure's first line, which is what the cached
+// instructions' lines are relative to, so that moving the whole procedure
+// doesn't stop it from being reused either.
+#define PROCEDURE_CACHE_VERSION "3"
+
+uint64_t hashProcedureTree(uint64_t hash, struct parseTree tree, struct generatorState *state,
+        int line) {
+    // Leaf nodes hold the text of the tokens.
+    if (tree.children == NULL) {
+        hash = hashInt(hash, tree.line - line);
+        hash = hashInt(hash, tree.column);
+        return hashString(hash, tree.name);
+    }
+
+    if (strcmp(tree.name, "@identifier") == 0) {
+        // Identifiers declared inside the procedure shadow the outer symbols,
+        // so this can include symbols that the procedure doesn't really use,
+        // but that only means that the procedure is regenerated when it
+        // didn't have to be.
+        struct symbol symbol;
+        if (lookupSymbol(state, getFirstChild(tree).name, &symbol)) {
+            hash = hashInt(hash, symbol.type);
+            hash = hashInt(hash, symbol.level);
+            if (symbol.type == VARIABLE)
+                hash = hashInt(hash, symbol.address);
+            else if (symbol.type == CONSTANT)
+                hash = hashInt(hash, symbol.constantValue);
+        } else {
+            hash = hashInt(hash, -1);
+        }
+    }
+
+    forVector(tree.children, i, struct parseTree, child,
+            hash = hashProcedureTree(hash, child, state, line););
+
+    return hash;
+}
+
+uint64_t hashProcedure(struct parseTree tree, struct generatorState *state) {
+    uint64_t hash = hashString(HASH_SEED, PROCEDURE_CACHE_VERSION);
+    hash = hashInt(hash, state->currentLevel);
+    // Tail calls are converted before the procedure is cached, and the
+    // display changes the instructions themselves.
+    hash = hashInt(hash, options.tailCalls);
+    hash = hashInt(hash, options.display);
+    hash = hashInt(hash, options.loops);
+
+    return hashProcedureTree(hash, tree, state, tree.line);
+}
+
+// Appends the cached code for the procedure with the given key to the
+// instructions, relocating it to its new address and to the procedure's
+// first line. Returns false if the procedure isn't in the cache.
+int loadProcedureFromCache(uint64_t key, struct generatorState *state, int line) {
+    struct vector *cachedInstructions = loadCachedProcedure(options.procedureCacheDirectory, key);
+    if (cachedInstructions == NULL)
+        return 0;
+
+    int start = state->instructions->length;
+
+    forVector(cachedInstructions, i, struct cachedInstruction, cached,
+        struct instruction instruction = cached.instruction;
+        instruction.line += line;
+
+        if (cached.relocation == RELOCATE_BLOCK) {
+            instruction.modifier += start;
+        } else if (cached.relocation == RELOCATE_SYMBOL) {
+            struct symbol procedure;
+            if (!lookupSymbol(state, cached.symbol, &procedure) || procedure.type != PROCEDURE) {
+                // The cache entry doesn't match after all, so undo the
+                // instructions that were already added.
+                state->instructions->length = start;
+                return 0;
+            }
+
+            instruction.modifier = procedure.address;
+        }
+
+        push(state->instructions, instruction););
+
+    return 1;
+}
+
+// Saves the instructions from start to the end of the instructions as the
+// code of the procedure with the given key, which starts on the given line.
+void saveProcedureToCache(uint64_t key, struct generatorState *state, int start, int line) {
+    struct vector *instructions = state->instructions;
+    struct vector *cachedInstructions = makeVector(struct cachedInstruction);
+
+    int i;
+    for (i = start; i < instructions->length; i++) {
+        struct instruction instruction = get(struct instruction, instructions, i);
+        struct cachedInstruction cached = {instruction, RELOCATE_NONE, NULL};
+        cached.instruction.line -= line;
+
+        int isCodeAddress = hasCodeAddress(instruction.opcode);
+        int target = instruction.modifier;
+
+        if (isCodeAddress && target >= start && target < instructions->length) {
+            cached.relocation = RELOCATE_BLOCK;
+            cached.instruction.modifier -= start;
+        } else if (isCodeAddress) {
+            // Jumps only leave the procedure for tail calls, so this must be
+            // a call to a procedure declared outside of it. Find out which
+            // one.
+            cached.relocation = RELOCATE_SYMBOL;
+
+            struct generatorState *scope;
+            for (scope = state; scope != NULL && cached.symbol == NULL; scope = scope->parentState) {
+                forVector(scope->symbols, j, struct symbol, symbol,
+                        if (symbol.type == PROCEDURE && symbol.address == target)
+                            cached.symbol = symbol.name;);
+            }
+
+            // Don't cache code that we wouldn't be able to relocate.
+            if (cached.symbol == NULL) {
+                freeVector(cachedInstructions);
+                return;
+            }
+        }
+
+        push(cachedInstructions, cached);
+    }
+
+    storeCachedProcedure(options.procedureCacheDirectory, key, cachedInstructions);
+    freeVector(cachedInstructions);
+}
+
+// Parallel code generation
+// ========================
+// With options.threads, the procedures declared at the top level of the
+// program are generated on that many threads, each into a chunk of its own
+// whose code addresses start at 0. Each procedure only needs the symbols that
+// were declared before it, and the only thing it needs from the other
+// procedures is their addresses, which aren't known until all of them have
+// been generated. So all of their symbols are added first, each with an
+// UNLINKED_ADDRESS that says which procedure it is, and the calls and tail
+// call jumps to them use those addresses until the chunks are linked:
+// concatenated after the program's jmp, with the addresses in each chunk's
+// relocation table changed to the real ones. The result is the same as
+// generating the procedures one after another, errors and all.
+//
+// Loop optimizations need to know what the procedures declared before each
+// procedure change (see findModifiedVariables), so with options.loops the
+// procedures are generated one after another.
+
+// -1 is the address of jumps that haven't been filled in yet, and of symbols
+// that weren't found.
+#define UNLINKED_ADDRESS(procedure) (-2 - (procedure))
+
+// A code address in a chunk.
+struct relocation {
+    int index;       // The instruction that has the address.
+    int procedure;   // The procedure that it goes to, or -1 if it goes into
+                     // the chunk itself.
+};
+
+// A top-level procedure, and what generating it produced.
+struct procedureChunk {
+    struct parseTree tree;
+    int symbolIndex;   // The index of the procedure's symbol in the program's
+                       // symbols.
+    struct vector *instructions;   // Code addresses start at 0.
+    struct vector *relocations;    // As relocation structs.
+    struct vector *errors;         // NULL if there weren't any.
+    struct generatorStatistics statistics;
+};
+
+// What the threads share. Each thread takes the next chunk until there are
+// none left.
+struct parallelGeneration {
+    struct generatorState *state;   // The program's state.
+    struct generatorOptions options;
+    struct procedureChunk *chunks;
+    int chunkCount;
+    int nextChunk;
+    // Whether the threads allocate from arenas of their own, which are merged
+    // into the caller's arena afterwards.
+    int useArenas;
+};
+
+struct generatorThread {
+    pthread_t thread;
+    struct parallelGeneration *parallel;
+    struct arena *arena;
+};
+
+static void generateChunks(struct parallelGeneration *parallel) {
+    // The errors and statistics of the thread that called
+    // generatePL0WithOptions are put back afterwards.
+    struct vector *errors = generatorErrors;
+    struct generatorStatistics threadStatistics = statistics;
+    options = parallel->options;
+
+    int index;
+    while ((index = __atomic_fetch_add(&parallel->nextChunk, 1, __ATOMIC_RELAXED)) < parallel->chunkCount) {
+        struct procedureChunk *chunk = &parallel->chunks[index];
+
+        // The procedure can see the symbols declared before it and its own,
+        // without copying them.
+        struct vector symbols = *parallel->state->symbols;
+        symbols.length = symbols.capacity = chunk->symbolIndex + 1;
+        struct generatorState scope = *parallel->state;
+        scope.symbols = &symbols;
+        scope.instructions = makeVector(struct instruction);
+
+        generatorErrors = NULL;
+        clearGeneratorStatistics();
+        generateProcedureBody(chunk->tree, &scope, chunk->symbolIndex);
+
+        chunk->instructions = scope.instructions;
+        // Calls to symbols that weren't found go to -1, wherever they are.
+        chunk->relocations = makeVector(struct relocation);
+        forVector(chunk->instructions, i, struct instruction, instruction,
+                if (hasCodeAddress(instruction.opcode) && instruction.modifier != -1)
+                    pushLiteral(chunk->relocations, struct relocation,
+                        {i, (instruction.modifier < -1) ? -2 - instruction.modifier : -1}););
+        chunk->errors = generatorErrors;
+        chunk->statistics = statistics;
+    }
+
+    generatorErrors = errors;
+    statistics = threadStatistics;
+}
+
+static void *runGeneratorThread(void *argument) {
+    struct generatorThread *thread = argument;
+    if (thread->parallel->useArenas)
+        useArena(thread->arena);
+
+    generateChunks(thread->parallel);
+
+    useArena(NULL);
+    return NULL;
+}
+
+// Generates the procedures in the @procedures tree, and returns true, or
+// returns false without generating anything if they should be generated one
+// after another.
+int generateProceduresInParallel(struct parseTree procedures, struct generatorState *state) {
+    if (options.threads < 2 || options.loops || state->currentLevel != 0)
+        return 0;
+
+    // Procedures with syntax errors are left out, the same as generate
+    // leaves them out.
+    struct vector *chunks = makeVector(struct procedureChunk);
+    struct parseTree list;
+    for (list = procedures; !isParseTreeError(list); list = getChild(list, "@procedures")) {
+        struct parseTree procedure = getChild(list, "@procedure");
+        if (!isParseTreeError(procedure))
+            pushLiteral(chunks, struct procedureChunk, {procedure, 0, NULL, NULL, NULL});
+    }
+    if (chunks->length < 2) {
+        freeVector(chunks);
+        return 0;
+    }
+
+    forVectorPointers(chunks, i, struct procedureChunk, chunk,
+            addProcedure(state, getChild(chunk->tree, "@identifier"), UNLINKED_ADDRESS(i));
+            chunk->symbolIndex = state->symbols->length - 1;);
+
+    // The threads allocate from the caller's arena through their own arenas,
+    // or from malloc like the caller.
+    struct arena *arena = useArena(NULL);
+    useArena(arena);
+
+    int chunkCount = chunks->length;
+    struct parallelGeneration parallel = {state, options, (struct procedureChunk *)chunks->items,
+        chunkCount, 0, arena != NULL};
+    int threadCount = (options.threads > chunkCount) ? chunkCount : options.threads;
+    struct generatorThread *threads = allocate(threadCount * sizeof (struct generatorThread));
+    int started = 0, i;
+    for (i = 1; i < threadCount; i++) {
+        threads[started] = (struct generatorThread){0, &parallel, arena != NULL ? makeArena() : NULL};
+        if (pthread_create(&threads[started].thread, NULL, runGeneratorThread, &threads[started]) != 0) {
+            if (threads[started].arena != NULL)
+                freeArena(threads[started].arena);
+            break;
+        }
+        started++;
     }
+
+    generateChunks(&parallel);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i].thread, NULL);
+        if (threads[i].arena != NULL)
+            mergeArena(arena, threads[i].arena);
+    }
+    deallocate(threads);
+
+    // Link the chunks: each one goes after the ones before it.
+    addInstruction(state, "jmp", -1, -1);
+    int jmpInstruction = state->instructions->length - 1;
+
+    int address = state->instructions->length;
+    forVector(chunks, i, struct procedureChunk, chunk,
+            struct symbol *procedure = vector_get(state->symbols, chunk.symbolIndex);
+            procedure->address = address;
+            address += chunk.instructions->length;);
+
+    forVector(chunks, i, struct procedureChunk, chunk,
+        int start = state->instructions->length;
+        forVector(chunk.relocations, j, struct relocation, relocation,
+            struct instruction *instruction = vector_get(chunk.instructions, relocation.index);
+            if (relocation.procedure == -1) {
+                instruction->modifier += start;
+            } else {
+                int symbolIndex = get(struct procedureChunk, chunks, relocation.procedure).symbolIndex;
+                instruction->modifier = get(struct symbol, state->symbols, symbolIndex).address;
+            });
+        vector_concat(state->instructions, chunk.instructions);
+
+        forVector(chunk.errors, j, struct generatorError, error,
+                pushGeneratorError(error););
+
+        statistics.proceduresGenerated += chunk.statistics.proceduresGenerated;
+        statistics.proceduresReused += chunk.statistics.proceduresReused;
+        vector_concat(statistics.tailCalls, chunk.statistics.tailCalls);
+
+        freeVector(chunk.instructions);
+        freeVector(chunk.relocations);
+        freeVector(chunk.statistics.tailCalls););
+
+    struct instruction jmpAfterProcedures = makeInstruction("jmp", 0, state->instructions->length);
+    set(state->instructions, jmpInstruction, jmpAfterProcedures);
+
+    freeVector(chunks);
+    return 1;
+}
+
+// Loop optimizations
+// ==================
+// With options.loops, each while loop is rotated (see generate_whileStatement)
+// and the expressions in it that give the same value on every iteration are
+// computed once, before the loop, into slots at the end of the frame. The
+// loop then loads them from there.
+//
+// An expression is loop-invariant if it only uses constants and variables
+// that nothing in the loop can change: the loop doesn't assign or read them,
+// and doesn't call a procedure that can. What a procedure can change is
+// recorded in its symbol once it has been generated, so calls to procedures
+// that are still being generated (the procedure itself and the ones around
+// it) or that were reused from the procedure cache stop anything from being
+// hoisted. Divisions aren't hoisted, since the loop might never have run them
+// with a divisor of zero.
+
+// Adds the variables that running the parse tree can change to
+// modifiedVariables, as symbols. Returns false if they aren't known.
+int findModifiedVariables(struct parseTree tree, struct generatorState *state,
+        struct vector *modifiedVariables) {
+    if (tree.children == NULL)
+        return 1;
+
+    struct symbol symbol;
+    if (strcmp(tree.name, "@assignment") == 0 || strcmp(tree.name, "@read-statement") == 0) {
+        if (lookupSymbol(state, getToken(getChild(tree, "@identifier")), &symbol)
+                && symbol.type == VARIABLE)
+            push(modifiedVariables, symbol);
+    } else if (strcmp(tree.name, "@call-statement") == 0) {
+        if (!lookupSymbol(state, getToken(getChild(tree, "@identifier")), &symbol)
+                || symbol.modifiedVariables == NULL)
+            return 0;
+        vector_concat(modifiedVariables, symbol.modifiedVariables);
+    }
+
+    forVector(tree.children, i, struct parseTree, child,
+            if (!findModifiedVariables(child, state, modifiedVariables))
+                return 0;);
+
+    return 1;
+}
+
+// Computes the loop-invariant expressions in the loop into new slots, and
+// adds them to the state's hoisted expressions.
+void hoistInvariantExpressions(struct parseTree loop, struct generatorState *state) {
+    struct vector *modifiedVariables = makeVector(struct symbol);
+    if (!findModifiedVariables(loop, state, modifiedVariables)) {
+        freeVector(modifiedVariables);
+        return;
+    }
+
+    int isInvariant(struct parseTree tree) {
+        if (tree.children == NULL)
+            return strcmp(tree.name, "/") != 0;
+
+        if (strcmp(tree.name, "@identifier") == 0) {
+            struct symbol symbol;
+            if (!lookupSymbol(state, getToken(tree), &symbol))
+                return 0;
+            if (symbol.type == CONSTANT)
+                return 1;
+            if (symbol.type != VARIABLE)
+                return 0;
+
+            forVector(modifiedVariables, i, struct symbol, variable,
+                    if (variable.level == symbol.level && variable.address == symbol.address)
+                        return 0;);
+            return 1;
+        }
+
+        forVector(tree.children, i, struct parseTree, child,
+                if (!isInvariant(child))
+                    return 0;);
+        return 1;
+    }
+
+    // Loading a constant or a variable is already a single instruction.
+    int hasOperator(struct parseTree tree) {
+        if (tree.children == NULL)
+            return 0;
+        if (strcmp(tree.name, "@add-or-subtract") == 0
+                || strcmp(tree.name, "@multiply-or-divide") == 0)
+            return 1;
+
+        forVector(tree.children, i, struct parseTree, child,
+                if (hasOperator(child))
+                    return 1;);
+        return 0;
+    }
+
+    int isHoisted(struct parseTree tree) {
+        forVector(state->hoistedExpressions, i, struct hoistedExpression, hoisted,
+                if (hoisted.children == tree.children)
+                    return 1;);
+        return 0;
+    }
+
+    // Only expressions that the generator generates on their own can be
+    // replaced by a load: every @expression, and the first @term of one (the
+    // @term inside a @term is generated together with the @term around it;
+    // see generate_term).
+    void hoist(struct parseTree tree, int isExpression) {
+        if (tree.children == NULL)
+            return;
+
+        if (isExpression && !isHoisted(tree) && hasOperator(tree) && isInvariant(tree)) {
+            generate(tree, state);
+            int address = state->temporaryStart + state->temporaries++;
+            if (state->temporaries > state->maxTemporaries)
+                state->maxTemporaries = state->temporaries;
+            addInstruction(state, "sto", 0, address);
+
+            pushLiteral(state->hoistedExpressions, struct hoistedExpression,
+                    {tree.children, address});
+            statistics.expressionsHoisted += 1;
+            return;
+        }
+
+        forVector(tree.children, i, struct parseTree, child,
+                hoist(child, strcmp(child.name, "@expression") == 0
+                    || (strcmp(tree.name, "@expression") == 0
+                        && strcmp(child.name, "@term") == 0)););
+    }
+
+    hoist(loop, 0);
+    freeVector(modifiedVariables);
+}
+
+// Loads the value of the expression if it was hoisted out of a loop and
+// returns true, or returns false if it wasn't.
+int loadHoistedExpression(struct parseTree tree, struct generatorState *state) {
+    forVector(state->hoistedExpressions, i, struct hoistedExpression, hoisted,
+            if (hoisted.children == tree.children) {
+                addInstruction(state, "lod", 0, hoisted.address);
+                return 1;
+            });
+
+    return 0;
+}
+
+// Tail calls
+// ==========
+// A call is in tail position if nothing but jumps run between it and the
+// procedure's return, so that "cal L A, ..., opr 0 0" does the same thing as
+// jumping to A with the calling procedure's frame: the new procedure returns
+// to where the calling one would have returned. The frame keeps its dynamic
+// link and return address, and gets the new procedure's static link, which is
+// the static link of the frame L - 1 levels out:
+//
+//   lod L-1 1, sto 0 1   (left out when L is 1, since it's the same frame)
+//   inc 0 -<frame size>
+//   jmp A
+//
+// The inc pops the calling procedure's variables, so that the new
+// procedure's inc instructions build its frame in the same place. Calls with
+// L = 0 go to a procedure declared inside the calling one, which needs the
+// calling procedure's frame as its static link, so they can't reuse it.
+
+// Returns true if only jumps run between the instruction after index and the
+// procedure's return.
+static int isTailPosition(struct vector *instructions, int index, int start, int end) {
+    int next = index + 1;
+    int jumps = 0;
+
+    while (next >= start && next < end && jumps++ < end - start) {
+        struct instruction instruction = get(struct instruction, instructions, next);
+        if (instruction.opcode != OP_JMP)
+            return 0;
+        next = instruction.modifier;
+    }
+
+    return next == end;
+}
+
+// Converts the tail calls in the procedure that was just generated, which
+// ends in the last instruction, and adds them to the statistics.
+void convertTailCalls(struct generatorState *state, char *procedureName) {
+    struct vector *instructions = state->instructions;
+    int start = state->statementStart;
+    int end = instructions->length - 1;
+
+    // The last instruction is the procedure's own return, which is never a
+    // tail call, but it's in the array so that both loops cover the same
+    // instructions.
+    char *isTailCall = allocate(end - start + 1);
+    memset(isTailCall, 0, end - start + 1);
+    int found = 0;
+    int i;
+    for (i = start; i <= end; i++) {
+        struct instruction instruction = get(struct instruction, instructions, i);
+        isTailCall[i - start] = (instruction.opcode == OP_CAL && instruction.lexicalLevel >= 1
+                && isTailPosition(instructions, i, start, end));
+        found |= isTailCall[i - start];
+    }
+
+    if (!found) {
+        deallocate(isTailCall);
+        return;
+    }
+
+    // The instructions after each tail call move, so the jumps to them have
+    // to move too.
+    struct vector *statement = makeVector(struct instruction);
+    int *newAddresses = allocate((end - start + 1) * sizeof (int));
+
+    for (i = start; i <= end; i++) {
+        struct instruction instruction = get(struct instruction, instructions, i);
+        newAddresses[i - start] = start + statement->length;
+
+        if (!isTailCall[i - start]) {
+            push(statement, instruction);
+            continue;
+        }
+
+        // The instructions that replace the call are where the call was.
+        int line = currentLine, column = currentColumn;
+        currentLine = instruction.line;
+        currentColumn = instruction.column;
+        int levels = instruction.lexicalLevel;
+        if (levels > 1) {
+            pushLiteral(statement, struct instruction, makeInstruction("lod", levels - 1, 1));
+            pushLiteral(statement, struct instruction, makeInstruction("sto", 0, 1));
+        }
+        pushLiteral(statement, struct instruction, makeInstruction("inc", 0, -state->frameSize));
+        pushLiteral(statement, struct instruction, makeInstruction("jmp", 0, instruction.modifier));
+        currentLine = line;
+        currentColumn = column;
+
+        // Find the name of the procedure that's called.
+        char *calleeName = "?";
+        struct generatorState *scope;
+        for (scope = state; scope != NULL; scope = scope->parentState)
+            forVector(scope->symbols, j, struct symbol, symbol,
+                    if (symbol.type == PROCEDURE && symbol.address == instruction.modifier)
+                        calleeName = symbol.name;);
+        if (objectSymbols != NULL && usesObjectSymbol(instruction))
+            calleeName = get(struct symbol, objectSymbols, OBJECT_SYMBOL(instruction.modifier)).name;
+        char *description = format("call %s in %s", calleeName, procedureName);
+        push(statistics.tailCalls, description);
+    }
+
+    // Only the jumps inside the statement can point into it. The jmp
+    // instructions that were just added go to procedures, which all come
+    // before it.
+    forVectorPointers(statement, j, struct instruction, instruction,
+            int target = instruction->modifier;
+            if ((instruction->opcode == OP_JMP || instruction->opcode == OP_JPC)
+                    && target >= start && target <= end)
+                instruction->modifier = newAddresses[target - start];);
+
+    instructions->length = start;
+    vector_concat(instructions, statement);
+
+    freeVector(statement);
+    deallocate(newAddresses);
+    deallocate(isTailCall);
 }
 
 // Error functions
 // ===============
-struct vector *generatorErrors = NULL;
+__thread struct vector *generatorErrors = NULL;
 
-void addGeneratorError(char *errorMessage) {
+static void pushGeneratorError(struct generatorError error) {
     if (generatorErrors == NULL)
-        generatorErrors = makeVector(char*);
+        generatorErrors = makeVector(struct generatorError);
 
-    push(generatorErrors, errorMessage);
+    push(generatorErrors, error);
+}
+void addGeneratorError(char *errorMessage) {
+    pushGeneratorError((struct generatorError){errorMessage, currentLine, currentColumn});
 }
 void clearGeneratorErrors() {
     if (generatorErrors != NULL)
@@ -642,10 +1596,25 @@ void clearGeneratorErrors() {
 
     generatorErrors = NULL;
 }
+int countGeneratorErrors() {
+    if (generatorErrors == NULL)
+        return 0;
+    else
+        return generatorErrors->length;
+}
 char *getGeneratorErrors() {
     if (generatorErrors == NULL)
         return NULL;
-    else
-        return joinStrings(generatorErrors, "\n");
+
+    struct vector *messages = makeVector(char*);
+    forVector(generatorErrors, i, struct generatorError, error,
+            push(messages, error.message););
+    char *errors = joinStrings(messages, "\n");
+    freeVector(messages);
+
+    return errors;
+}
+struct vector *getGeneratorErrorList() {
+    return generatorErrors;
 }
 
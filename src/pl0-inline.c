@@ -0,0 +1,337 @@
+#include "pl0.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <string.h>
+
+// Procedure inlining
+// ==================
+// A call to a small procedure costs more than the procedure's body: cal, the
+// inc instructions that set up its frame, and the opr 0 0 that returns, on
+// top of building and tearing down the frame itself. This pass replaces calls
+// to small procedures with a copy of the procedure's body, which then runs in
+// the caller's frame.
+//
+// The generator lays out every procedure, including the main program, as
+//
+//   inc 0 4, [inc 0 <variables>], [jmp <after nested procedures>, ...],
+//   <statement>, opr 0 0
+//
+// and the statement never contains opr 0 0 or inc, so the body of a
+// procedure is everything between the last jump over nested procedures and
+// the first opr 0 0 after it.
+//
+// In the copy, a variable n levels out from the procedure is n - 1 levels out
+// from the procedure that it was declared in, which is levels levels out from
+// the caller for "cal levels address", so it is n - 1 + levels levels out from
+// the caller. The procedure's own variables move to new slots at the end of
+// the caller's frame, which the caller's first inc makes room for. Copies in
+// the same caller never run at the same time, so they share these slots.
+//
+// Only procedures that aren't recursive and don't declare procedures of their
+// own are inlined, since those are the ones that never need their own frame.
+// The copy is made from the procedure's original code, so calls inside it are
+// left as they are; generatePL0WithOptions runs the pass again for those.
+// Procedures whose calls were all inlined are removed.
+
+// Procedures with longer bodies than this are called instead of inlined.
+#define MAX_INLINED_INSTRUCTIONS 24
+
+struct inlineProcedure {
+    int entry;
+    int frameSize;      // The sum of the inc instructions at its entry.
+    int bodyStart;      // The first instruction of its statement.
+    int end;            // Its opr 0 0.
+    int nestedStart;    // The procedures declared inside it, if any, are
+    int nestedEnd;      // from nestedStart up to nestedEnd.
+    int inlinable;
+    int removed;        // True if every call to it was inlined.
+    int extraSlots;     // The slots its frame needs for inlined variables.
+};
+
+static int isReturn(struct instruction instruction) {
+    return instruction.opcode == OP_OPR && instruction.modifier == OPR_RET;
+}
+
+struct vector *inlineProcedures(struct vector *instructions,
+        struct generatorStatistics *statistics) {
+    int length = instructions->length;
+    struct vector *procedures = makeVector(struct inlineProcedure);
+    struct vector *result = NULL;
+
+    struct instruction at(int index) {
+        return get(struct instruction, instructions, index);
+    }
+
+    // The index in procedures of the procedure that starts at an address, or
+    // of the procedure that an instruction is part of.
+    int *procedureAt = allocate((length + 1) * sizeof (int));
+    int *owner = allocate((length + 1) * sizeof (int));
+    // Whether each cal is replaced by a copy of the procedure.
+    char *inlined = allocate(length + 1);
+    int *newAddresses = allocate((length + 1) * sizeof (int));
+    memset(inlined, 0, length + 1);
+    int i, j;
+    for (i = 0; i <= length; i++)
+        procedureAt[i] = owner[i] = -1;
+
+    // Finds the parts of the procedure that starts at entry, or returns false
+    // if it doesn't look like what the generator generates.
+    int findProcedure(int entry, struct inlineProcedure *procedure) {
+        *procedure = (struct inlineProcedure){entry, 0, entry, -1, entry, entry, 0, 0, 0};
+
+        int index = entry;
+        while (index < length && at(index).opcode == OP_INC && at(index).lexicalLevel == 0)
+            procedure->frameSize += at(index++).modifier;
+        if (index == entry)
+            return 0;
+
+        if (index < length && at(index).opcode == OP_JMP && at(index).modifier > index
+                && at(index).modifier <= length) {
+            procedure->nestedStart = index + 1;
+            procedure->nestedEnd = at(index).modifier;
+            index = at(index).modifier;
+        }
+
+        procedure->bodyStart = index;
+        while (index < length && !isReturn(at(index))) {
+            // Only tail calls pop the frame with inc in the statement.
+            if (at(index).opcode == OP_INC && at(index).modifier >= 0)
+                return 0;
+            index++;
+        }
+        if (index == length)
+            return 0;
+
+        procedure->end = index;
+        return 1;
+    }
+
+    int addProcedure(int entry) {
+        if (procedureAt[entry] >= 0)
+            return 1;
+
+        struct inlineProcedure procedure;
+        if (!findProcedure(entry, &procedure))
+            return 0;
+
+        procedureAt[entry] = procedures->length;
+        push(procedures, procedure);
+        return 1;
+    }
+
+    struct inlineProcedure *procedure(int index) {
+        return (struct inlineProcedure *)vector_get(procedures, index);
+    }
+
+    // Leaves the code as it is if any procedure can't be found.
+    if (length == 0 || !addProcedure(0))
+        goto done;
+    forVector(instructions, i, struct instruction, instruction,
+            if (instruction.opcode == OP_CAL) {
+                if (instruction.modifier < 0 || instruction.modifier >= length
+                        || !addProcedure(instruction.modifier))
+                    goto done;
+            });
+
+    forVectorPointers(procedures, p, struct inlineProcedure, current,
+            for (i = current->entry; i <= current->end; i++)
+                if (i < current->nestedStart || i >= current->nestedEnd)
+                    owner[i] = p;);
+
+    // Returns true if the procedure at from can end up calling the procedure
+    // at to.
+    char *visited = allocate(procedures->length);
+    int reaches(int from, int to) {
+        if (visited[from])
+            return 0;
+        visited[from] = 1;
+
+        struct inlineProcedure *p = procedure(from);
+        int index;
+        for (index = p->entry; index <= p->end; index++) {
+            if (index >= p->nestedStart && index < p->nestedEnd)
+                continue;
+            if (at(index).opcode != OP_CAL)
+                continue;
+
+            int callee = procedureAt[at(index).modifier];
+            if (callee == to || reaches(callee, to))
+                return 1;
+        }
+
+        return 0;
+    }
+
+    // Returns true if the body of the procedure can run in its caller's
+    // frame: it only jumps inside itself, only uses its own variables, and
+    // doesn't call procedures declared inside it.
+    int canRunInCaller(struct inlineProcedure *p) {
+        int index;
+        for (index = p->bodyStart; index < p->end; index++) {
+            struct instruction instruction = at(index);
+
+            if (instruction.opcode == OP_JMP || instruction.opcode == OP_JPC) {
+                if (instruction.modifier < p->bodyStart || instruction.modifier > p->end)
+                    return 0;
+            } else if (instruction.opcode == OP_CAL) {
+                if (instruction.lexicalLevel < 1)
+                    return 0;
+            } else if ((instruction.opcode == OP_LOD || instruction.opcode == OP_STO)
+                    && instruction.lexicalLevel == 0) {
+                if (instruction.modifier < 4 || instruction.modifier >= p->frameSize)
+                    return 0;
+            } else if (instruction.opcode == OP_INC
+                    || instruction.opcode < OP_LIT || instruction.opcode > OP_READ) {
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+    forVectorPointers(procedures, p, struct inlineProcedure, current,
+            memset(visited, 0, procedures->length);
+            current->inlinable = current->entry != 0
+                && current->nestedStart == current->nestedEnd
+                && current->end - current->bodyStart <= MAX_INLINED_INSTRUCTIONS
+                && canRunInCaller(current)
+                && !reaches(p, p););
+    deallocate(visited);
+
+    // Decide which calls to inline. A procedure can be removed if none of
+    // its calls are left, counting the calls in the copies, which are made
+    // from the original code. Removing a procedure removes its calls too, so
+    // this repeats until nothing changes.
+    int anyInlined = 0;
+    forVector(instructions, i, struct instruction, instruction,
+            if (instruction.opcode == OP_CAL && owner[i] >= 0
+                    && procedure(procedureAt[instruction.modifier])->inlinable) {
+                inlined[i] = 1;
+                anyInlined = 1;
+            });
+    if (!anyInlined)
+        goto done;
+
+    // Tail calls jump to procedures instead of calling them, so those can't
+    // be removed.
+    char *isJumpTarget = allocate(length + 1);
+    memset(isJumpTarget, 0, length + 1);
+    forVector(instructions, i, struct instruction, instruction,
+            if ((instruction.opcode == OP_JMP || instruction.opcode == OP_JPC)
+                    && instruction.modifier >= 0 && instruction.modifier <= length)
+                isJumpTarget[instruction.modifier] = 1;);
+    forVectorPointers(procedures, p, struct inlineProcedure, current,
+            current->removed = current->inlinable && !isJumpTarget[current->entry];);
+    deallocate(isJumpTarget);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        int *calls = allocate(procedures->length * sizeof (int));
+        memset(calls, 0, procedures->length * sizeof (int));
+
+        forVector(instructions, i, struct instruction, instruction,
+            if (instruction.opcode != OP_CAL || owner[i] < 0 || procedure(owner[i])->removed)
+                continue;
+            struct inlineProcedure *callee = procedure(procedureAt[instruction.modifier]);
+            if (!inlined[i]) {
+                calls[procedureAt[instruction.modifier]] += 1;
+                continue;
+            }
+            for (j = callee->bodyStart; j < callee->end; j++)
+                if (at(j).opcode == OP_CAL)
+                    calls[procedureAt[at(j).modifier]] += 1;);
+
+        forVectorPointers(procedures, p, struct inlineProcedure, current,
+                if (current->removed && calls[p] > 0) {
+                    current->removed = 0;
+                    changed = 1;
+                });
+        deallocate(calls);
+    }
+
+    // Make room in each caller for the variables of the procedures inlined
+    // into it.
+    forVector(instructions, i, struct instruction, instruction,
+            if (inlined[i]) {
+                struct inlineProcedure *caller = procedure(owner[i]);
+                struct inlineProcedure *callee = procedure(procedureAt[instruction.modifier]);
+                if (callee->frameSize - 4 > caller->extraSlots)
+                    caller->extraSlots = callee->frameSize - 4;
+            });
+
+    result = makeVector(struct instruction);
+    // Whether each instruction in result still has an old code address.
+    struct vector *relocate = makeVector(char);
+
+    void add(struct instruction instruction, char needsRelocation) {
+        push(result, instruction);
+        push(relocate, needsRelocation);
+    }
+
+    for (i = 0; i < length; i++) {
+        struct instruction instruction = at(i);
+        newAddresses[i] = result->length;
+
+        if (owner[i] >= 0 && procedure(owner[i])->removed)
+            continue;
+
+        if (!inlined[i]) {
+            // Grow the caller's frame for the inlined variables, and pop them
+            // too in its tail calls.
+            if (procedureAt[i] >= 0 && instruction.opcode == OP_INC)
+                instruction.modifier += procedure(procedureAt[i])->extraSlots;
+            else if (owner[i] >= 0 && instruction.opcode == OP_INC && instruction.modifier < 0)
+                instruction.modifier -= procedure(owner[i])->extraSlots;
+            add(instruction, hasCodeAddress(instruction.opcode));
+            continue;
+        }
+
+        struct inlineProcedure *caller = procedure(owner[i]);
+        struct inlineProcedure *callee = procedure(procedureAt[instruction.modifier]);
+        int levels = instruction.lexicalLevel;
+        int start = result->length;
+
+        for (j = callee->bodyStart; j < callee->end; j++) {
+            struct instruction copy = at(j);
+
+            if (copy.opcode == OP_JMP || copy.opcode == OP_JPC) {
+                copy.modifier = start + (copy.modifier - callee->bodyStart);
+                add(copy, 0);
+                continue;
+            }
+
+            // canRunInCaller checked that calls are at least one level out.
+            if (copy.opcode == OP_LOD || copy.opcode == OP_STO || copy.opcode == OP_CAL) {
+                if (copy.lexicalLevel > 0)
+                    copy.lexicalLevel += levels - 1;
+                else
+                    copy.modifier = caller->frameSize + (copy.modifier - 4);
+            }
+            add(copy, copy.opcode == OP_CAL);
+        }
+
+        statistics->callsInlined += 1;
+        // cal, the inc instructions and opr 0 0.
+        statistics->callInstructionsSaved += (callee->bodyStart - callee->entry) + 2;
+    }
+    newAddresses[length] = result->length;
+
+    forVectorPointers(result, i, struct instruction, instruction,
+            if (get(char, relocate, i))
+                instruction->modifier = newAddresses[instruction->modifier];);
+    freeVector(relocate);
+
+done:
+    if (result == NULL) {
+        result = makeVector(struct instruction);
+        vector_concat(result, instructions);
+    }
+
+    deallocate(procedureAt);
+    deallocate(owner);
+    deallocate(inlined);
+    deallocate(newAddresses);
+    freeVector(procedures);
+
+    return result;
+}
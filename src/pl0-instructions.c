@@ -0,0 +1,132 @@
+#include "pl0.h"
+#include "lib/vector.h"
+#include <stdio.h>
+#include <string.h>
+
+// The names of the opcodes, indexed by opcode.
+static char *opcodeNames[] = {NULL, "lit", "opr", "lod", "sto", "cal", "inc", "jmp", "jpc",
+    "write", "read", "lop", "cjp", "lcj", "llo", "inv", "wrv", "rdv", "stl", "ext",
+    "lodd", "stod", "cald", "retd"};
+
+int getOpcode(char *instruction) {
+    int opcode;
+    for (opcode = 1; opcode < OPCODE_COUNT; opcode++)
+        if (strcmp(instruction, opcodeNames[opcode]) == 0)
+            return opcode;
+
+    return 0;
+}
+
+char *getOpcodeName(int opcode) {
+    if (opcode < 1 || opcode >= OPCODE_COUNT)
+        return NULL;
+
+    return opcodeNames[opcode];
+}
+
+void printInstructions(struct vector *instructions, int humanReadable) {
+    forVector(instructions, i, struct instruction, instruction,
+        int lineNumber = i;
+        if (humanReadable)
+            printf("%3d %-5s %-3d %-3d\n", lineNumber, instruction.opcodeName,
+                    instruction.lexicalLevel, instruction.modifier);
+        else
+            printf("%d %d %d\n", instruction.opcode,
+                    instruction.lexicalLevel, instruction.modifier););
+}
+
+struct vector *readInstructions(FILE *file) {
+    int stackBound;
+    return readInstructionsWithStackBound(file, &stackBound);
+}
+
+struct vector *readInstructionsWithStackBound(FILE *file, int *stackBound) {
+    // A line that doesn't start with "stack" is left for the instructions.
+    *stackBound = -1;
+    if (fscanf(file, " stack %d", stackBound) != 1)
+        *stackBound = -1;
+
+    struct vector *instructions = makeVector(struct instruction);
+
+    int opcode, lexicalLevel, modifier, count;
+    while ((count = fscanf(file, "%d %d %d", &opcode, &lexicalLevel, &modifier)) == 3) {
+        char *opcodeName = getOpcodeName(opcode);
+        if (opcodeName == NULL) {
+            freeVector(instructions);
+            return NULL;
+        }
+
+        pushLiteral(instructions, struct instruction,
+                {opcode, opcodeName, lexicalLevel, modifier});
+    }
+
+    // A line that starts with "lines" is the line table.
+    struct vector *lineTable = NULL;
+    char word[sizeof "lines"];
+    if (count == 0 && fscanf(file, "%5s", word) == 1 && strcmp(word, "lines") == 0) {
+        lineTable = makeVector(int);
+        int value;
+        while ((count = fscanf(file, "%d", &value)) == 1)
+            push(lineTable, value);
+    }
+
+    int valid = (count == EOF && (lineTable == NULL || applyLineTable(instructions, lineTable)));
+    if (lineTable != NULL)
+        freeVector(lineTable);
+    if (!valid) {
+        freeVector(instructions);
+        return NULL;
+    }
+
+    return instructions;
+}
+
+struct vector *makeLineTable(struct vector *instructions) {
+    struct vector *lineTable = makeVector(int);
+    int runLength = 0, runLine = 0, previousLine = 0;
+
+    void addRun() {
+        if (runLength == 0)
+            return;
+        push(lineTable, runLength);
+        pushLiteral(lineTable, int, runLine - previousLine);
+        previousLine = runLine;
+    }
+
+    forVector(instructions, i, struct instruction, instruction,
+        if (runLength > 0 && instruction.line == runLine) {
+            runLength++;
+        } else {
+            addRun();
+            runLength = 1;
+            runLine = instruction.line;
+        });
+    addRun();
+
+    return lineTable;
+}
+
+void printLineTable(struct vector *lineTable) {
+    printf("lines");
+    forVector(lineTable, i, int, value,
+            printf(" %d", value););
+    printf("\n");
+}
+
+int applyLineTable(struct vector *instructions, struct vector *lineTable) {
+    if (lineTable->length % 2 != 0)
+        return 0;
+
+    int address = 0, line = 0, i;
+    for (i = 0; i < lineTable->length; i += 2) {
+        int runLength = get(int, lineTable, i);
+        line += get(int, lineTable, i + 1);
+        if (runLength <= 0 || runLength > instructions->length - address)
+            return 0;
+
+        for (; runLength > 0; runLength--, address++)
+            get(struct instruction, instructions, address).line = line;
+    }
+
+    return address == instructions->length;
+}
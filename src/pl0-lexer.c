@@ -346,6 +346,9 @@ void yyfree (void *  );
 
 /* Begin user sect3 */
 
+#define yywrap() 1
+#define YY_SKIP_YYWRAP
+
 typedef unsigned char YY_CHAR;
 
 FILE *yyin = (FILE *) 0, *yyout = (FILE *) 0;
@@ -516,18 +519,34 @@ char *yytext;
 // Code to go before the code generated by flex.
 #include "lib/vector.h"
 #include "lib/lexer.h"
+#include "lib/memory.h"
 #include "pl0.h"
 
 struct vector *pl0Tokens;
 char *pl0Source;
+size_t pl0SourceLength;   // The number of characters left to read in pl0Source.
+// The column that the text that flex just matched starts at, and the column
+// after it. Columns start at 1, like lines.
+int pl0Column, pl0NextColumn;
 
 // Adds a token to the vector of tokens that readPL0Tokens returns.
 void addToken(char *type, char *token, int line) {
     // We need to make copies of the strings because flex might later change
     // the contents of the string that yytext points to, so we want to keep the
     // current state of the string when addToken was called.
-    pushLiteral(pl0Tokens, struct token, {strdup(type), strdup(token), line});
+    pushLiteral(pl0Tokens, struct token, {copyString(type), copyString(token), line, pl0Column});
+}
+
+// Flex runs YY_USER_ACTION before the action of every rule, including the
+// ones that match newlines, comments and whitespace, so it sees every
+// character of the source code.
+void updateColumn(char *text, int length) {
+    pl0Column = pl0NextColumn;
+    int i;
+    for (i = 0; i < length; i++)
+        pl0NextColumn = (text[i] == '\n') ? 1 : pl0NextColumn + 1;
 }
+#define YY_USER_ACTION updateColumn(yytext, yyleng);
 
 #define ECHO // Stop the generated lexer code from outputing anything.
 
@@ -535,17 +554,17 @@ void addToken(char *type, char *token, int line) {
 #define min(x, y) ((x) < (y) ? (x) : (y))
 #define YY_INPUT(buf, num_read, max_size)\
 {\
-    int length = strlen(pl0Source);\
-    if (length == 0) {\
+    if (pl0SourceLength == 0) {\
         num_read = YY_NULL;\
     } else {\
-        num_read = min(length, max_size);\
+        num_read = min(pl0SourceLength, (size_t)max_size);\
         memcpy(buf, pl0Source, num_read);\
         pl0Source += num_read;\
+        pl0SourceLength -= num_read;\
     }\
 }
 /* Definitions for use in rules section below. */
-#line 549 "pl0-lexer.c"
+#line 568 "pl0-lexer.c"
 
 #define INITIAL 0
 
@@ -727,11 +746,11 @@ YY_DECL
 	register char *yy_cp, *yy_bp;
 	register int yy_act;
     
-#line 43 "pl0-vector.l"
+#line 60 "pl0-vector.l"
 
     /* Rules section. */
 
-#line 735 "pl0-lexer.c"
+#line 754 "pl0-lexer.c"
 
 	if ( !(yy_init) )
 		{
@@ -827,36 +846,36 @@ do_action:	/* This label is used only to access EOF actions. */
 case 1:
 /* rule 1 can match eol */
 YY_RULE_SETUP
-#line 46 "pl0-vector.l"
+#line 63 "pl0-vector.l"
 /* For some reason, this rule must be here to make flex update yylineno. */
 	YY_BREAK
 case 2:
 YY_RULE_SETUP
-#line 47 "pl0-vector.l"
+#line 64 "pl0-vector.l"
 addToken("number-token", yytext, yylineno);
 	YY_BREAK
 case 3:
 /* rule 3 can match eol */
 YY_RULE_SETUP
-#line 48 "pl0-vector.l"
+#line 65 "pl0-vector.l"
 /* Ignore comments. */
 	YY_BREAK
 case 4:
 YY_RULE_SETUP
-#line 49 "pl0-vector.l"
+#line 66 "pl0-vector.l"
 addToken(yytext, yytext, yylineno); /* Tokens that don't have any special information associated with them, unlike numbers and identifiers. */
 	YY_BREAK
 case 5:
 YY_RULE_SETUP
-#line 50 "pl0-vector.l"
+#line 67 "pl0-vector.l"
 addToken("identifier-token", yytext, yylineno);
 	YY_BREAK
 case 6:
 YY_RULE_SETUP
-#line 52 "pl0-vector.l"
+#line 69 "pl0-vector.l"
 ECHO;
 	YY_BREAK
-#line 860 "pl0-lexer.c"
+#line 879 "pl0-lexer.c"
 case YY_STATE_EOF(INITIAL):
 	yyterminate();
 
@@ -1862,7 +1881,7 @@ void yyfree (void * ptr )
 
 #define YYTABLES_NAME "yytables"
 
-#line 52 "pl0-vector.l"
+#line 69 "pl0-vector.l"
 
 
 // Code to go after the code generated by flex.
@@ -1870,13 +1889,23 @@ void yyfree (void * ptr )
 // Generate a function that takes a string of PL/0 source code uses the code
 // generated by flex to read the string and make a vector of token structs.
 struct vector *readPL0Tokens(char *source) {
-    // Assign the argument and result to global variables so that the code
+    return readPL0TokensWithLength(source, strlen(source));
+}
+
+struct vector *readPL0TokensWithLength(char *source, size_t length) {
+    // Assign the arguments and result to global variables so that the code
     // generated by flex can access them.
     pl0Source = source;
+    pl0SourceLength = length;
     pl0Tokens = makeVector(struct token);
+    pl0NextColumn = 1;
 
     yylex();
 
+    // Free flex's buffers and reset its state (including yylineno), so that
+    // readPL0Tokens can be called again with a different string.
+    yylex_destroy();
+
     return pl0Tokens;
 }
 
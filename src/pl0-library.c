@@ -0,0 +1,115 @@
+#include "libpl0.h"
+#include "pl0.h"
+#include "lib/lexer.h"
+#include "lib/parser.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+struct pl0_context {
+    // Holds everything allocated by the context's last compilation.
+    struct arena *arena;
+};
+
+struct pl0_context *pl0_create_context(void) {
+    struct pl0_context *context = malloc(sizeof (struct pl0_context));
+    if (context == NULL)
+        return NULL;
+
+    context->arena = makeArena();
+
+    return context;
+}
+
+void pl0_free_context(struct pl0_context *context) {
+    if (context == NULL)
+        return;
+
+    freeArena(context->arena);
+    free(context);
+}
+
+// The lexer is generated by flex, and keeps its state in global variables.
+// Everything after it (the parser, the generator, and the arena that they
+// allocate from) keeps its state per thread, and pl0_compile resets it for
+// each compilation, so only lexing has to wait for other threads.
+static pthread_mutex_t lexerLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns the diagnostic for a parser error at the token with the given
+// index, which can be past the end of the input.
+struct pl0_diagnostic getParserDiagnostic(struct vector *tokens, struct parserError error) {
+    struct pl0_diagnostic diagnostic = {PL0_PHASE_PARSER, 0, 0, error.message};
+    if (tokens->length == 0)
+        return diagnostic;
+
+    int tokenIndex = error.tokenIndex;
+    if (tokenIndex >= tokens->length)
+        tokenIndex = tokens->length - 1;
+    else if (tokenIndex < 0)
+        tokenIndex = 0;
+
+    diagnostic.line = get(struct token, tokens, tokenIndex).line;
+    diagnostic.column = get(struct token, tokens, tokenIndex).column;
+    return diagnostic;
+}
+
+int pl0_compile(struct pl0_context *context, const char *source, size_t length,
+        struct pl0_output *output) {
+    // The parser and generator keep their errors in thread-local vectors,
+    // which would point into the arena after it's reset.
+    clearParserErrors();
+    clearGeneratorErrors();
+
+    // Free everything from the last compilation, now that its output is no
+    // longer needed, and allocate everything for this one from the arena.
+    resetArena(context->arena);
+    struct arena *previousArena = useArena(context->arena);
+
+    int status = PL0_OK;
+    struct vector *diagnostics = makeVector(struct pl0_diagnostic);
+    struct vector *instructions = makeVector(struct pl0_instruction);
+
+    pthread_mutex_lock(&lexerLock);
+    struct vector *tokens = readPL0TokensWithLength((char*)source, length);
+    pthread_mutex_unlock(&lexerLock);
+    struct parseTree tree = parsePL0Tokens(tokens);
+
+    if (isParseTreeError(tree)) {
+        status = PL0_PARSER_ERROR;
+        forVector(getParserErrorList(), i, struct parserError, error,
+                pushLiteral(diagnostics, struct pl0_diagnostic,
+                    getParserDiagnostic(tokens, error)););
+    } else {
+        struct vector *generatedInstructions = generatePL0(tree);
+
+        if (getGeneratorErrorList() != NULL) {
+            status = PL0_GENERATOR_ERROR;
+            forVector(getGeneratorErrorList(), i, struct generatorError, error,
+                    pushLiteral(diagnostics, struct pl0_diagnostic,
+                        {PL0_PHASE_GENERATOR, error.line, error.column, error.message}););
+        } else {
+            forVector(generatedInstructions, i, struct instruction, instruction,
+                    pushLiteral(instructions, struct pl0_instruction,
+                        {instruction.opcode, instruction.lexicalLevel, instruction.modifier}););
+        }
+    }
+
+    // Every error should have a message, but make sure that a failed
+    // compilation never looks like it succeeded with no instructions.
+    if (status != PL0_OK && diagnostics->length == 0) {
+        pushLiteral(diagnostics, struct pl0_diagnostic,
+                {status == PL0_PARSER_ERROR ? PL0_PHASE_PARSER : PL0_PHASE_GENERATOR, 0, 0,
+                "Compilation failed."});
+    }
+
+    output->instructions = instructions->items;
+    output->instruction_count = instructions->length;
+    output->diagnostics = diagnostics->items;
+    output->diagnostic_count = diagnostics->length;
+
+    useArena(previousArena);
+
+    return status;
+}
@@ -0,0 +1,277 @@
+#include "pl0.h"
+#include "lib/vector.h"
+#include "lib/util.h"
+#include "lib/hash.h"
+#include "lib/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Objects are text files that look like:
+//
+// pl0-object 1
+// display 0
+// globals 1
+// statement 4
+// exports 3
+// constant size 10
+// variable total 4
+// procedure square 3
+// code 13
+// 6 0 4 0
+// 6 0 1 0
+// 7 0 8 1
+// ...
+// 5 0 0 2 print
+//
+// After the header are the object's fields and its exports, and the
+// instructions are in the same format as in the procedure cache (see
+// pl0-cache.c), without the lines and columns: an opcode, lexical level,
+// modifier and relocation type, followed by the symbol's name for
+// RELOCATE_SYMBOL instructions. A line table couldn't tell the lines of one
+// module from another's, so linked programs don't have one.
+#define OBJECT_HEADER "pl0-object 1"
+
+// The longest symbol name that objects can have.
+#define MAX_SYMBOL_LENGTH 255
+
+// The names of the OBJECT_* symbol types.
+static char *symbolTypeNames[] = {NULL, "procedure", "variable", "constant"};
+
+void printPL0Object(struct pl0Object *object) {
+    printf("%s\n", OBJECT_HEADER);
+    printf("display %d\n", object->display);
+    printf("globals %d\n", object->globals);
+    printf("statement %d\n", object->statementSize);
+
+    printf("exports %d\n", object->exports->length);
+    forVector(object->exports, i, struct objectSymbol, export,
+            printf("%s %s %d\n", symbolTypeNames[export.type], export.name, export.value););
+
+    printf("code %d\n", object->code->length);
+    forVector(object->code, i, struct cachedInstruction, cached,
+        struct instruction instruction = cached.instruction;
+        printf("%d %d %d %d", instruction.opcode, instruction.lexicalLevel,
+                instruction.modifier, cached.relocation);
+        if (cached.relocation == RELOCATE_SYMBOL)
+            printf(" %s", cached.symbol);
+        printf("\n"););
+}
+
+struct pl0Object *readPL0Object(FILE *file, char *name) {
+    struct pl0Object *object = allocate(sizeof (struct pl0Object));
+    object->name = name;
+    object->code = makeVector(struct cachedInstruction);
+    object->exports = makeVector(struct objectSymbol);
+
+    char header[sizeof OBJECT_HEADER + 1];
+    int exports, count;
+    int valid = (fgets(header, sizeof header, file) != NULL
+            && strncmp(header, OBJECT_HEADER, strlen(OBJECT_HEADER)) == 0
+            && fscanf(file, " display %d globals %d statement %d exports %d", &object->display,
+                &object->globals, &object->statementSize, &exports) == 4
+            && exports >= 0);
+
+    int i;
+    for (i = 0; valid && i < exports; i++) {
+        char type[sizeof "procedure"], symbol[MAX_SYMBOL_LENGTH + 1];
+        struct objectSymbol export;
+
+        if (fscanf(file, "%9s %255s %d", type, symbol, &export.value) != 3) {
+            valid = 0;
+            break;
+        }
+
+        export.name = copyString(symbol);
+        export.type = 0;
+        int j;
+        for (j = OBJECT_PROCEDURE; j <= OBJECT_CONSTANT; j++)
+            if (strcmp(type, symbolTypeNames[j]) == 0)
+                export.type = j;
+        valid = (export.type != 0);
+
+        push(object->exports, export);
+    }
+
+    valid = valid && fscanf(file, " code %d", &count) == 1 && count >= 0;
+
+    for (i = 0; valid && i < count; i++) {
+        struct cachedInstruction cached = {{0, NULL, 0, 0}, RELOCATE_NONE, NULL};
+        struct instruction *instruction = &cached.instruction;
+
+        if (fscanf(file, "%d %d %d %d", &instruction->opcode, &instruction->lexicalLevel,
+                    &instruction->modifier, &cached.relocation) != 4) {
+            valid = 0;
+            break;
+        }
+
+        instruction->opcodeName = getOpcodeName(instruction->opcode);
+        if (instruction->opcodeName == NULL)
+            valid = 0;
+
+        if (cached.relocation == RELOCATE_SYMBOL) {
+            char symbol[MAX_SYMBOL_LENGTH + 1];
+            if (fscanf(file, "%255s", symbol) == 1)
+                cached.symbol = copyString(symbol);
+            else
+                valid = 0;
+        } else if (cached.relocation != RELOCATE_NONE && cached.relocation != RELOCATE_BLOCK
+                && cached.relocation != RELOCATE_GLOBAL) {
+            valid = 0;
+        }
+
+        push(object->code, cached);
+    }
+
+    if (!valid) {
+        freeVector(object->code);
+        freeVector(object->exports);
+        deallocate(object);
+        return NULL;
+    }
+
+    return object;
+}
+
+// Linking
+// =======
+// The objects' code goes one after another, starting with the main program,
+// so that the linked program starts with the main program's code. Their
+// variables go one after another in the main program's frame, so its first
+// inc instruction makes room for the other objects' variables. The exports of
+// all of the objects go in a hash table, and the addresses in each object
+// are then relocated: RELOCATE_BLOCK and RELOCATE_GLOBAL addresses move with
+// the object's code and variables, and RELOCATE_SYMBOL ones get the address
+// of the procedure or variable that they name, or the value of the constant.
+
+// An exported symbol, with its address in the linked program.
+struct linkedSymbol {
+    struct objectSymbol symbol;
+    struct pl0Object *object;
+};
+
+static struct vector *linkerErrors = NULL;
+
+static void addLinkerError(char *errorMessage) {
+    if (linkerErrors == NULL)
+        linkerErrors = makeVector(char*);
+
+    push(linkerErrors, errorMessage);
+}
+
+struct vector *linkPL0Objects(struct vector *objects) {
+    if (linkerErrors != NULL)
+        freeVector(linkerErrors);
+    linkerErrors = NULL;
+
+    if (objects->length == 0) {
+        addLinkerError("There are no objects to link.");
+        return NULL;
+    }
+
+    // Where each object's code starts, and how far its variables move.
+    struct pl0Object *program = get(struct pl0Object *, objects, 0);
+    int *starts = allocate(objects->length * sizeof (int));
+    int *globalStarts = allocate(objects->length * sizeof (int));
+    int length = 0, globals = 0, exports = 0;
+    forVector(objects, i, struct pl0Object *, object,
+        starts[i] = length;
+        globalStarts[i] = globals;
+        length += object->code->length;
+        globals += object->globals;
+        exports += object->exports->length;
+
+        if (object->display != program->display)
+            addLinkerError(format("%s uses the display, but %s doesn't.",
+                        object->display ? object->name : program->name,
+                        object->display ? program->name : object->name));
+        if (i > 0 && object->statementSize > 0)
+            addLinkerError(format("%s: only the main program can have a statement.", object->name)););
+
+    // An open addressing hash table of the exports, at most half full.
+    int capacity = 16;
+    while (capacity < 2 * exports)
+        capacity *= 2;
+    struct linkedSymbol *table = allocate(capacity * sizeof (struct linkedSymbol));
+    memset(table, 0, capacity * sizeof (struct linkedSymbol));
+
+    struct linkedSymbol *find(char *name) {
+        int slot = hashString(HASH_SEED, name) & (capacity - 1);
+        while (table[slot].symbol.name != NULL && strcmp(table[slot].symbol.name, name) != 0)
+            slot = (slot + 1) & (capacity - 1);
+        return &table[slot];
+    }
+
+    forVector(objects, i, struct pl0Object *, object,
+        forVector(object->exports, j, struct objectSymbol, export,
+            struct linkedSymbol *linked = find(export.name);
+            if (linked->symbol.name != NULL) {
+                addLinkerError(format("'%s' is exported by both %s and %s.", export.name,
+                            linked->object->name, object->name));
+                continue;
+            }
+
+            if (export.type == OBJECT_PROCEDURE)
+                export.value += starts[i];
+            else if (export.type == OBJECT_VARIABLE)
+                export.value += globalStarts[i];
+            *linked = (struct linkedSymbol){export, object};););
+
+    struct vector *instructions = makeVector(struct instruction);
+    vector_resize(instructions, length);
+    forVector(objects, i, struct pl0Object *, object,
+        forVector(object->code, j, struct cachedInstruction, cached,
+            struct instruction instruction = cached.instruction;
+
+            if (cached.relocation == RELOCATE_BLOCK) {
+                instruction.modifier += starts[i];
+            } else if (cached.relocation == RELOCATE_GLOBAL) {
+                instruction.modifier += globalStarts[i];
+            } else if (cached.relocation == RELOCATE_SYMBOL) {
+                struct linkedSymbol *linked = find(cached.symbol);
+                int type = linked->symbol.type;
+                int isCall = hasCodeAddress(instruction.opcode);
+                int isLoad = instruction.opcode == OP_LOD || instruction.opcode == OP_LOD_DISPLAY;
+
+                if (linked->symbol.name == NULL)
+                    addLinkerError(format("%s: '%s' isn't declared in any object.",
+                                object->name, cached.symbol));
+                else if (isCall != (type == OBJECT_PROCEDURE)
+                        || (type == OBJECT_CONSTANT && !isLoad))
+                    addLinkerError(format("%s: '%s' can't be used that way, because it's a %s in %s.",
+                                object->name, cached.symbol, symbolTypeNames[type],
+                                linked->object->name));
+                else if (type == OBJECT_CONSTANT)
+                    instruction = (struct instruction){OP_LIT, getOpcodeName(OP_LIT), 0,
+                        linked->symbol.value};
+                else
+                    instruction.modifier = linked->symbol.value;
+            }
+
+            push(instructions, instruction);););
+
+    // Make room for the other objects' variables in the main program's
+    // frame.
+    if (instructions->length > 0 && get(struct instruction, instructions, 0).opcode == OP_INC)
+        get(struct instruction, instructions, 0).modifier += globals - program->globals;
+    else if (globals > program->globals)
+        addLinkerError(format("%s doesn't start with an inc instruction.", program->name));
+
+    deallocate(table);
+    deallocate(globalStarts);
+    deallocate(starts);
+
+    if (linkerErrors != NULL) {
+        freeVector(instructions);
+        return NULL;
+    }
+
+    return instructions;
+}
+
+char *getLinkerErrors() {
+    if (linkerErrors == NULL)
+        return NULL;
+    else
+        return joinStrings(linkerErrors, "\n");
+}
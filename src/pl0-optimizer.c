@@ -0,0 +1,1566 @@
+#include "pl0.h"
+#include "lib/parser.h"
+#include "lib/memory.h"
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+
+// Mid-level optimizer
+// ===================
+// The optimizer builds an intermediate representation of each procedure from
+// the parse tree: a control-flow graph of basic blocks, split at if and while
+// statements, whose values are in SSA form. The passes work on that, and then
+// it's lowered back to stack code with the same layout as the generator's (see
+// pl0-inline.c), so that inlining and superinstructions still work on it.
+//
+// The variables of a procedure that none of its nested procedures use live in
+// SSA values instead of the stack frame. These are built with the algorithm
+// from Braun et al., "Simple and Efficient Construction of Static Single
+// Assignment Form": each block remembers the latest value of each variable,
+// and reading a variable that a block doesn't define looks in the block's
+// predecessors, adding a phi where they meet. Other procedures can change the
+// rest of the variables, so those are read and written with SSA_LOAD and
+// SSA_STORE, and calls are assumed to change all of them.
+//
+// Like the register backend, the optimizer walks the parse tree in the same
+// order as the generator, so that expressions are evaluated in the same order
+// and with the same grouping. It's only run on programs that the generator
+// generated without errors, so it doesn't check for errors itself. Reading a
+// variable before anything is assigned to it gives 0.
+
+// Value kinds.
+enum {
+    SSA_CONSTANT = 1,
+    SSA_COPY,       // The value of left, for assignments.
+    SSA_PHI,
+    SSA_OPERATOR,   // opr with the modifier in operator, on left and right.
+    SSA_LOAD,       // Reads a variable from the stack.
+    SSA_STORE,      // Writes left to a variable on the stack.
+    SSA_CALL,
+    SSA_READ,
+    SSA_WRITE       // Writes left.
+};
+
+// How a block ends.
+enum { SSA_JUMP = 1, SSA_BRANCH, SSA_RETURN };
+
+struct ssaValue {
+    int kind;
+    int block;        // -1 for constants, which aren't in any block.
+    int operator;     // The opr modifier for SSA_OPERATOR, or the value of
+                      // SSA_CONSTANT.
+    int left, right;  // Operands, or -1.
+    int level;        // For SSA_LOAD, SSA_STORE and SSA_CALL, the lexical
+    int index;        // level and index of the symbol. For SSA_PHI, the
+                      // variable.
+    struct vector *operands;   // For SSA_PHI, one for each predecessor.
+    int removed;
+    int replacement;  // The value that replaced this one, or -1.
+    int line;         // Where the statement that the value is from starts,
+    int column;       // for the instructions that compute it.
+};
+
+struct ssaBlock {
+    struct vector *phis;           // Value indexes.
+    struct vector *values;         // Value indexes, in order.
+    struct vector *predecessors;   // Block indexes.
+    int terminator;
+    int condition;    // For SSA_BRANCH.
+    int targets[2];   // The block to jump to, or for SSA_BRANCH, the blocks
+                      // for a nonzero and a zero condition.
+    int sealed;       // True once all of its predecessors are known.
+    int *definitions; // The latest value of each variable in the block, or -1.
+    int removed;
+    int splitFrom;    // For blocks added on the edges out of a branch, the
+                      // block with the branch, otherwise -1.
+};
+
+struct optimizerSymbol {
+    char *name;
+    int type;         // VARIABLE, CONSTANT or PROCEDURE.
+    int level;        // The lexical level of the symbol.
+    int index;        // The index of a variable or procedure, or the value of
+                      // a constant.
+};
+// Symbol types
+enum { VARIABLE = 1, CONSTANT, PROCEDURE };
+
+struct optimizerProcedure {
+    int level;
+    int parent;               // -1 for the main program.
+    struct vector *symbols;   // optimizerSymbol structs.
+    struct vector *nested;    // The procedures declared in it.
+    int variableCount;
+    char *captured;           // Whether a nested procedure uses each variable.
+    struct vector *values;    // ssaValue structs.
+    struct vector *blocks;    // ssaBlock structs. The first one is the entry.
+    int exit;                 // The block that returns, which comes last.
+    int address;              // Set when it's lowered.
+    int *variableAddresses;   // The offset in the frame of each captured
+                              // variable, set when it's lowered.
+    int line;                 // Where its block starts, for the code that
+    int column;               // isn't part of a statement.
+};
+
+struct optimizerState {
+    struct vector *procedures;   // optimizerProcedure structs. The first one
+                                 // is the main program.
+    int procedure;               // The procedure being built.
+    int block;                   // The block being built.
+    struct generatorOptions options;
+    struct vector *instructions;
+};
+
+// Defined in pl0-generator.c.
+struct instruction makeInstruction(char *instruction, int lexicalLevel, int modifier);
+
+// The location of the statement being built, which addValue gives to the
+// values.
+static __thread int buildLine = 0, buildColumn = 0;
+
+void buildBlock(struct parseTree tree, struct optimizerState *state);
+void buildStatement(struct parseTree tree, struct optimizerState *state);
+int buildCondition(struct parseTree tree, struct optimizerState *state);
+int buildExpression(struct parseTree tree, struct optimizerState *state);
+int buildTerm(struct parseTree tree, struct optimizerState *state);
+int buildFactor(struct parseTree tree, struct optimizerState *state);
+
+// Helper functions
+// ================
+static struct optimizerProcedure *getProcedure(struct optimizerState *state, int index) {
+    return (struct optimizerProcedure *)vector_get(state->procedures, index);
+}
+
+static struct ssaValue *getValue(struct optimizerProcedure *procedure, int index) {
+    return (struct ssaValue *)vector_get(procedure->values, index);
+}
+
+static struct ssaBlock *getBlock(struct optimizerProcedure *procedure, int index) {
+    return (struct ssaBlock *)vector_get(procedure->blocks, index);
+}
+
+static void removeFromVector(struct vector *vector, int index) {
+    char *items = vector->items;
+    memmove(items + index * vector->itemSize, items + (index + 1) * vector->itemSize,
+            (vector->length - index - 1) * vector->itemSize);
+    vector->length -= 1;
+}
+
+static int findInVector(struct vector *vector, int item) {
+    forVector(vector, i, int, current,
+            if (current == item)
+                return i;);
+
+    return -1;
+}
+
+static int addValue(struct optimizerProcedure *procedure, int block, int kind, int operator,
+        int left, int right) {
+    int index = procedure->values->length;
+    pushLiteral(procedure->values, struct ssaValue,
+            {kind, block, operator, left, right, 0, 0, NULL, 0, -1, buildLine, buildColumn});
+
+    if (block >= 0) {
+        struct ssaBlock *current = getBlock(procedure, block);
+        if (kind == SSA_PHI)
+            push(current->phis, index);
+        else
+            push(current->values, index);
+    }
+
+    return index;
+}
+
+static int addConstant(struct optimizerProcedure *procedure, int value) {
+    return addValue(procedure, -1, SSA_CONSTANT, value, -1, -1);
+}
+
+// Adds an SSA_LOAD, SSA_STORE or SSA_CALL of the given symbol.
+static int addAccess(struct optimizerProcedure *procedure, int block, int kind, int left,
+        struct optimizerSymbol *symbol) {
+    int index = addValue(procedure, block, kind, 0, left, -1);
+    getValue(procedure, index)->level = symbol->level;
+    getValue(procedure, index)->index = symbol->index;
+
+    return index;
+}
+
+static int addBlock(struct optimizerProcedure *procedure) {
+    int *definitions = allocate((procedure->variableCount + 1) * sizeof (int));
+    int i;
+    for (i = 0; i < procedure->variableCount; i++)
+        definitions[i] = -1;
+
+    pushLiteral(procedure->blocks, struct ssaBlock, {makeVector(int), makeVector(int),
+            makeVector(int), 0, -1, {-1, -1}, 0, definitions, 0, -1});
+
+    return procedure->blocks->length - 1;
+}
+
+static void setTerminator(struct optimizerProcedure *procedure, int block, int terminator,
+        int condition, int ifTrue, int ifFalse) {
+    struct ssaBlock *current = getBlock(procedure, block);
+    current->terminator = terminator;
+    current->condition = condition;
+    current->targets[0] = ifTrue;
+    current->targets[1] = ifFalse;
+}
+
+static void addEdge(struct optimizerProcedure *procedure, int from, int to) {
+    push(getBlock(procedure, to)->predecessors, from);
+}
+
+static void addJump(struct optimizerProcedure *procedure, int from, int to) {
+    setTerminator(procedure, from, SSA_JUMP, -1, to, -1);
+    addEdge(procedure, from, to);
+}
+
+// Returns the number of blocks that the block can go to next, and puts them
+// in successors.
+static int getSuccessors(struct ssaBlock *block, int successors[2]) {
+    successors[0] = block->targets[0];
+    successors[1] = block->targets[1];
+
+    if (block->terminator == SSA_BRANCH)
+        return 2;
+    return (block->terminator == SSA_JUMP) ? 1 : 0;
+}
+
+// Removes one edge from from to to, along with the phi operands for it.
+static void removeEdge(struct optimizerProcedure *procedure, int from, int to) {
+    struct ssaBlock *target = getBlock(procedure, to);
+    int index = findInVector(target->predecessors, from);
+    if (index < 0)
+        return;
+
+    removeFromVector(target->predecessors, index);
+    forVector(target->phis, i, int, phi,
+            removeFromVector(getValue(procedure, phi)->operands, index););
+}
+
+static int getNumberValue(struct parseTree factor) {
+    int value = atoi(getFirstChild(getChild(factor, "@number")).name);
+    struct parseTree sign = getChild(factor, "@sign");
+
+    if (sign.children != NULL && sign.children->length > 0
+            && strcmp(getFirstChild(sign).name, "-") == 0)
+        return -value;
+
+    return value;
+}
+
+static double getMilliseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+// SSA construction
+// ================
+static int readVariable(struct optimizerProcedure *procedure, int block, int variable);
+
+static void writeVariable(struct optimizerProcedure *procedure, int block, int variable,
+        int value) {
+    getBlock(procedure, block)->definitions[variable] = value;
+}
+
+static int addPhi(struct optimizerProcedure *procedure, int block, int variable) {
+    int phi = addValue(procedure, block, SSA_PHI, 0, -1, -1);
+    getValue(procedure, phi)->index = variable;
+    getValue(procedure, phi)->operands = makeVector(int);
+
+    return phi;
+}
+
+static void addPhiOperands(struct optimizerProcedure *procedure, int phi) {
+    struct ssaBlock *block = getBlock(procedure, getValue(procedure, phi)->block);
+
+    forVector(block->predecessors, i, int, predecessor,
+            int operand = readVariable(procedure, predecessor, getValue(procedure, phi)->index);
+            push(getValue(procedure, phi)->operands, operand););
+}
+
+static int readVariable(struct optimizerProcedure *procedure, int block, int variable) {
+    struct ssaBlock *current = getBlock(procedure, block);
+    if (current->definitions[variable] >= 0)
+        return current->definitions[variable];
+
+    int value;
+    if (!current->sealed) {
+        // sealBlock adds the operands once the predecessors are known.
+        value = addPhi(procedure, block, variable);
+    } else if (current->predecessors->length == 0) {
+        value = addConstant(procedure, 0);
+    } else if (current->predecessors->length == 1) {
+        value = readVariable(procedure, get(int, current->predecessors, 0), variable);
+    } else {
+        // Define the variable first, in case the predecessors loop back here.
+        value = addPhi(procedure, block, variable);
+        writeVariable(procedure, block, variable, value);
+        addPhiOperands(procedure, value);
+    }
+
+    writeVariable(procedure, block, variable, value);
+    return value;
+}
+
+// Marks the block as having all of its predecessors, and adds the operands of
+// the phis that were added before then.
+static void sealBlock(struct optimizerProcedure *procedure, int block) {
+    // Reading a variable can add more phis to the block, which are handled
+    // by the same loop.
+    forVector(getBlock(procedure, block)->phis, i, int, phi,
+            addPhiOperands(procedure, phi););
+
+    getBlock(procedure, block)->sealed = 1;
+}
+
+static struct optimizerSymbol *lookupOptimizerSymbol(struct optimizerState *state,
+        struct parseTree identifier) {
+    char *name = getFirstChild(identifier).name;
+    int index = state->procedure;
+
+    while (index >= 0) {
+        struct optimizerProcedure *procedure = getProcedure(state, index);
+        forVectorPointers(procedure->symbols, i, struct optimizerSymbol, symbol,
+                if (strcmp(symbol->name, name) == 0)
+                    return symbol;);
+        index = procedure->parent;
+    }
+
+    return NULL;
+}
+
+// Returns true if the variable is kept in SSA values instead of on the stack,
+// and marks it as captured if it belongs to an enclosing procedure.
+static int isSSAVariable(struct optimizerState *state, struct optimizerSymbol *symbol) {
+    struct optimizerProcedure *procedure = getProcedure(state, state->procedure);
+
+    if (symbol->level == procedure->level)
+        return !procedure->captured[symbol->index];
+
+    while (procedure->level > symbol->level)
+        procedure = getProcedure(state, procedure->parent);
+    procedure->captured[symbol->index] = 1;
+
+    return 0;
+}
+
+static void storeVariable(struct optimizerState *state, struct optimizerSymbol *symbol,
+        int value, int isAssignment) {
+    struct optimizerProcedure *procedure = getProcedure(state, state->procedure);
+
+    if (!isSSAVariable(state, symbol)) {
+        addAccess(procedure, state->block, SSA_STORE, value, symbol);
+        return;
+    }
+
+    // Assignments get a copy of their own, for copy propagation to remove.
+    if (isAssignment)
+        value = addValue(procedure, state->block, SSA_COPY, 0, value, -1);
+    writeVariable(procedure, state->block, symbol->index, value);
+}
+
+// Declarations
+// ============
+void buildBlock(struct parseTree tree, struct optimizerState *state) {
+    struct optimizerProcedure *procedure = getProcedure(state, state->procedure);
+    int level = procedure->level;
+    procedure->line = tree.line;
+    procedure->column = tree.column;
+
+    // Constants.
+    struct parseTree constants = getChild(getChild(tree, "@const-declaration"), "@constants");
+    while (!isParseTreeError(constants) && hasChild(constants, "@constant")) {
+        struct parseTree constant = getChild(constants, "@constant");
+        pushLiteral(procedure->symbols, struct optimizerSymbol,
+                {getFirstChild(getChild(constant, "@identifier")).name, CONSTANT, level,
+                    atoi(getFirstChild(getChild(constant, "@number")).name)});
+
+        constants = getChild(constants, "@constants");
+    }
+
+    // Variables.
+    struct parseTree variables = getChild(getChild(tree, "@var-declaration"), "@vars");
+    while (!isParseTreeError(variables) && hasChild(variables, "@var")) {
+        struct parseTree variable = getChild(variables, "@var");
+        pushLiteral(procedure->symbols, struct optimizerSymbol,
+                {getFirstChild(getChild(variable, "@identifier")).name, VARIABLE, level,
+                    procedure->variableCount++});
+
+        variables = getChild(variables, "@vars");
+    }
+    procedure->captured = allocate(procedure->variableCount + 1);
+    memset(procedure->captured, 0, procedure->variableCount + 1);
+
+    // Procedures. These are built first, so that the variables that they use
+    // are known to be captured by the time the statement is built.
+    struct parseTree procedures = getChild(getChild(tree, "@procedure-declaration"),
+            "@procedures");
+    while (!isParseTreeError(procedures) && hasChild(procedures, "@procedure")) {
+        struct parseTree procedureTree = getChild(procedures, "@procedure");
+        int index = state->procedures->length;
+
+        // Add the symbol first so that the procedure can call itself.
+        procedure = getProcedure(state, state->procedure);
+        pushLiteral(procedure->symbols, struct optimizerSymbol,
+                {getFirstChild(getChild(procedureTree, "@identifier")).name, PROCEDURE,
+                    level, index});
+        push(procedure->nested, index);
+        pushLiteral(state->procedures, struct optimizerProcedure,
+                {level + 1, state->procedure, makeVector(struct optimizerSymbol),
+                    makeVector(int), 0, NULL, makeVector(struct ssaValue),
+                    makeVector(struct ssaBlock), -1, 0, NULL});
+
+        struct optimizerState procedureState = *state;
+        procedureState.procedure = index;
+        buildBlock(getChild(procedureTree, "@block"), &procedureState);
+
+        procedures = getChild(procedures, "@procedures");
+    }
+
+    // The statement.
+    procedure = getProcedure(state, state->procedure);
+    state->block = addBlock(procedure);
+    sealBlock(procedure, state->block);
+
+    buildStatement(getChild(tree, "@statement"), state);
+
+    procedure->exit = addBlock(procedure);
+    addJump(procedure, state->block, procedure->exit);
+    sealBlock(procedure, procedure->exit);
+    setTerminator(procedure, procedure->exit, SSA_RETURN, -1, -1, -1);
+}
+
+// Statements
+// ==========
+void buildStatement(struct parseTree tree, struct optimizerState *state) {
+    if (isParseTreeError(tree) || tree.children == NULL || tree.children->length == 0)
+        return;
+
+    int is(char *name) {
+        return (strcmp(tree.name, name) == 0);
+    }
+
+    struct optimizerProcedure *procedure = getProcedure(state, state->procedure);
+    if (tree.line > 0) {
+        buildLine = tree.line;
+        buildColumn = tree.column;
+    }
+
+    if (is("@statement")) {
+        buildStatement(getFirstChild(tree), state);
+    } else if (is("@begin-block")) {
+        buildStatement(getChild(tree, "@statements"), state);
+    } else if (is("@statements")) {
+        buildStatement(getChild(tree, "@statement"), state);
+        buildStatement(getChild(tree, "@statements"), state);
+    } else if (is("@assignment")) {
+        struct optimizerSymbol *symbol = lookupOptimizerSymbol(state,
+                getChild(tree, "@identifier"));
+        int value = buildExpression(getChild(tree, "@expression"), state);
+        storeVariable(state, symbol, value, 1);
+    } else if (is("@call-statement")) {
+        struct optimizerSymbol *symbol = lookupOptimizerSymbol(state,
+                getChild(tree, "@identifier"));
+        addAccess(procedure, state->block, SSA_CALL, -1, symbol);
+    } else if (is("@read-statement")) {
+        struct optimizerSymbol *symbol = lookupOptimizerSymbol(state,
+                getChild(tree, "@identifier"));
+        int value = addValue(procedure, state->block, SSA_READ, 0, -1, -1);
+        storeVariable(state, symbol, value, 0);
+    } else if (is("@write-statement")) {
+        // A write statement's identifier is built like a factor.
+        int value = buildFactor(tree, state);
+        addValue(procedure, state->block, SSA_WRITE, 0, value, -1);
+    } else if (is("@if-statement")) {
+        struct vector *statements = getChildren(tree, "@statement");
+        int condition = buildCondition(getChild(tree, "@condition"), state);
+        int branch = state->block;
+
+        int thenBlock = addBlock(procedure);
+        addEdge(procedure, branch, thenBlock);
+        sealBlock(procedure, thenBlock);
+        state->block = thenBlock;
+        buildStatement(getChild(tree, "@statement"), state);
+        int thenEnd = state->block;
+
+        // The blocks are made in the order that they're laid out in.
+        int elseBlock = -1, elseEnd = -1;
+        if (statements->length == 2) {
+            elseBlock = addBlock(procedure);
+            addEdge(procedure, branch, elseBlock);
+            sealBlock(procedure, elseBlock);
+            state->block = elseBlock;
+            buildStatement(getLastChild(tree, "@statement"), state);
+            elseEnd = state->block;
+        }
+
+        int join = addBlock(procedure);
+        addJump(procedure, thenEnd, join);
+        if (elseBlock >= 0)
+            addJump(procedure, elseEnd, join);
+        else
+            addEdge(procedure, branch, join);
+        sealBlock(procedure, join);
+
+        setTerminator(procedure, branch, SSA_BRANCH, condition, thenBlock,
+                (elseBlock >= 0) ? elseBlock : join);
+        state->block = join;
+    } else if (is("@while-statement")) {
+        // The header isn't sealed until the jump back from the body is added.
+        int header = addBlock(procedure);
+        addJump(procedure, state->block, header);
+        state->block = header;
+        int condition = buildCondition(getChild(tree, "@condition"), state);
+
+        int body = addBlock(procedure);
+        addEdge(procedure, header, body);
+        sealBlock(procedure, body);
+        state->block = body;
+        buildStatement(getChild(tree, "@statement"), state);
+        addJump(procedure, state->block, header);
+        sealBlock(procedure, header);
+
+        int exit = addBlock(procedure);
+        addEdge(procedure, header, exit);
+        sealBlock(procedure, exit);
+        setTerminator(procedure, header, SSA_BRANCH, condition, body, exit);
+        state->block = exit;
+    }
+}
+
+int buildCondition(struct parseTree tree, struct optimizerState *state) {
+    struct optimizerProcedure *procedure = getProcedure(state, state->procedure);
+
+    if (hasChild(tree, "odd")) {
+        int value = buildExpression(getChild(tree, "@expression"), state);
+        return addValue(procedure, state->block, SSA_OPERATOR, OPR_ODD, value, -1);
+    }
+
+    int left = buildExpression(getChild(tree, "@expression"), state);
+    int right = buildExpression(getLastChild(tree, "@expression"), state);
+
+    char *operator = getFirstChild(getChild(tree, "@rel-op")).name;
+    int modifier;
+    if (strcmp(operator, "=") == 0) modifier = OPR_EQL;
+    else if (strcmp(operator, "<>") == 0) modifier = OPR_NEQ;
+    else if (strcmp(operator, "<") == 0) modifier = OPR_LSS;
+    else if (strcmp(operator, "<=") == 0) modifier = OPR_LEQ;
+    else if (strcmp(operator, ">") == 0) modifier = OPR_GTR;
+    else modifier = OPR_GEQ;
+
+    return addValue(procedure, state->block, SSA_OPERATOR, modifier, left, right);
+}
+
+// Expressions
+// ===========
+int buildExpression(struct parseTree tree, struct optimizerState *state) {
+    if (!hasChild(tree, "@add-or-subtract"))
+        return buildTerm(getChild(tree, "@term"), state);
+
+    int left = buildTerm(getChild(tree, "@term"), state);
+    int right = buildExpression(getChild(tree, "@expression"), state);
+
+    char *plusOrMinus = getFirstChild(getChild(tree, "@add-or-subtract")).name;
+    int modifier = (strcmp(plusOrMinus, "+") == 0) ? OPR_ADD : OPR_SUB;
+
+    return addValue(getProcedure(state, state->procedure), state->block, SSA_OPERATOR,
+            modifier, left, right);
+}
+
+static int getMultiplyOrDivide(struct parseTree tree) {
+    return (strcmp(getFirstChild(getChild(tree, "@multiply-or-divide")).name, "*") == 0)
+        ? OPR_MUL : OPR_DIV;
+}
+
+int buildTerm(struct parseTree tree, struct optimizerState *state) {
+    if (!hasChild(tree, "@multiply-or-divide"))
+        return buildFactor(getChild(tree, "@factor"), state);
+
+    // Like generate_term, this computes "a * b * c * d" as "(a * b) * (c * d)".
+    struct parseTree term = getChild(tree, "@term");
+
+    int left = buildFactor(getChild(tree, "@factor"), state);
+    int right = buildFactor(getChild(term, "@factor"), state);
+    left = addValue(getProcedure(state, state->procedure), state->block, SSA_OPERATOR,
+            getMultiplyOrDivide(tree), left, right);
+
+    if (!hasChild(term, "@multiply-or-divide"))
+        return left;
+
+    right = buildTerm(getChild(term, "@term"), state);
+    return addValue(getProcedure(state, state->procedure), state->block, SSA_OPERATOR,
+            getMultiplyOrDivide(term), left, right);
+}
+
+int buildFactor(struct parseTree tree, struct optimizerState *state) {
+    struct optimizerProcedure *procedure = getProcedure(state, state->procedure);
+
+    if (hasChild(tree, "@expression"))
+        return buildExpression(getChild(tree, "@expression"), state);
+
+    if (hasChild(tree, "@number"))
+        return addConstant(procedure, getNumberValue(tree));
+
+    struct optimizerSymbol *symbol = lookupOptimizerSymbol(state, getChild(tree, "@identifier"));
+
+    if (symbol->type == CONSTANT)
+        return addConstant(procedure, symbol->index);
+    if (isSSAVariable(state, symbol))
+        return readVariable(procedure, state->block, symbol->index);
+
+    return addAccess(procedure, state->block, SSA_LOAD, -1, symbol);
+}
+
+// Passes
+// ======
+// Each pass returns the number of changes that it made.
+
+static int resolve(struct optimizerProcedure *procedure, int value) {
+    while (value >= 0 && getValue(procedure, value)->replacement >= 0)
+        value = getValue(procedure, value)->replacement;
+
+    return value;
+}
+
+static void replaceValue(struct optimizerProcedure *procedure, int value, int replacement) {
+    getValue(procedure, value)->removed = 1;
+    getValue(procedure, value)->replacement = replacement;
+}
+
+// Points the operands of every value at the values that replaced them.
+static void resolveOperands(struct optimizerProcedure *procedure) {
+    forVectorPointers(procedure->values, i, struct ssaValue, value,
+            value->left = resolve(procedure, value->left);
+            value->right = resolve(procedure, value->right);
+            forVectorPointers(value->operands, j, int, operand,
+                    *operand = resolve(procedure, *operand);););
+
+    forVectorPointers(procedure->blocks, i, struct ssaBlock, block,
+            block->condition = resolve(procedure, block->condition););
+}
+
+static int isConstant(struct optimizerProcedure *procedure, int value) {
+    return value >= 0 && getValue(procedure, value)->kind == SSA_CONSTANT;
+}
+
+// Removes the blocks that can't be reached from the entry, other than the exit.
+static int removeUnreachableBlocks(struct optimizerProcedure *procedure) {
+    int count = procedure->blocks->length;
+    int changes = 0;
+    int successors[2];
+
+    char *reachable = allocate(count);
+    memset(reachable, 0, count);
+    struct vector *worklist = makeVector(int);
+    pushLiteral(worklist, int, 0);
+    reachable[0] = 1;
+
+    while (worklist->length > 0) {
+        int block = get(int, worklist, worklist->length - 1);
+        worklist->length -= 1;
+        int i, successorCount = getSuccessors(getBlock(procedure, block), successors);
+
+        for (i = 0; i < successorCount; i++) {
+            if (!reachable[successors[i]]) {
+                reachable[successors[i]] = 1;
+                push(worklist, successors[i]);
+            }
+        }
+    }
+
+    forVectorPointers(procedure->blocks, b, struct ssaBlock, block,
+        if (reachable[b] || block->removed || b == procedure->exit)
+            continue;
+
+        int i, successorCount = getSuccessors(block, successors);
+        for (i = 0; i < successorCount; i++)
+            removeEdge(procedure, b, successors[i]);
+
+        block->removed = 1;
+        block->terminator = 0;
+        forVector(block->phis, i, int, phi, getValue(procedure, phi)->removed = 1;);
+        forVector(block->values, i, int, value, getValue(procedure, value)->removed = 1;);
+        changes += 1;);
+
+    freeVector(worklist);
+    deallocate(reachable);
+
+    return changes;
+}
+
+// Computes an operator on constants in the same way as the VM, or returns
+// false if it would fail or be undefined, so that it's left to happen when the
+// program runs.
+static int foldOperator(int operator, int left, int right, int *result) {
+    // Overflow wraps around in the VM.
+    unsigned a = left, b = right;
+
+    switch (operator) {
+        case OPR_NEG: *result = (int)-a; return 1;
+        case OPR_ODD: *result = left % 2 != 0; return 1;
+        case OPR_ADD: *result = (int)(a + b); return 1;
+        case OPR_SUB: *result = (int)(a - b); return 1;
+        case OPR_MUL: *result = (int)(a * b); return 1;
+        case OPR_DIV:
+        case OPR_MOD:
+            if (right == 0 || (left == INT_MIN && right == -1))
+                return 0;
+            *result = (operator == OPR_DIV) ? left / right : left % right;
+            return 1;
+        case OPR_EQL: *result = left == right; return 1;
+        case OPR_NEQ: *result = left != right; return 1;
+        case OPR_LSS: *result = left < right; return 1;
+        case OPR_LEQ: *result = left <= right; return 1;
+        case OPR_GTR: *result = left > right; return 1;
+        case OPR_GEQ: *result = left >= right; return 1;
+        default: return 0;
+    }
+}
+
+// Global constant propagation: folds operators and copies whose operands are
+// constants and phis whose operands are all the same constant, and turns
+// branches on constants into jumps, until nothing changes. Since the values
+// are in SSA form, this carries constants across blocks and loops.
+static int propagateConstants(struct optimizerProcedure *procedure) {
+    int changes = 0, changed = 1;
+
+    while (changed) {
+        changed = 0;
+        resolveOperands(procedure);
+
+        forVectorPointers(procedure->blocks, b, struct ssaBlock, block,
+            if (block->removed)
+                continue;
+
+            forVector(block->phis, i, int, phi,
+                struct ssaValue *value = getValue(procedure, phi);
+                if (value->removed)
+                    continue;
+
+                // Operands that refer to the phi itself don't change it.
+                int constant = 0, found = 0, same = 1;
+                forVector(value->operands, j, int, operand,
+                    if (operand == phi)
+                        continue;
+                    if (!isConstant(procedure, operand)
+                            || (found && getValue(procedure, operand)->operator != constant)) {
+                        same = 0;
+                        break;
+                    }
+                    constant = getValue(procedure, operand)->operator;
+                    found = 1;);
+
+                if (found && same) {
+                    replaceValue(procedure, phi, addConstant(procedure, constant));
+                    changed = 1;
+                    changes += 1;
+                });
+
+            forVector(block->values, i, int, index,
+                struct ssaValue *value = getValue(procedure, index);
+                int result;
+                if (value->removed)
+                    continue;
+
+                if (value->kind == SSA_COPY && isConstant(procedure, value->left)) {
+                    result = getValue(procedure, value->left)->operator;
+                } else if (value->kind == SSA_OPERATOR && isConstant(procedure, value->left)
+                        && (value->right < 0 || isConstant(procedure, value->right))) {
+                    int right = (value->right < 0) ? 0 : getValue(procedure, value->right)->operator;
+                    if (!foldOperator(value->operator, getValue(procedure, value->left)->operator,
+                                right, &result))
+                        continue;
+                } else {
+                    continue;
+                }
+
+                *value = (struct ssaValue){SSA_CONSTANT, b, result, -1, -1, 0, 0, NULL, 0, -1,
+                    value->line, value->column};
+                changed = 1;
+                changes += 1;);
+
+            if (block->terminator == SSA_BRANCH && isConstant(procedure, block->condition)) {
+                int taken = (getValue(procedure, block->condition)->operator != 0) ? 0 : 1;
+                removeEdge(procedure, b, block->targets[1 - taken]);
+                block->terminator = SSA_JUMP;
+                block->targets[0] = block->targets[taken];
+                block->targets[1] = -1;
+                block->condition = -1;
+                changed = 1;
+                changes += 1;
+            });
+    }
+
+    return changes + removeUnreachableBlocks(procedure);
+}
+
+// Copy propagation: replaces copies with the values that they copy, and phis
+// whose operands are all the same value with that value.
+static int propagateCopies(struct optimizerProcedure *procedure) {
+    int changes = 0, changed = 1;
+
+    while (changed) {
+        changed = 0;
+        resolveOperands(procedure);
+
+        forVectorPointers(procedure->blocks, b, struct ssaBlock, block,
+            if (block->removed)
+                continue;
+
+            forVector(block->phis, i, int, phi,
+                if (getValue(procedure, phi)->removed)
+                    continue;
+
+                int same = -1, trivial = 1;
+                forVector(getValue(procedure, phi)->operands, j, int, operand,
+                    operand = resolve(procedure, operand);
+                    if (operand == phi || operand == same)
+                        continue;
+                    if (same >= 0) {
+                        trivial = 0;
+                        break;
+                    }
+                    same = operand;);
+
+                if (trivial) {
+                    // A phi that only refers to itself reads a variable that
+                    // was never assigned.
+                    replaceValue(procedure, phi, (same >= 0) ? same : addConstant(procedure, 0));
+                    changed = 1;
+                    changes += 1;
+                });
+
+            forVector(block->values, i, int, index,
+                struct ssaValue *value = getValue(procedure, index);
+                if (!value->removed && value->kind == SSA_COPY) {
+                    replaceValue(procedure, index, resolve(procedure, value->left));
+                    changed = 1;
+                    changes += 1;
+                }););
+    }
+
+    return changes;
+}
+
+// Dead store elimination: removes stores to variables on the stack that are
+// stored to again later in the same block before anything can read them, and
+// stores to the procedure's own variables just before it returns. Stores to
+// variables in SSA values are copies, which eliminateDeadCode removes when
+// nothing uses them.
+static int eliminateDeadStores(struct optimizerProcedure *procedure) {
+    int changes = 0;
+    // The variables that are stored to later in the block, as level and index.
+    struct vector *overwritten = makeVector(long long);
+
+    long long key(struct ssaValue *value) {
+        return ((long long)value->level << 32) | (unsigned)value->index;
+    }
+
+    resolveOperands(procedure);
+
+    forVectorPointers(procedure->blocks, b, struct ssaBlock, block,
+        if (block->removed)
+            continue;
+
+        overwritten->length = 0;
+        if (block->terminator == SSA_RETURN || (block->terminator == SSA_JUMP
+                    && block->targets[0] == procedure->exit)) {
+            int i;
+            for (i = 0; i < procedure->variableCount; i++)
+                pushLiteral(overwritten, long long, ((long long)procedure->level << 32) | i);
+        }
+
+        int i;
+        for (i = block->values->length - 1; i >= 0; i--) {
+            int index = get(int, block->values, i);
+            struct ssaValue *value = getValue(procedure, index);
+            if (value->removed)
+                continue;
+
+            if (value->kind == SSA_CALL) {
+                overwritten->length = 0;
+            } else if (value->kind == SSA_LOAD || value->kind == SSA_STORE) {
+                int found = -1;
+                forVector(overwritten, j, long long, variable,
+                        if (variable == key(value))
+                            found = j;);
+
+                if (value->kind == SSA_LOAD) {
+                    if (found >= 0)
+                        removeFromVector(overwritten, found);
+                } else if (found >= 0) {
+                    value->removed = 1;
+                    changes += 1;
+                } else {
+                    pushLiteral(overwritten, long long, key(value));
+                }
+            }
+        });
+
+    freeVector(overwritten);
+    return changes;
+}
+
+// Dead code elimination: removes unreachable blocks, and values that nothing
+// uses. Values with side effects are always kept, and so are divisions, which
+// can fail.
+static int eliminateDeadCode(struct optimizerProcedure *procedure) {
+    int changes = removeUnreachableBlocks(procedure);
+    resolveOperands(procedure);
+
+    char *used = allocate(procedure->values->length);
+    memset(used, 0, procedure->values->length);
+    struct vector *worklist = makeVector(int);
+
+    void use(int value) {
+        if (value >= 0 && !used[value]) {
+            used[value] = 1;
+            push(worklist, value);
+        }
+    }
+
+    forVectorPointers(procedure->blocks, b, struct ssaBlock, block,
+        if (block->removed)
+            continue;
+        forVector(block->values, i, int, index,
+            struct ssaValue *value = getValue(procedure, index);
+            if (value->kind == SSA_STORE || value->kind == SSA_CALL || value->kind == SSA_READ
+                    || value->kind == SSA_WRITE || (value->kind == SSA_OPERATOR
+                        && (value->operator == OPR_DIV || value->operator == OPR_MOD)))
+                use(index););
+        if (block->terminator == SSA_BRANCH)
+            use(block->condition););
+
+    while (worklist->length > 0) {
+        struct ssaValue *value = getValue(procedure, get(int, worklist, worklist->length - 1));
+        worklist->length -= 1;
+        use(value->left);
+        use(value->right);
+        forVector(value->operands, i, int, operand, use(operand););
+    }
+
+    forVectorPointers(procedure->values, i, struct ssaValue, value,
+            if (!used[i] && !value->removed && value->block >= 0) {
+                value->removed = 1;
+                changes += value->kind != SSA_CONSTANT;
+            });
+
+    freeVector(worklist);
+    deallocate(used);
+
+    return changes;
+}
+
+static char *passNames[OPTIMIZER_PASS_COUNT] = {"constants", "copies", "dead-stores",
+    "dead-code"};
+static int (*passes[OPTIMIZER_PASS_COUNT])(struct optimizerProcedure *) = {propagateConstants,
+    propagateCopies, eliminateDeadStores, eliminateDeadCode};
+// The order the passes run in. Copies run again after constants, since
+// folding a branch can leave phis with only one operand.
+static int passOrder[] = {1, 0, 1, 2, 3};
+
+char *getOptimizerPassName(int pass) {
+    if (pass < 0 || pass >= OPTIMIZER_PASS_COUNT)
+        return NULL;
+
+    return passNames[pass];
+}
+
+static void runPasses(struct optimizerProcedure *procedure, int enabledPasses,
+        struct generatorStatistics *statistics) {
+    int i;
+    for (i = 0; i < (int)(sizeof passOrder / sizeof passOrder[0]); i++) {
+        int pass = passOrder[i];
+        if (!(enabledPasses & (1 << pass)))
+            continue;
+
+        double start = getMilliseconds();
+        statistics->optimizerChanges[pass] += passes[pass](procedure);
+        statistics->optimizerMilliseconds[pass] += getMilliseconds() - start;
+    }
+
+    resolveOperands(procedure);
+}
+
+// Lowering
+// ========
+// Phis are lowered to copies at the end of each predecessor, so a branch to a
+// block with phis gets a block of its own on that edge to hold them.
+static void splitBranchEdges(struct optimizerProcedure *procedure) {
+    int count = procedure->blocks->length;
+    int b, t;
+
+    for (b = 0; b < count; b++) {
+        if (getBlock(procedure, b)->removed || getBlock(procedure, b)->terminator != SSA_BRANCH)
+            continue;
+
+        for (t = 0; t < 2; t++) {
+            int target = getBlock(procedure, b)->targets[t];
+            int hasPhis = 0;
+            forVector(getBlock(procedure, target)->phis, i, int, phi,
+                    hasPhis |= !getValue(procedure, phi)->removed;);
+            if (!hasPhis)
+                continue;
+
+            int edge = addBlock(procedure);
+            getBlock(procedure, edge)->splitFrom = b;
+            addJump(procedure, edge, target);
+            // Keep the order of the predecessors, which the phi operands
+            // follow. The new block's edge was added at the end.
+            struct vector *predecessors = getBlock(procedure, target)->predecessors;
+            set(predecessors, findInVector(predecessors, b), edge);
+            predecessors->length -= 1;
+            getBlock(procedure, b)->targets[t] = edge;
+        }
+    }
+}
+
+// Lowers a procedure, and the procedures declared in it, to stack code.
+//
+// Each value is either computed where it's used, if that's the only use and
+// it's in the same block, or computed where it's defined and stored in a slot
+// of its own in the frame after the variables that live on the stack. Values
+// that read input, read the stack or can fail are only moved to their use if
+// nothing with side effects comes in between.
+static void lowerProcedure(struct optimizerState *state, int procedureIndex) {
+    struct optimizerProcedure *procedure = getProcedure(state, procedureIndex);
+    struct vector *instructions = state->instructions;
+    int display = state->options.display;
+
+    splitBranchEdges(procedure);
+
+    int count = procedure->values->length;
+    int blockCount = procedure->blocks->length;
+    int *uses = allocate((count + 1) * sizeof (int));
+    int *position = allocate((count + 1) * sizeof (int));       // In its block.
+    int *user = allocate((count + 1) * sizeof (int));           // The last use, or -1
+    int *userPosition = allocate((count + 1) * sizeof (int));   // for phis and branches.
+    int *slots = allocate((count + 1) * sizeof (int));
+    char *inlined = allocate(count + 1);
+    int *blockAddresses = allocate((blockCount + 1) * sizeof (int));
+    struct vector *jumps = makeVector(int);   // Pairs of an address and a block.
+    int i;
+
+    struct ssaValue *value(int index) {
+        return getValue(procedure, index);
+    }
+
+    for (i = 0; i < count; i++) {
+        uses[i] = 0;
+        user[i] = userPosition[i] = slots[i] = -1;
+        inlined[i] = 0;
+    }
+
+    void addUse(int operand, int by, int at) {
+        if (operand < 0 || value(operand)->kind == SSA_CONSTANT)
+            return;
+        uses[operand] += 1;
+        user[operand] = by;
+        userPosition[operand] = at;
+    }
+
+    forVectorPointers(procedure->blocks, b, struct ssaBlock, block,
+        if (block->removed)
+            continue;
+        forVector(block->values, j, int, index, position[index] = j;);
+        forVector(block->phis, j, int, phi,
+            if (!value(phi)->removed)
+                forVector(value(phi)->operands, k, int, operand, addUse(operand, -1, -1);););
+        forVector(block->values, j, int, index,
+            if (!value(index)->removed) {
+                addUse(value(index)->left, index, j);
+                addUse(value(index)->right, index, j);
+            });
+        if (block->terminator == SSA_BRANCH)
+            addUse(block->condition, -1, block->values->length););
+
+    int producesValue(int index) {
+        int kind = value(index)->kind;
+        return kind != SSA_STORE && kind != SSA_CALL && kind != SSA_WRITE;
+    }
+
+    int isDivision(int index) {
+        return value(index)->kind == SSA_OPERATOR
+            && (value(index)->operator == OPR_DIV || value(index)->operator == OPR_MOD);
+    }
+
+    int hasSideEffects(int index) {
+        int kind = value(index)->kind;
+        return !producesValue(index) || kind == SSA_READ || isDivision(index);
+    }
+
+    // Where an inlined value is computed.
+    int getRootPosition(int index) {
+        while (user[index] >= 0 && inlined[user[index]])
+            index = user[index];
+        return userPosition[index];
+    }
+
+    // Values used once in the same block, by another value or by the block's
+    // branch.
+    forVector(procedure->values, j, struct ssaValue, current,
+        if (current.removed || current.block < 0 || current.kind == SSA_PHI
+                || !producesValue(j) || uses[j] != 1 || userPosition[j] < 0)
+            continue;
+        if (user[j] >= 0)
+            inlined[j] = value(user[j])->block == current.block;
+        else
+            inlined[j] = getBlock(procedure, current.block)->terminator == SSA_BRANCH
+                && getBlock(procedure, current.block)->condition == j;);
+
+    // Moving a value that has to stay in order past something else with side
+    // effects changes the program, so compute those where they're defined.
+    // That changes where other values are computed, so repeat until nothing
+    // changes.
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        forVector(procedure->values, j, struct ssaValue, current,
+            if (!inlined[j] || !(current.kind == SSA_LOAD || hasSideEffects(j)))
+                continue;
+
+            struct vector *values = getBlock(procedure, current.block)->values;
+            int root = getRootPosition(j), k;
+            for (k = position[j] + 1; k < root; k++) {
+                int other = get(int, values, k);
+                if (value(other)->removed || value(other)->kind == SSA_CONSTANT
+                        || !hasSideEffects(other))
+                    continue;
+                if (!inlined[other] || getRootPosition(other) != root) {
+                    inlined[j] = 0;
+                    changed = 1;
+                    break;
+                }
+            });
+    }
+
+    // Where a value is read, which is where the value it's part of is
+    // computed.
+    int getReadPosition(int index) {
+        return inlined[index] ? getRootPosition(index) : position[index];
+    }
+
+    int needsSlot(int index) {
+        return !value(index)->removed && value(index)->block >= 0
+            && value(index)->kind != SSA_CONSTANT && producesValue(index) && !inlined[index];
+    }
+
+    // Liveness of the values with slots at the ends of blocks, where the
+    // operands of phis are used at the end of the predecessor they come from.
+    char *liveIn = allocate(blockCount * (count + 1));
+    char *liveOut = allocate(blockCount * (count + 1));
+    memset(liveIn, 0, blockCount * (count + 1));
+    memset(liveOut, 0, blockCount * (count + 1));
+
+    #define LIVE_IN(block, index) liveIn[(block) * (count + 1) + (index)]
+    #define LIVE_OUT(block, index) liveOut[(block) * (count + 1) + (index)]
+
+    void useInBlock(int block, int index) {
+        if (index >= 0 && needsSlot(index) && value(index)->block != block)
+            LIVE_IN(block, index) = 1;
+    }
+
+    forVectorPointers(procedure->blocks, b, struct ssaBlock, block,
+        if (block->removed)
+            continue;
+        forVector(block->values, j, int, index,
+            if (!value(index)->removed) {
+                useInBlock(b, value(index)->left);
+                useInBlock(b, value(index)->right);
+            });
+        if (block->terminator == SSA_BRANCH)
+            useInBlock(b, block->condition););
+
+    changed = 1;
+    while (changed) {
+        changed = 0;
+        int b, successors[2];
+        for (b = blockCount - 1; b >= 0; b--) {
+            struct ssaBlock *block = getBlock(procedure, b);
+            int k, successorCount = getSuccessors(block, successors);
+            if (block->removed)
+                continue;
+
+            for (k = 0; k < successorCount; k++) {
+                struct ssaBlock *successor = getBlock(procedure, successors[k]);
+                int edge = findInVector(successor->predecessors, b);
+
+                for (i = 0; i < count; i++) {
+                    if (LIVE_IN(successors[k], i) && !LIVE_OUT(b, i)) {
+                        LIVE_OUT(b, i) = 1;
+                        changed = 1;
+                    }
+                }
+                forVector(successor->phis, j, int, phi,
+                    int operand = value(phi)->removed ? -1
+                        : get(int, value(phi)->operands, edge);
+                    if (operand >= 0 && needsSlot(operand) && !LIVE_OUT(b, operand)) {
+                        LIVE_OUT(b, operand) = 1;
+                        changed = 1;
+                    });
+            }
+
+            for (i = 0; i < count; i++) {
+                if (LIVE_OUT(b, i) && !LIVE_IN(b, i) && value(i)->block != b) {
+                    LIVE_IN(b, i) = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    // Returns true if the value is still needed after the given position in
+    // the block, where -1 is after its phis.
+    int isLiveAfter(int index, int block, int after) {
+        if (LIVE_OUT(block, index))
+            return 1;
+
+        struct ssaBlock *current = getBlock(procedure, block);
+        forVector(current->values, j, int, user,
+            if (!value(user)->removed && getReadPosition(user) > after
+                    && (value(user)->left == index || value(user)->right == index))
+                return 1;);
+
+        return current->terminator == SSA_BRANCH && current->condition == index;
+    }
+
+    // Returns true if a is still needed where b is defined. Since a's
+    // definition comes before all of its uses, that's when the two can't
+    // share a slot.
+    int isLiveAt(int a, int b) {
+        int block = value(b)->block;
+        int definition = (value(b)->kind == SSA_PHI) ? -1 : position[b];
+
+        if (value(a)->block == block) {
+            int other = (value(a)->kind == SSA_PHI) ? -1 : position[a];
+            if (other > definition)
+                return 0;
+            // Phis are all defined at the start of the block.
+            if (other == definition)
+                return 1;
+        }
+
+        return isLiveAfter(a, block, definition);
+    }
+
+    // Values are put in classes that share a slot, starting with a class of
+    // their own. A phi shares its slot with its operands if none of their
+    // classes' values are needed at the same time, and then the copy for that
+    // operand isn't needed.
+    int *classes = allocate((count + 1) * sizeof (int));    // The first value.
+    int *nextInClass = allocate((count + 1) * sizeof (int));
+    for (i = 0; i < count; i++) {
+        classes[i] = i;
+        nextInClass[i] = -1;
+    }
+
+    void mergeClasses(int a, int b) {
+        int x, y;
+        a = classes[a];
+        b = classes[b];
+        if (a == b)
+            return;
+
+        for (x = a; x >= 0; x = nextInClass[x])
+            for (y = b; y >= 0; y = nextInClass[y])
+                if (isLiveAt(x, y) || isLiveAt(y, x))
+                    return;
+
+        for (y = b; y >= 0; y = nextInClass[y])
+            classes[y] = a;
+        for (x = a; nextInClass[x] >= 0; x = nextInClass[x]);
+        nextInClass[x] = b;
+    }
+
+    forVectorPointers(procedure->blocks, b, struct ssaBlock, block,
+        if (block->removed)
+            continue;
+        forVector(block->phis, j, int, phi,
+            if (needsSlot(phi))
+                forVector(value(phi)->operands, k, int, operand,
+                    if (needsSlot(operand))
+                        mergeClasses(phi, operand););););
+
+    // The frame: the variables that nested procedures use, then the slots.
+    int frameSize = 4;
+    procedure->variableAddresses = allocate((procedure->variableCount + 1) * sizeof (int));
+    for (i = 0; i < procedure->variableCount; i++)
+        if (procedure->captured[i])
+            procedure->variableAddresses[i] = frameSize++;
+    for (i = 0; i < count; i++) {
+        if (!needsSlot(i))
+            continue;
+        if (slots[classes[i]] < 0)
+            slots[classes[i]] = frameSize++;
+        slots[i] = slots[classes[i]];
+    }
+
+    // The location of the instructions that are being added.
+    int line = procedure->line, column = procedure->column;
+    void setLocation(int index) {
+        line = value(index)->line;
+        column = value(index)->column;
+    }
+
+    void add(char *opcode, int level, int modifier) {
+        struct instruction instruction = makeInstruction(opcode, level, modifier);
+        instruction.line = line;
+        instruction.column = column;
+        push(instructions, instruction);
+    }
+
+    void addJumpTo(char *opcode, int block) {
+        pushLiteral(jumps, int, instructions->length);
+        push(jumps, block);
+        add(opcode, 0, -1);
+    }
+
+    // Loads or stores a variable on the stack.
+    void addVariableAccess(char *opcode, char *displayOpcode, int level, int index) {
+        struct optimizerProcedure *owner = procedure;
+        while (owner->level > level)
+            owner = getProcedure(state, owner->parent);
+
+        if (display)
+            add(displayOpcode, level, owner->variableAddresses[index]);
+        else
+            add(opcode, procedure->level - level, owner->variableAddresses[index]);
+    }
+
+    auto void pushValue(int index);
+
+    // Adds the code that computes a value and pushes it.
+    void pushDefinition(int index) {
+        struct ssaValue *current = value(index);
+        switch (current->kind) {
+            case SSA_COPY:
+                pushValue(current->left);
+                break;
+            case SSA_OPERATOR:
+                pushValue(current->left);
+                if (current->right >= 0)
+                    pushValue(value(index)->right);
+                add("opr", 0, value(index)->operator);
+                break;
+            case SSA_LOAD:
+                addVariableAccess("lod", "lodd", current->level, current->index);
+                break;
+            case SSA_READ:
+                add("read", 0, 2);
+                break;
+        }
+    }
+
+    // Adds the code that pushes a value where it's used.
+    void pushValue(int index) {
+        if (value(index)->kind == SSA_CONSTANT)
+            add("lit", 0, value(index)->operator);
+        else if (inlined[index])
+            pushDefinition(index);
+        else
+            add("lod", 0, slots[index]);
+    }
+
+    // Adds the code for a value that isn't inlined, where it's defined.
+    void addRootValue(int index) {
+        setLocation(index);
+        struct ssaValue *current = value(index);
+        switch (current->kind) {
+            case SSA_STORE:
+                pushValue(current->left);
+                current = value(index);
+                addVariableAccess("sto", "stod", current->level, current->index);
+                break;
+            case SSA_WRITE:
+                pushValue(current->left);
+                add("write", 0, 1);
+                break;
+            case SSA_CALL: {
+                struct optimizerProcedure *callee = getProcedure(state, current->index);
+                if (display)
+                    add("cald", current->level + 1, callee->address);
+                else
+                    add("cal", procedure->level - current->level, callee->address);
+                break;
+            }
+            default:
+                pushDefinition(index);
+                add("sto", 0, slots[index]);
+                break;
+        }
+    }
+
+    // Sets the phis of the target for the edge from the block. All of the
+    // operands are pushed before any are stored, since phis can use each
+    // other.
+    // Returns true if the phi needs a copy for the edge with the given index,
+    // which it doesn't if its operand shares its slot.
+    int needsCopy(int phi, int edge) {
+        int operand = get(int, value(phi)->operands, edge);
+        return !value(phi)->removed
+            && (value(operand)->kind == SSA_CONSTANT || slots[operand] != slots[phi]);
+    }
+
+    void addPhiCopies(int from, int to) {
+        struct ssaBlock *target = getBlock(procedure, to);
+        int edge = findInVector(target->predecessors, from);
+        int k;
+
+        forVector(target->phis, j, int, phi,
+                if (needsCopy(phi, edge))
+                    pushValue(get(int, value(phi)->operands, edge)););
+        for (k = target->phis->length - 1; k >= 0; k--) {
+            int phi = get(int, target->phis, k);
+            if (needsCopy(phi, edge))
+                add("sto", 0, slots[phi]);
+        }
+    }
+
+    // Returns true if the block doesn't have any code other than its jump.
+    int isEmpty(int b) {
+        struct ssaBlock *block = getBlock(procedure, b);
+        if (b == 0 || block->terminator != SSA_JUMP)
+            return 0;
+
+        forVector(block->values, j, int, index,
+            if (!value(index)->removed && value(index)->kind != SSA_CONSTANT && !inlined[index])
+                return 0;);
+
+        struct ssaBlock *target = getBlock(procedure, block->targets[0]);
+        int edge = findInVector(target->predecessors, b);
+        forVector(target->phis, j, int, phi,
+            if (needsCopy(phi, edge))
+                return 0;);
+
+        return 1;
+    }
+
+    // Empty blocks aren't laid out, and jumps to them go to where they jump
+    // to instead, unless they only lead to each other.
+    int getJumpTarget(int b) {
+        int target = b, steps = 0;
+        while (isEmpty(target)) {
+            target = getBlock(procedure, target)->targets[0];
+            if (++steps > blockCount)
+                return b;
+        }
+        return target;
+    }
+
+    // The procedure's frame, and the procedures declared in it.
+    procedure->address = instructions->length;
+    add("inc", 0, 4);
+    if (frameSize > 4)
+        add("inc", 0, frameSize - 4);
+    if (procedure->nested->length > 0) {
+        int jump = instructions->length;
+        add("jmp", 0, -1);
+        forVector(procedure->nested, j, int, nested, lowerProcedure(state, nested););
+        procedure = getProcedure(state, procedureIndex);
+        get(struct instruction, instructions, jump).modifier = instructions->length;
+    }
+
+    // Blocks are laid out in the order they were made, with the blocks on
+    // the edges out of a branch right before their targets, and the exit last.
+    struct vector *order = makeVector(int);
+    for (i = 0; i < blockCount; i++) {
+        if (getBlock(procedure, i)->removed || getBlock(procedure, i)->splitFrom >= 0
+                || i == procedure->exit)
+            continue;
+        forVector(procedure->blocks, j, struct ssaBlock, block,
+                if (block.splitFrom >= 0 && block.targets[0] == i && getJumpTarget(j) == j)
+                    push(order, j););
+        if (getJumpTarget(i) == i)
+            push(order, i);
+    }
+    push(order, procedure->exit);
+
+    forVector(order, k, int, b,
+        struct ssaBlock *block = getBlock(procedure, b);
+        int next = (k + 1 < order->length) ? get(int, order, k + 1) : -1;
+        blockAddresses[b] = instructions->length;
+
+        forVector(block->values, j, int, index,
+            if (!value(index)->removed && value(index)->kind != SSA_CONSTANT && !inlined[index])
+                addRootValue(index););
+
+        if (block->terminator == SSA_JUMP) {
+            addPhiCopies(b, block->targets[0]);
+            if (getJumpTarget(block->targets[0]) != next)
+                addJumpTo("jmp", getJumpTarget(block->targets[0]));
+        } else if (block->terminator == SSA_BRANCH) {
+            setLocation(block->condition);
+            pushValue(block->condition);
+            addJumpTo("jpc", getJumpTarget(block->targets[1]));
+            if (getJumpTarget(block->targets[0]) != next)
+                addJumpTo("jmp", getJumpTarget(block->targets[0]));
+        } else if (display && procedure->level > 0) {
+            // Procedures called with cald restore the display when they
+            // return.
+            line = procedure->line;
+            column = procedure->column;
+            add("retd", 0, 0);
+        } else {
+            line = procedure->line;
+            column = procedure->column;
+            add("opr", 0, 0);
+        });
+
+    for (i = 0; i < jumps->length; i += 2)
+        get(struct instruction, instructions, get(int, jumps, i)).modifier =
+            blockAddresses[get(int, jumps, i + 1)];
+
+    freeVector(order);
+    freeVector(jumps);
+    deallocate(uses);
+    deallocate(position);
+    deallocate(user);
+    deallocate(userPosition);
+    deallocate(slots);
+    deallocate(inlined);
+    deallocate(liveIn);
+    deallocate(liveOut);
+    deallocate(classes);
+    deallocate(nextInClass);
+    deallocate(blockAddresses);
+}
+
+struct vector *optimizePL0(struct parseTree tree, struct generatorOptions options,
+        struct generatorStatistics *statistics) {
+    struct optimizerState state = {makeVector(struct optimizerProcedure), 0, -1, options,
+        makeVector(struct instruction)};
+
+    pushLiteral(state.procedures, struct optimizerProcedure,
+            {0, -1, makeVector(struct optimizerSymbol), makeVector(int), 0, NULL,
+                makeVector(struct ssaValue), makeVector(struct ssaBlock), -1, 0, NULL});
+    buildLine = buildColumn = 0;
+    buildBlock(getChild(tree, "@block"), &state);
+
+    forVectorPointers(state.procedures, i, struct optimizerProcedure, procedure,
+            runPasses(procedure, options.optimizerPasses, statistics););
+
+    lowerProcedure(&state, 0);
+
+    forVectorPointers(state.procedures, i, struct optimizerProcedure, procedure,
+        forVectorPointers(procedure->values, j, struct ssaValue, value,
+                if (value->operands != NULL)
+                    freeVector(value->operands););
+        forVectorPointers(procedure->blocks, j, struct ssaBlock, block,
+                freeVector(block->phis);
+                freeVector(block->values);
+                freeVector(block->predecessors);
+                deallocate(block->definitions););
+        freeVector(procedure->symbols);
+        freeVector(procedure->nested);
+        freeVector(procedure->values);
+        freeVector(procedure->blocks);
+        deallocate(procedure->captured);
+        deallocate(procedure->variableAddresses););
+    freeVector(state.procedures);
+
+    return state.instructions;
+}
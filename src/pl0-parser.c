@@ -1,27 +1,35 @@
 #include "pl0.h"
 #include "lib/lexer.h"
 #include "lib/parser.h"
+#include "lib/earley.h"
 #include "lib/vector.h"
+#include "lib/memory.h"
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 
 struct grammar getPL0Grammar() {
     // Define full PL/0 grammar.
     // The @'s before the variable names don't have any special meaning,
     // they're just a convention I'm using to make it easier to know what's a
     // variable and what's a terminal in the production rules.
-    struct grammar grammar = (struct grammar){makeVector(struct rule)};
+    struct grammar grammar = (struct grammar){makeVector(struct rule), makeVector(char*),
+            makeVector(struct nestingTokens)};
     addRule(grammar, "@program", "@block .");
+    addRule(grammar, "@program", "@block error");
 
     addRule(grammar, "@block", "@const-declaration @var-declaration @procedure-declaration @statement");
 
     addRule(grammar, "@const-declaration", "const @constants ;");
+    addRule(grammar, "@const-declaration", "const error ;");
     addRule(grammar, "@const-declaration", "nothing");
     addRule(grammar, "@constants", "@constant , @constants");
     addRule(grammar, "@constants", "@constant");
     addRule(grammar, "@constant", "@identifier = @number");
 
     addRule(grammar, "@var-declaration", "int @vars ;");
+    addRule(grammar, "@var-declaration", "int error ;");
     addRule(grammar, "@var-declaration", "nothing");
     addRule(grammar, "@vars", "@var , @vars");
     addRule(grammar, "@vars", "@var");
@@ -31,6 +39,7 @@ struct grammar getPL0Grammar() {
     addRule(grammar, "@procedures", "@procedure @procedures");
     addRule(grammar, "@procedures", "nothing");
     addRule(grammar, "@procedure", "procedure @identifier ; @block ;");
+    addRule(grammar, "@procedure", "procedure error ; @block ;");
 
     addRule(grammar, "@statement", "@read-statement");
     addRule(grammar, "@statement", "@write-statement");
@@ -39,6 +48,7 @@ struct grammar getPL0Grammar() {
     addRule(grammar, "@statement", "@while-statement");
     addRule(grammar, "@statement", "@begin-block");
     addRule(grammar, "@statement", "@call-statement");
+    addRule(grammar, "@statement", "error");
     addRule(grammar, "@statement", "nothing");
 
     addRule(grammar, "@assignment", "@identifier := @expression");
@@ -47,6 +57,8 @@ struct grammar getPL0Grammar() {
 
     addRule(grammar, "@begin-block", "begin @statements end");
     addRule(grammar, "@statements", "@statement ; @statements");
+    addRule(grammar, "@statements", "@statement error ; @statements");
+    addRule(grammar, "@statements", "@statement error");
     addRule(grammar, "@statements", "@statement");
 
     addRule(grammar, "@if-statement", "if @condition then @statement else @statement");
@@ -103,10 +115,297 @@ struct grammar getPL0Grammar() {
     addRule(grammar, "@identifier", "identifier-token");
     addRule(grammar, "@number", "number-token");
 
+    // The "error" rules above only match when the program has syntax errors
+    // in it, so that the parser can skip over each error and report the next
+    // one (see lib/parser.h). They skip up to the end of the statement or
+    // declaration, which is one of these tokens, and skip over whole begin
+    // blocks. else is there so that a statement before it isn't skipped
+    // along with the else branch.
+    addSynchronizingToken(grammar, ";");
+    addSynchronizingToken(grammar, "end");
+    addSynchronizingToken(grammar, ".");
+    addSynchronizingToken(grammar, "else");
+    addNestingTokens(grammar, "begin", "end");
+
     return grammar;
 }
 
+// The grammar never changes, so it's only built once. This matters for the
+// compiler server (see compiler-server.c) and libpl0, which parse many
+// programs, possibly from several threads at once.
+static struct grammar sharedPL0Grammar;
+static pthread_once_t sharedPL0GrammarOnce = PTHREAD_ONCE_INIT;
+
+static void makeSharedPL0Grammar(void) {
+    // It's allocated outside of any arena (see lib/memory.h), because it has
+    // to outlive whatever is being compiled.
+    struct arena *previousArena = useArena(NULL);
+    sharedPL0Grammar = getPL0Grammar();
+    useArena(previousArena);
+}
+
+static struct grammar getSharedPL0Grammar() {
+    pthread_once(&sharedPL0GrammarOnce, makeSharedPL0Grammar);
+
+    return sharedPL0Grammar;
+}
+
 struct parseTree parsePL0Tokens(struct vector *tokens) {
-    return parse(tokens, getPL0Grammar(), "@program");
+    return parse(tokens, getSharedPL0Grammar(), "@program");
+}
+
+struct parseTree parsePL0TokensWithEarley(struct vector *tokens) {
+    return earleyParse(tokens, getSharedPL0Grammar(), "@program");
+}
+
+
+// Parallel parsing
+// ================
+// Most of the tokens of a big program are in its procedures, and each
+// procedure declaration at the top level, from "procedure" to the ";" after
+// its block, parses the same on its own as it does in the program: its
+// statement can't have a ";" outside of begin and end, so the parser never
+// looks past the ";" that ends it. A quick scan of the tokens finds where
+// these declarations start and end, threads parse them with "@procedure" as
+// the start variable, and the rest of the program is parsed with them left
+// out. Their parse trees then replace the empty @procedures in the program's
+// parse tree.
+//
+// If any part doesn't parse, or the scan doesn't find the declarations, the
+// whole program is parsed again with parsePL0Tokens, so syntax errors are
+// reported exactly the same way.
+
+// A top-level procedure declaration, which is tokens start up to end.
+struct procedureSpan {
+    int start;
+    int end;
+    struct parseTree tree;
+};
+
+// What the threads share. Each thread takes the next span until there are
+// none left.
+struct parallelParse {
+    struct vector *tokens;
+    struct grammar grammar;
+    struct procedureSpan *spans;
+    int spanCount;
+    int nextSpan;
+    // Whether the threads allocate from arenas of their own, which are merged
+    // into the caller's arena afterwards.
+    int useArenas;
+};
+
+struct parseThread {
+    pthread_t thread;
+    struct parallelParse *parallel;
+    struct arena *arena;
+};
+
+static void parseSpans(struct parallelParse *parallel) {
+    int index;
+    while ((index = __atomic_fetch_add(&parallel->nextSpan, 1, __ATOMIC_RELAXED)) < parallel->spanCount) {
+        struct procedureSpan *span = &parallel->spans[index];
+        // The span's tokens, without copying them.
+        struct vector tokens = *parallel->tokens;
+        tokens.items = (struct token *)tokens.items + span->start;
+        tokens.length = tokens.capacity = span->end - span->start;
+
+        span->tree = parse(&tokens, parallel->grammar, "@procedure");
+    }
+}
+
+static void *runParseThread(void *argument) {
+    struct parseThread *thread = argument;
+    if (thread->parallel->useArenas)
+        useArena(thread->arena);
+
+    parseSpans(thread->parallel);
+
+    useArena(NULL);
+    return NULL;
+}
+
+// Finds the top-level procedure declarations, and returns them, or NULL if
+// the tokens don't look like a program.
+static struct vector *findProcedureSpans(struct vector *tokens) {
+    auto int skipBlock(int index);
+
+    int is(int index, char *type) {
+        return index < tokens->length
+            && strcmp(get(struct token, tokens, index).type, type) == 0;
+    }
+
+    // Returns the index after the ";" that ends a declaration, or -1.
+    int skipDeclaration(int index) {
+        while (index < tokens->length && !is(index, ";")) {
+            if (is(index, "begin") || is(index, "procedure") || is(index, "."))
+                return -1;
+            index++;
+        }
+
+        return (index < tokens->length) ? index + 1 : -1;
+    }
+
+    int skipProcedure(int index) {
+        if (!is(index + 2, ";"))
+            return -1;
+
+        index = skipBlock(index + 3);
+        return (index >= 0 && is(index, ";")) ? index + 1 : -1;
+    }
+
+    // Returns the index after the statement that ends the block, or -1.
+    int skipStatement(int index) {
+        int depth = 0;
+        for (; index < tokens->length; index++) {
+            if (is(index, "begin")) {
+                depth++;
+            } else if (is(index, "end")) {
+                if (--depth < 0)
+                    return -1;
+            } else if (is(index, "procedure") || is(index, "const") || is(index, "int")) {
+                return -1;
+            } else if (depth == 0 && (is(index, ";") || is(index, "."))) {
+                return index;
+            }
+        }
+
+        return -1;
+    }
+
+    int skipBlock(int index) {
+        if (is(index, "const"))
+            index = skipDeclaration(index);
+        if (index >= 0 && is(index, "int"))
+            index = skipDeclaration(index);
+        while (index >= 0 && is(index, "procedure"))
+            index = skipProcedure(index);
+
+        return (index >= 0) ? skipStatement(index) : -1;
+    }
+
+    struct vector *spans = makeVector(struct procedureSpan);
+    int index = 0;
+    if (is(index, "const"))
+        index = skipDeclaration(index);
+    if (index >= 0 && is(index, "int"))
+        index = skipDeclaration(index);
+    while (index >= 0 && is(index, "procedure")) {
+        int end = skipProcedure(index);
+        if (end >= 0)
+            pushLiteral(spans, struct procedureSpan, {index, end, {NULL, NULL, 0}});
+        index = end;
+    }
+
+    if (index < 0) {
+        freeVector(spans);
+        return NULL;
+    }
+
+    return spans;
+}
+
+// Returns the child of parent with the given name, so that it can be changed.
+static struct parseTree *getChildPointer(struct parseTree *parent, char *name) {
+    forVectorPointers(parent->children, i, struct parseTree, child,
+            if (child->name != NULL && strcmp(child->name, name) == 0)
+                return child;);
+
+    return NULL;
 }
 
+struct parseTree parsePL0TokensInParallel(struct vector *tokens, int threadCount) {
+    struct grammar grammar = getSharedPL0Grammar();
+    if (threadCount <= 0)
+        threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+    struct vector *spans = findProcedureSpans(tokens);
+    if (threadCount < 2 || spans == NULL || spans->length < 2)
+        return parsePL0Tokens(tokens);
+
+    int spanCount = spans->length;
+    int first = get(struct procedureSpan, spans, 0).start;
+    int last = get(struct procedureSpan, spans, spanCount - 1).end;
+
+    // The threads allocate from the caller's arena through their own arenas,
+    // or from malloc like the caller.
+    struct arena *arena = useArena(NULL);
+    useArena(arena);
+
+    struct parallelParse parallel = {tokens, grammar, (struct procedureSpan *)spans->items,
+        spanCount, 0, arena != NULL};
+    if (threadCount > spanCount)
+        threadCount = spanCount;
+    struct parseThread *threads = allocate(threadCount * sizeof (struct parseThread));
+    int started = 0, i;
+    for (i = 1; i < threadCount; i++) {
+        threads[started] = (struct parseThread){0, &parallel, arena != NULL ? makeArena() : NULL};
+        if (pthread_create(&threads[started].thread, NULL, runParseThread, &threads[started]) != 0) {
+            if (threads[started].arena != NULL)
+                freeArena(threads[started].arena);
+            break;
+        }
+        started++;
+    }
+
+    // Parse the rest of the program on this thread, then help with the
+    // procedures.
+    struct vector *rest = makeVector(struct token);
+    vector_resize(rest, tokens->length - (last - first));
+    for (i = 0; i < tokens->length; i++)
+        if (i < first || i >= last)
+            push(rest, get(struct token, tokens, i));
+    struct parseTree tree = parse(rest, grammar, "@program");
+    parseSpans(&parallel);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i].thread, NULL);
+        if (threads[i].arena != NULL)
+            mergeArena(arena, threads[i].arena);
+    }
+    deallocate(threads);
+    freeVector(rest);
+
+    // Put the procedures into the program's parse tree.
+    struct parseTree *block = isParseTreeError(tree) ? NULL : getChildPointer(&tree, "@block");
+    struct parseTree *declaration = (block == NULL) ? NULL
+        : getChildPointer(block, "@procedure-declaration");
+    struct parseTree *procedures = (declaration == NULL) ? NULL
+        : getChildPointer(declaration, "@procedures");
+    int parsed = procedures != NULL && procedures->numTokens == 0;
+    forVector(spans, i, struct procedureSpan, span,
+            parsed &= !isParseTreeError(span.tree););
+    if (!parsed) {
+        freeVector(spans);
+        return parsePL0Tokens(tokens);
+    }
+
+    struct parseTree chain = *procedures;
+    for (i = spanCount - 1; i >= 0; i--) {
+        struct parseTree procedure = get(struct procedureSpan, spans, i).tree;
+        struct vector *children = makeVector(struct parseTree);
+        push(children, procedure);
+        push(children, chain);
+        chain = (struct parseTree){procedures->name, children, procedure.numTokens + chain.numTokens,
+            procedure.line, procedure.column};
+    }
+
+    // The trees around the procedures start at the first procedure if
+    // nothing comes before it.
+    void addChain(struct parseTree *parent) {
+        if (chain.numTokens > 0 && (parent->numTokens == 0 || parent->line > chain.line
+                    || (parent->line == chain.line && parent->column > chain.column))) {
+            parent->line = chain.line;
+            parent->column = chain.column;
+        }
+        parent->numTokens += chain.numTokens;
+    }
+
+    *procedures = chain;
+    addChain(declaration);
+    addChain(block);
+    addChain(&tree);
+    freeVector(spans);
+
+    return tree;
+}
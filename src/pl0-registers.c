@@ -0,0 +1,485 @@
+#include "pl0.h"
+#include "lib/parser.h"
+#include "lib/util.h"
+#include "lib/memory.h"
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+
+// The register backend walks the parse tree in the same order as the stack
+// code generator in pl0-generator.c, so that both backends evaluate every
+// expression in the same order and with the same grouping.
+//
+// Registers are only allocated for what the stack code would keep on the
+// stack: an expression that is just a variable, a literal or a constant uses
+// that register directly, and an assignment writes the result of its last
+// operation straight into the variable's register. Temporaries are allocated
+// like a stack, and are all free again after each statement.
+
+struct registerSymbol {
+    char *name;
+    int type;      // VARIABLE, CONSTANT or PROCEDURE.
+    int level;     // The lexical level of the symbol.
+    int index;     // The register of a variable, or the index of a procedure.
+    int constantValue;
+};
+// Symbol types
+enum { VARIABLE = 1, CONSTANT, PROCEDURE };
+
+struct registerState {
+    struct vector *symbols;
+    int currentLevel;
+    int procedure;       // The index of the procedure being generated.
+    int nextTemporary;   // The first free temporary register.
+    struct registerProgram *program;
+    struct registerState *parentState;
+};
+
+// Defined in pl0-generator.c.
+void addGeneratorError(char *errorMessage);
+int countGeneratorErrors();
+
+void lowerBlock(struct parseTree tree, struct registerState *state);
+void lowerStatement(struct parseTree tree, struct registerState *state);
+int lowerExpression(struct parseTree tree, struct registerState *state, int destination);
+int lowerTerm(struct parseTree tree, struct registerState *state, int destination);
+int lowerFactor(struct parseTree tree, struct registerState *state, int destination);
+int lowerCondition(struct parseTree tree, struct registerState *state);
+
+static char *registerOpcodeNames[] = {NULL, "move", "neg", "add", "sub", "mul", "div", "mod",
+    "jump", "jeql", "jneq", "jlss", "jleq", "jgtr", "jgeq", "jeven", "load", "store", "call",
+    "ret", "read", "write"};
+
+char *getRegisterOpcodeName(int opcode) {
+    if (opcode < 1 || opcode >= REGISTER_OPCODE_COUNT)
+        return NULL;
+
+    return registerOpcodeNames[opcode];
+}
+
+struct registerProgram *generateRegisterPL0(struct parseTree tree) {
+    clearGeneratorErrors();
+
+    if (isParseTreeError(tree))
+        return NULL;
+
+    struct registerProgram *program = allocate(sizeof (struct registerProgram));
+    program->code = makeVector(struct registerInstruction);
+    program->procedures = makeVector(struct registerProcedure);
+
+    pushLiteral(program->procedures, struct registerProcedure,
+            {"main", 0, 0, 0, makeVector(struct registerConstant)});
+
+    struct registerState state = {makeVector(struct registerSymbol), 0, 0, 0, program, NULL};
+    lowerBlock(getChild(tree, "@block"), &state);
+
+    if (countGeneratorErrors() > 0)
+        return NULL;
+
+    return program;
+}
+
+// Helper functions
+// ================
+static struct registerProcedure *getProcedure(struct registerState *state) {
+    return &get(struct registerProcedure, state->program->procedures, state->procedure);
+}
+
+static int addRegisterInstruction(struct registerState *state, int opcode, int a, int b, int c) {
+    pushLiteral(state->program->code, struct registerInstruction, {opcode, a, b, c});
+
+    return state->program->code->length - 1;
+}
+
+static int getAddress(struct registerState *state) {
+    return state->program->code->length;
+}
+
+// Sets the jump target of the jump instruction at the given address.
+static void setJumpTarget(struct registerState *state, int address, int target) {
+    struct registerInstruction *instruction =
+        &get(struct registerInstruction, state->program->code, address);
+
+    if (instruction->opcode == R_JUMP)
+        instruction->a = target;
+    else if (instruction->opcode == R_JUMP_EVEN)
+        instruction->b = target;
+    else
+        instruction->c = target;
+}
+
+static int allocateTemporary(struct registerState *state) {
+    int index = state->nextTemporary++;
+
+    struct registerProcedure *procedure = getProcedure(state);
+    if (state->nextTemporary > procedure->registerCount)
+        procedure->registerCount = state->nextTemporary;
+
+    return index;
+}
+
+// Returns the register that holds the given constant value, adding one if the
+// procedure doesn't have it yet. addConstantRegisters adds all of them before
+// any temporaries are allocated, so constants always come before temporaries.
+static int getConstantRegister(struct registerState *state, int value) {
+    struct registerProcedure *procedure = getProcedure(state);
+    forVector(procedure->constants, i, struct registerConstant, constant,
+            if (constant.value == value)
+                return constant.index;);
+
+    int index = procedure->registerCount++;
+    pushLiteral(procedure->constants, struct registerConstant, {index, value});
+
+    return index;
+}
+
+static int lookupRegisterSymbol(struct registerState *state, char *name,
+        struct registerSymbol *result) {
+    forVector(state->symbols, i, struct registerSymbol, symbol,
+            if (strcmp(symbol.name, name) == 0) {
+                *result = symbol;
+                return 1;
+            });
+
+    if (state->parentState == NULL)
+        return 0;
+    else
+        return lookupRegisterSymbol(state->parentState, name, result);
+}
+
+static struct registerSymbol getRegisterSymbol(struct registerState *state,
+        struct parseTree identifier) {
+    char *name = getFirstChild(identifier).name;
+    struct registerSymbol symbol;
+
+    if (lookupRegisterSymbol(state, name, &symbol))
+        return symbol;
+
+    addGeneratorError(format("Could not find symbol '%s'.", name));
+
+    return (struct registerSymbol){NULL, -1, -1, -1, -1};
+}
+
+static int getNumberValue(struct parseTree factor) {
+    int value = atoi(getFirstChild(getChild(factor, "@number")).name);
+    struct parseTree sign = getChild(factor, "@sign");
+
+    if (sign.children != NULL && sign.children->length > 0
+            && strcmp(getFirstChild(sign).name, "-") == 0)
+        return -value;
+
+    return value;
+}
+
+// Adds registers for the literals and constants used in the given statement,
+// so that they come before the temporaries.
+static void addConstantRegisters(struct parseTree tree, struct registerState *state) {
+    if (tree.children == NULL)
+        return;
+
+    if (strcmp(tree.name, "@factor") == 0 && hasChild(tree, "@number")) {
+        getConstantRegister(state, getNumberValue(tree));
+        return;
+    }
+
+    if (strcmp(tree.name, "@identifier") == 0) {
+        struct registerSymbol symbol;
+        if (lookupRegisterSymbol(state, getFirstChild(tree).name, &symbol)
+                && symbol.type == CONSTANT)
+            getConstantRegister(state, symbol.constantValue);
+        return;
+    }
+
+    forVector(tree.children, i, struct parseTree, child,
+            addConstantRegisters(child, state););
+}
+
+// Declarations
+// ============
+void lowerBlock(struct parseTree tree, struct registerState *state) {
+    assert(hasChild(tree, "@statement"));
+
+    struct registerProcedure *procedure;
+
+    // Constants.
+    struct parseTree constants = getChild(getChild(tree, "@const-declaration"), "@constants");
+    while (!isParseTreeError(constants) && hasChild(constants, "@constant")) {
+        struct parseTree constant = getChild(constants, "@constant");
+        struct registerSymbol symbol = {getFirstChild(getChild(constant, "@identifier")).name,
+            CONSTANT, state->currentLevel, -1,
+            atoi(getFirstChild(getChild(constant, "@number")).name)};
+        push(state->symbols, symbol);
+
+        constants = getChild(constants, "@constants");
+    }
+
+    // Variables.
+    procedure = getProcedure(state);
+    struct parseTree variables = getChild(getChild(tree, "@var-declaration"), "@vars");
+    while (!isParseTreeError(variables) && hasChild(variables, "@var")) {
+        struct parseTree variable = getChild(variables, "@var");
+        struct registerSymbol symbol = {getFirstChild(getChild(variable, "@identifier")).name,
+            VARIABLE, state->currentLevel, procedure->variableCount++, 0};
+        push(state->symbols, symbol);
+
+        variables = getChild(variables, "@vars");
+    }
+    procedure->registerCount = procedure->variableCount;
+
+    // Procedures, whose code comes before the code of the block that
+    // declares them.
+    struct parseTree procedures = getChild(getChild(tree, "@procedure-declaration"),
+            "@procedures");
+    while (!isParseTreeError(procedures) && hasChild(procedures, "@procedure")) {
+        struct parseTree procedureTree = getChild(procedures, "@procedure");
+        char *name = getFirstChild(getChild(procedureTree, "@identifier")).name;
+        int index = state->program->procedures->length;
+
+        // Add the symbol first so that the procedure can call itself.
+        struct registerSymbol symbol = {name, PROCEDURE, state->currentLevel, index, 0};
+        push(state->symbols, symbol);
+        pushLiteral(state->program->procedures, struct registerProcedure,
+                {name, 0, 0, 0, makeVector(struct registerConstant)});
+
+        struct registerState procedureState = {makeVector(struct registerSymbol),
+            state->currentLevel + 1, index, 0, state->program, state};
+        lowerBlock(getChild(procedureTree, "@block"), &procedureState);
+
+        procedures = getChild(procedures, "@procedures");
+    }
+
+    // The statement.
+    struct parseTree statement = getChild(tree, "@statement");
+    addConstantRegisters(statement, state);
+
+    procedure = getProcedure(state);
+    procedure->entry = getAddress(state);
+    state->nextTemporary = procedure->registerCount;
+
+    lowerStatement(statement, state);
+    addRegisterInstruction(state, R_RETURN, 0, 0, 0);
+}
+
+// Statements
+// ==========
+void lowerStatement(struct parseTree tree, struct registerState *state) {
+    if (isParseTreeError(tree) || tree.children == NULL || tree.children->length == 0)
+        return;
+
+    int is(char *name) {
+        return (strcmp(tree.name, name) == 0);
+    }
+
+    // Temporaries only live until the end of the statement.
+    int firstTemporary = state->nextTemporary;
+
+    if (is("@statement")) {
+        lowerStatement(getFirstChild(tree), state);
+    } else if (is("@begin-block")) {
+        lowerStatement(getChild(tree, "@statements"), state);
+    } else if (is("@statements")) {
+        lowerStatement(getChild(tree, "@statement"), state);
+        lowerStatement(getChild(tree, "@statements"), state);
+    } else if (is("@assignment")) {
+        struct registerSymbol symbol = getRegisterSymbol(state, getChild(tree, "@identifier"));
+        int levelsBack = state->currentLevel - symbol.level;
+        struct parseTree expression = getChild(tree, "@expression");
+
+        if (symbol.type != VARIABLE) {
+            if (symbol.type != -1)
+                addGeneratorError("Cannot store into a constant or procedure.");
+        } else if (levelsBack == 0) {
+            int result = lowerExpression(expression, state, symbol.index);
+            if (result != symbol.index)
+                addRegisterInstruction(state, R_MOVE, symbol.index, result, 0);
+        } else {
+            int result = lowerExpression(expression, state, -1);
+            addRegisterInstruction(state, R_STORE, levelsBack, symbol.index, result);
+        }
+    } else if (is("@call-statement")) {
+        struct registerSymbol symbol = getRegisterSymbol(state, getChild(tree, "@identifier"));
+
+        if (symbol.type == PROCEDURE)
+            addRegisterInstruction(state, R_CALL, state->currentLevel - symbol.level,
+                    symbol.index, 0);
+        else if (symbol.type != -1)
+            addGeneratorError("Cannot call a variable or constant.");
+    } else if (is("@read-statement")) {
+        struct registerSymbol symbol = getRegisterSymbol(state, getChild(tree, "@identifier"));
+        int levelsBack = state->currentLevel - symbol.level;
+
+        if (symbol.type != VARIABLE) {
+            if (symbol.type != -1)
+                addGeneratorError("Cannot store into a constant or procedure.");
+        } else if (levelsBack == 0) {
+            addRegisterInstruction(state, R_READ, symbol.index, 0, 0);
+        } else {
+            int temporary = allocateTemporary(state);
+            addRegisterInstruction(state, R_READ, temporary, 0, 0);
+            addRegisterInstruction(state, R_STORE, levelsBack, symbol.index, temporary);
+        }
+    } else if (is("@write-statement")) {
+        // A write statement's identifier is lowered like a factor.
+        int result = lowerFactor(tree, state, -1);
+        addRegisterInstruction(state, R_WRITE, result, 0, 0);
+    } else if (is("@if-statement")) {
+        struct vector *statements = getChildren(tree, "@statement");
+        assert(statements->length == 1 || statements->length == 2);
+
+        int jumpOverThen = lowerCondition(getChild(tree, "@condition"), state);
+        state->nextTemporary = firstTemporary;
+        lowerStatement(getChild(tree, "@statement"), state);
+
+        if (statements->length == 1) {
+            setJumpTarget(state, jumpOverThen, getAddress(state));
+        } else {
+            int jumpOverElse = addRegisterInstruction(state, R_JUMP, -1, 0, 0);
+            setJumpTarget(state, jumpOverThen, getAddress(state));
+            lowerStatement(getLastChild(tree, "@statement"), state);
+            setJumpTarget(state, jumpOverElse, getAddress(state));
+        }
+    } else if (is("@while-statement")) {
+        int beginning = getAddress(state);
+        int jumpOut = lowerCondition(getChild(tree, "@condition"), state);
+        state->nextTemporary = firstTemporary;
+        lowerStatement(getChild(tree, "@statement"), state);
+        addRegisterInstruction(state, R_JUMP, beginning, 0, 0);
+        setJumpTarget(state, jumpOut, getAddress(state));
+    }
+
+    state->nextTemporary = firstTemporary;
+}
+
+// Adds a jump that is taken when the condition is false, and returns its
+// address so that the caller can set its target.
+int lowerCondition(struct parseTree tree, struct registerState *state) {
+    assert(hasChild(tree, "@expression")
+            && (hasChild(tree, "@rel-op") || hasChild(tree, "odd")));
+
+    if (hasChild(tree, "odd")) {
+        int value = lowerExpression(getChild(tree, "@expression"), state, -1);
+        return addRegisterInstruction(state, R_JUMP_EVEN, value, -1, 0);
+    }
+
+    int left = lowerExpression(getChild(tree, "@expression"), state, -1);
+    int right = lowerExpression(getLastChild(tree, "@expression"), state, -1);
+
+    // Jump if the opposite of the operator is true.
+    char *operator = getFirstChild(getChild(tree, "@rel-op")).name;
+    int opcode;
+    if (strcmp(operator, "=") == 0) opcode = R_JUMP_NEQ;
+    else if (strcmp(operator, "<>") == 0) opcode = R_JUMP_EQL;
+    else if (strcmp(operator, "<") == 0) opcode = R_JUMP_GEQ;
+    else if (strcmp(operator, "<=") == 0) opcode = R_JUMP_GTR;
+    else if (strcmp(operator, ">") == 0) opcode = R_JUMP_LEQ;
+    else if (strcmp(operator, ">=") == 0) opcode = R_JUMP_LSS;
+    else assert(0 /* Invalid relational operator. */);
+
+    return addRegisterInstruction(state, opcode, left, right, -1);
+}
+
+// Expressions
+// ===========
+// Each of these returns the register that holds the value. If destination
+// isn't -1, the value is put in that register when it has to be computed, but
+// the caller still has to move it there if a different register is returned.
+
+// Adds an instruction for a binary operation on registers left and right,
+// after freeing any temporaries above firstTemporary.
+static int addOperation(struct registerState *state, int opcode, int left, int right,
+        int destination, int firstTemporary) {
+    state->nextTemporary = firstTemporary;
+    if (destination == -1)
+        destination = allocateTemporary(state);
+
+    addRegisterInstruction(state, opcode, destination, left, right);
+
+    return destination;
+}
+
+int lowerExpression(struct parseTree tree, struct registerState *state, int destination) {
+    assert(hasChild(tree, "@term"));
+
+    if (!hasChild(tree, "@add-or-subtract"))
+        return lowerTerm(getChild(tree, "@term"), state, destination);
+
+    int firstTemporary = state->nextTemporary;
+    int left = lowerTerm(getChild(tree, "@term"), state, -1);
+    int right = lowerExpression(getChild(tree, "@expression"), state, -1);
+
+    char *plusOrMinus = getFirstChild(getChild(tree, "@add-or-subtract")).name;
+    int opcode = (strcmp(plusOrMinus, "+") == 0) ? R_ADD : R_SUB;
+
+    return addOperation(state, opcode, left, right, destination, firstTemporary);
+}
+
+static int getMultiplyOrDivideOpcode(struct parseTree tree) {
+    return (strcmp(getFirstChild(getChild(tree, "@multiply-or-divide")).name, "*") == 0)
+        ? R_MUL : R_DIV;
+}
+
+int lowerTerm(struct parseTree tree, struct registerState *state, int destination) {
+    assert(hasChild(tree, "@factor"));
+
+    if (!hasChild(tree, "@multiply-or-divide"))
+        return lowerFactor(getChild(tree, "@factor"), state, destination);
+
+    // Like generate_term, this computes "a * b * c * d" as "(a * b) * (c * d)".
+    int firstTemporary = state->nextTemporary;
+    struct parseTree term = getChild(tree, "@term");
+
+    int left = lowerFactor(getChild(tree, "@factor"), state, -1);
+    int right = lowerFactor(getChild(term, "@factor"), state, -1);
+
+    if (!hasChild(term, "@multiply-or-divide"))
+        return addOperation(state, getMultiplyOrDivideOpcode(tree), left, right, destination,
+                firstTemporary);
+
+    left = addOperation(state, getMultiplyOrDivideOpcode(tree), left, right, -1,
+            firstTemporary);
+    right = lowerTerm(getChild(term, "@term"), state, -1);
+
+    return addOperation(state, getMultiplyOrDivideOpcode(term), left, right, destination,
+            firstTemporary);
+}
+
+int lowerFactor(struct parseTree tree, struct registerState *state, int destination) {
+    if (hasChild(tree, "@expression"))
+        return lowerExpression(getChild(tree, "@expression"), state, destination);
+
+    if (hasChild(tree, "@number"))
+        return getConstantRegister(state, getNumberValue(tree));
+
+    struct registerSymbol symbol = getRegisterSymbol(state, getChild(tree, "@identifier"));
+    int levelsBack = state->currentLevel - symbol.level;
+
+    if (symbol.type == PROCEDURE) {
+        addGeneratorError("Cannot take value of procedure.");
+    } else if (symbol.type == CONSTANT) {
+        return getConstantRegister(state, symbol.constantValue);
+    } else if (symbol.type == VARIABLE) {
+        if (levelsBack == 0)
+            return symbol.index;
+
+        if (destination == -1)
+            destination = allocateTemporary(state);
+        addRegisterInstruction(state, R_LOAD, destination, levelsBack, symbol.index);
+        return destination;
+    }
+
+    return 0;
+}
+
+void printRegisterProgram(struct registerProgram *program) {
+    forVector(program->procedures, i, struct registerProcedure, procedure,
+        printf("procedure %s: entry %d, %d registers, %d variables", procedure.name,
+                procedure.entry, procedure.registerCount, procedure.variableCount);
+        forVector(procedure.constants, j, struct registerConstant, constant,
+                printf(", r%d = %d", constant.index, constant.value););
+        printf("\n"););
+
+    forVector(program->code, i, struct registerInstruction, instruction,
+            printf("%3d %-5s %-3d %-3d %-3d\n", i, getRegisterOpcodeName(instruction.opcode),
+                    instruction.a, instruction.b, instruction.c););
+}
@@ -0,0 +1,175 @@
+#include "pl0.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+
+// Stack bounds
+// ============
+// Finds the highest the stack pointer can get while a program runs, so that
+// the VM can allocate exactly that much stack and stop checking the stack
+// pointer before every instruction.
+//
+// Each procedure is analyzed on its own, from its entry, with the depth (the
+// number of values above bp - 1, where its frame starts) at 0. Following the
+// jumps gives each instruction the depth that the stack has when it runs. The
+// generator always reaches an instruction with the same depth, so reaching one
+// again with a different depth means that a loop can keep pushing, and the
+// program has no bound. A cal adds the deepest point of the procedure it
+// calls to the depth at the call, so a procedure that can end up calling
+// itself has no bound either. Tail calls pop the frame and jump to the
+// procedure, so they are followed like any other jump, which gives tail
+// recursion a bound.
+//
+// This assumes that the program doesn't overwrite the dynamic links and
+// return addresses that cal leaves in each frame, which would make a return
+// go somewhere else, so programs with stores to those slots have no bound.
+
+// The slots that cal fills in at the start of a frame: the function value,
+// static link, dynamic link and return address.
+#define CALL_FRAME_SIZE 4
+#define DYNAMIC_LINK 2
+#define RETURN_ADDRESS 3
+
+// Depths of procedures that aren't numbers.
+enum { NOT_ANALYZED = -1, ANALYZING = -2, UNBOUNDED = -3 };
+
+static int isStore(int opcode) {
+    return opcode == OP_STO || opcode == OP_STO_DISPLAY || opcode == OP_READ_STO
+        || opcode == OP_LIT_STO || opcode == OP_INCREMENT;
+}
+
+int computeStackBound(struct vector *instructions) {
+    int length = instructions->length;
+    if (length == 0)
+        return -1;
+
+    // The deepest that the stack gets in the procedure at each address, for
+    // procedures that were analyzed.
+    int *procedureDepths = allocate(length * sizeof (int));
+    int i;
+    for (i = 0; i < length; i++)
+        procedureDepths[i] = NOT_ANALYZED;
+
+    int analyze(int entry) {
+        if (entry < 0 || entry >= length || procedureDepths[entry] == ANALYZING)
+            return UNBOUNDED;
+        if (procedureDepths[entry] != NOT_ANALYZED)
+            return procedureDepths[entry];
+        procedureDepths[entry] = ANALYZING;
+
+        // The depth at each instruction, or -1 if it isn't reached.
+        int *depths = allocate(length * sizeof (int));
+        int address;
+        for (address = 0; address < length; address++)
+            depths[address] = -1;
+        struct vector *worklist = makeVector(int);
+        int maxDepth = 0;
+        int bounded = 1;
+
+        void reach(int address, int depth) {
+            if (address < 0 || address >= length || depth < 0) {
+                bounded = 0;
+            } else if (depths[address] < 0) {
+                depths[address] = depth;
+                push(worklist, address);
+            } else if (depths[address] != depth) {
+                bounded = 0;
+            }
+        }
+
+        reach(entry, 0);
+        while (bounded && worklist->length > 0) {
+            address = get(int, worklist, worklist->length - 1);
+            worklist->length -= 1;
+
+            struct instruction instruction = get(struct instruction, instructions, address);
+            int depth = depths[address];
+            int after = depth;   // The depth after the instruction runs.
+            int peak = depth;    // The deepest the stack gets while it runs.
+            int next = address + getInstructionLength(instruction.opcode);
+
+            if (isStore(instruction.opcode) && (instruction.modifier == DYNAMIC_LINK
+                        || instruction.modifier == RETURN_ADDRESS)) {
+                bounded = 0;
+                break;
+            }
+
+            switch (instruction.opcode) {
+                case OP_LIT:
+                case OP_LOD:
+                case OP_READ:
+                case OP_LOD_LOD_OPR:
+                case OP_LOD_DISPLAY:
+                    after = depth + 1;
+                    break;
+                case OP_STO:
+                case OP_WRITE:
+                case OP_STO_DISPLAY:
+                    after = depth - 1;
+                    break;
+                case OP_OPR:
+                    if (instruction.modifier == OPR_RET)
+                        continue;
+                    if (instruction.modifier != OPR_NEG && instruction.modifier != OPR_ODD)
+                        after = depth - 1;
+                    break;
+                case OP_INC:
+                    after = depth + instruction.modifier;
+                    break;
+                case OP_JMP:
+                    next = instruction.modifier;
+                    break;
+                case OP_JPC:
+                case OP_LIT_OPR_JPC:
+                    after = depth - 1;
+                    reach(instruction.modifier, after);
+                    break;
+                case OP_OPR_JPC:
+                    after = depth - 2;
+                    reach(instruction.modifier, after);
+                    break;
+                case OP_LIT_OPR:
+                case OP_INCREMENT:
+                case OP_LOD_WRITE:
+                case OP_READ_STO:
+                case OP_LIT_STO:
+                    break;
+                case OP_CAL:
+                case OP_CAL_DISPLAY: {
+                    int calleeDepth = analyze(instruction.modifier);
+                    if (calleeDepth == UNBOUNDED) {
+                        bounded = 0;
+                        continue;
+                    }
+                    // cal fills in the frame before the callee's inc makes
+                    // room for it.
+                    if (calleeDepth < CALL_FRAME_SIZE)
+                        calleeDepth = CALL_FRAME_SIZE;
+                    peak = depth + calleeDepth;
+                    break;
+                }
+                default:
+                    // Returns, and instructions that the VM stops at.
+                    continue;
+            }
+
+            if (after > peak)
+                peak = after;
+            if (peak > maxDepth)
+                maxDepth = peak;
+            reach(next, after);
+        }
+
+        freeVector(worklist);
+        deallocate(depths);
+
+        procedureDepths[entry] = bounded ? maxDepth : UNBOUNDED;
+        return procedureDepths[entry];
+    }
+
+    // The main program's frame starts at 1, so its depth is the stack
+    // pointer.
+    int bound = analyze(0);
+    deallocate(procedureDepths);
+
+    return (bound == UNBOUNDED) ? -1 : bound;
+}
@@ -0,0 +1,181 @@
+#include "pl0.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <string.h>
+
+// Superinstructions
+// =================
+// Most of the time that the VM spends on a PL/0 program goes to dispatching
+// instructions rather than to the work that they do, and the generator always
+// produces the same few sequences: loading a variable and a literal before an
+// operator, comparing and jumping, adding a constant to a variable. Each
+// superinstruction does the work of one of these sequences with a single
+// dispatch. The sequences were picked by running the example programs with
+// `pl0vm --ngrams` (see src/vm/pl0vm.c), which prints the most common
+// sequences of executed instructions.
+//
+// Superinstructions that need more operands than fit in one instruction are
+// followed by ext instructions, which the VM skips over. This keeps every
+// instruction in the "opcode level modifier" format.
+
+static int isBinaryOperator(int operator) {
+    return (operator >= OPR_ADD && operator <= OPR_DIV)
+        || (operator >= OPR_MOD && operator <= OPR_GEQ);
+}
+
+static int isRelationalOperator(int operator) {
+    return operator >= OPR_EQL && operator <= OPR_GEQ;
+}
+
+int getInstructionLength(int opcode) {
+    switch (opcode) {
+        case OP_LIT_OPR_JPC:
+        case OP_LOD_LOD_OPR:
+        case OP_INCREMENT:
+        case OP_LIT_STO:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+int hasCodeAddress(int opcode) {
+    return opcode == OP_CAL || opcode == OP_JMP || opcode == OP_JPC
+        || opcode == OP_OPR_JPC || opcode == OP_LIT_OPR_JPC || opcode == OP_CAL_DISPLAY;
+}
+
+struct vector *selectSuperinstructions(struct vector *instructions) {
+    int length = instructions->length;
+    struct vector *result = makeVector(struct instruction);
+
+    // A sequence can't be replaced if something jumps into the middle of it.
+    char *isJumpTarget = allocate(length + 1);
+    memset(isJumpTarget, 0, length + 1);
+    forVector(instructions, i, struct instruction, instruction,
+            if (hasCodeAddress(instruction.opcode)
+                    && instruction.modifier >= 0 && instruction.modifier <= length)
+                isJumpTarget[instruction.modifier] = 1;);
+
+    // The address of each old instruction in the result.
+    int *newAddresses = allocate((length + 1) * sizeof (int));
+
+    struct instruction at(int index) {
+        return get(struct instruction, instructions, index);
+    }
+
+    // Returns true if the count instructions starting at index have the given
+    // opcodes and nothing jumps into the middle of them.
+    int matches(int index, int count, int opcode1, int opcode2, int opcode3, int opcode4) {
+        int opcodes[] = {opcode1, opcode2, opcode3, opcode4};
+        int i;
+
+        if (index + count > length)
+            return 0;
+
+        for (i = 0; i < count; i++) {
+            if (at(index + i).opcode != opcodes[i])
+                return 0;
+            if (i > 0 && isJumpTarget[index + i])
+                return 0;
+        }
+
+        return 1;
+    }
+
+    // Superinstructions are at the location of the first instruction that
+    // they replace.
+    int line = 0, column = 0;
+    void add(int opcode, int lexicalLevel, int modifier) {
+        pushLiteral(result, struct instruction,
+                {opcode, getOpcodeName(opcode), lexicalLevel, modifier, line, column});
+    }
+
+    // Tries each superinstruction at index, longest first, and returns the
+    // number of instructions replaced, or 0.
+    int replace(int index) {
+        struct instruction a = at(index);
+        struct instruction b = (index + 1 < length) ? at(index + 1) : a;
+        struct instruction c = (index + 2 < length) ? at(index + 2) : a;
+        struct instruction d = (index + 3 < length) ? at(index + 3) : a;
+
+        if (matches(index, 4, OP_LOD, OP_LIT, OP_OPR, OP_STO)
+                && (c.modifier == OPR_ADD || c.modifier == OPR_SUB)
+                && a.lexicalLevel == d.lexicalLevel && a.modifier == d.modifier) {
+            add(OP_INCREMENT, a.lexicalLevel, a.modifier);
+            add(OP_EXT, 0, (c.modifier == OPR_ADD) ? b.modifier : -b.modifier);
+            return 4;
+        }
+
+        if (matches(index, 3, OP_LIT, OP_OPR, OP_JPC, 0) && isRelationalOperator(b.modifier)) {
+            add(OP_LIT_OPR_JPC, b.modifier, c.modifier);
+            add(OP_EXT, 0, a.modifier);
+            return 3;
+        }
+
+        if (matches(index, 3, OP_LOD, OP_LOD, OP_OPR, 0) && isBinaryOperator(c.modifier)
+                && a.lexicalLevel == b.lexicalLevel) {
+            add(OP_LOD_LOD_OPR, a.lexicalLevel, a.modifier);
+            add(OP_EXT, c.modifier, b.modifier);
+            return 3;
+        }
+
+        if (matches(index, 2, OP_OPR, OP_JPC, 0, 0) && isRelationalOperator(a.modifier)) {
+            add(OP_OPR_JPC, a.modifier, b.modifier);
+            return 2;
+        }
+
+        if (matches(index, 2, OP_LIT, OP_OPR, 0, 0) && isBinaryOperator(b.modifier)) {
+            add(OP_LIT_OPR, b.modifier, a.modifier);
+            return 2;
+        }
+
+        if (matches(index, 2, OP_LIT, OP_STO, 0, 0)) {
+            add(OP_LIT_STO, b.lexicalLevel, b.modifier);
+            add(OP_EXT, 0, a.modifier);
+            return 2;
+        }
+
+        if (matches(index, 2, OP_LOD, OP_WRITE, 0, 0)) {
+            add(OP_LOD_WRITE, a.lexicalLevel, a.modifier);
+            return 2;
+        }
+
+        if (matches(index, 2, OP_READ, OP_STO, 0, 0)) {
+            add(OP_READ_STO, b.lexicalLevel, b.modifier);
+            return 2;
+        }
+
+        return 0;
+    }
+
+    int index = 0;
+    while (index < length) {
+        newAddresses[index] = result->length;
+        line = at(index).line;
+        column = at(index).column;
+
+        int replaced = replace(index);
+        if (replaced == 0) {
+            push(result, get(struct instruction, instructions, index));
+            replaced = 1;
+        }
+
+        // Nothing jumps to the other instructions in the sequence.
+        int i;
+        for (i = 1; i < replaced; i++)
+            newAddresses[index + i] = newAddresses[index];
+
+        index += replaced;
+    }
+    newAddresses[length] = result->length;
+
+    forVectorPointers(result, i, struct instruction, instruction,
+            if (hasCodeAddress(instruction->opcode)
+                    && instruction->modifier >= 0 && instruction->modifier <= length)
+                instruction->modifier = newAddresses[instruction->modifier];);
+
+    deallocate(isJumpTarget);
+    deallocate(newAddresses);
+
+    return result;
+}
@@ -1,28 +1,132 @@
 #ifndef PL0_H
 #define PL0_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The version of the compiler. Change this whenever a change to the compiler
+// changes the code that it generates, so that programs cached by older
+// versions aren't reused.
+#define PL0_COMPILER_VERSION "1.2"
+
 // Use the lexer code generated by flex and pl0-vector.l to return a vector of
 // token structs containing all of the tokens in the given string of PL/0
 // source code.
 // Defined in pl0-lexer.c, which is generated from pl0-vector.l by flex.
 struct vector *readPL0Tokens(char *source);
+// The same as readPL0Tokens, but reads exactly length characters of source,
+// which doesn't need to be null-terminated.
+struct vector *readPL0TokensWithLength(char *source, size_t length);
 
 // Takes a vector of tokens representing PL/0 source code tokens and returns a
 // parse tree representing the structure of the code.
 // Defined in pl0-parser.c.
 struct parseTree parsePL0Tokens(struct vector *tokens);
+// The same as parsePL0Tokens, but with the Earley parser (see lib/earley.h),
+// which returns the same parse trees.
+// Defined in pl0-parser.c.
+struct parseTree parsePL0TokensWithEarley(struct vector *tokens);
+// The same as parsePL0Tokens, but parses the procedures declared at the top
+// level of the program on threadCount threads, or on one thread per core if
+// threadCount is 0, and returns the same parse tree.
+// Defined in pl0-parser.c.
+struct parseTree parsePL0TokensInParallel(struct vector *tokens, int threadCount);
+// Returns the grammar that parsePL0Tokens uses. Each call builds a new copy.
+// Defined in pl0-parser.c.
+struct grammar getPL0Grammar();
 
 // Takes a parse tree produced by parsePL0Tokens and returns a list of VM
 // instructions.
 // Defined in pl0-generator.c.
 struct vector *generatePL0(struct parseTree tree);
 
+// Options that change how generatePL0WithOptions generates code. A
+// zero-initialized struct gives the same behavior as generatePL0.
+struct generatorOptions {
+    // If not NULL, the generator keeps the code it generates for each
+    // procedure in this directory, and reuses it the next time it sees the
+    // same procedure in the same surroundings instead of generating it again.
+    char *procedureCacheDirectory;
+    // If true, common sequences of instructions are replaced by
+    // superinstructions (see selectSuperinstructions).
+    int superinstructions;
+    // If true, calls to small procedures are replaced by their bodies (see
+    // inlineProcedures).
+    int inlining;
+    // If true, calls in tail position reuse the calling procedure's frame
+    // instead of making a new one.
+    int tailCalls;
+    // If true, variables are accessed through a display instead of static
+    // links (see OP_LOD_DISPLAY). Only pl0vm can run the result.
+    int display;
+    // If true, the code is generated from the mid-level optimizer's
+    // intermediate representation (see optimizePL0), after running the
+    // passes in optimizerPasses, which is a combination of OPTIMIZE_* flags.
+    int optimize;
+    int optimizerPasses;
+    // If true, while loops are rotated so that each iteration runs one jump
+    // instead of two, and the expressions in them that don't change from one
+    // iteration to the next are computed once before the loop.
+    int loops;
+    // If greater than 1, the procedures declared at the top level of the
+    // program are generated on this many threads, and then linked. The code
+    // is the same as with one thread. It doesn't apply with loops.
+    int threads;
+};
+
+struct vector *generatePL0WithOptions(struct parseTree tree, struct generatorOptions options);
+
+// Adds the options that affect the generated code to the given hash (see
+// lib/hash.h), for building cache keys.
+uint64_t hashGeneratorOptions(uint64_t hash, struct generatorOptions options);
+
+// The passes of the mid-level optimizer. OPTIMIZE_CONSTANTS is 1 << 0 and so
+// on, where the shift is the pass's index for getOptimizerPassName and the
+// statistics below.
+enum {
+    OPTIMIZE_CONSTANTS = 1,     // Global constant propagation.
+    OPTIMIZE_COPIES = 2,        // Copy propagation.
+    OPTIMIZE_DEAD_STORES = 4,   // Dead store elimination.
+    OPTIMIZE_DEAD_CODE = 8,     // Dead code elimination.
+    OPTIMIZE_ALL = 15
+};
+#define OPTIMIZER_PASS_COUNT 4
+
+// Counters describing what the last call to generatePL0 did.
+struct generatorStatistics {
+    int proceduresGenerated;
+    int proceduresReused;   // Procedures copied from the procedure cache.
+    int callsInlined;       // Each of these saves a frame when it runs.
+    int callInstructionsSaved;   // The instructions that running every
+                                 // inlined call once no longer runs.
+    // Descriptions of the calls that were turned into tail calls, such as
+    // "call b in a", as a vector of strings. Procedures that were reused
+    // from the procedure cache aren't included.
+    struct vector *tailCalls;
+    // The number of changes that each optimizer pass made, and the time it
+    // took, over all procedures.
+    int optimizerChanges[OPTIMIZER_PASS_COUNT];
+    double optimizerMilliseconds[OPTIMIZER_PASS_COUNT];
+    int loopsRotated;
+    int expressionsHoisted;   // Loop-invariant expressions moved out of loops.
+};
+
+struct generatorStatistics getGeneratorStatistics();
+// Sets the statistics back to those of a program with no procedures, for a
+// compilation that stops before generating anything.
+void clearGeneratorStatistics();
+
 // generatePL0 returns a vector of this struct:
 struct instruction {
     int opcode;
     char *opcodeName;
     int lexicalLevel;
     int modifier;
+    // Where the statement or expression that the instruction was generated
+    // for starts in the source code, or 0 if it isn't known.
+    int line;
+    int column;
 };
 
 // Print a list of instructions returned by generatePL0. If humanReadable is
@@ -30,11 +134,320 @@ struct instruction {
 // directly to the VM. Otherwise, prints something a little bit more friendly.
 void printInstructions(struct vector *instructions, int humanReadable);
 
+// Line tables
+// ===========
+// A line table maps each instruction back to its line in the source code. It
+// has a pair of ints for each run of instructions on the same line: the
+// number of instructions in the run, and the difference between its line and
+// the line of the run before it (or 0 for the first one). With --line-table,
+// the compiler prints one after the instructions, like this:
+//
+// lines 3 1 4 2 2 -1
+//
+// which puts instructions 0 to 2 on line 1, 3 to 6 on line 3 and 7 to 8 on
+// line 2. Defined in pl0-instructions.c.
+struct vector *makeLineTable(struct vector *instructions);
+void printLineTable(struct vector *lineTable);
+// Sets the line of each instruction from the line table. Returns false if the
+// table is for a different number of instructions.
+int applyLineTable(struct vector *instructions, struct vector *lineTable);
+
+// An error found by generatePL0, at the location of the innermost part of the
+// parse tree with tokens that it was generating, or at line 0 if that isn't
+// known.
+struct generatorError {
+    char *message;
+    int line;
+    int column;
+};
+
 // Used for checking if generatePL0 had any errors.
 char *getGeneratorErrors();
+// Returns the generator's errors as a vector of struct generatorError, or NULL
+// if there weren't any errors.
+struct vector *getGeneratorErrorList();
+void clearGeneratorErrors();
+
+// Opcodes
+// =======
+// The instructions from lit to read are the ones that the VM in ./vm runs.
+// The rest are superinstructions and the display instructions, which only the
+// VM in src/vm runs.
+enum {
+    OP_LIT = 1, OP_OPR, OP_LOD, OP_STO, OP_CAL, OP_INC, OP_JMP, OP_JPC, OP_WRITE, OP_READ,
+    OP_LIT_OPR,       // lop OP N:       lit N, opr OP
+    OP_OPR_JPC,       // cjp OP A:       opr OP, jpc A
+    OP_LIT_OPR_JPC,   // lcj OP A, ext N: lit N, opr OP, jpc A
+    OP_LOD_LOD_OPR,   // llo L A, ext OP B: lod L A, lod L B, opr OP
+    OP_INCREMENT,     // inv L A, ext N: lod L A, lit N, opr add, sto L A
+    OP_LOD_WRITE,     // wrv L A:        lod L A, write
+    OP_READ_STO,      // rdv L A:        read, sto L A
+    OP_LIT_STO,       // stl L A, ext N: lit N, sto L A
+    OP_EXT,           // Holds more operands for the instruction before it.
+    // With --display, the generator finds the frame of a variable's procedure
+    // in a display, which holds the frame of the latest activation at each
+    // lexical level, instead of by following static links. L is the lexical
+    // level of the procedure itself here, not the number of levels out.
+    OP_LOD_DISPLAY,   // lodd L A:       push stack[display[L] + A]
+    OP_STO_DISPLAY,   // stod L A:       pop into stack[display[L] + A]
+    OP_CAL_DISPLAY,   // cald L A:       call A, which runs at level L, and set
+                      //                 display[L] to its frame
+    OP_RET_DISPLAY,   // retd 0 0:       restore display[L] and return
+    OPCODE_COUNT
+};
+
+// The modifiers of opr.
+enum {
+    OPR_RET = 0, OPR_NEG, OPR_ADD, OPR_SUB, OPR_MUL, OPR_DIV, OPR_ODD, OPR_MOD,
+    OPR_EQL, OPR_NEQ, OPR_LSS, OPR_LEQ, OPR_GTR, OPR_GEQ
+};
 
 // Given a VM instruction name, such as "lit" or "sto", returns the
 // corresponding integer opcode.
+// Defined in pl0-instructions.c.
 int getOpcode(char *instruction);
+// The reverse of getOpcode. Returns NULL for unknown opcodes.
+char *getOpcodeName(int opcode);
+
+// Reads instructions in the format that printInstructions prints when
+// humanReadable is false, followed by a line table if the compiler printed
+// one, which sets the instructions' lines. Returns NULL if the file isn't in
+// that format. Defined in pl0-instructions.c.
+struct vector *readInstructions(FILE *file);
+// The same, but the instructions can start with a "stack N" line, which the
+// compiler prints with --stack-bound. Sets stackBound to N, or to -1 if there
+// isn't one.
+struct vector *readInstructionsWithStackBound(FILE *file, int *stackBound);
+
+// Stack bounds
+// ============
+// Returns the highest that the stack pointer can get while the instructions
+// run, or -1 if that can't be known, for example because the program is
+// recursive. Defined in pl0-stack.c.
+int computeStackBound(struct vector *instructions);
+
+// Superinstructions
+// =================
+// Defined in pl0-superinstructions.c.
+
+// Returns a copy of the instructions with common sequences replaced by
+// superinstructions, and with code addresses moved to match.
+struct vector *selectSuperinstructions(struct vector *instructions);
+// Returns the number of instructions that the instruction with the given
+// opcode takes up, including its ext instructions.
+int getInstructionLength(int opcode);
+// Returns true if the modifier of the instruction with the given opcode is a
+// code address.
+int hasCodeAddress(int opcode);
+
+// Procedure inlining
+// ==================
+// Returns a copy of the instructions with calls to small, non-recursive
+// procedures replaced by the procedures' bodies, and adds what it did to the
+// statistics. Defined in pl0-inline.c.
+struct vector *inlineProcedures(struct vector *instructions,
+        struct generatorStatistics *statistics);
+
+// Mid-level optimizer
+// ===================
+// Defined in pl0-optimizer.c.
+
+// Takes a parse tree that generatePL0 generated code for without errors,
+// builds a control-flow graph in SSA form for each procedure, runs the passes
+// in options.optimizerPasses on it, and lowers it to stack code. Only the
+// display option changes the code; adds what the passes did to statistics.
+struct vector *optimizePL0(struct parseTree tree, struct generatorOptions options,
+        struct generatorStatistics *statistics);
+// Returns the name of the optimizer pass with the given index, such as
+// "constants", or NULL if there isn't one.
+char *getOptimizerPassName(int pass);
+
+// C backend
+// =========
+// Prints a self-contained C program that runs the instructions in the same
+// way as the VM, for compiling PL/0 programs to native code. Superinstructions
+// aren't supported. Defined in pl0-c.c.
+void printCProgram(struct vector *instructions);
+
+// Register code
+// =============
+// An alternative backend that lowers the parse tree to three-address code for
+// a register machine instead of to stack code. Each activation of a procedure
+// gets its own set of registers: first its variables, then the literals and
+// constants it uses (which the VM sets when the procedure is called), then the
+// temporaries for its expressions. Variables of enclosing procedures are
+// reached with R_LOAD and R_STORE. Defined in pl0-registers.c.
+
+// Opcodes for registerInstruction. r[x] is register x of the running
+// procedure.
+enum {
+    R_MOVE = 1,    // r[a] = r[b]
+    R_NEG,         // r[a] = -r[b]
+    R_ADD,         // r[a] = r[b] + r[c], and so on for the next four.
+    R_SUB,
+    R_MUL,
+    R_DIV,
+    R_MOD,
+    R_JUMP,        // Jump to a.
+    R_JUMP_EQL,    // Jump to c if r[a] = r[b], and so on for the next five.
+    R_JUMP_NEQ,
+    R_JUMP_LSS,
+    R_JUMP_LEQ,
+    R_JUMP_GTR,
+    R_JUMP_GEQ,
+    R_JUMP_EVEN,   // Jump to b if r[a] is even.
+    R_LOAD,        // r[a] = register c of the procedure b levels out.
+    R_STORE,       // Register b of the procedure a levels out = r[c].
+    R_CALL,        // Call procedure b, which was declared a levels out.
+    R_RETURN,
+    R_READ,        // Read r[a].
+    R_WRITE,       // Write r[a].
+    REGISTER_OPCODE_COUNT
+};
+
+struct registerInstruction {
+    int opcode;
+    int a, b, c;
+};
+
+struct registerConstant {
+    int index;   // The register that holds the constant.
+    int value;
+};
+
+struct registerProcedure {
+    char *name;
+    int entry;           // The address of the procedure's first instruction.
+    int registerCount;
+    int variableCount;   // Registers 0 to variableCount - 1 are variables.
+    struct vector *constants;   // A vector of registerConstant structs.
+};
+
+struct registerProgram {
+    struct vector *code;         // A vector of registerInstruction structs.
+    struct vector *procedures;   // A vector of registerProcedure structs.
+                                 // The first one is the main program.
+};
+
+// Takes a parse tree produced by parsePL0Tokens and returns the program as
+// register code. Reports errors in the same way as generatePL0, and returns
+// NULL if there were any.
+struct registerProgram *generateRegisterPL0(struct parseTree tree);
+
+// Returns the name of a register opcode, such as "add", or NULL for unknown
+// opcodes.
+char *getRegisterOpcodeName(int opcode);
+// Prints a listing of the procedures and instructions in a register program.
+void printRegisterProgram(struct registerProgram *program);
+
+// Procedure cache
+// ===============
+// The procedure cache stores the instructions generated for a single
+// procedure, along with enough information to move them to a different code
+// address. Defined in pl0-cache.c.
+
+// How the address in an instruction's modifier has to be changed when the
+// instruction is moved.
+enum {
+    RELOCATE_NONE = 0,  // The modifier isn't a code address.
+    RELOCATE_BLOCK,     // The modifier is relative to the start of the block.
+    RELOCATE_SYMBOL,    // The modifier is the address of the named procedure,
+                        // or in an object (see below), of the named variable.
+    RELOCATE_GLOBAL     // Objects only: the modifier is the address of one
+                        // of the object's variables in its frame.
+};
+
+struct cachedInstruction {
+    struct instruction instruction;
+    int relocation;
+    char *symbol;   // The procedure name for RELOCATE_SYMBOL, otherwise NULL.
+};
+
+// Returns a vector of cachedInstruction structs, or NULL if there is no
+// block with the given key in the directory.
+struct vector *loadCachedProcedure(char *directory, uint64_t key);
+void storeCachedProcedure(char *directory, uint64_t key, struct vector *cachedInstructions);
+
+// Program cache
+// =============
+// The program cache stores the instructions generated for whole programs,
+// keyed by the hash of the source code, the compiler version and the options.
+// Defined in pl0-cache.c.
+
+// Returns the key for compiling the given source code with the given options.
+uint64_t hashProgram(char *sourceCode, struct generatorOptions options);
+
+// Returns a vector of instruction structs, or NULL if the program isn't in the
+// cache. Programs that are found are marked as recently used.
+struct vector *loadCachedProgram(char *directory, uint64_t key);
+
+// Stores the instructions for the program with the given key, then removes
+// the least recently used programs until the cache is no bigger than maxSize
+// bytes.
+void storeCachedProgram(char *directory, uint64_t key, struct vector *instructions,
+        long long maxSize);
+
+// The number of lookups in a program cache directory since it was created.
+struct programCacheCounters {
+    long long hits;
+    long long misses;
+};
+
+// Counts a lookup in the given program cache directory, and returns the
+// updated counters.
+struct programCacheCounters countProgramCacheLookup(char *directory, int hit);
+
+// Separate compilation
+// ====================
+// A program can be split into modules that are compiled on their own into
+// objects, which pl0ld links into one program. A module is a PL/0 program
+// that can use procedures, variables and constants without declaring them:
+// they're imported from the modules that declare them at the top level,
+// which export all of their top-level symbols. The first object that is
+// linked is the main program, and the others can't have a statement. Their
+// variables go after the main program's, in its frame.
+
+// Symbol types in objects.
+enum { OBJECT_PROCEDURE = 1, OBJECT_VARIABLE, OBJECT_CONSTANT };
+
+struct objectSymbol {
+    char *name;
+    int type;
+    int value;   // The procedure's address in the object, the variable's
+                 // address in its frame, or the constant's value.
+};
+
+struct pl0Object {
+    char *name;   // What the linker calls the object in its errors, such as
+                  // the object's filename.
+    // A vector of cachedInstruction structs. Code addresses are relative to
+    // the start of the object, and the instructions that use imported
+    // symbols are RELOCATE_SYMBOL. pl0ld turns loads of constants into lit
+    // instructions.
+    struct vector *code;
+    struct vector *exports;   // A vector of objectSymbol structs.
+    int globals;         // The slots that the module's variables take up in
+                         // its frame, after the ones that cal fills in.
+    int statementSize;   // The instructions in the module's statement.
+    int display;         // Whether the code uses the display.
+};
+
+// Generates an object for the module with the given parse tree. Only
+// options.tailCalls, options.display and options.loops apply. Reports errors
+// in the same way as generatePL0, and returns NULL if there were any.
+// Defined in pl0-generator.c.
+struct pl0Object *generatePL0Object(struct parseTree tree, struct generatorOptions options);
+
+// Prints an object in the format that readPL0Object reads.
+// Defined in pl0-object.c.
+void printPL0Object(struct pl0Object *object);
+// Returns the object with the given name in the file, or NULL if the file
+// isn't an object.
+struct pl0Object *readPL0Object(FILE *file, char *name);
+
+// Links a vector of pl0Object pointers into one program, and returns its
+// instructions, or NULL if there were errors, which getLinkerErrors returns.
+struct vector *linkPL0Objects(struct vector *objects);
+char *getLinkerErrors();
 
 #endif
@@ -0,0 +1,111 @@
+#include "compiler.h"
+#include "lib/util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// A thin client for the compiler server (see compiler-server.c). It takes the
+// same arguments as the compiler and behaves the same way, but sends the
+// program to a running `compiler --serve` instead of starting a compiler. If
+// no server is running, it runs the compiler itself instead.
+
+// Replaces the client with the compiler from the same directory, passing it
+// the same arguments.
+void runCompiler(char **argv) {
+    char *compilerPath = "compiler";
+    char *slash = strrchr(argv[0], '/');
+    if (slash != NULL)
+        compilerPath = format("%.*scompiler", (int)(slash - argv[0] + 1), argv[0]);
+
+    argv[0] = compilerPath;
+    execvp(compilerPath, argv);
+
+    perror(compilerPath);
+    exit(1);
+}
+
+// Connects to the compiler server. Returns the socket, or -1 if no server is
+// listening.
+int connectToServer() {
+    char *socketPath = getenv(SERVER_SOCKET_VARIABLE);
+    if (socketPath == NULL)
+        socketPath = DEFAULT_SERVER_SOCKET;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof address.sun_path)
+        return -1;
+    strcpy(address.sun_path, socketPath);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0)
+        return -1;
+
+    if (connect(connection, (struct sockaddr*)&address, sizeof address) != 0) {
+        close(connection);
+        return -1;
+    }
+
+    return connection;
+}
+
+int main(int argc, char **argv) {
+    int connection = connectToServer();
+    if (connection < 0)
+        runCompiler(argv);
+
+    // Find the filename in the same way as the compiler. The server parses
+    // the arguments again and prints any errors, so don't print them here.
+    opterr = 0;
+    while (getopt_long(argc, argv, "", compilerLongOptions, NULL) != -1)
+        continue;
+
+    char *sourceCode = "";
+    if (optind < argc) {
+        sourceCode = readContents(argv[optind]);
+        if (sourceCode == NULL) {
+            fprintf(stderr, "Error reading input file.\n");
+            return 2;
+        }
+    }
+
+    FILE *output = fdopen(dup(connection), "w");
+    FILE *input = fdopen(connection, "r");
+
+    char workingDirectory[PATH_MAX];
+    if (getcwd(workingDirectory, sizeof workingDirectory) == NULL)
+        runCompiler(argv);
+
+    // Send the request.
+    fprintf(output, "%s\n", SERVER_PROTOCOL_HEADER);
+    writeString(output, workingDirectory, strlen(workingDirectory));
+    fprintf(output, "%d\n", argc - 1);
+    int i;
+    for (i = 1; i < argc; i++)
+        writeString(output, argv[i], strlen(argv[i]));
+    writeString(output, sourceCode, strlen(sourceCode));
+    if (fclose(output) != 0)
+        runCompiler(argv);
+
+    // Read the reply, and print it as if the compiler had run here.
+    int result;
+    size_t outputLength, errorLength;
+    char *outputText = NULL, *errorText = NULL;
+    if (fscanf(input, "%d", &result) != 1
+            || (outputText = readString(input, &outputLength)) == NULL
+            || (errorText = readString(input, &errorLength)) == NULL) {
+        // The server went away before replying. Compiling is safe to repeat,
+        // so just compile the program here instead.
+        runCompiler(argv);
+    }
+
+    fwrite(outputText, sizeof(char), outputLength, stdout);
+    fwrite(errorText, sizeof(char), errorLength, stderr);
+
+    return result;
+}
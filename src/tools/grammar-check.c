@@ -0,0 +1,120 @@
+#include "pl0.h"
+#include "lib/parser.h"
+#include "lib/grammar-analysis.h"
+#include "lib/vector.h"
+#include "lib/util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// grammar-check
+// =============
+// Reports on the shape of a grammar (see lib/grammar-analysis.h): left
+// recursion, unreachable, unproductive and nullable variables, FIRST/FIRST
+// and FIRST/FOLLOW conflicts, and the lookahead that each variable needs.
+// Without a file, it checks the PL/0 grammar from getPL0Grammar().
+//
+// A grammar file has one rule per line: the variable, then the symbols that
+// it produces, the same as the arguments of addRule. For example:
+//
+//   # Left-recursive expressions.
+//   @expression @expression + @term
+//   @expression @term
+//   @term number-token
+//
+// Lines that start with # are comments. The start variable is the first
+// rule's variable, unless -s gives another one. It exits with 1 if the
+// grammar has left recursion or variables that can't produce anything, which
+// parse() can't handle.
+
+#define DEFAULT_LOOKAHEAD 3
+
+void printUsage(char *program) {
+    printf("Usage: %s [-k lookahead] [-s start variable] [grammar file]\n", program);
+    printf("Reports left recursion, unreachable, unproductive and nullable variables,\n");
+    printf("conflicts and the lookahead that each variable needs, for the PL/0 grammar\n");
+    printf("or for the grammar in the given file.\n");
+    printf("  -k lookahead  Check up to this many tokens of lookahead (default: %d, at most %d).\n",
+            DEFAULT_LOOKAHEAD, MAX_LOOKAHEAD);
+    printf("  -s variable   Start from this variable.\n");
+}
+
+// Reads a grammar file, and sets startVariable to the first rule's variable.
+// Returns a grammar with no rules if the file has a line with no symbols.
+struct grammar readGrammar(char *contents, char **startVariable) {
+    struct grammar grammar = (struct grammar){makeVector(struct rule), makeVector(char*),
+            makeVector(struct nestingTokens)};
+
+    struct vector *lines = splitString(contents, "\n");
+    forVector(lines, i, char*, line,
+        struct vector *words = splitString(line, " \t\r");
+        if (words->length == 0 || get(char*, words, 0)[0] == '#')
+            continue;
+
+        char *variable = get(char*, words, 0);
+        if (words->length == 1) {
+            fprintf(stderr, "Line %d: %s has no symbols (use \"nothing\" for an empty rule).\n",
+                    i + 1, variable);
+            grammar.rules->length = 0;
+            return grammar;
+        }
+
+        struct vector *symbols = makeVector(char*);
+        forVector(words, j, char*, word,
+                if (j > 0)
+                    push(symbols, word););
+        addRule(grammar, variable, joinStrings(symbols, " "));
+        if (*startVariable == NULL)
+            *startVariable = variable;);
+
+    return grammar;
+}
+
+int main(int argc, char **argv) {
+    int lookahead = DEFAULT_LOOKAHEAD;
+    char *startVariable = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "k:s:")) != -1) {
+        switch (option) {
+            case 'k': lookahead = atoi(optarg); break;
+            case 's': startVariable = optarg; break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind > 1 || lookahead < 1 || lookahead > MAX_LOOKAHEAD) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    struct grammar grammar;
+    if (argc - optind == 0) {
+        grammar = getPL0Grammar();
+        if (startVariable == NULL)
+            startVariable = "@program";
+    } else {
+        char *contents = readContents(argv[optind]);
+        if (contents == NULL) {
+            fprintf(stderr, "Error reading grammar file.\n");
+            return 2;
+        }
+
+        char *firstVariable = NULL;
+        grammar = readGrammar(contents, &firstVariable);
+        if (grammar.rules->length == 0) {
+            fprintf(stderr, "The grammar has no rules.\n");
+            return 2;
+        }
+        if (startVariable == NULL)
+            startVariable = firstVariable;
+    }
+
+    struct grammarReport report = analyzeGrammar(grammar, startVariable, lookahead);
+    printf("%s", report.text);
+
+    return (report.leftRecursiveCycles > 0 || report.unproductiveVariables > 0) ? 1 : 0;
+}
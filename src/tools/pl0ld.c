@@ -0,0 +1,77 @@
+#include "pl0.h"
+#include "lib/vector.h"
+#include "lib/util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// pl0ld
+// =====
+// Links objects from `./compiler --object` into one program (see "Separate
+// compilation" in pl0.h), and prints its instructions in the same format as
+// the compiler, for the VM. The first object is the main program. With a
+// Makefile like this one, only the modules that changed are compiled again,
+// and make -j compiles them in parallel:
+//
+//   %.o: %.pl0
+//   	./compiler --object $< > $@
+//   program: main.o math.o strings.o
+//   	./pl0ld main.o math.o strings.o > $@
+
+void printUsage(char *program) {
+    printf("Usage: %s [-u] <main program object> [<object>...]\n", program);
+    printf("Links objects from `compiler --object` into a program, and prints its instructions.\n");
+    printf("  -u  Use superinstructions, which only pl0vm can run.\n");
+}
+
+int main(int argc, char **argv) {
+    int superinstructions = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "u")) != -1) {
+        switch (option) {
+            case 'u': superinstructions = 1; break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    struct vector *objects = makeVector(struct pl0Object *);
+    int i;
+    for (i = optind; i < argc; i++) {
+        FILE *file = fopen(argv[i], "r");
+        if (file == NULL) {
+            perror(argv[i]);
+            return 2;
+        }
+
+        struct pl0Object *object = readPL0Object(file, argv[i]);
+        fclose(file);
+        if (object == NULL) {
+            fprintf(stderr, "%s isn't an object.\n", argv[i]);
+            return 2;
+        }
+
+        push(objects, object);
+    }
+
+    struct vector *instructions = linkPL0Objects(objects);
+    if (instructions == NULL) {
+        fprintf(stderr, "The linker encountered errors:\n%s\n", getLinkerErrors());
+        return 3;
+    }
+
+    if (superinstructions)
+        instructions = selectSuperinstructions(instructions);
+
+    printInstructions(instructions, 0);
+
+    return 0;
+}
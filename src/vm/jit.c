@@ -0,0 +1,518 @@
+#include "vm/vm.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <stdio.h>
+#include <string.h>
+
+// Template JIT
+// ============
+// Translates each instruction to a fixed sequence of x86-64 machine code, in
+// one pass. The VM's registers live in callee-saved machine registers:
+//
+//   rbx   the address of stack[0]
+//   r12   sp
+//   r13   bp
+//   r14d  the value on top of the stack, when it's cached (see below)
+//   r15   the jitContext
+//
+// Within a basic block, the generator tracks whether the top of the stack is
+// in r14d instead of in memory, so that "lod, lit, opr, sto" only touches
+// memory for the variables. The top of the stack is always written back
+// before a jump and at every jump target, so each instruction can be entered
+// with it in memory. A comparison followed by jpc becomes a compare and a
+// conditional jump.
+//
+// The generated code only checks sp where it can loop or call (at backward
+// jumps, cal, inc and the return from a procedure). The stack has room for
+// as much as straight-line code between those checks can push or pop, so it
+// can't go out of bounds in between. A stack overflow can therefore be
+// reported at a different instruction than the interpreter reports it at.
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+
+// The largest variable offset that the JIT accepts. Programs that use larger
+// ones run in the interpreter.
+#define JIT_MAX_OFFSET 4096
+
+enum {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Runtime errors, which the generated code returns through the context.
+enum {
+    JIT_OK = 0,
+    JIT_DIVISION_BY_ZERO,
+    JIT_ADDRESS_OUT_OF_RANGE,
+    JIT_STACK_OVERFLOW,
+    JIT_INPUT_ERROR,
+    JIT_BAD_RETURN
+};
+
+static char *jitErrorMessages[] = {NULL, "division by zero", "variable address out of range",
+    "stack overflow", "couldn't read input", "return to an invalid address"};
+
+// What the generated code needs from C. The code reaches the fields by their
+// offsets, so they can't be reordered.
+struct jitContext {
+    void **addresses;   // The code for each instruction that cal returns to.
+    int error;
+    int errorAddress;
+};
+
+// Flags for the instructions that can be jumped to.
+enum { JUMP_TARGET = 1, RETURN_TARGET = 2 };
+
+struct jitFixup {
+    int offset;   // Where the rel32 of a jump is in the code.
+    int target;   // The instruction it jumps to, or the error it reports.
+};
+
+static void jitWrite(int value) {
+    printf("Output: %d\n", value);
+}
+
+static int jitRead(int *destination) {
+    printf("Input: ");
+    fflush(stdout);
+
+    return scanf("%d", destination) == 1;
+}
+
+typedef int (*jitFunction)(int *stack, struct jitContext *context);
+
+int runJIT(struct vector *instructions) {
+    int length = instructions->length;
+    if (length == 0)
+        return JIT_UNAVAILABLE;
+
+    // Check that the program only uses instructions that the JIT knows, and
+    // find the jump targets.
+    char *isTarget = allocate(length + 1);
+    memset(isTarget, 0, length + 1);
+    int supported = 1;
+    forVector(instructions, i, struct instruction, instruction,
+        int opcode = instruction.opcode;
+        int modifier = instruction.modifier;
+
+        if (opcode < OP_LIT || opcode > OP_READ)
+            supported = 0;
+        if ((opcode == OP_LOD || opcode == OP_STO || opcode == OP_CAL)
+                && (instruction.lexicalLevel < 0 || instruction.lexicalLevel > JIT_MAX_OFFSET))
+            supported = 0;
+        if ((opcode == OP_LOD || opcode == OP_STO)
+                && (modifier < 0 || modifier > JIT_MAX_OFFSET))
+            supported = 0;
+        if (opcode == OP_INC && (modifier < -JIT_MAX_OFFSET || modifier > JIT_MAX_OFFSET))
+            supported = 0;
+
+        if (opcode == OP_JMP || opcode == OP_JPC || opcode == OP_CAL) {
+            if (modifier < 0 || modifier >= length)
+                supported = 0;
+            else
+                isTarget[modifier] |= JUMP_TARGET;
+        }
+        // cal returns to the instruction after it.
+        if (opcode == OP_CAL)
+            isTarget[i + 1] |= RETURN_TARGET;);
+
+    if (!supported) {
+        deallocate(isTarget);
+        return JIT_UNAVAILABLE;
+    }
+
+    // Room below and above the stack for what straight-line code can pop and
+    // push between checks.
+    int margin = 2 * length + JIT_MAX_OFFSET + 16;
+    int stackLimit = VM_STACK_SIZE;
+
+    unsigned char *code = NULL;
+    int size = 0, capacity = 0;
+    int *offsets = allocate((length + 1) * sizeof (int));
+    struct vector *jumps = makeVector(struct jitFixup);
+    struct vector *errors = makeVector(struct jitFixup);
+    int cached = 0;
+
+    void emit(int byte) {
+        if (size == capacity) {
+            capacity = (capacity == 0) ? 4096 : capacity * 2;
+            code = reallocate(code, capacity);
+        }
+        code[size++] = byte;
+    }
+    void emitInt32(int value) {
+        int i;
+        for (i = 0; i < 4; i++)
+            emit((value >> (8 * i)) & 0xff);
+    }
+    void emitInt64(long long value) {
+        int i;
+        for (i = 0; i < 8; i++)
+            emit((value >> (8 * i)) & 0xff);
+    }
+    void emitRex(int wide, int reg, int index, int base) {
+        emit(0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+    }
+    // An instruction with a [rbx + index * 4 + displacement] operand.
+    void emitStackOperand(int opcode, int reg, int index, int displacement) {
+        emitRex(0, reg, index, RBX);
+        emit(opcode);
+        emit(0x80 | ((reg & 7) << 3) | 4);
+        emit(0x80 | ((index & 7) << 3) | RBX);
+        emitInt32(displacement);
+    }
+    void emitLoad(int reg, int index, int displacement) {
+        emitStackOperand(0x8b, reg, index, displacement);
+    }
+    void emitStore(int reg, int index, int displacement) {
+        emitStackOperand(0x89, reg, index, displacement);
+    }
+    // An instruction with two 32-bit (or 64-bit if wide) register operands.
+    void emitRegisters(int wide, int opcode, int reg, int rm) {
+        emitRex(wide, reg, 0, rm);
+        emit(opcode);
+        emit(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+    // add, sub or cmp of a 64-bit register and an immediate (extension 0, 5
+    // or 7).
+    void emitImmediate64(int extension, int reg, int value) {
+        emitRex(1, 0, 0, reg);
+        emit(0x81);
+        emit(0xc0 | (extension << 3) | (reg & 7));
+        emitInt32(value);
+    }
+    void emitMoveImmediate(int reg, int value) {
+        emitRex(0, 0, 0, reg);
+        emit(0xb8 + (reg & 7));
+        emitInt32(value);
+    }
+    void emitJump(int target) {
+        emit(0xe9);
+        pushLiteral(jumps, struct jitFixup, {size, target});
+        emitInt32(0);
+    }
+    // Jumps to the given instruction if the condition (0x84 for je and so on)
+    // is true.
+    void emitConditionalJump(int condition, int target) {
+        emit(0x0f);
+        emit(condition);
+        pushLiteral(jumps, struct jitFixup, {size, target});
+        emitInt32(0);
+    }
+    // Reports the given error for the instruction at address if the condition
+    // is true. The jump's rel32 holds the address until the error stubs are
+    // added at the end.
+    void emitErrorJump(int condition, int error, int address) {
+        emit(0x0f);
+        emit(condition);
+        pushLiteral(errors, struct jitFixup, {size, error});
+        emitInt32(address);
+    }
+    void emitCall(void *function) {
+        emit(0x48); emit(0xb8); emitInt64((long long)function);   // mov rax, function
+        emit(0xff); emit(0xd0);                                   // call rax
+    }
+
+    // Writes the cached top of the stack back to memory.
+    void flush() {
+        if (cached)
+            emitStore(R14, R12, 0);
+        cached = 0;
+    }
+    // Loads the top of the stack into r14d.
+    void fill() {
+        if (!cached)
+            emitLoad(R14, R12, 0);
+        cached = 1;
+    }
+    // Checks that sp is inside the stack.
+    void checkStack(int address) {
+        emitImmediate64(7, R12, stackLimit);   // cmp r12, stackLimit
+        emitErrorJump(0x87, JIT_STACK_OVERFLOW, address);   // ja (also catches sp < 0)
+    }
+    // Leaves the base of the frame the given number of levels down in eax.
+    void emitBase(int levels, int address) {
+        emitRegisters(0, 0x89, R13, RAX);   // mov eax, r13d
+        while (levels-- > 0) {
+            emitLoad(RAX, RAX, 4);   // mov eax, [rbx + rax * 4 + 4]
+            emit(0x3d); emitInt32(stackLimit);   // cmp eax, stackLimit
+            emitErrorJump(0x87, JIT_ADDRESS_OUT_OF_RANGE, address);
+        }
+    }
+    // Pops the left operand of a binary operator into eax, leaving the right
+    // one in r14d.
+    void popOperands() {
+        fill();
+        emitLoad(RAX, R12, -4);
+        emitImmediate64(5, R12, 1);   // sub r12, 1
+    }
+
+    // Prologue: save the callee-saved registers and align the stack.
+    emit(0x53); emit(0x55);                          // push rbx, push rbp
+    emit(0x41); emit(0x54); emit(0x41); emit(0x55);  // push r12, push r13
+    emit(0x41); emit(0x56); emit(0x41); emit(0x57);  // push r14, push r15
+    emit(0x48); emit(0x83); emit(0xec); emit(0x08);  // sub rsp, 8
+    emitRegisters(1, 0x89, RDI, RBX);                // mov rbx, rdi
+    emitRegisters(1, 0x89, RSI, R15);                // mov r15, rsi
+    emitRegisters(0, 0x31, R12, R12);                // xor r12d, r12d
+    emitMoveImmediate(R13, 1);                       // mov r13d, 1
+
+    // Conditions for setcc and jcc, indexed by opr modifier. Each one's
+    // opposite is the same number with the lowest bit flipped.
+    int conditions[] = {0, 0, 0, 0, 0, 0, 0, 0, 0x84, 0x85, 0x8c, 0x8e, 0x8f, 0x8d};
+
+    int i;
+    for (i = 0; i < length; i++) {
+        struct instruction instruction = get(struct instruction, instructions, i);
+        int level = instruction.lexicalLevel;
+        int modifier = instruction.modifier;
+
+        if (isTarget[i])
+            flush();
+        offsets[i] = size;
+
+        switch (instruction.opcode) {
+            case OP_LIT:
+                flush();
+                emitImmediate64(0, R12, 1);   // add r12, 1
+                emitMoveImmediate(R14, modifier);
+                cached = 1;
+                break;
+            case OP_LOD:
+                flush();
+                if (level == 0) {
+                    emitImmediate64(0, R12, 1);
+                    emitLoad(R14, R13, modifier * 4);
+                } else {
+                    emitBase(level, i);
+                    emitImmediate64(0, R12, 1);
+                    emitLoad(R14, RAX, modifier * 4);
+                }
+                cached = 1;
+                break;
+            case OP_STO:
+                fill();
+                if (level == 0) {
+                    emitStore(R14, R13, modifier * 4);
+                } else {
+                    emitBase(level, i);
+                    emitStore(R14, RAX, modifier * 4);
+                }
+                emitImmediate64(5, R12, 1);
+                cached = 0;
+                break;
+            case OP_CAL:
+                flush();
+                emitImmediate64(7, R12, stackLimit - 4);   // cmp r12, stackLimit - 4
+                emitErrorJump(0x87, JIT_STACK_OVERFLOW, i);
+                emitBase(level, i);
+                // mov dword [rbx + r12 * 4 + 4], 0
+                emitStackOperand(0xc7, 0, R12, 4); emitInt32(0);
+                emitStore(RAX, R12, 8);
+                emitStore(R13, R12, 12);
+                emitStackOperand(0xc7, 0, R12, 16); emitInt32(i + 1);
+                // lea r13, [r12 + 1]
+                emit(0x4d); emit(0x8d); emit(0xac); emit(0x24); emitInt32(1);
+                emitJump(modifier);
+                break;
+            case OP_INC:
+                flush();
+                emitImmediate64(0, R12, modifier);
+                checkStack(i);
+                break;
+            case OP_JMP:
+                flush();
+                if (modifier <= i)
+                    checkStack(i);
+                emitJump(modifier);
+                break;
+            case OP_JPC:
+                fill();
+                emitImmediate64(5, R12, 1);
+                cached = 0;
+                if (modifier <= i)
+                    checkStack(i);
+                emitRegisters(0, 0x85, R14, R14);   // test r14d, r14d
+                emitConditionalJump(0x84, modifier);   // jz
+                break;
+            case OP_WRITE:
+                fill();
+                emitRegisters(0, 0x89, R14, RDI);   // mov edi, r14d
+                emitCall(jitWrite);
+                emitImmediate64(5, R12, 1);
+                cached = 0;
+                break;
+            case OP_READ:
+                flush();
+                emitImmediate64(0, R12, 1);
+                // lea rsi, [rbx + r12 * 4], then mov rdi, rsi
+                emit(0x4a); emit(0x8d); emit(0x34); emit(0xa3);
+                emitRegisters(1, 0x89, RSI, RDI);
+                emitCall(jitRead);
+                emitRegisters(0, 0x85, RAX, RAX);   // test eax, eax
+                emitErrorJump(0x84, JIT_INPUT_ERROR, i);
+                break;
+            case OP_OPR:
+                if (modifier == OPR_RET) {
+                    cached = 0;
+                    // lea r12, [r13 - 1]
+                    emit(0x4d); emit(0x8d); emit(0xa5); emitInt32(-1);
+                    emitLoad(RCX, R12, 16);   // The return address.
+                    emitLoad(R13, R12, 12);   // The caller's bp.
+                    emitRegisters(0, 0x85, R13, R13);   // test r13d, r13d
+                    emitConditionalJump(0x84, length);   // jz to the end
+                    emitImmediate64(7, R13, stackLimit);
+                    emitErrorJump(0x87, JIT_BAD_RETURN, i);
+                    emit(0x81); emit(0xf9); emitInt32(length);   // cmp ecx, length
+                    emitErrorJump(0x83, JIT_BAD_RETURN, i);   // jae
+                    emit(0x49); emit(0x8b); emit(0x07);   // mov rax, [r15]
+                    emit(0xff); emit(0x24); emit(0xc8);   // jmp [rax + rcx * 8]
+                } else if (modifier == OPR_NEG) {
+                    fill();
+                    emit(0x41); emit(0xf7); emit(0xde);   // neg r14d
+                } else if (modifier == OPR_ODD) {
+                    fill();
+                    emit(0x41); emit(0x83); emit(0xe6); emit(0x01);   // and r14d, 1
+                } else if (modifier >= OPR_EQL && modifier <= OPR_GEQ) {
+                    int condition = conditions[modifier];
+                    popOperands();
+
+                    if (i + 1 < length && !isTarget[i + 1]
+                            && get(struct instruction, instructions, i + 1).opcode == OP_JPC) {
+                        // Jump on the opposite of the comparison, without
+                        // pushing its result.
+                        int target = get(struct instruction, instructions, i + 1).modifier;
+                        i += 1;
+                        offsets[i] = size;
+                        emitImmediate64(5, R12, 1);
+                        cached = 0;
+                        if (target <= i)
+                            checkStack(i);
+                        emitRegisters(0, 0x39, R14, RAX);   // cmp eax, r14d
+                        emitConditionalJump(condition ^ 1, target);
+                    } else {
+                        emitRegisters(0, 0x39, R14, RAX);   // cmp eax, r14d
+                        emit(0x0f); emit(condition + 0x10); emit(0xc0);   // setcc al
+                        emit(0x0f); emit(0xb6); emit(0xc0);   // movzx eax, al
+                        emitRegisters(0, 0x89, RAX, R14);   // mov r14d, eax
+                    }
+                } else {
+                    popOperands();
+                    switch (modifier) {
+                        case OPR_ADD: emitRegisters(0, 0x01, R14, RAX); break;
+                        case OPR_SUB: emitRegisters(0, 0x29, R14, RAX); break;
+                        case OPR_MUL: emit(0x41); emit(0x0f); emit(0xaf); emit(0xc6); break;
+                        case OPR_DIV:
+                        case OPR_MOD:
+                            emitRegisters(0, 0x85, R14, R14);
+                            emitErrorJump(0x84, JIT_DIVISION_BY_ZERO, i);
+                            // x / -1 is -x, and x % -1 is 0, which idiv can't do
+                            // for the smallest int.
+                            emit(0x41); emit(0x83); emit(0xfe); emit(0xff);   // cmp r14d, -1
+                            emit(0x75); emit(4);                              // jne +4
+                            if (modifier == OPR_DIV) {
+                                emit(0xf7); emit(0xd8);   // neg eax
+                                emit(0xeb); emit(4);      // jmp over the idiv
+                            } else {
+                                emit(0x31); emit(0xc0);   // xor eax, eax
+                                emit(0xeb); emit(7);      // jmp over the idiv and mov
+                            }
+                            emit(0x99);                                       // cdq
+                            emit(0x41); emit(0xf7); emit(0xfe);               // idiv r14d
+                            if (modifier == OPR_MOD)
+                                emitRegisters(0, 0x89, RDX, RAX);            // mov eax, edx
+                            break;
+                        default:
+                            supported = 0;
+                    }
+                    emitRegisters(0, 0x89, RAX, R14);   // mov r14d, eax
+                }
+                break;
+        }
+    }
+    offsets[length] = size;
+
+    // The end: return 0, or 1 after storing an error in the context.
+    emit(0x31); emit(0xc0);   // xor eax, eax
+    int epilogue = size;
+    emit(0x48); emit(0x83); emit(0xc4); emit(0x08);  // add rsp, 8
+    emit(0x41); emit(0x5f); emit(0x41); emit(0x5e);  // pop r15, pop r14
+    emit(0x41); emit(0x5d); emit(0x41); emit(0x5c);  // pop r13, pop r12
+    emit(0x5d); emit(0x5b);                          // pop rbp, pop rbx
+    emit(0xc3);                                      // ret
+
+    // Error stubs, which store the error and the instruction's address.
+    forVector(errors, j, struct jitFixup, error,
+        int address;
+        memcpy(&address, code + error.offset, 4);
+        int stub = size;
+        emit(0x41); emit(0xc7); emit(0x47); emit(8); emitInt32(error.target);  // mov [r15 + 8], error
+        emit(0x41); emit(0xc7); emit(0x47); emit(12); emitInt32(address);      // mov [r15 + 12], address
+        emitMoveImmediate(RAX, 1);
+        emit(0xe9); emitInt32(epilogue - (size + 4));
+        int rel = stub - (error.offset + 4);
+        memcpy(code + error.offset, &rel, 4););
+
+    forVector(jumps, j, struct jitFixup, jump,
+        int rel = offsets[jump.target] - (jump.offset + 4);
+        memcpy(code + jump.offset, &rel, 4););
+
+    // Returns to anything but the instruction after a cal go here, with the
+    // return address in ecx.
+    int badReturn = size;
+    emit(0x41); emit(0xc7); emit(0x47); emit(8); emitInt32(JIT_BAD_RETURN);
+    emit(0x41); emit(0x89); emit(0x4f); emit(12);   // mov [r15 + 12], ecx
+    emitMoveImmediate(RAX, 1);
+    emit(0xe9); emitInt32(epilogue - (size + 4));
+
+    int result = JIT_UNAVAILABLE;
+    void *executable = supported
+        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+        : MAP_FAILED;
+
+    if (executable != MAP_FAILED) {
+        memcpy(executable, code, size);
+
+        if (mprotect(executable, size, PROT_READ | PROT_EXEC) == 0) {
+            void **addresses = allocate(length * sizeof (void*));
+            for (i = 0; i < length; i++)
+                addresses[i] = (char*)executable
+                    + ((isTarget[i] & RETURN_TARGET) ? offsets[i] : badReturn);
+
+            struct jitContext context = {addresses, JIT_OK, 0};
+            int *memory = allocate((VM_STACK_SIZE + 2 * margin) * sizeof (int));
+            memset(memory, 0, (VM_STACK_SIZE + 2 * margin) * sizeof (int));
+
+            ((jitFunction)executable)(memory + margin, &context);
+            fflush(stdout);
+
+            result = 0;
+            if (context.error != JIT_OK) {
+                fprintf(stderr, "Error at instruction %d: %s.\n", context.errorAddress,
+                        jitErrorMessages[context.error]);
+                result = 1;
+            }
+
+            deallocate(memory);
+            deallocate(addresses);
+        }
+
+        munmap(executable, size);
+    }
+
+    deallocate(code);
+    deallocate(offsets);
+    deallocate(isTarget);
+    freeVector(jumps);
+    freeVector(errors);
+
+    return result;
+}
+
+#else
+
+int runJIT(struct vector *instructions) {
+    return JIT_UNAVAILABLE;
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include "pl0.h"
+#include "vm/vm.h"
+#include "lib/lexer.h"
+#include "lib/parser.h"
+#include "lib/vector.h"
+#include "lib/util.h"
+#include "lib/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+// pl0bench
+// ========
+// Compiles a PL/0 program with each backend and compares how many
+// instructions each one runs and how long it takes: the stack code from
+// generatePL0, the same code with superinstructions, the stack code with a
+// display, the stack code with loop optimizations, the stack code from the
+// mid-level optimizer with all of its passes, the register code from
+// generateRegisterPL0, and the stack code compiled by the JIT on x86-64. It
+// also times the recursive descent parser against the Earley parser and the
+// parallel parser, with one thread per core, on the program's tokens, and the
+// generator on one thread against the generator on one thread per core.
+// Each program runs once to count dispatches, once more to check that its
+// output is the same as the stack code's, and then -n more times for timing,
+// of which the fastest run is reported. If any backend's output differs,
+// pl0bench says which and exits with 6. Otherwise the program's output is
+// thrown away. Programs that read input read it from stdin, so it has to have
+// enough input for every run, and give the same input to each run (like
+// `yes 5 | ./pl0bench program.pl0`) for the outputs to match.
+
+#define DEFAULT_RUNS 5
+
+double getMilliseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+void printUsage(char *program) {
+    printf("Usage: %s [-n runs] [-l] <PL/0 source code filename>\n", program);
+    printf("Compares the stack, superinstruction, display, loop-optimized, optimized, register\n");
+    printf("and JIT backends on a program, and the recursive descent, Earley and parallel\n");
+    printf("parsers, and the generator on one thread and on one thread per core.\n");
+    printf("  -n runs  Time this many runs of each (default: %d).\n", DEFAULT_RUNS);
+    printf("  -l       Print the register code.\n");
+}
+
+int main(int argc, char **argv) {
+    int runs = DEFAULT_RUNS, printListing = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:l")) != -1) {
+        switch (option) {
+            case 'n': runs = atoi(optarg); break;
+            case 'l': printListing = 1; break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 1 || runs < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    char *sourceCode = readContents(argv[optind]);
+    if (sourceCode == NULL) {
+        fprintf(stderr, "Error reading input file.\n");
+        return 2;
+    }
+
+    struct vector *tokens = readPL0Tokens(sourceCode);
+    struct parseTree tree = parsePL0Tokens(tokens);
+    if (isParseTreeError(tree)) {
+        fprintf(stderr, "Errors while parsing program:\n%s\n", getParserErrors());
+        return 4;
+    }
+
+    struct vector *stackCode = generatePL0(tree);
+    if (getGeneratorErrors() != NULL) {
+        fprintf(stderr, "The generator encountered errors:\n%s\n", getGeneratorErrors());
+        return 5;
+    }
+    struct vector *superinstructionCode = selectSuperinstructions(stackCode);
+    struct generatorOptions displayOptions = {NULL, 0, 0, 0, 1};
+    struct vector *displayCode = generatePL0WithOptions(tree, displayOptions);
+    struct generatorOptions loopOptions = {NULL, 0, 0, 0, 0, 0, 0, 1};
+    struct vector *loopCode = generatePL0WithOptions(tree, loopOptions);
+    struct generatorOptions optimizedOptions = {NULL, 0, 0, 0, 0, 1, OPTIMIZE_ALL};
+    struct vector *optimizedCode = generatePL0WithOptions(tree, optimizedOptions);
+    struct registerProgram *registerCode = generateRegisterPL0(tree);
+    if (registerCode == NULL) {
+        fprintf(stderr, "The register backend encountered errors:\n%s\n", getGeneratorErrors());
+        return 5;
+    }
+
+    if (printListing)
+        printRegisterProgram(registerCode);
+
+    // Keep the benchmark's results on stdout, and send the programs' output
+    // to /dev/null, except while it's being checked.
+    fflush(stdout);
+    int resultsFile = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    FILE *results = fdopen(resultsFile, "w");
+
+    fprintf(results, "%-18s %6s %10s\n", "parser", "tokens", "best ms");
+
+    void reportParser(char *name, struct parseTree (*parseTokens)(struct vector *)) {
+        double best = 0;
+        int i;
+
+        for (i = 0; i < runs; i++) {
+            double start = getMilliseconds();
+            parseTokens(tokens);
+            double milliseconds = getMilliseconds() - start;
+
+            if (i == 0 || milliseconds < best)
+                best = milliseconds;
+        }
+
+        fprintf(results, "%-18s %6d %10.2f\n", name, tokens->length, best);
+    }
+
+    reportParser("recursive descent", parsePL0Tokens);
+    reportParser("earley", parsePL0TokensWithEarley);
+    struct parseTree parseInParallel(struct vector *tokens) {
+        return parsePL0TokensInParallel(tokens, 0);
+    }
+    reportParser("parallel", parseInParallel);
+    fprintf(results, "\n");
+
+    fprintf(results, "%-18s %6s %10s\n", "generator", "size", "best ms");
+
+    void reportGenerator(char *name, int threads) {
+        struct generatorOptions options = {NULL};
+        options.threads = threads;
+        double best = 0;
+        int size = 0, i;
+
+        for (i = 0; i < runs; i++) {
+            double start = getMilliseconds();
+            size = generatePL0WithOptions(tree, options)->length;
+            double milliseconds = getMilliseconds() - start;
+
+            if (i == 0 || milliseconds < best)
+                best = milliseconds;
+        }
+
+        fprintf(results, "%-18s %6d %10.2f\n", name, size, best);
+    }
+
+    reportGenerator("one thread", 1);
+    reportGenerator("parallel", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(results, "\n");
+
+    fprintf(results, "%-18s %6s %14s %10s\n", "backend", "size", "dispatches", "best ms");
+
+    // Runs the code once with its output going to a temporary file, and
+    // returns the output.
+    char *captureOutput(int (*run)(void *, long long *), void *code) {
+        FILE *file = tmpfile();
+        if (file == NULL) {
+            perror("tmpfile");
+            exit(2);
+        }
+
+        fflush(stdout);
+        dup2(fileno(file), STDOUT_FILENO);
+        run(code, NULL);
+        fflush(stdout);
+        dup2(null, STDOUT_FILENO);
+
+        fseek(file, 0, SEEK_END);
+        long length = ftell(file);
+        char *output = allocate(length + 1);
+        rewind(file);
+        length = fread(output, 1, length, file);
+        output[length] = '\0';
+        fclose(file);
+
+        return output;
+    }
+
+    // The stack code's output, which every other backend's has to match.
+    char *expectedOutput = NULL;
+    int mismatches = 0;
+
+    void report(char *name, int size, int (*run)(void *, long long *), void *code) {
+        long long dispatches = 0;
+        double best = 0;
+        int i;
+
+        if (run(code, &dispatches) != 0)
+            return;
+
+        char *output = captureOutput(run, code);
+        if (expectedOutput == NULL) {
+            expectedOutput = output;
+        } else if (strcmp(output, expectedOutput) != 0) {
+            fprintf(stderr, "The %s backend's output is different from the stack code's.\n",
+                    name);
+            mismatches += 1;
+        }
+
+        for (i = 0; i < runs; i++) {
+            double start = getMilliseconds();
+            run(code, NULL);
+            double milliseconds = getMilliseconds() - start;
+            fflush(stdout);
+
+            if (i == 0 || milliseconds < best)
+                best = milliseconds;
+        }
+
+        fprintf(results, "%-18s %6d %14lld %10.2f\n", name, size, dispatches, best);
+    }
+
+    int runStackCode(void *code, long long *dispatches) {
+        if (dispatches == NULL)
+            return runProgram(code, NULL);
+
+        struct vmProfile profile = makeProfile(0);
+        int result = runProgram(code, &profile);
+        *dispatches = profile.dispatches;
+        freeProfile(&profile);
+
+        return result;
+    }
+
+    int runRegisterCode(void *code, long long *dispatches) {
+        return runRegisterProgram(code, dispatches);
+    }
+
+    // The JIT doesn't count dispatches, so this counts them with the
+    // interpreter, after checking that the JIT can run the program at all.
+    int runJITCode(void *code, long long *dispatches) {
+        if (dispatches == NULL)
+            return runJIT(code);
+
+        int result = runJIT(code);
+        if (result != 0)
+            return result;
+
+        return runStackCode(code, dispatches);
+    }
+
+    report("stack", stackCode->length, runStackCode, stackCode);
+    report("superinstructions", superinstructionCode->length, runStackCode,
+            superinstructionCode);
+    report("display", displayCode->length, runStackCode, displayCode);
+    report("loops", loopCode->length, runStackCode, loopCode);
+    report("optimized", optimizedCode->length, runStackCode, optimizedCode);
+    report("registers", registerCode->code->length, runRegisterCode, registerCode);
+    report("jit", stackCode->length, runJITCode, stackCode);
+
+    fclose(results);
+    close(null);
+
+    return (mismatches > 0) ? 6 : 0;
+}
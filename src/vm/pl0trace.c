@@ -0,0 +1,131 @@
+#include "pl0.h"
+#include "vm/vm.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// pl0trace
+// ========
+// Prints a trace from `pl0vm-trace --trace=FILE` (see "Tracing" in vm.h) as
+// the same table that ./vm prints: each instruction that ran, the registers
+// after it ran, and the stack. The trace only has the stack cells that each
+// instruction wrote, so the stack is rebuilt from them as it goes. It needs
+// the program's instructions, with superinstructions if pl0vm-trace ran it
+// with --superinstructions.
+//
+//   ./pl0vm-trace --trace=out.trace out
+//   ./pl0trace out out.trace
+
+void printUsage(char *program) {
+    printf("Usage: %s [-n count] <instructions filename> <trace filename>\n", program);
+    printf("Prints a trace from pl0vm-trace in the same format as ./vm.\n");
+    printf("  -n count  Print only the first count instructions.\n");
+}
+
+int main(int argc, char **argv) {
+    long long limit = -1;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:")) != -1) {
+        switch (option) {
+            case 'n': limit = atoll(optarg); break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[optind], "r");
+    if (file == NULL) {
+        perror(argv[optind]);
+        return 2;
+    }
+    struct vector *instructions = readInstructions(file);
+    fclose(file);
+    if (instructions == NULL) {
+        fprintf(stderr, "%s doesn't contain valid instructions.\n", argv[optind]);
+        return 3;
+    }
+
+    FILE *trace = fopen(argv[optind + 1], "rb");
+    if (trace == NULL) {
+        perror(argv[optind + 1]);
+        return 2;
+    }
+    char header[sizeof TRACE_HEADER];
+    if (fread(header, 1, strlen(TRACE_HEADER), trace) != strlen(TRACE_HEADER)
+            || memcmp(header, TRACE_HEADER, strlen(TRACE_HEADER)) != 0) {
+        fprintf(stderr, "%s isn't a trace.\n", argv[optind + 1]);
+        return 3;
+    }
+
+    // The stack, as far as the trace has written it. Cells that weren't
+    // written are 0, like in the VM.
+    int capacity = 1024;
+    int *stack = allocate(capacity * sizeof (int));
+    memset(stack, 0, capacity * sizeof (int));
+
+    printf("%30s%-6s%-6s%-6s%s\n", "", "pc", "bp", "sp", "stack");
+    printf("%-30s%-6d%-6d%-6d\n", "Initial values", 0, 1, 0);
+
+    struct traceRecord record;
+    long long count = 0;
+    while ((limit < 0 || count < limit) && fread(&record, sizeof record, 1, trace) == 1) {
+        if (record.address < 0 || record.address >= instructions->length
+                || record.writes < 0 || record.writes > MAX_TRACE_WRITES || record.sp < 0) {
+            fprintf(stderr, "The trace doesn't match the instructions.\n");
+            return 3;
+        }
+
+        int i;
+        for (i = 0; i < record.writes; i++) {
+            struct traceWrite write;
+            if (fread(&write, sizeof write, 1, trace) != 1 || write.cell < 0
+                    || write.cell > VM_STACK_SIZE) {
+                fprintf(stderr, "The trace is cut off.\n");
+                return 3;
+            }
+
+            if (write.cell >= capacity) {
+                int newCapacity = capacity;
+                while (write.cell >= newCapacity)
+                    newCapacity *= 2;
+
+                int *newStack = allocate(newCapacity * sizeof (int));
+                memcpy(newStack, stack, capacity * sizeof (int));
+                memset(newStack + capacity, 0, (newCapacity - capacity) * sizeof (int));
+                deallocate(stack);
+                stack = newStack;
+                capacity = newCapacity;
+            }
+            stack[write.cell] = write.value;
+        }
+
+        struct instruction instruction = get(struct instruction, instructions, record.address);
+        printf("%-6d%-6s%-6d%-6d      %-6d%-6d%-6d", record.address, instruction.opcodeName,
+                instruction.lexicalLevel, instruction.modifier, record.pc, record.bp, record.sp);
+        // Like ./vm, a bar separates the current frame from the rest of the
+        // stack.
+        for (i = 1; i <= record.sp; i++) {
+            if (i == record.bp && i > 1)
+                printf("| ");
+            printf("%d ", (i < capacity) ? stack[i] : 0);
+        }
+        printf("\n");
+
+        count += 1;
+    }
+
+    fclose(trace);
+    deallocate(stack);
+
+    return 0;
+}
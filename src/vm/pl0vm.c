@@ -0,0 +1,164 @@
+#include "pl0.h"
+#include "vm/vm.h"
+#include "lib/vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+// pl0vm
+// =====
+// Runs PL/0 programs compiled by the compiler, with or without
+// --superinstructions. With --stats, it also prints how many of each
+// instruction ran, and with --ngrams=N, the most common sequences of N
+// instructions, which are the best candidates for new superinstructions. With
+// --jit, it compiles the program to machine code instead of interpreting it.
+// With --profile=FILE, it writes how many instructions ran in each procedure,
+// for each source line and at each address to FILE, and with --folded=FILE,
+// the instructions that ran in each call stack, for flamegraph.pl. When it's
+// built as pl0vm-trace, --trace=FILE writes a binary trace of every
+// instruction to FILE, for pl0trace to print (see "Tracing" in vm.h).
+// Programs compiled with --stack-bound run on a stack of exactly the size they
+// need, without stack pointer checks.
+
+#define DEFAULT_NGRAMS_TO_PRINT 20
+
+static struct option longOptions[] = {
+    {"stats", no_argument, NULL, 's'},
+    {"ngrams", required_argument, NULL, 'n'},
+    {"top", required_argument, NULL, 't'},
+    {"superinstructions", no_argument, NULL, 'u'},
+    {"jit", no_argument, NULL, 'j'},
+    {"profile", required_argument, NULL, 'p'},
+    {"folded", required_argument, NULL, 'f'},
+#ifdef PL0_VM_TRACE
+    {"trace", required_argument, NULL, 'r'},
+#endif
+    {NULL, 0, NULL, 0}
+};
+
+void printUsage(char *program) {
+    printf("Usage: %s [options] <instructions filename>\n", program);
+    printf("Runs the instructions in the file, or in stdin if the filename is -.\n");
+    printf("Options:\n");
+    printf("  --stats             Print how many of each instruction ran to stderr.\n");
+    printf("  --ngrams=N          Also print the most common sequences of N instructions.\n");
+    printf("  --top=K             Print K sequences (default: %d).\n", DEFAULT_NGRAMS_TO_PRINT);
+    printf("  --superinstructions Replace common sequences with superinstructions first.\n");
+    printf("  --jit               Compile the program to machine code, if this is x86-64.\n");
+    printf("  --profile=FILE      Write the instructions that ran in each procedure, for each\n");
+    printf("                      line and at each address to FILE.\n");
+    printf("  --folded=FILE       Write the instructions that ran in each call stack to FILE,\n");
+    printf("                      in the folded format of flamegraph.pl.\n");
+#ifdef PL0_VM_TRACE
+    printf("  --trace=FILE        Write a binary trace of each instruction to FILE, for pl0trace.\n");
+#endif
+}
+
+int main(int argc, char **argv) {
+    int printStatistics = 0, superinstructions = 0, jit = 0;
+    int ngramLength = 0, ngramsToPrint = DEFAULT_NGRAMS_TO_PRINT;
+    char *profileFilename = NULL, *foldedFilename = NULL, *traceFilename = NULL;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+        switch (option) {
+            case 's': printStatistics = 1; break;
+            case 'n':
+                ngramLength = atoi(optarg);
+                if (ngramLength < 1 || ngramLength > MAX_NGRAM_LENGTH) {
+                    fprintf(stderr, "The n-gram length must be from 1 to %d.\n", MAX_NGRAM_LENGTH);
+                    return 1;
+                }
+                printStatistics = 1;
+                break;
+            case 't': ngramsToPrint = atoi(optarg); break;
+            case 'u': superinstructions = 1; break;
+            case 'j': jit = 1; break;
+            case 'p': profileFilename = optarg; break;
+            case 'f': foldedFilename = optarg; break;
+            case 'r': traceFilename = optarg; break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    char *filename = argv[optind];
+    FILE *file = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error reading input file.\n");
+        return 2;
+    }
+
+    int stackBound;
+    struct vector *instructions = readInstructionsWithStackBound(file, &stackBound);
+    if (file != stdin)
+        fclose(file);
+    if (instructions == NULL) {
+        fprintf(stderr, "The input file doesn't contain valid instructions.\n");
+        return 3;
+    }
+
+    // Open the profile's files before running, so that a bad filename
+    // doesn't waste a run.
+    FILE *profileFile = NULL, *foldedFile = NULL;
+    if (profileFilename != NULL && (profileFile = fopen(profileFilename, "w")) == NULL) {
+        perror(profileFilename);
+        return 2;
+    }
+    if (foldedFilename != NULL && (foldedFile = fopen(foldedFilename, "w")) == NULL) {
+        perror(foldedFilename);
+        return 2;
+    }
+    int profiling = printStatistics || profileFile != NULL || foldedFile != NULL;
+
+#ifdef PL0_VM_TRACE
+    FILE *traceFile = NULL;
+    if (traceFilename != NULL && (traceFile = fopen(traceFilename, "wb")) == NULL) {
+        perror(traceFilename);
+        return 2;
+    }
+    traceToFile(traceFile);
+#endif
+
+    // The JIT doesn't count or trace anything, and doesn't know
+    // superinstructions, so fall back to the interpreter for those, and on
+    // other architectures.
+    if (jit && !profiling && traceFilename == NULL && !superinstructions) {
+        int result = runJIT(instructions);
+        if (result != JIT_UNAVAILABLE)
+            return result;
+    }
+
+    if (superinstructions)
+        instructions = selectSuperinstructions(instructions);
+
+    struct vmProfile profile = makeProfile(ngramLength);
+    profile.countAddresses = (profileFile != NULL || foldedFile != NULL);
+    int result = runProgramWithStackBound(instructions, profiling ? &profile : NULL,
+            stackBound);
+
+    if (printStatistics)
+        printProfile(&profile, ngramsToPrint, stderr);
+    if (profileFile != NULL) {
+        printAnnotatedListing(&profile, instructions, profileFile);
+        fclose(profileFile);
+    }
+    if (foldedFile != NULL) {
+        printFoldedStacks(&profile, instructions, foldedFile);
+        fclose(foldedFile);
+    }
+#ifdef PL0_VM_TRACE
+    if (traceFile != NULL)
+        fclose(traceFile);
+#endif
+    freeProfile(&profile);
+
+    return result;
+}
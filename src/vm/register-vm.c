@@ -0,0 +1,157 @@
+#include "vm/vm.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <stdio.h>
+#include <string.h>
+
+// The register VM keeps the registers of every active procedure in one array,
+// like the stack VM's stack, and the rest of each activation in a frame.
+struct registerFrame {
+    int *registers;
+    int *end;          // The first register after this procedure's registers.
+    int staticLink;    // The frame of the procedure that declared this one.
+    int returnAddress;
+};
+
+#define MAX_FRAMES (VM_STACK_SIZE / 4)
+
+// Sets up the registers of a new activation of the given procedure in frame,
+// and returns the address to jump to, or -1 if the registers don't fit.
+static int enterProcedure(struct registerProgram *program, int procedureIndex,
+        struct registerFrame *frame, int *memoryEnd) {
+    struct registerProcedure procedure =
+        get(struct registerProcedure, program->procedures, procedureIndex);
+
+    if (frame->registers + procedure.registerCount > memoryEnd)
+        return -1;
+
+    memset(frame->registers, 0, procedure.registerCount * sizeof (int));
+    forVector(procedure.constants, i, struct registerConstant, constant,
+            frame->registers[constant.index] = constant.value;);
+    frame->end = frame->registers + procedure.registerCount;
+
+    return procedure.entry;
+}
+
+// Returns the registers of the procedure the given number of levels out from
+// the one in the given frame.
+static int *getOuterRegisters(struct registerFrame *frames, int frame, int levels) {
+    while (levels-- > 0)
+        frame = frames[frame].staticLink;
+
+    return frames[frame].registers;
+}
+
+int runRegisterProgram(struct registerProgram *program, long long *dispatches) {
+    int length = program->code->length;
+    struct registerInstruction *code = allocate((length + 1) * sizeof (struct registerInstruction));
+    forVector(program->code, i, struct registerInstruction, instruction,
+            code[i] = instruction;);
+
+    int *memory = allocate(VM_STACK_SIZE * sizeof (int));
+    struct registerFrame *frames = allocate(MAX_FRAMES * sizeof (struct registerFrame));
+
+    int frame = 0;
+    int pc = 0, address = 0;
+    int result = 0;
+    char *error = NULL;
+
+    frames[0] = (struct registerFrame){memory, memory, 0, 0};
+    pc = enterProcedure(program, 0, &frames[0], memory + VM_STACK_SIZE);
+    if (pc < 0) {
+        error = "stack overflow";
+        goto fail;
+    }
+
+    int *r = memory;
+    while (1) {
+        address = pc;
+        struct registerInstruction instruction = code[pc++];
+        if (dispatches != NULL)
+            *dispatches += 1;
+
+        int a = instruction.a, b = instruction.b, c = instruction.c;
+
+        switch (instruction.opcode) {
+            case R_MOVE: r[a] = r[b]; break;
+            case R_NEG: r[a] = -r[b]; break;
+            case R_ADD: r[a] = r[b] + r[c]; break;
+            case R_SUB: r[a] = r[b] - r[c]; break;
+            case R_MUL: r[a] = r[b] * r[c]; break;
+            case R_DIV:
+                if (r[c] == 0) {
+                    error = "division by zero";
+                    goto fail;
+                }
+                r[a] = r[b] / r[c];
+                break;
+            case R_MOD:
+                if (r[c] == 0) {
+                    error = "division by zero";
+                    goto fail;
+                }
+                r[a] = r[b] % r[c];
+                break;
+            case R_JUMP: pc = a; break;
+            case R_JUMP_EQL: if (r[a] == r[b]) pc = c; break;
+            case R_JUMP_NEQ: if (r[a] != r[b]) pc = c; break;
+            case R_JUMP_LSS: if (r[a] < r[b]) pc = c; break;
+            case R_JUMP_LEQ: if (r[a] <= r[b]) pc = c; break;
+            case R_JUMP_GTR: if (r[a] > r[b]) pc = c; break;
+            case R_JUMP_GEQ: if (r[a] >= r[b]) pc = c; break;
+            case R_JUMP_EVEN: if (r[a] % 2 == 0) pc = b; break;
+            case R_LOAD: r[a] = getOuterRegisters(frames, frame, b)[c]; break;
+            case R_STORE: getOuterRegisters(frames, frame, a)[b] = r[c]; break;
+            case R_CALL: {
+                int staticLink = frame;
+                while (a-- > 0)
+                    staticLink = frames[staticLink].staticLink;
+
+                if (frame + 1 >= MAX_FRAMES) {
+                    error = "stack overflow";
+                    goto fail;
+                }
+                frames[frame + 1] = (struct registerFrame){frames[frame].end, NULL, staticLink, pc};
+                frame += 1;
+                pc = enterProcedure(program, b, &frames[frame], memory + VM_STACK_SIZE);
+                if (pc < 0) {
+                    error = "stack overflow";
+                    goto fail;
+                }
+                r = frames[frame].registers;
+                break;
+            }
+            case R_RETURN:
+                if (frame == 0)
+                    goto done;
+                pc = frames[frame].returnAddress;
+                frame -= 1;
+                r = frames[frame].registers;
+                break;
+            case R_READ:
+                printf("Input: ");
+                fflush(stdout);
+                if (scanf("%d", &r[a]) != 1) {
+                    error = "couldn't read input";
+                    goto fail;
+                }
+                break;
+            case R_WRITE:
+                printf("Output: %d\n", r[a]);
+                break;
+            default:
+                error = "invalid instruction";
+                goto fail;
+        }
+    }
+
+fail:
+    fprintf(stderr, "Error at instruction %d: %s.\n", address, error);
+    result = 1;
+done:
+    deallocate(code);
+    deallocate(memory);
+    deallocate(frames);
+
+    return result;
+}
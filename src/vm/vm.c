@@ -0,0 +1,831 @@
+#include "vm/vm.h"
+#include "lib/vector.h"
+#include "lib/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The VM's copy of an instruction, without the opcode name, so that more of the
+// program fits in the cache.
+struct vmInstruction {
+    int opcode;
+    int lexicalLevel;
+    int modifier;
+};
+
+// Room above and below the stack, so that checking the stack pointer once per
+// instruction is enough. No instruction pushes or pops more than this.
+#define STACK_MARGIN 8
+// The deepest lexical level that the display instructions can use.
+#define MAX_DISPLAY_LEVELS 256
+// The deepest call stack that a profile tells apart from the ones above it.
+// Deeper calls count as part of the stack at this depth, so that deep
+// recursion doesn't make the folded stacks grow with the square of its depth.
+#define MAX_PROFILE_DEPTH 128
+
+static char *operatorNames[] = {"ret", "neg", "add", "sub", "mul", "div", "odd", "mod",
+    "eql", "neq", "lss", "leq", "gtr", "geq"};
+#define OPERATOR_COUNT ((int)(sizeof operatorNames / sizeof operatorNames[0]))
+
+// The n-gram symbol for an instruction. Each opr is its own symbol, since the
+// operators are too different to share a superinstruction.
+static int getSymbol(struct vmInstruction instruction) {
+    if (instruction.opcode == OP_OPR && instruction.modifier >= 0
+            && instruction.modifier < OPERATOR_COUNT)
+        return OPCODE_COUNT + instruction.modifier;
+
+    return instruction.opcode;
+}
+
+static void printSymbol(int symbol, FILE *file) {
+    if (symbol >= OPCODE_COUNT)
+        fprintf(file, " opr:%s", operatorNames[symbol - OPCODE_COUNT]);
+    else
+        fprintf(file, " %s", getOpcodeName(symbol));
+}
+
+struct vmProfile makeProfile(int ngramLength) {
+    struct vmProfile profile;
+    memset(&profile, 0, sizeof profile);
+
+    if (ngramLength > MAX_NGRAM_LENGTH)
+        ngramLength = MAX_NGRAM_LENGTH;
+    profile.ngramLength = ngramLength;
+    profile.nextAddress = -1;
+
+    return profile;
+}
+
+void freeProfile(struct vmProfile *profile) {
+    deallocate(profile->ngrams);
+    profile->ngrams = NULL;
+    deallocate(profile->addressCounts);
+    profile->addressCounts = NULL;
+    deallocate(profile->calls);
+    profile->calls = NULL;
+}
+
+// Returns the index of the n-gram in the profile's hash table, or of the empty
+// entry where it belongs.
+static int findNgram(struct vmProfile *profile, uint64_t ngram) {
+    int mask = profile->ngramCapacity - 1;
+    int index = (int)((ngram * 0x9e3779b97f4a7c15ULL) >> 40) & mask;
+    while (profile->ngrams[index].ngram != 0 && profile->ngrams[index].ngram != ngram)
+        index = (index + 1) & mask;
+
+    return index;
+}
+
+static void countNgram(struct vmProfile *profile, uint64_t ngram) {
+    // Keep the table at most half full.
+    if (profile->ngramsUsed * 2 >= profile->ngramCapacity) {
+        struct ngramCount *oldNgrams = profile->ngrams;
+        int oldCapacity = profile->ngramCapacity;
+
+        profile->ngramCapacity = (oldCapacity == 0) ? 1024 : oldCapacity * 2;
+        profile->ngrams = allocate(profile->ngramCapacity * sizeof (struct ngramCount));
+        memset(profile->ngrams, 0, profile->ngramCapacity * sizeof (struct ngramCount));
+
+        int i;
+        for (i = 0; i < oldCapacity; i++)
+            if (oldNgrams[i].ngram != 0)
+                profile->ngrams[findNgram(profile, oldNgrams[i].ngram)] = oldNgrams[i];
+        deallocate(oldNgrams);
+    }
+
+    int index = findNgram(profile, ngram);
+    if (profile->ngrams[index].ngram == 0) {
+        profile->ngrams[index].ngram = ngram;
+        profile->ngramsUsed += 1;
+    }
+    profile->ngrams[index].count += 1;
+}
+
+// A call stack in a profile's tree of call stacks.
+struct callNode {
+    int entry;         // The address of the procedure that was called.
+    int parent;        // The stack that called it, or -1 for the main program.
+    int firstChild;    // The first stack that it called, or -1.
+    int nextSibling;   // The next stack that its parent called, or -1.
+    int depth;         // 0 for the main program.
+    long long count;   // The instructions that ran in it, not in the procedures it called.
+};
+
+static void startCallProfile(struct vmProfile *profile, int length) {
+    profile->length = length;
+    profile->addressCounts = allocate((length + 1) * sizeof (long long));
+    memset(profile->addressCounts, 0, (length + 1) * sizeof (long long));
+
+    profile->callCapacity = 64;
+    profile->calls = allocate(profile->callCapacity * sizeof (struct callNode));
+    profile->calls[0] = (struct callNode){0, -1, -1, -1, 0, 0};
+    profile->callsUsed = 1;
+    profile->currentCall = 0;
+    profile->deeperCalls = 0;
+    profile->callStart = profile->dispatches;
+}
+
+// Counts the instructions that ran since the current call was entered.
+static void finishCall(struct vmProfile *profile) {
+    profile->calls[profile->currentCall].count += profile->dispatches - profile->callStart;
+    profile->callStart = profile->dispatches;
+}
+
+static void enterCall(struct vmProfile *profile, int entry) {
+    finishCall(profile);
+
+    int parent = profile->currentCall;
+    if (profile->calls[parent].depth == MAX_PROFILE_DEPTH) {
+        profile->deeperCalls += 1;
+        return;
+    }
+
+    int child = profile->calls[parent].firstChild;
+    while (child != -1 && profile->calls[child].entry != entry)
+        child = profile->calls[child].nextSibling;
+
+    if (child == -1) {
+        if (profile->callsUsed == profile->callCapacity) {
+            struct callNode *oldCalls = profile->calls;
+            profile->callCapacity *= 2;
+            profile->calls = allocate(profile->callCapacity * sizeof (struct callNode));
+            memcpy(profile->calls, oldCalls, profile->callsUsed * sizeof (struct callNode));
+            deallocate(oldCalls);
+        }
+
+        child = profile->callsUsed++;
+        profile->calls[child] = (struct callNode){entry, parent, -1,
+            profile->calls[parent].firstChild, profile->calls[parent].depth + 1, 0};
+        profile->calls[parent].firstChild = child;
+    }
+
+    profile->currentCall = child;
+}
+
+static void leaveCall(struct vmProfile *profile) {
+    finishCall(profile);
+    if (profile->deeperCalls > 0)
+        profile->deeperCalls -= 1;
+    else if (profile->calls[profile->currentCall].parent != -1)
+        profile->currentCall = profile->calls[profile->currentCall].parent;
+}
+
+static void profileInstruction(struct vmProfile *profile, int address,
+        struct vmInstruction instruction) {
+    profile->dispatches += 1;
+    profile->opcodeCounts[instruction.opcode] += 1;
+
+    // The cal or ret itself counts as part of the procedure that runs it.
+    if (profile->addressCounts != NULL) {
+        profile->addressCounts[address] += 1;
+        if (instruction.opcode == OP_CAL || instruction.opcode == OP_CAL_DISPLAY)
+            enterCall(profile, instruction.modifier);
+        else if (instruction.opcode == OP_RET_DISPLAY
+                || (instruction.opcode == OP_OPR && instruction.modifier == OPR_RET))
+            leaveCall(profile);
+    }
+
+    if (profile->ngramLength == 0)
+        return;
+
+    // Only count instructions that follow each other in the code.
+    if (address != profile->nextAddress)
+        profile->windowLength = 0;
+    profile->nextAddress = address + getInstructionLength(instruction.opcode);
+
+    int bits = 6 * profile->ngramLength;
+    uint64_t mask = (bits == 64) ? ~0ULL : ((1ULL << bits) - 1);
+    profile->window = ((profile->window << 6) | getSymbol(instruction)) & mask;
+
+    if (profile->windowLength < profile->ngramLength)
+        profile->windowLength += 1;
+    if (profile->windowLength == profile->ngramLength)
+        countNgram(profile, profile->window);
+}
+
+static int compareNgramCounts(const void *a, const void *b) {
+    long long countA = ((struct ngramCount*)a)->count;
+    long long countB = ((struct ngramCount*)b)->count;
+
+    return (countA < countB) - (countA > countB);
+}
+
+void printProfile(struct vmProfile *profile, int ngramsToPrint, FILE *file) {
+    fprintf(file, "Instructions executed: %lld\n", profile->dispatches);
+
+    int opcode;
+    for (opcode = 1; opcode < OPCODE_COUNT; opcode++)
+        if (profile->opcodeCounts[opcode] != 0)
+            fprintf(file, "  %-5s %lld\n", getOpcodeName(opcode), profile->opcodeCounts[opcode]);
+
+    if (profile->ngramLength == 0)
+        return;
+
+    // Copy the used entries out of the table to sort them.
+    struct ngramCount *ngrams = allocate((profile->ngramsUsed + 1) * sizeof (struct ngramCount));
+    int count = 0, i, j;
+    for (i = 0; i < profile->ngramCapacity; i++)
+        if (profile->ngrams[i].ngram != 0)
+            ngrams[count++] = profile->ngrams[i];
+    qsort(ngrams, count, sizeof (struct ngramCount), compareNgramCounts);
+
+    fprintf(file, "Most common %d-grams:\n", profile->ngramLength);
+    for (i = 0; i < count && i < ngramsToPrint; i++) {
+        fprintf(file, "%12lld ", ngrams[i].count);
+        for (j = profile->ngramLength - 1; j >= 0; j--)
+            printSymbol((ngrams[i].ngram >> (6 * j)) & 63, file);
+        fprintf(file, "\n");
+    }
+
+    deallocate(ngrams);
+}
+
+// The instructions that ran in a procedure, in all of the stacks that it's in.
+struct procedureCount {
+    int entry;
+    long long calls;
+    long long self;    // Not counting the procedures that it called.
+    long long total;   // Counting them.
+};
+
+struct lineCount {
+    int line;
+    long long count;
+};
+
+static int compareProcedureCounts(const void *a, const void *b) {
+    long long totalA = ((struct procedureCount*)a)->total;
+    long long totalB = ((struct procedureCount*)b)->total;
+
+    return (totalA < totalB) - (totalA > totalB);
+}
+
+static int compareLineCounts(const void *a, const void *b) {
+    long long countA = ((struct lineCount*)a)->count;
+    long long countB = ((struct lineCount*)b)->count;
+
+    return (countA < countB) - (countA > countB);
+}
+
+static void printProcedureName(int entry, struct vector *instructions, FILE *file) {
+    if (entry == 0) {
+        fprintf(file, "main");
+        return;
+    }
+
+    fprintf(file, "procedure@%d", entry);
+    if (entry > 0 && entry < instructions->length
+            && get(struct instruction, instructions, entry).line > 0)
+        fprintf(file, " (line %d)", get(struct instruction, instructions, entry).line);
+}
+
+static double getPercentage(long long count, long long total) {
+    return (total == 0) ? 0 : 100.0 * count / total;
+}
+
+void printAnnotatedListing(struct vmProfile *profile, struct vector *instructions, FILE *file) {
+    if (profile->addressCounts == NULL)
+        return;
+
+    int length = profile->length;
+    struct callNode *calls = profile->calls;
+    long long dispatches = profile->dispatches;
+
+    // Each node's count, plus the counts of the stacks below it. Nodes are
+    // added after their parents, so going backwards visits the children
+    // first.
+    long long *stackTotals = allocate(profile->callsUsed * sizeof (long long));
+    int node;
+    for (node = 0; node < profile->callsUsed; node++)
+        stackTotals[node] = calls[node].count;
+    for (node = profile->callsUsed - 1; node > 0; node--)
+        stackTotals[calls[node].parent] += stackTotals[node];
+
+    struct procedureCount *procedures = allocate((length + 1) * sizeof (struct procedureCount));
+    int *active = allocate((length + 1) * sizeof (int));
+    int address;
+    for (address = 0; address <= length; address++) {
+        procedures[address] = (struct procedureCount){address, 0, 0, 0};
+        active[address] = 0;
+    }
+
+    // Calls to addresses outside of the program fail, so they count as being
+    // at the end.
+    int getEntry(int node) {
+        int entry = calls[node].entry;
+        return (entry >= 0 && entry < length) ? entry : length;
+    }
+
+    // Visit the stacks depth first, keeping track of which procedures are
+    // active, so that a recursive procedure's total only counts its outermost
+    // calls.
+    node = 0;
+    while (node != -1) {
+        int entry = getEntry(node);
+        procedures[entry].self += calls[node].count;
+        if (active[entry]++ == 0)
+            procedures[entry].total += stackTotals[node];
+
+        if (calls[node].firstChild != -1) {
+            node = calls[node].firstChild;
+            continue;
+        }
+
+        while (node != -1) {
+            active[getEntry(node)] -= 1;
+            if (calls[node].nextSibling != -1) {
+                node = calls[node].nextSibling;
+                break;
+            }
+            node = calls[node].parent;
+        }
+    }
+
+    // The calls are counted from the cal instructions, since the tree doesn't
+    // have the calls below MAX_PROFILE_DEPTH.
+    procedures[0].calls = 1;
+    forVector(instructions, i, struct instruction, instruction,
+        if (i < length && (instruction.opcode == OP_CAL || instruction.opcode == OP_CAL_DISPLAY))
+            procedures[(instruction.modifier >= 0 && instruction.modifier < length)
+                ? instruction.modifier : length].calls += profile->addressCounts[i];);
+
+    // Procedures that were called, from the one with the most instructions.
+    int *isEntry = active;
+    int count = 0;
+    for (address = 0; address <= length; address++) {
+        isEntry[address] = (procedures[address].calls > 0);
+        if (isEntry[address])
+            procedures[count++] = procedures[address];
+    }
+    qsort(procedures, count, sizeof (struct procedureCount), compareProcedureCounts);
+
+    fprintf(file, "Instructions executed: %lld\n", dispatches);
+    fprintf(file, "\nProcedures (self: in the procedure, total: with the procedures it called):\n");
+    fprintf(file, "%12s %12s %6s %12s %6s  %s\n", "calls", "self", "", "total", "", "procedure");
+    int i;
+    for (i = 0; i < count; i++) {
+        fprintf(file, "%12lld %12lld %5.1f%% %12lld %5.1f%%  ", procedures[i].calls,
+                procedures[i].self, getPercentage(procedures[i].self, dispatches),
+                procedures[i].total, getPercentage(procedures[i].total, dispatches));
+        printProcedureName(procedures[i].entry, instructions, file);
+        fprintf(file, "\n");
+    }
+
+    // The line table, if there is one, attributes each address to a line.
+    int maxLine = 0;
+    forVector(instructions, i, struct instruction, instruction,
+            if (instruction.line > maxLine)
+                maxLine = instruction.line;);
+
+    if (maxLine > 0) {
+        struct lineCount *lines = allocate((maxLine + 1) * sizeof (struct lineCount));
+        int line;
+        for (line = 0; line <= maxLine; line++)
+            lines[line] = (struct lineCount){line, 0};
+        for (address = 0; address < length; address++)
+            lines[get(struct instruction, instructions, address).line].count
+                += profile->addressCounts[address];
+
+        int lineCount = 0;
+        for (line = 1; line <= maxLine; line++)
+            if (lines[line].count > 0)
+                lines[lineCount++] = lines[line];
+        qsort(lines, lineCount, sizeof (struct lineCount), compareLineCounts);
+
+        fprintf(file, "\nLines:\n");
+        for (i = 0; i < lineCount; i++)
+            fprintf(file, "  line %-6d %12lld %5.1f%%\n", lines[i].line, lines[i].count,
+                    getPercentage(lines[i].count, dispatches));
+
+        deallocate(lines);
+    }
+
+    fprintf(file, "\nInstructions:\n");
+    forVector(instructions, i, struct instruction, instruction,
+        if (i < length && isEntry[i]) {
+            printProcedureName(i, instructions, file);
+            fprintf(file, ":\n");
+        }
+
+        long long runs = (i < length) ? profile->addressCounts[i] : 0;
+        fprintf(file, "%3d %-5s %-3d %-3d %12lld %5.1f%%", i, instruction.opcodeName,
+                instruction.lexicalLevel, instruction.modifier, runs,
+                getPercentage(runs, dispatches));
+        if (instruction.line > 0)
+            fprintf(file, "  line %d", instruction.line);
+        fprintf(file, "\n"););
+
+    deallocate(active);
+    deallocate(procedures);
+    deallocate(stackTotals);
+}
+
+void printFoldedStacks(struct vmProfile *profile, struct vector *instructions, FILE *file) {
+    if (profile->calls == NULL)
+        return;
+
+    struct callNode *calls = profile->calls;
+    int *stack = allocate(profile->callsUsed * sizeof (int));
+    int node;
+    for (node = 0; node < profile->callsUsed; node++) {
+        if (calls[node].count == 0)
+            continue;
+
+        int depth = 0, caller;
+        for (caller = node; caller != -1; caller = calls[caller].parent)
+            stack[depth++] = caller;
+        while (depth-- > 0) {
+            printProcedureName(calls[stack[depth]].entry, instructions, file);
+            fprintf(file, "%s", (depth > 0) ? ";" : " ");
+        }
+        fprintf(file, "%lld\n", calls[node].count);
+    }
+
+    deallocate(stack);
+}
+
+#ifdef PL0_VM_TRACE
+static FILE *traceFile = NULL;
+
+void traceToFile(FILE *file) {
+    traceFile = file;
+    if (traceFile != NULL)
+        fwrite(TRACE_HEADER, 1, strlen(TRACE_HEADER), traceFile);
+}
+
+static void traceInstruction(int address, int pc, int bp, int sp, int *stack, int *writes,
+        int writeCount) {
+    struct traceRecord record = {address, pc, bp, sp, writeCount};
+    fwrite(&record, sizeof record, 1, traceFile);
+
+    int i;
+    for (i = 0; i < writeCount; i++) {
+        struct traceWrite write = {writes[i], stack[writes[i]]};
+        fwrite(&write, sizeof write, 1, traceFile);
+    }
+}
+#endif
+
+// Returns the base of the stack frame the given number of levels down from the
+// one at bp.
+static inline int findBase(int *stack, int stackSize, int bp, int level) {
+    while (level-- > 0 && bp >= 1 && bp < stackSize)
+        bp = stack[bp + 1];
+    return bp;
+}
+
+// Runs the program on a stack that holds stackSize values. The stack pointer
+// is only checked when checkStack is true. runProgramWithStackBound always
+// passes a constant, so that the compiler makes a copy of the loop without
+// the checks for programs with a proven stack bound. The instructions that
+// code was made from have the lines for error messages.
+static inline __attribute__((always_inline)) int interpret(struct vmInstruction *code,
+        int length, int *stack, int stackSize, struct vmProfile *profile, int checkStack,
+        struct vector *instructions) {
+    int pc = 0, bp = 1, sp = 0;
+    int address = 0;   // The address of the instruction that is running.
+    // The frame of the latest activation at each lexical level, for the
+    // display instructions. The main program's frame is at level 0.
+    int display[MAX_DISPLAY_LEVELS] = {1};
+    char *error = NULL;
+
+    // TRACE_WRITE records that the running instruction wrote to a stack
+    // cell, and TRACE_INSTRUCTION writes the instruction to the trace once it
+    // has run. They're nothing unless the VM is built with PL0_VM_TRACE.
+#ifdef PL0_VM_TRACE
+    int writes[MAX_TRACE_WRITES];
+    int writeCount = 0;
+#define TRACE_WRITE(cell) (writes[writeCount++] = (cell))
+#define TRACE_INSTRUCTION() do {\
+        if (traceFile != NULL)\
+            traceInstruction(address, pc, bp, sp, stack, writes, writeCount);\
+    } while (0)
+#else
+#define TRACE_WRITE(cell) ((void)0)
+#define TRACE_INSTRUCTION() ((void)0)
+#endif
+
+#define base(level) findBase(stack, stackSize, bp, level)
+
+    // The address of a variable, which must be on the stack.
+#define ADDRESS(level, offset) ({\
+        int variable = base(level) + (offset);\
+        if (variable < 1 || variable > stackSize) {\
+            error = "variable address out of range";\
+            goto fail;\
+        }\
+        variable; })
+
+    // The same for the display instructions, where level is a lexical level.
+#define DISPLAY_ADDRESS(level, offset) ({\
+        if ((level) < 0 || (level) >= MAX_DISPLAY_LEVELS) {\
+            error = "lexical level out of range";\
+            goto fail;\
+        }\
+        int variable = display[level] + (offset);\
+        if (variable < 1 || variable > stackSize) {\
+            error = "variable address out of range";\
+            goto fail;\
+        }\
+        variable; })
+
+    // Evaluates a binary operator such as OPR_ADD or OPR_LSS.
+#define BINARY_OPERATOR(operator, left, right) ({\
+        int value = 0;\
+        switch (operator) {\
+            case OPR_ADD: value = left + right; break;\
+            case OPR_SUB: value = left - right; break;\
+            case OPR_MUL: value = left * right; break;\
+            case OPR_DIV:\
+                if (right == 0) { error = "division by zero"; goto fail; }\
+                value = left / right; break;\
+            case OPR_MOD:\
+                if (right == 0) { error = "division by zero"; goto fail; }\
+                value = left % right; break;\
+            case OPR_EQL: value = left == right; break;\
+            case OPR_NEQ: value = left != right; break;\
+            case OPR_LSS: value = left < right; break;\
+            case OPR_LEQ: value = left <= right; break;\
+            case OPR_GTR: value = left > right; break;\
+            case OPR_GEQ: value = left >= right; break;\
+            default: error = "invalid operator"; goto fail;\
+        }\
+        value; })
+
+    while (1) {
+        address = pc;
+        if (pc < 0 || pc >= length) {
+            error = "jump out of the program";
+            goto fail;
+        }
+        if (checkStack && (sp < 0 || sp > stackSize - STACK_MARGIN)) {
+            error = (sp < 0) ? "stack underflow" : "stack overflow";
+            goto fail;
+        }
+
+        struct vmInstruction instruction = code[pc];
+#ifdef PL0_VM_TRACE
+        writeCount = 0;
+#endif
+        if (profile != NULL)
+            profileInstruction(profile, pc, instruction);
+        pc += 1;
+
+        int level = instruction.lexicalLevel;
+        int modifier = instruction.modifier;
+
+        switch (instruction.opcode) {
+            case OP_LIT:
+                stack[++sp] = modifier;
+                TRACE_WRITE(sp);
+                break;
+            case OP_OPR:
+                if (modifier == OPR_RET) {
+                    sp = bp - 1;
+                    pc = stack[sp + 4];
+                    bp = stack[sp + 3];
+                    if (bp == 0) {
+                        TRACE_INSTRUCTION();
+                        goto done;
+                    }
+                } else if (modifier == OPR_NEG) {
+                    stack[sp] = -stack[sp];
+                    TRACE_WRITE(sp);
+                } else if (modifier == OPR_ODD) {
+                    stack[sp] = stack[sp] % 2 != 0;
+                    TRACE_WRITE(sp);
+                } else {
+                    sp -= 1;
+                    stack[sp] = BINARY_OPERATOR(modifier, stack[sp], stack[sp + 1]);
+                    TRACE_WRITE(sp);
+                }
+                break;
+            case OP_LOD:
+                stack[sp + 1] = stack[ADDRESS(level, modifier)];
+                sp += 1;
+                TRACE_WRITE(sp);
+                break;
+            case OP_STO: {
+                int variable = ADDRESS(level, modifier);
+                stack[variable] = stack[sp];
+                TRACE_WRITE(variable);
+                sp -= 1;
+                break;
+            }
+            case OP_CAL:
+                stack[sp + 1] = 0;
+                stack[sp + 2] = base(level);
+                stack[sp + 3] = bp;
+                stack[sp + 4] = pc;
+                bp = sp + 1;
+                pc = modifier;
+                TRACE_WRITE(bp);
+                TRACE_WRITE(bp + 1);
+                TRACE_WRITE(bp + 2);
+                TRACE_WRITE(bp + 3);
+                break;
+            case OP_INC:
+                if (checkStack && modifier > stackSize - STACK_MARGIN - sp) {
+                    error = "stack overflow";
+                    goto fail;
+                }
+                sp += modifier;
+                break;
+            case OP_JMP:
+                pc = modifier;
+                break;
+            case OP_JPC:
+                if (stack[sp] == 0)
+                    pc = modifier;
+                sp -= 1;
+                break;
+            case OP_WRITE:
+                printf("Output: %d\n", stack[sp]);
+                sp -= 1;
+                break;
+            case OP_READ:
+                printf("Input: ");
+                fflush(stdout);
+                sp += 1;
+                if (scanf("%d", &stack[sp]) != 1) {
+                    error = "couldn't read input";
+                    goto fail;
+                }
+                TRACE_WRITE(sp);
+                break;
+
+            // Superinstructions. Their ext instructions are skipped.
+            case OP_LIT_OPR:
+                stack[sp] = BINARY_OPERATOR(level, stack[sp], modifier);
+                TRACE_WRITE(sp);
+                break;
+            case OP_OPR_JPC:
+                if (!BINARY_OPERATOR(level, stack[sp - 1], stack[sp]))
+                    pc = modifier;
+                sp -= 2;
+                break;
+            case OP_LIT_OPR_JPC: {
+                int literal = code[pc].modifier;
+                pc += 1;
+                if (!BINARY_OPERATOR(level, stack[sp], literal))
+                    pc = modifier;
+                sp -= 1;
+                break;
+            }
+            case OP_LOD_LOD_OPR: {
+                int operator = code[pc].lexicalLevel;
+                int right = stack[ADDRESS(level, code[pc].modifier)];
+                int left = stack[ADDRESS(level, modifier)];
+                pc += 1;
+                stack[++sp] = BINARY_OPERATOR(operator, left, right);
+                TRACE_WRITE(sp);
+                break;
+            }
+            case OP_INCREMENT: {
+                int variable = ADDRESS(level, modifier);
+                stack[variable] += code[pc].modifier;
+                TRACE_WRITE(variable);
+                pc += 1;
+                break;
+            }
+            case OP_LOD_WRITE:
+                printf("Output: %d\n", stack[ADDRESS(level, modifier)]);
+                break;
+            case OP_READ_STO: {
+                int value;
+                printf("Input: ");
+                fflush(stdout);
+                if (scanf("%d", &value) != 1) {
+                    error = "couldn't read input";
+                    goto fail;
+                }
+                int variable = ADDRESS(level, modifier);
+                stack[variable] = value;
+                TRACE_WRITE(variable);
+                break;
+            }
+            case OP_LIT_STO: {
+                int variable = ADDRESS(level, modifier);
+                stack[variable] = code[pc].modifier;
+                TRACE_WRITE(variable);
+                pc += 1;
+                break;
+            }
+
+            // Display instructions. cald keeps the display entry that it
+            // replaces where cal keeps the static link, and the level in the
+            // function value slot, so that retd can put it back.
+            case OP_LOD_DISPLAY:
+                stack[sp + 1] = stack[DISPLAY_ADDRESS(level, modifier)];
+                sp += 1;
+                TRACE_WRITE(sp);
+                break;
+            case OP_STO_DISPLAY: {
+                int variable = DISPLAY_ADDRESS(level, modifier);
+                stack[variable] = stack[sp];
+                TRACE_WRITE(variable);
+                sp -= 1;
+                break;
+            }
+            case OP_CAL_DISPLAY:
+                if (level < 1 || level >= MAX_DISPLAY_LEVELS) {
+                    error = "lexical level out of range";
+                    goto fail;
+                }
+                stack[sp + 1] = level;
+                stack[sp + 2] = display[level];
+                stack[sp + 3] = bp;
+                stack[sp + 4] = pc;
+                bp = sp + 1;
+                display[level] = bp;
+                pc = modifier;
+                TRACE_WRITE(bp);
+                TRACE_WRITE(bp + 1);
+                TRACE_WRITE(bp + 2);
+                TRACE_WRITE(bp + 3);
+                break;
+            case OP_RET_DISPLAY:
+                if (stack[bp] < 1 || stack[bp] >= MAX_DISPLAY_LEVELS) {
+                    error = "lexical level out of range";
+                    goto fail;
+                }
+                display[stack[bp]] = stack[bp + 1];
+                sp = bp - 1;
+                pc = stack[sp + 4];
+                bp = stack[sp + 3];
+                if (bp == 0) {
+                    TRACE_INSTRUCTION();
+                    goto done;
+                }
+                break;
+            default:
+                error = "invalid instruction";
+                goto fail;
+        }
+
+        TRACE_INSTRUCTION();
+    }
+#undef base
+#undef ADDRESS
+#undef DISPLAY_ADDRESS
+#undef BINARY_OPERATOR
+#undef TRACE_WRITE
+#undef TRACE_INSTRUCTION
+
+fail:
+    if (address >= 0 && address < length && get(struct instruction, instructions, address).line > 0)
+        fprintf(stderr, "Error at instruction %d (line %d): %s.\n", address,
+                get(struct instruction, instructions, address).line, error);
+    else
+        fprintf(stderr, "Error at instruction %d: %s.\n", address, error);
+    return 1;
+done:
+    return 0;
+}
+
+int runProgram(struct vector *instructions, struct vmProfile *profile) {
+    return runProgramWithStackBound(instructions, profile, -1);
+}
+
+int runProgramWithStackBound(struct vector *instructions, struct vmProfile *profile,
+        int stackBound) {
+    int length = instructions->length;
+    struct vmInstruction *code = allocate((length + 1) * sizeof (struct vmInstruction));
+    forVector(instructions, i, struct instruction, instruction,
+            code[i] = (struct vmInstruction){instruction.opcode, instruction.lexicalLevel,
+                instruction.modifier};);
+
+    // The file that the bound came from could have been changed since it was
+    // compiled, so the bound is only used if it holds for these instructions.
+    int checkStack = 1;
+    int stackSize = VM_STACK_SIZE;
+    if (stackBound >= 0 && stackBound <= VM_STACK_SIZE - STACK_MARGIN) {
+        int provenBound = computeStackBound(instructions);
+        if (provenBound >= 0 && provenBound <= stackBound) {
+            checkStack = 0;
+            stackSize = stackBound + STACK_MARGIN;
+        }
+    }
+
+    // The stack starts at 1, like in ./vm.
+    int *memory = allocate((stackSize + 2 * STACK_MARGIN) * sizeof (int));
+    memset(memory, 0, (stackSize + 2 * STACK_MARGIN) * sizeof (int));
+    int *stack = memory + STACK_MARGIN;
+
+    if (profile != NULL && profile->countAddresses && profile->addressCounts == NULL)
+        startCallProfile(profile, length);
+
+    int result;
+    if (checkStack)
+        result = interpret(code, length, stack, stackSize, profile, 1, instructions);
+    else
+        result = interpret(code, length, stack, stackSize, profile, 0, instructions);
+
+    if (profile != NULL && profile->addressCounts != NULL)
+        finishCall(profile);
+
+    deallocate(code);
+    deallocate(memory);
+
+    return result;
+}
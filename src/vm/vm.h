@@ -0,0 +1,143 @@
+#ifndef VM_H
+#define VM_H
+
+#include "pl0.h"
+#include <stdio.h>
+#include <stdint.h>
+
+// PL/0 virtual machines
+// =====================
+// runProgram runs the instructions printed by the compiler, including
+// superinstructions, runJIT compiles them to machine code first, and
+// runRegisterProgram runs register code. Programs read
+// from stdin and write to stdout in the same format as ./vm, but without its
+// listing and trace.
+
+// The number of values that fit on the stack.
+#define VM_STACK_SIZE (1 << 20)
+// The longest sequences of instructions that a profile can count.
+#define MAX_NGRAM_LENGTH 8
+
+struct ngramCount {
+    uint64_t ngram;   // The symbols in the n-gram, 6 bits each, or 0 if unused.
+    long long count;
+};
+
+// Counts what a program does while it runs.
+struct vmProfile {
+    long long dispatches;
+    long long opcodeCounts[OPCODE_COUNT];
+
+    // Counts of each sequence of ngramLength instructions that ran one after
+    // the other without a jump between them, in a hash table. Sequences like
+    // these are the candidates for superinstructions.
+    int ngramLength;   // 0 if n-grams aren't counted.
+    struct ngramCount *ngrams;
+    int ngramCapacity;
+    int ngramsUsed;
+
+    // The last instructions that ran, and where the next one has to be for
+    // them to be part of the same sequence.
+    uint64_t window;
+    int windowLength;
+    int nextAddress;
+
+    // If countAddresses is set before the program runs, the profile also
+    // counts how many times each address ran, and how many instructions ran
+    // in each call stack. The call stacks are a tree whose root is the main
+    // program, with a child for each procedure that a stack called, so cal
+    // and ret only move between nodes and the other instructions are only
+    // counted once per call.
+    int countAddresses;
+    long long *addressCounts;
+    int length;
+    struct callNode *calls;
+    int callsUsed;
+    int callCapacity;
+    int currentCall;
+    int deeperCalls;   // Calls below the deepest stack that the tree has room for.
+    long long callStart;   // The dispatches when the current call was entered.
+};
+
+// Returns an empty profile, which counts n-grams of the given length if it
+// isn't 0.
+struct vmProfile makeProfile(int ngramLength);
+void freeProfile(struct vmProfile *profile);
+
+// Prints the counts in the profile, and the given number of the most common
+// n-grams.
+void printProfile(struct vmProfile *profile, int ngramsToPrint, FILE *file);
+
+// For a profile with countAddresses, prints the instructions that ran in each
+// procedure and in the procedures it called, the instructions that ran for
+// each source line if the program has a line table, and the program's
+// instructions in the same format as printInstructions(instructions, 1), each
+// with how many times it ran. A procedure is named by its address, and the
+// line of its first instruction if that's known, and the main program is
+// "main".
+void printAnnotatedListing(struct vmProfile *profile, struct vector *instructions, FILE *file);
+// Prints the call stacks in the profile in the folded format of
+// flamegraph.pl: one line per stack, with the procedures from the main
+// program down separated by semicolons, then the number of instructions that
+// ran in the last one.
+void printFoldedStacks(struct vmProfile *profile, struct vector *instructions, FILE *file);
+
+// Tracing
+// =======
+// pl0vm-trace is pl0vm built with PL0_VM_TRACE, which can write a binary
+// trace of every instruction that runs, for pl0trace to print. Without
+// PL0_VM_TRACE, none of the tracing code is compiled, so pl0vm's dispatch
+// loop has no trace checks in it.
+//
+// A trace is TRACE_HEADER, then a traceRecord for each instruction that ran,
+// each followed by a traceWrite for each stack cell that it wrote, in the
+// byte order of the machine that wrote it.
+#define TRACE_HEADER "pl0-trace 1\n"
+
+struct traceRecord {
+    int32_t address;   // The instruction that ran.
+    int32_t pc;        // The registers after it ran.
+    int32_t bp;
+    int32_t sp;
+    int32_t writes;    // The number of traceWrites after this.
+};
+
+struct traceWrite {
+    int32_t cell;
+    int32_t value;
+};
+
+// No instruction writes more stack cells than this.
+#define MAX_TRACE_WRITES 4
+
+#ifdef PL0_VM_TRACE
+// Writes the trace of the programs that run after this to file, or stops
+// tracing if file is NULL.
+void traceToFile(FILE *file);
+#endif
+
+// Runs the program. If profile isn't NULL, counts the instructions that run
+// in it. Returns 0, or prints an error and returns 1 if the program fails.
+int runProgram(struct vector *instructions, struct vmProfile *profile);
+// The same, for a program whose stack pointer never gets higher than
+// stackBound (see computeStackBound), or -1 if that isn't known. If the bound
+// holds, the stack only has room for that much, and the stack pointer isn't
+// checked while the program runs.
+int runProgramWithStackBound(struct vector *instructions, struct vmProfile *profile,
+        int stackBound);
+
+// Runs a program generated by generateRegisterPL0, in the same way. If
+// dispatches isn't NULL, adds the number of instructions that ran to it.
+// Defined in register-vm.c.
+int runRegisterProgram(struct registerProgram *program, long long *dispatches);
+
+// runJIT returns this without running anything if it can't compile the
+// program, so that the caller can run it with runProgram instead.
+#define JIT_UNAVAILABLE -1
+
+// Compiles the program to x86-64 machine code and runs it, in the same way as
+// runProgram. Only programs without superinstructions can be compiled, and
+// only on x86-64. Defined in jit.c.
+int runJIT(struct vector *instructions);
+
+#endif